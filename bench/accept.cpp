@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/protocol/protocol.hpp"
+
+// Connects, says Hello and waits for the server's Hello, which comes from
+// the connection's first read on its shard's loop; the time covers the
+// accept, the connection's setup and that first dispatch. Closed with a
+// reset so a long run does not use up ports in TIME_WAIT.
+static bool connectOnce(unsigned short port, DWORD timeoutMs, double& elapsedMs) {
+    Socket socket;
+    if (!socket.create()) {
+        return false;
+    }
+    setsockopt(socket.getHandle(), SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeoutMs, sizeof(timeoutMs));
+    linger abort = { 1, 0 };
+    setsockopt(socket.getHandle(), SOL_SOCKET, SO_LINGER, (const char*)&abort, sizeof(abort));
+
+    double started = nowSeconds();
+    if (!socket.connect(HOST, port)) {
+        return false;
+    }
+    ControlPayload hello;
+    encodeControl(hello, ControlCode::Hello, 0);
+    if (!sendFrame(socket, Channel::Control, &hello, sizeof(hello))) {
+        return false;
+    }
+
+    FrameReader reader;
+    while (true) {
+        int bytesRead = socket.recv(reader.writePointer(), reader.writableSize());
+        if (bytesRead <= 0) {
+            return false;
+        }
+        reader.commit(bytesRead);
+
+        Frame frame;
+        while (reader.next(frame)) {
+            ControlPayload control;
+            if (frame.channel == Channel::Control && decodeControl(frame, control) &&
+                (ControlCode)control.code == ControlCode::Hello) {
+                elapsedMs = (nowSeconds() - started) * 1000.0;
+                return true;
+            }
+        }
+        if (reader.isCorrupt()) {
+            return false;
+        }
+    }
+}
+
+struct AcceptRun {
+    size_t shards = 0;
+    size_t connections = 0;
+    int failed = 0;
+    double seconds = 0.0;
+    std::vector<double> connectMs;
+};
+
+static bool runShards(size_t shards, unsigned short port, int clients, double seconds, int loopThreads,
+                      DWORD timeoutMs, AcceptRun& run) {
+    // No session is started before keys are exchanged, and these clients
+    // never exchange them, so only the accept path is measured.
+    RelayOptions relay;
+    relay.shell = childCommand();
+    relay.requireEncryption = true;
+    SchedulerOptions limits;
+    limits.maxConnections = 0;
+
+    Server server(port, loopThreads, relay, limits, shards);
+    if (!server.initialize()) {
+        return false;
+    }
+    server.start();
+    Sleep(200);
+
+    std::mutex mutex;
+    run.shards = shards;
+    double started = nowSeconds();
+    double deadline = started + seconds;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < clients; ++i) {
+        threads.emplace_back([&] {
+            std::vector<double> samples;
+            int failed = 0;
+            while (nowSeconds() < deadline) {
+                double elapsed = 0.0;
+                if (connectOnce(port, timeoutMs, elapsed)) {
+                    samples.push_back(elapsed);
+                } else {
+                    ++failed;
+                }
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            run.connectMs.insert(run.connectMs.end(), samples.begin(), samples.end());
+            run.failed += failed;
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    run.seconds = nowSeconds() - started;
+    server.stop();
+
+    run.connections = run.connectMs.size();
+    std::sort(run.connectMs.begin(), run.connectMs.end());
+    return true;
+}
+
+// Accept rate and connect latency with 1, 2, 4 and 8 acceptor shards (or
+// --shards N alone), each hammered by --clients threads that connect, wait
+// for the server's Hello and disconnect, for --seconds.
+int benchAccept(const BenchOptions& options) {
+    int clients = optionInt(options, "clients", 32);
+    double seconds = optionInt(options, "seconds", 5);
+    int loopThreads = optionInt(options, "threads", LOOP_THREADS);
+    int onlyShards = optionInt(options, "shards", 0);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 110);
+    DWORD timeoutMs = (DWORD)optionInt(options, "timeout", 10) * 1000;
+
+    std::vector<size_t> counts = { 1, 2, 4, 8 };
+    if (onlyShards > 0) {
+        counts = { (size_t)onlyShards };
+    }
+
+    std::cout << clients << " client threads, " << seconds << " s per run, "
+              << std::thread::hardware_concurrency() << " CPUs" << std::endl;
+    std::cout << "shards  connections  accepts/s  failed  connect ms p50/p99/max" << std::endl;
+
+    bool pass = true;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        AcceptRun run;
+        // A port per run, so one run's closing sockets cannot meet the next.
+        if (!runShards(counts[i], (unsigned short)(port + i), clients, seconds, loopThreads, timeoutMs, run)) {
+            std::cout << counts[i] << ": server failed to start" << std::endl;
+            pass = false;
+            continue;
+        }
+        double rate = run.seconds > 0.0 ? run.connections / run.seconds : 0.0;
+        std::cout << run.shards << "       " << run.connections << "        " << (uint64_t)rate << "      "
+                  << run.failed << "       " << percentile(run.connectMs, 0.50) << " / "
+                  << percentile(run.connectMs, 0.99) << " / "
+                  << (run.connectMs.empty() ? 0.0 : run.connectMs.back()) << std::endl;
+        pass = pass && run.failed == 0;
+    }
+
+    std::cout << (pass ? "PASS" : "FAIL") << std::endl;
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,313 @@
+#include <psapi.h>
+#include <tlhelp32.h>
+
+#include <algorithm>
+
+#include "bench.hpp"
+#include "../src/log/log.hpp"
+
+double nowSeconds() {
+    static LARGE_INTEGER frequency = [] {
+        LARGE_INTEGER value;
+        QueryPerformanceFrequency(&value);
+        return value;
+    }();
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+size_t processThreadCount() {
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (snapshot == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+
+    DWORD pid = GetCurrentProcessId();
+    size_t count = 0;
+
+    THREADENTRY32 entry;
+    entry.dwSize = sizeof(entry);
+    if (Thread32First(snapshot, &entry)) {
+        do {
+            if (entry.th32OwnerProcessID == pid) {
+                ++count;
+            }
+        } while (Thread32Next(snapshot, &entry));
+    }
+
+    CloseHandle(snapshot);
+    return count;
+}
+
+size_t processRssBytes() {
+    PROCESS_MEMORY_COUNTERS counters;
+    ZeroMemory(&counters, sizeof(counters));
+    counters.cb = sizeof(counters);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.WorkingSetSize;
+}
+
+double processCpuSeconds() {
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) {
+        return 0.0;
+    }
+
+    ULARGE_INTEGER kernelTime, userTime;
+    kernelTime.LowPart = kernel.dwLowDateTime;
+    kernelTime.HighPart = kernel.dwHighDateTime;
+    userTime.LowPart = user.dwLowDateTime;
+    userTime.HighPart = user.dwHighDateTime;
+    return (kernelTime.QuadPart + userTime.QuadPart) / 1e7;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+int optionInt(const BenchOptions& options, const std::string& name, int fallback) {
+    auto it = options.find(name);
+    return it == options.end() ? fallback : std::atoi(it->second.c_str());
+}
+
+std::string optionString(const BenchOptions& options, const std::string& name, const std::string& fallback) {
+    auto it = options.find(name);
+    return it == options.end() ? fallback : it->second;
+}
+
+Socket connectLoopback(unsigned short port, int attempts) {
+    for (int attempt = 0; attempt < attempts; ++attempt) {
+        Socket socket;
+        if (!socket.create()) {
+            return Socket();
+        }
+        if (socket.connect(HOST, port)) {
+            return socket;
+        }
+        Sleep(20);
+    }
+    return Socket();
+}
+
+std::unique_ptr<Transport> loopbackTransport(unsigned short port, double timeout, int receiveBuffer) {
+    auto socket = std::make_unique<Socket>(connectLoopback(port));
+    if (!socket->isValid()) {
+        return nullptr;
+    }
+    if (receiveBuffer > 0) {
+        setsockopt(socket->getHandle(), SOL_SOCKET, SO_RCVBUF, (const char*)&receiveBuffer, sizeof(receiveBuffer));
+    }
+    DWORD timeoutMs = (DWORD)(timeout * 1000.0);
+    setsockopt(socket->getHandle(), SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeoutMs, sizeof(timeoutMs));
+    return socket;
+}
+
+bool BenchClient::send(Channel channel, const void* payload, uint32_t length) {
+    OutgoingFrame frame;
+    frame.prepare(channel, payload, length);
+    if (layer.isSecure()) {
+        layer.seal(frame, sealed);
+    }
+    return sendFrame(*transport, frame);
+}
+
+bool BenchClient::sendLine(const std::string& line) {
+    std::string text = line + "\r\n";
+    return send(Channel::Stdin, text.data(), (uint32_t)text.size());
+}
+
+bool BenchClient::sendControl(ControlCode code, uint32_t value) {
+    ControlPayload payload;
+    encodeControl(payload, code, value);
+    return send(Channel::Control, &payload, sizeof(payload));
+}
+
+void BenchClient::take(const Frame& frame, uint32_t& credit) {
+    ++frames;
+    bool keep = !onFrame || onFrame(frame);
+
+    ControlPayload control;
+    if (frame.channel == Channel::Control && decodeControl(frame, control) &&
+        (ControlCode)control.code == ControlCode::Hello) {
+        helloSeen = true;
+        serverFeatures = control.value;
+    } else if (frame.channel == Channel::Stdout && frame.session == 0) {
+        bytes += frame.length;
+        credit += frame.length;
+        if (keep) {
+            output.append(frame.payload, frame.length);
+        }
+    }
+}
+
+bool BenchClient::readOnce() {
+    return received(transport->recv(reader.writePointer(), reader.writableSize()));
+}
+
+bool BenchClient::received(int bytesRead) {
+    if (bytesRead <= 0) {
+        return false;
+    }
+    reader.commit(bytesRead);
+    wireBytes += bytesRead;
+
+    uint32_t credit = 0;
+    Frame frame;
+    while (reader.next(frame)) {
+        if (layer.isSecure() && !layer.open(frame)) {
+            std::cerr << "Record failed to authenticate" << std::endl;
+            return false;
+        }
+        take(frame, credit);
+    }
+    // Only the tail can still hold the start of a marker.
+    if (output.size() > 65536) {
+        output.erase(0, output.size() - 256);
+    }
+    if (reader.isCorrupt() || (credit > 0 && !sendControl(ControlCode::WindowUpdate, credit))) {
+        return false;
+    }
+    if (afterReceive) {
+        afterReceive();
+    }
+    return true;
+}
+
+bool BenchClient::readUntil(const std::function<bool()>& done) {
+    while (!done()) {
+        if (!readOnce()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BenchClient::readUntil(const std::string& marker) {
+    for (;;) {
+        size_t found = output.find(marker);
+        if (found != std::string::npos) {
+            output.erase(0, found + marker.size());
+            return true;
+        }
+        if (!readOnce()) {
+            return false;
+        }
+    }
+}
+
+bool BenchClient::drain() {
+    if (!transport->setBlocking(false)) {
+        return false;
+    }
+    int bytesRead = transport->recv(reader.writePointer(), reader.writableSize());
+    while (bytesRead != SOCKET_ERROR || WSAGetLastError() != WSAEWOULDBLOCK) {
+        // Credit goes out blocking, as it does everywhere else.
+        if (!transport->setBlocking(true) || !received(bytesRead) || !transport->setBlocking(false)) {
+            transport->setBlocking(true);
+            return false;
+        }
+        bytesRead = transport->recv(reader.writePointer(), reader.writableSize());
+    }
+    return transport->setBlocking(true);
+}
+
+bool BenchClient::hello(uint32_t features) {
+    return sendControl(ControlCode::Hello, features) && readUntil([this] { return helloSeen; });
+}
+
+struct BenchScenario {
+    const char* name;
+    int (*run)(const BenchOptions&);
+    const char* description;
+};
+
+static const BenchScenario s_scenarios[] = {
+    { "sessions", benchSessions, "N concurrent loopback sessions: threads, RSS, per-session throughput" },
+    { "storm", benchStorm, "N clients connecting at once: time-to-first-prompt percentiles" },
+    { "teardown", benchTeardown, "Sequential short sessions: latency from 'exit' to connection close" },
+    { "framing", benchFraming, "Raw vs framed loopback throughput at 4 KB and 64 KB chunks" },
+    { "mux", benchMux, "N sessions over one connection vs N connections: open latency, RSS" },
+    { "compress", benchCompress, "Output codec over recorded output (--input file): ratio, MB/s, echo latency" },
+    { "coalesce", benchCoalesce, "Output batching and Nagle settings: echo RTT, bulk MB/s, sends vs bytes" },
+    { "logging", benchLogging, "Bulk session throughput with logging off vs trace-to-file; per-call cost" },
+    { "pool", benchPool, "Burst of N clients: time to first prompt without and with a warm shell pool" },
+    { "buffers", benchBuffers, "Bulk MB/s and CPU per GB: fixed 16 KB stream buffers vs pooled adaptive ones" },
+    { "slowreader", benchSlowReader, "Stalled then trickling client vs a flooding child: checks the output bound" },
+    { "keystroke", benchKeystroke, "Typed keys and pastes: echo latency in line vs raw mode, per-key vs batched sends" },
+    { "files", benchFiles, "1 GB file and 10,000 small files up and down over loopback: MB/s, files/s" },
+    { "exec", benchExec, "Short commands per connection: typed into the shell vs -e exec frames, commands/s" },
+    { "fanout", benchFanout, "One command on 1,000 targets over local servers from a single poll loop: wall time, threads" },
+    { "encryption", benchEncryption, "Record sealing GB/s per cipher kernel; bulk MB/s in the clear vs encrypted, with a limit" },
+    { "flood", benchFlood, "Connection flood against small limits: every client answered, probe echo p99, thread growth" },
+    { "accept", benchAccept, "Connect-and-Hello loop against 1, 2, 4 and 8 acceptor shards: accepts/s, connect p99" },
+    { "transport", benchTransport, "Ping RTT and bulk MB/s over TCP loopback vs an AF_UNIX socket vs shared memory" },
+    { "relay", benchRelay, "Bursty child, jittery reader: MB/s at relay depths 1, 2, 4 and 8, reads stalled on a full ring" },
+    { "screen", benchScreen, "100 MB output flood, all output vs screen updates: time to last line, wire bytes, draw time" },
+    { "interrupt", benchInterrupt, "Ctrl-C against a flooding child, 20 rounds: answer and child-stop p50/p99, output dropped" },
+    { "suite", benchSuite, "Release comparison as JSON: bulk MB/s, CPU/MB, echo p50/p99/p999, spawn rate, idle RSS" },
+    { "child", benchChild, "Stand-in shell the suite runs as each session's child" },
+    { "raise", benchRaise, "Console event helper the interrupt scenario's server runs" },
+};
+
+static void printUsage() {
+    std::cout << "Usage: bench <scenario> [--name value ...]" << std::endl;
+    std::cout << "Every scenario accepts --log-level (default warn) and --log-file." << std::endl;
+    std::cout << "Scenarios:" << std::endl;
+    for (const auto& scenario : s_scenarios) {
+        std::cout << "  " << scenario.name << "  " << scenario.description << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printUsage();
+        return 1;
+    }
+
+    BenchOptions options;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        std::string name = argv[i];
+        if (name.compare(0, 2, "--") != 0) {
+            printUsage();
+            return 1;
+        }
+        options[name.substr(2)] = argv[i + 1];
+    }
+
+    LogLevel logLevel = LogLevel::Warn;
+    if (!Logger::parseLevel(optionString(options, "log-level", "warn"), logLevel)) {
+        std::cerr << "Unknown log level" << std::endl;
+        return 1;
+    }
+    Logger::configure(logLevel, optionString(options, "log-file", ""));
+
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+    int result = 1;
+    bool found = false;
+    for (const auto& scenario : s_scenarios) {
+        if (argv[1] == std::string(scenario.name)) {
+            found = true;
+            result = scenario.run(options);
+            break;
+        }
+    }
+
+    if (!found) {
+        std::cerr << "Unknown scenario: " << argv[1] << std::endl;
+        printUsage();
+    }
+
+    WSACleanup();
+    Logger::shutdown();
+    return result;
+}
@@ -0,0 +1,133 @@
+#pragma once
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "../src/utils.hpp"
+#include "../src/protocol/protocol.hpp"
+
+typedef std::map<std::string, std::string> BenchOptions;
+
+double nowSeconds();
+size_t processThreadCount();
+size_t processRssBytes();
+// User plus kernel time consumed by this process so far.
+double processCpuSeconds();
+
+// Value at fraction p (0..1) of an ascending vector; 0 when empty.
+double percentile(const std::vector<double>& sorted, double p);
+
+int optionInt(const BenchOptions& options, const std::string& name, int fallback);
+std::string optionString(const BenchOptions& options, const std::string& name, const std::string& fallback);
+
+// Opens a blocking loopback connection, retrying while the listen backlog is full.
+Socket connectLoopback(unsigned short port, int attempts = 50);
+
+// connectLoopback() as a Transport whose receives give up after `timeout`
+// seconds, with SO_RCVBUF set to `receiveBuffer` unless it is 0; null if the
+// connection failed.
+std::unique_ptr<Transport> loopbackTransport(unsigned short port, double timeout, int receiveBuffer = 0);
+
+// The session-0 client most scenarios drive a child with: output is kept for
+// marker searches and credited once per receive. Scenarios hook in where
+// they differ: the transport it runs over, the record layer once a key
+// exchange has secured it, a look at each frame and a pause after each
+// receive.
+struct BenchClient {
+    std::unique_ptr<Transport> transport;
+    FrameReader reader;
+    // Frames are sealed and opened once this is secure.
+    RecordLayer layer;
+    // Recent session 0 output, searched for markers.
+    std::string output;
+    // Session 0 output received, kept or not, and everything received.
+    size_t bytes = 0;
+    size_t wireBytes = 0;
+    size_t frames = 0;
+    bool helloSeen = false;
+    uint32_t serverFeatures = 0;
+    // Sees every frame first; for session 0 output, false leaves it out of
+    // `output` (it is still credited).
+    std::function<bool(const Frame&)> onFrame;
+    // Runs after each receive has been credited.
+    std::function<void()> afterReceive;
+    // Frames sent here are short (a line, a control), sealed out of place.
+    char sealed[256];
+
+    bool send(Channel channel, const void* payload, uint32_t length);
+    bool sendLine(const std::string& line);
+    bool sendControl(ControlCode code, uint32_t value = 0);
+    // Handles a frame already read and opened, adding its output to `credit`.
+    void take(const Frame& frame, uint32_t& credit);
+    // One receive: frames are handled and their output credited.
+    bool readOnce();
+    // Reads until `done` holds.
+    bool readUntil(const std::function<bool()>& done);
+    // Reads until `marker` has arrived; it is consumed with everything
+    // before it.
+    bool readUntil(const std::string& marker);
+    // Reads what has arrived already, without waiting for more.
+    bool drain();
+    // Sends a Hello and reads until the server's answer.
+    bool hello(uint32_t features);
+
+private:
+    // Handles what one receive returned.
+    bool received(int bytesRead);
+};
+
+struct StormResult {
+    std::vector<double> promptMs;
+    double seconds = 0.0;
+    int failed = 0;
+    int timedOut = 0;
+};
+
+// Connects `count` clients to a running server at once and collects each
+// one's time to first output, sorted; false if any failed or timed out.
+bool measureFirstPrompts(unsigned short port, int count, double timeout, StormResult& result);
+
+// Command line that runs this executable as the stand-in child (benchChild).
+std::string childCommand();
+
+struct BulkResult {
+    double megabytes = 0.0;
+    double seconds = 0.0;
+    double cpuSeconds = 0.0;
+};
+
+// Has session 0 of a new connection to a server running childCommand()
+// write `bytes` of output, and times it until the last byte is read.
+bool measureBulk(unsigned short port, size_t bytes, double timeout, BulkResult& result);
+
+int benchSessions(const BenchOptions& options);
+int benchStorm(const BenchOptions& options);
+int benchTeardown(const BenchOptions& options);
+int benchFraming(const BenchOptions& options);
+int benchMux(const BenchOptions& options);
+int benchCompress(const BenchOptions& options);
+int benchCoalesce(const BenchOptions& options);
+int benchLogging(const BenchOptions& options);
+int benchPool(const BenchOptions& options);
+int benchBuffers(const BenchOptions& options);
+int benchSlowReader(const BenchOptions& options);
+int benchKeystroke(const BenchOptions& options);
+int benchFiles(const BenchOptions& options);
+int benchExec(const BenchOptions& options);
+int benchFanout(const BenchOptions& options);
+int benchEncryption(const BenchOptions& options);
+int benchFlood(const BenchOptions& options);
+int benchAccept(const BenchOptions& options);
+int benchTransport(const BenchOptions& options);
+int benchRelay(const BenchOptions& options);
+int benchScreen(const BenchOptions& options);
+int benchInterrupt(const BenchOptions& options);
+int benchSuite(const BenchOptions& options);
+int benchChild(const BenchOptions& options);
+int benchRaise(const BenchOptions& options);
+
+#endif // BENCH_HPP
@@ -0,0 +1,62 @@
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/buffer/buffer.hpp"
+
+static bool runBulk(unsigned short port, int loopThreads, const RelayOptions& relay, size_t bytes,
+                    int rounds, double timeout, BulkResult& total) {
+    Server server(port, loopThreads, relay);
+    if (!server.initialize()) {
+        return false;
+    }
+    server.start();
+
+    bool ok = true;
+    for (int i = 0; ok && i < rounds; ++i) {
+        BulkResult result;
+        ok = measureBulk(port, bytes, timeout, result);
+        total.megabytes += result.megabytes;
+        total.seconds += result.seconds;
+        total.cpuSeconds += result.cpuSeconds;
+    }
+
+    server.stop();
+    return ok;
+}
+
+static void printBulk(const char* label, const BulkResult& result) {
+    std::cout << label << std::endl;
+    std::cout << "  MB/s:                  " << result.megabytes / result.seconds << std::endl;
+    std::cout << "  CPU s per GB:          " << result.cpuSeconds * 1000.0 / result.megabytes << std::endl;
+}
+
+// Bulk output through the stand-in child with the old fixed 16 KB stream
+// buffers vs pooled buffers that grow with throughput.
+int benchBuffers(const BenchOptions& options) {
+    size_t bytes = (size_t)optionInt(options, "mb", 256) * 1000 * 1000;
+    int rounds = optionInt(options, "rounds", 3);
+    int loopThreads = optionInt(options, "threads", LOOP_THREADS);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 100);
+    double timeout = optionInt(options, "timeout", 120);
+
+    RelayOptions fixed;
+    fixed.shell = childCommand();
+    fixed.minBuffer = 16384;
+    fixed.maxBuffer = 16384;
+
+    RelayOptions adaptive;
+    adaptive.shell = childCommand();
+
+    BulkResult fixedResult;
+    BulkResult adaptiveResult;
+    if (!runBulk(port, loopThreads, fixed, bytes, rounds, timeout, fixedResult) ||
+        !runBulk(port + 1, loopThreads, adaptive, bytes, rounds, timeout, adaptiveResult)) {
+        std::cerr << "Bulk transfer did not complete" << std::endl;
+        return 1;
+    }
+
+    std::cout << "output per round MB: " << bytes / 1e6 << ", rounds: " << rounds << std::endl;
+    printBulk("fixed 16 KB buffers:", fixedResult);
+    printBulk("pooled, adaptive buffers:", adaptiveResult);
+    std::cout << "pool heap allocations:   " << BufferPool::shared().allocations() << std::endl;
+    return 0;
+}
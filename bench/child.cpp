@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <atomic>
+
+#include "bench.hpp"
+
+static std::atomic<bool> s_interrupted(false);
+
+static BOOL WINAPI onConsoleEvent(DWORD event) {
+    if (event != CTRL_C_EVENT && event != CTRL_BREAK_EVENT) {
+        return FALSE;
+    }
+    s_interrupted = true;
+    return TRUE;
+}
+
+static bool writeAll(HANDLE handle, const char* data, size_t length) {
+    while (length > 0) {
+        DWORD written = 0;
+        if (!WriteFile(handle, data, (DWORD)length, &written, nullptr)) {
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+static bool writeLines(HANDLE output, size_t bytes) {
+    // 64-byte lines, like a build log or a directory listing.
+    std::string line = "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcd\r\n";
+    std::string block;
+    for (int i = 0; i < 1024; ++i) {
+        block += line;
+    }
+
+    while (bytes > 0) {
+        size_t chunk = std::min(bytes, block.size());
+        chunk -= chunk % line.size();
+        if (chunk == 0) {
+            break;
+        }
+        if (!writeAll(output, block.data(), chunk)) {
+            return false;
+        }
+        bytes -= chunk;
+    }
+    return true;
+}
+
+static bool writeBulk(HANDLE output, size_t bytes) {
+    return writeLines(output, bytes) && writeAll(output, "bulk_done\r\n", 11);
+}
+
+// Output in bursts with idle gaps between them, like a build printing a
+// module at a time.
+static bool writeBursts(HANDLE output, int bursts, size_t bytes, DWORD gapMs) {
+    for (int i = 0; i < bursts; ++i) {
+        if (i > 0) {
+            Sleep(gapMs);
+        }
+        if (!writeLines(output, bytes)) {
+            return false;
+        }
+    }
+    return writeAll(output, "bulk_done\r\n", 11);
+}
+
+// Output without end, like a runaway command, until a Ctrl-C or Ctrl-Break
+// console event arrives; then "flood_stopped".
+static bool writeFlood(HANDLE output) {
+    s_interrupted = false;
+    SetConsoleCtrlHandler(onConsoleEvent, TRUE);
+    bool ok = true;
+    while (ok && !s_interrupted) {
+        ok = writeLines(output, 64 * 1024);
+    }
+    SetConsoleCtrlHandler(onConsoleEvent, FALSE);
+    return ok && writeAll(output, "flood_stopped\r\n", 15);
+}
+
+// Echoes every read back as it arrives, like a terminal in raw mode, until
+// stdin is closed. `pending` is what followed the "raw" line.
+static int echoRaw(HANDLE input, HANDLE output, const std::string& pending) {
+    if (!writeAll(output, pending.data(), pending.size())) {
+        return 1;
+    }
+
+    char buffer[BUFFER_SIZE];
+    DWORD bytesRead = 0;
+    while (ReadFile(input, buffer, sizeof(buffer), &bytesRead, nullptr) && bytesRead > 0) {
+        if (!writeAll(output, buffer, bytesRead)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Stand-in for cmd.exe that the suite scenario runs as the session's child,
+// so its numbers measure the relay rather than the shell. Commands, one per
+// line on stdin, each followed by a "> " prompt:
+//   bulk N   write N bytes of 64-byte lines, then "bulk_done"
+//   burst N BYTES MS
+//            write N bursts of BYTES, MS milliseconds apart, then "bulk_done"
+//   flood    write 64-byte lines until interrupted, then "flood_stopped"
+//   raw      echo every byte from then on as soon as it is read
+//   exit     exit with code 0
+//   other    echoed back as a line
+int benchChild(const BenchOptions&) {
+    HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+    HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
+
+    if (!writeAll(output, "> ", 2)) {
+        return 1;
+    }
+
+    std::string pending;
+    char buffer[BUFFER_SIZE];
+    DWORD bytesRead = 0;
+    while (ReadFile(input, buffer, sizeof(buffer), &bytesRead, nullptr) && bytesRead > 0) {
+        pending.append(buffer, bytesRead);
+
+        size_t end;
+        while ((end = pending.find('\n')) != std::string::npos) {
+            std::string line = pending.substr(0, end);
+            pending.erase(0, end + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+
+            bool ok;
+            if (line == "exit") {
+                return 0;
+            } else if (line == "raw") {
+                return echoRaw(input, output, pending);
+            } else if (line == "flood") {
+                ok = writeFlood(output);
+            } else if (line.compare(0, 5, "bulk ") == 0) {
+                ok = writeBulk(output, std::strtoull(line.c_str() + 5, nullptr, 10));
+            } else if (line.compare(0, 6, "burst ") == 0) {
+                char* next = nullptr;
+                int bursts = (int)std::strtol(line.c_str() + 6, &next, 10);
+                size_t bytes = std::strtoull(next, &next, 10);
+                DWORD gapMs = std::strtoul(next, nullptr, 10);
+                ok = writeBursts(output, bursts, bytes, gapMs);
+            } else {
+                line += "\r\n";
+                ok = writeAll(output, line.data(), line.size());
+            }
+            if (!ok || !writeAll(output, "> ", 2)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
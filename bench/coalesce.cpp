@@ -0,0 +1,149 @@
+#include <algorithm>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/protocol/protocol.hpp"
+
+struct EchoClient {
+    Socket socket;
+    FrameReader reader;
+    std::string output;
+    size_t bytes = 0;
+};
+
+// Reads Stdout until `marker` appears, returning the window as it goes.
+static bool waitForOutput(EchoClient& client, const std::string& marker) {
+    while (client.output.find(marker) == std::string::npos) {
+        int bytesRead = client.socket.recv(client.reader.writePointer(), client.reader.writableSize());
+        if (bytesRead <= 0) {
+            return false;
+        }
+        client.reader.commit(bytesRead);
+
+        Frame frame;
+        uint32_t consumed = 0;
+        while (client.reader.next(frame)) {
+            if (frame.channel == Channel::Stdout) {
+                client.output.append(frame.payload, frame.length);
+                client.bytes += frame.length;
+                consumed += frame.length;
+            }
+        }
+        if (consumed > 0) {
+            ControlPayload payload;
+            encodeControl(payload, ControlCode::WindowUpdate, consumed);
+            sendFrame(client.socket, Channel::Control, &payload, sizeof(payload));
+        }
+
+        // Only the tail can still contain the marker.
+        if (client.output.size() > 4096) {
+            client.output.erase(0, client.output.size() - 256);
+        }
+    }
+    client.output.clear();
+    return true;
+}
+
+struct CoalesceResult {
+    std::vector<double> rttMs;
+    double bulkMBs = 0.0;
+    uint64_t reads = 0;
+    uint64_t sends = 0;
+    uint64_t bytes = 0;
+};
+
+static bool runConfig(unsigned short port, const RelayOptions& relay, int echoes, int lines,
+                      CoalesceResult& result) {
+    Server server(port, LOOP_THREADS, relay);
+    if (!server.initialize()) {
+        return false;
+    }
+    server.start();
+
+    EchoClient client;
+    client.socket = connectLoopback(port);
+    if (!client.socket.isValid()) {
+        server.stop();
+        return false;
+    }
+    client.socket.setNoDelay(true);
+
+    bool ok = waitForOutput(client, ">");
+
+    // The caret keeps the echoed command line from matching the marker.
+    for (int i = 0; ok && i < echoes; ++i) {
+        std::string tag = std::to_string(i);
+        std::string command = "echo rtt^_" + tag + "\r\n";
+        double sent = nowSeconds();
+        ok = sendFrame(client.socket, Channel::Stdin, command.c_str(), (uint32_t)command.size()) &&
+             waitForOutput(client, "rtt_" + tag + "\r\n");
+        result.rttMs.push_back((nowSeconds() - sent) * 1000.0);
+    }
+
+    const ServerMetrics& stats = server.metrics().server();
+    uint64_t reads = stats.pipeReads;
+    uint64_t sends = stats.outputFrames;
+    uint64_t bytes = stats.outputBytes;
+
+    if (ok) {
+        std::string command = "for /L %i in (1,1," + std::to_string(lines) +
+            ") do @echo 0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef\r\n"
+            "echo bulk^_done\r\n";
+        size_t before = client.bytes;
+        double start = nowSeconds();
+        ok = sendFrame(client.socket, Channel::Stdin, command.c_str(), (uint32_t)command.size()) &&
+             waitForOutput(client, "bulk_done");
+        result.bulkMBs = (client.bytes - before) / (nowSeconds() - start) / 1e6;
+    }
+
+    result.reads = stats.pipeReads - reads;
+    result.sends = stats.outputFrames - sends;
+    result.bytes = stats.outputBytes - bytes;
+
+    client.socket.close();
+    server.stop();
+    std::sort(result.rttMs.begin(), result.rttMs.end());
+    return ok;
+}
+
+// Compares output coalescing and Nagle settings on an interactive echo
+// round trip and on bulk output. Sends vs bytes shows how well the bulk
+// phase was batched.
+int benchCoalesce(const BenchOptions& options) {
+    int echoes = optionInt(options, "echoes", 200);
+    int lines = optionInt(options, "lines", 50000);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 100);
+
+    struct Config {
+        const char* name;
+        RelayOptions relay;
+    };
+    std::vector<Config> configs(3);
+    configs[0].name = "coalesce + nodelay";
+    configs[0].relay.coalesceBytes = optionInt(options, "bytes", COALESCE_BYTES);
+    configs[0].relay.coalesceMicros = optionInt(options, "micros", COALESCE_DEADLINE_US);
+    configs[1].name = "per-read + nodelay";
+    configs[1].relay.coalesceBytes = 0;
+    configs[2].name = "per-read + nagle";
+    configs[2].relay.coalesceBytes = 0;
+    configs[2].relay.noDelay = false;
+
+    bool ok = true;
+    for (size_t i = 0; i < configs.size(); ++i) {
+        CoalesceResult result;
+        if (!runConfig((unsigned short)(port + i), configs[i].relay, echoes, lines, result)) {
+            std::cerr << configs[i].name << ": run failed" << std::endl;
+            ok = false;
+            continue;
+        }
+
+        std::cout << configs[i].name << std::endl;
+        std::cout << "  echo RTT p50 ms:       " << percentile(result.rttMs, 0.50) << std::endl;
+        std::cout << "  echo RTT p99 ms:       " << percentile(result.rttMs, 0.99) << std::endl;
+        std::cout << "  bulk MB/s:             " << result.bulkMBs << std::endl;
+        std::cout << "  bulk pipe reads:       " << result.reads << std::endl;
+        std::cout << "  bulk sends:            " << result.sends << std::endl;
+        std::cout << "  bytes per send:        " << (result.sends ? result.bytes / result.sends : 0) << std::endl;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "bench.hpp"
+#include "../src/compress/compress.hpp"
+
+// Stand-in for a recorded session when no --input file is given: a mix of
+// `dir /s` listings, build log lines and a little binary noise.
+static std::string syntheticOutput(size_t size) {
+    std::string output;
+    unsigned int seed = 12345;
+    auto next = [&seed] { seed = seed * 1103515245 + 12345; return (seed >> 16) & 0x7FFF; };
+
+    while (output.size() < size) {
+        int kind = next() % 10;
+        if (kind < 5) {
+            output += "10/17/2026  09:" + std::to_string(10 + next() % 50) + " AM    " +
+                      std::to_string(next() * 7) + " module" + std::to_string(next() % 300) + ".obj\r\n";
+        } else if (kind < 9) {
+            output += "  Compiling src\\component" + std::to_string(next() % 40) +
+                      "\\source" + std::to_string(next() % 200) + ".cpp ... ok\r\n";
+        } else {
+            for (int i = 0; i < 64; ++i) {
+                output += (char)next();
+            }
+        }
+    }
+    output.resize(size);
+    return output;
+}
+
+// Replays output through the codec in pipe-read sized chunks, checking the
+// round trip and timing both directions. Keystroke latency is the time added
+// to a short echo by compressing and decompressing it mid-stream.
+int benchCompress(const BenchOptions& options) {
+    size_t chunk = (size_t)optionInt(options, "chunk", BUFFER_SIZE);
+    std::string path = optionString(options, "input", "");
+    int echoes = optionInt(options, "echoes", 10000);
+
+    if (chunk == 0 || chunk > MAX_FRAME_PAYLOAD) {
+        std::cerr << "--chunk must be between 1 and " << MAX_FRAME_PAYLOAD << std::endl;
+        return 1;
+    }
+
+    std::string data;
+    if (path.empty()) {
+        data = syntheticOutput(64 * 1024 * 1024);
+    } else {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            std::cerr << "Cannot open " << path << std::endl;
+            return 1;
+        }
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    std::vector<char> block(compressBound(chunk));
+    std::vector<size_t> sizes;
+    std::vector<std::string> wire;
+
+    StreamCompressor compressor;
+    size_t wireBytes = 0;
+    size_t rawBlocks = 0;
+    double compressStart = nowSeconds();
+    for (size_t offset = 0; offset < data.size(); offset += chunk) {
+        size_t length = std::min(chunk, data.size() - offset);
+        size_t size = compressor.compress(data.data() + offset, length, block.data());
+        sizes.push_back(size);
+        if (size > 0) {
+            wire.emplace_back(block.data(), size);
+            wireBytes += size;
+        } else {
+            wire.emplace_back();
+            wireBytes += length;
+            ++rawBlocks;
+        }
+    }
+    double compressTime = nowSeconds() - compressStart;
+
+    StreamDecompressor decompressor;
+    bool intact = true;
+    double decompressStart = nowSeconds();
+    for (size_t i = 0, offset = 0; i < sizes.size() && intact; ++i, offset += chunk) {
+        size_t length = std::min(chunk, data.size() - offset);
+        if (sizes[i] == 0) {
+            decompressor.append(data.data() + offset, length);
+            continue;
+        }
+
+        const char* out;
+        size_t outLength;
+        intact = decompressor.decompress(wire[i].data(), wire[i].size(), out, outLength) &&
+                 outLength == length && memcmp(out, data.data() + offset, length) == 0;
+    }
+    double decompressTime = nowSeconds() - decompressStart;
+
+    if (!intact) {
+        std::cerr << "Round trip mismatch" << std::endl;
+        return 1;
+    }
+
+    // A keystroke echo is a byte or two; a line echo is just above the
+    // compression threshold, so it takes the full encode/decode path.
+    std::vector<double> keystroke;
+    std::vector<double> line;
+    std::string lineEcho = "dir /s C:\\Users\\build\\workspace\\project\\src\\component\\generated\\*.cpp\r\n";
+    for (int i = 0; i < echoes; ++i) {
+        const std::string& echo = i % 2 ? lineEcho : std::string(1, 'a' + i % 26);
+        double start = nowSeconds();
+        size_t size = compressor.compress(echo.data(), echo.size(), block.data());
+        if (size > 0) {
+            const char* out;
+            size_t outLength;
+            decompressor.decompress(block.data(), size, out, outLength);
+        } else {
+            decompressor.append(echo.data(), echo.size());
+        }
+        (i % 2 ? line : keystroke).push_back((nowSeconds() - start) * 1e6);
+    }
+    std::sort(keystroke.begin(), keystroke.end());
+    std::sort(line.begin(), line.end());
+
+    std::cout << "input MB:                " << data.size() / 1e6 << (path.empty() ? " (synthetic)" : "") << std::endl;
+    std::cout << "chunk bytes:             " << chunk << std::endl;
+    std::cout << "compression ratio:       " << (double)data.size() / wireBytes << std::endl;
+    std::cout << "blocks sent raw:         " << rawBlocks << "/" << sizes.size() << std::endl;
+    std::cout << "compress MB/s:           " << data.size() / compressTime / 1e6 << std::endl;
+    std::cout << "decompress MB/s:         " << data.size() / decompressTime / 1e6 << std::endl;
+    std::cout << "keystroke added us p50:  " << percentile(keystroke, 0.50) << std::endl;
+    std::cout << "keystroke added us p99:  " << percentile(keystroke, 0.99) << std::endl;
+    std::cout << "line echo added us p50:  " << percentile(line, 0.50) << std::endl;
+    std::cout << "line echo added us p99:  " << percentile(line, 0.99) << std::endl;
+    return 0;
+}
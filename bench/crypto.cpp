@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cstring>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/protocol/protocol.hpp"
+#include "../src/crypto/crypto.hpp"
+
+// Session 0 of a new connection, in the clear or, after the same key
+// exchange as `-c`, sealed.
+static bool connectClient(BenchClient& client, unsigned short port, bool encrypt, double timeout) {
+    client.transport = loopbackTransport(port, timeout);
+    if (!client.transport) {
+        return false;
+    }
+    client.transport->setNoDelay(true);
+    if (!encrypt) {
+        return true;
+    }
+
+    std::vector<HeldFrame> early;
+    if (!clientHandshake(*client.transport, client.reader, client.layer, 0, early)) {
+        return false;
+    }
+    if (!client.layer.isSecure()) {
+        std::cerr << "Server turned encryption down" << std::endl;
+        return false;
+    }
+    uint32_t credit = 0;
+    for (auto& held : early) {
+        client.take(held.frame(), credit);
+    }
+    return credit == 0 || client.sendControl(ControlCode::WindowUpdate, credit);
+}
+
+static bool runBulk(unsigned short port, bool encrypt, size_t bytes, double timeout, BulkResult& result) {
+    BenchClient client;
+    if (!connectClient(client, port, encrypt, timeout) || !client.readUntil("> ")) {
+        return false;
+    }
+
+    size_t before = client.bytes;
+    double cpuStart = processCpuSeconds();
+    double start = nowSeconds();
+    if (!client.sendLine("bulk " + std::to_string(bytes)) || !client.readUntil("bulk_done")) {
+        return false;
+    }
+    result.seconds += nowSeconds() - start;
+    result.cpuSeconds += processCpuSeconds() - cpuStart;
+    result.megabytes += (client.bytes - before) / 1e6;
+
+    client.sendLine("exit");
+    return true;
+}
+
+// GB/s of the keystream alone and of whole records (cipher and MAC) of
+// `recordBytes`, under the current kernel.
+static void measureKernel(size_t recordBytes, size_t totalBytes, double& cipherRate, double& recordRate) {
+    uint8_t key[CRYPTO_KEY_SIZE];
+    uint8_t nonce[CRYPTO_NONCE_SIZE] = {};
+    randomBytes(key, sizeof(key));
+    std::vector<char> data(recordBytes, 'x');
+    size_t rounds = std::max<size_t>(totalBytes / recordBytes, 1);
+
+    ChaCha20 cipher(key, nonce, 1);
+    double start = nowSeconds();
+    for (size_t i = 0; i < rounds; ++i) {
+        cipher.apply(data.data(), data.data(), data.size());
+    }
+    cipherRate = rounds * recordBytes / 1e9 / (nowSeconds() - start);
+
+    RecordCipher records;
+    records.setKey(key);
+    FrameHeader header;
+    memset(&header, 0, sizeof(header));
+    WSABUF buffer;
+    buffer.buf = data.data();
+    buffer.len = (ULONG)data.size();
+    uint8_t tag[RECORD_TAG_SIZE];
+    start = nowSeconds();
+    for (size_t i = 0; i < rounds; ++i) {
+        records.seal(&header, sizeof(header), &buffer, 1, nullptr, tag);
+    }
+    recordRate = rounds * recordBytes / 1e9 / (nowSeconds() - start);
+}
+
+// Record layer cost: seal throughput for each cipher kernel the CPU has,
+// then bulk output through a local server in the clear vs encrypted.
+// Fails if encryption costs more than --max-overhead-pct of the throughput.
+int benchEncryption(const BenchOptions& options) {
+    size_t cipherBytes = (size_t)optionInt(options, "cipher-mb", 512) * 1000 * 1000;
+    size_t bytes = (size_t)optionInt(options, "mb", 256) * 1000 * 1000;
+    int rounds = optionInt(options, "rounds", 3);
+    double maxOverhead = optionInt(options, "max-overhead-pct", 20);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 100);
+    double timeout = optionInt(options, "timeout", 120);
+
+    CipherKernel best = cipherKernel();
+    std::cout << "kernel   chacha20 GB/s   64 KB records GB/s   64 B records GB/s" << std::endl;
+    for (CipherKernel kernel : { CipherKernel::Scalar, CipherKernel::Sse2, CipherKernel::Avx2 }) {
+        if (!setCipherKernel(kernel)) {
+            std::cout << cipherKernelName(kernel) << "   not supported by this CPU" << std::endl;
+            continue;
+        }
+        double cipherRate, recordRate, smallCipherRate, smallRecordRate;
+        measureKernel(MAX_FRAME_PAYLOAD, cipherBytes, cipherRate, recordRate);
+        measureKernel(64, cipherBytes / 16, smallCipherRate, smallRecordRate);
+        std::cout << cipherKernelName(kernel) << "   " << cipherRate << "   " << recordRate << "   "
+                  << smallRecordRate << std::endl;
+    }
+    setCipherKernel(best);
+
+    RelayOptions relay;
+    relay.shell = childCommand();
+    Server server(port, LOOP_THREADS, relay);
+    if (!server.initialize()) {
+        return 1;
+    }
+    server.start();
+
+    BulkResult plain;
+    BulkResult sealed;
+    bool ok = true;
+    for (int i = 0; ok && i < rounds; ++i) {
+        ok = runBulk(port, false, bytes, timeout, plain) && runBulk(port, true, bytes, timeout, sealed);
+    }
+    server.stop();
+    if (!ok) {
+        std::cerr << "Bulk transfer did not complete" << std::endl;
+        return 1;
+    }
+
+    double plainRate = plain.megabytes / plain.seconds;
+    double sealedRate = sealed.megabytes / sealed.seconds;
+    double overhead = (plainRate / sealedRate - 1.0) * 100.0;
+    std::cout << "bulk output per round MB: " << bytes / 1e6 << ", rounds: " << rounds
+              << ", kernel: " << cipherKernelName(best) << std::endl;
+    std::cout << "  in the clear MB/s:     " << plainRate << ", CPU s per GB: "
+              << plain.cpuSeconds * 1000.0 / plain.megabytes << std::endl;
+    std::cout << "  encrypted MB/s:        " << sealedRate << ", CPU s per GB: "
+              << sealed.cpuSeconds * 1000.0 / sealed.megabytes << std::endl;
+    std::cout << "  throughput overhead:   " << overhead << "% (limit " << maxOverhead << "%) "
+              << (overhead <= maxOverhead ? "PASS" : "FAIL") << std::endl;
+    return overhead <= maxOverhead ? 0 : 1;
+}
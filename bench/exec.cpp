@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/protocol/protocol.hpp"
+
+static bool sendControlFrame(Socket& socket, uint16_t session, ControlCode code, uint32_t value = 0) {
+    ControlPayload payload;
+    encodeControl(payload, code, value);
+    return sendFrame(socket, Channel::Control, &payload, sizeof(payload), 0, session);
+}
+
+// Runs `command` once over a new connection and waits for its exit. With
+// `exec` it is sent in an Exec frame like `-e` does; otherwise it is typed
+// into session 0's shell followed by "exit", as a script piping into `-c`
+// would. Output is credited back per receive.
+static bool runCommand(unsigned short port, const std::string& command, bool exec, int& exitCode) {
+    Socket socket = connectLoopback(port);
+    if (!socket.isValid()) {
+        return false;
+    }
+    socket.setNoDelay(true);
+
+    uint16_t session = exec ? 1 : 0;
+    bool ok;
+    if (exec) {
+        ok = sendFrame(socket, Channel::Exec, command.data(), (uint32_t)command.size(), 0, session) &&
+             sendControlFrame(socket, session, ControlCode::CloseStdin) &&
+             sendControlFrame(socket, 0, ControlCode::CloseSession);
+    } else {
+        std::string input = command + "\r\nexit\r\n";
+        ok = sendFrame(socket, Channel::Stdin, input.data(), (uint32_t)input.size(), 0, session);
+    }
+
+    FrameReader reader;
+    bool exited = false;
+    while (ok && !exited) {
+        int bytesRead = socket.recv(reader.writePointer(), reader.writableSize());
+        if (bytesRead <= 0) {
+            return false;
+        }
+        reader.commit(bytesRead);
+
+        uint32_t credit = 0;
+        Frame frame;
+        while (reader.next(frame)) {
+            if (frame.session != session) {
+                continue;
+            }
+            if (frame.channel == Channel::Stdout || frame.channel == Channel::Stderr) {
+                credit += frame.length;
+            } else if (frame.channel == Channel::ExitStatus) {
+                ExitStatusPayload status;
+                decodeExitStatus(frame, status);
+                exitCode = (int)status.exitCode;
+                exited = true;
+            }
+        }
+        ok = !reader.isCorrupt() && (exited || credit == 0 ||
+                                     sendControlFrame(socket, session, ControlCode::WindowUpdate, credit));
+    }
+    return ok && exited;
+}
+
+struct ExecRun {
+    std::vector<double> latencyMs;
+    double seconds = 0.0;
+    int failed = 0;
+};
+
+// `count` runs of `command`, `clients` at a time.
+static void measureCommands(unsigned short port, const std::string& command, bool exec, int count, int clients,
+                            ExecRun& run) {
+    std::mutex mutex;
+    std::atomic<int> next(0);
+    std::vector<std::thread> threads;
+
+    double start = nowSeconds();
+    for (int i = 0; i < clients; ++i) {
+        threads.emplace_back([&] {
+            while (next++ < count) {
+                double begin = nowSeconds();
+                int exitCode = -1;
+                bool ok = runCommand(port, command, exec, exitCode);
+                double elapsed = (nowSeconds() - begin) * 1000.0;
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (ok) {
+                    run.latencyMs.push_back(elapsed);
+                } else {
+                    ++run.failed;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    run.seconds = nowSeconds() - start;
+    std::sort(run.latencyMs.begin(), run.latencyMs.end());
+}
+
+static void printRun(const char* label, const ExecRun& run) {
+    std::cout << label << run.latencyMs.size() / run.seconds << " commands/s, p50 "
+              << percentile(run.latencyMs, 0.50) << " ms, p99 " << percentile(run.latencyMs, 0.99)
+              << " ms, " << run.failed << " failed" << std::endl;
+}
+
+// Short commands run one connection each: typed into the interactive shell
+// against sent as an Exec frame and started directly. --pool N gives the
+// shell path its warm pool.
+int benchExec(const BenchOptions& options) {
+    int count = optionInt(options, "count", 200);
+    int clients = optionInt(options, "clients", 1);
+    int poolSize = optionInt(options, "pool", 0);
+    std::string command = optionString(options, "command", "cmd.exe /c ver");
+    int loopThreads = optionInt(options, "threads", LOOP_THREADS);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 100);
+
+    Server server(port, loopThreads);
+    if (!server.initialize()) {
+        return 1;
+    }
+    if (poolSize > 0) {
+        PoolOptions pool;
+        pool.size = poolSize;
+        server.startPool(pool);
+    }
+    server.start();
+
+    ExecRun shell;
+    measureCommands(port, command, false, count, clients, shell);
+    ExecRun exec;
+    measureCommands(port, command, true, count, clients, exec);
+    server.stop();
+
+    std::cout << "command:       " << command << std::endl;
+    std::cout << "runs x clients: " << count << " x " << clients << std::endl;
+    printRun("through shell: ", shell);
+    printRun("exec:          ", exec);
+    bool ok = shell.failed == 0 && exec.failed == 0;
+    std::cout << "result:        " << (ok ? "PASS" : "FAIL") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/client/fanout.hpp"
+
+// Runs one command on `hosts` targets spread over `servers` local servers on
+// consecutive ports, the way `-m` would on a fleet, and reports the wall
+// time and the process's peak thread count over the run. The servers' wait
+// threads are included, so it bounds what the fan-out itself adds.
+// Passes if every target ran the command and exited 0.
+int benchFanout(const BenchOptions& options) {
+    int serverCount = std::max(optionInt(options, "servers", 8), 1);
+    int hostCount = optionInt(options, "hosts", 1000);
+    int concurrency = optionInt(options, "parallel", FANOUT_CONCURRENCY);
+    std::string command = optionString(options, "command", childCommand());
+    int loopThreads = optionInt(options, "threads", 2);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 100);
+
+    std::vector<std::unique_ptr<Server>> servers;
+    for (int i = 0; i < serverCount; ++i) {
+        servers.push_back(std::make_unique<Server>((unsigned short)(port + i), loopThreads));
+        if (!servers.back()->initialize()) {
+            std::cerr << "Cannot listen on port " << port + i << std::endl;
+            for (auto& server : servers) {
+                server->stop();
+            }
+            return 1;
+        }
+        servers.back()->start();
+    }
+
+    std::vector<FanoutTarget> targets;
+    for (int i = 0; i < hostCount; ++i) {
+        FanoutTarget target;
+        target.port = (unsigned short)(port + i % serverCount);
+        target.host = HOST;
+        target.name = "host" + std::to_string(i) + ":" + std::to_string(target.port);
+        targets.push_back(target);
+    }
+
+    FanoutOptions fanout;
+    fanout.concurrency = concurrency;
+    fanout.quiet = true;
+
+    // Sampled from another thread, which counts itself.
+    size_t baseThreads = processThreadCount();
+    std::atomic<bool> sampling(true);
+    std::atomic<size_t> peakThreads(baseThreads);
+    std::thread sampler([&] {
+        while (sampling) {
+            size_t threads = processThreadCount();
+            if (threads > peakThreads) {
+                peakThreads = threads;
+            }
+            Sleep(20);
+        }
+    });
+
+    double start = nowSeconds();
+    FanoutClient client(targets, command, fanout);
+    client.run();
+    double seconds = nowSeconds() - start;
+
+    sampling = false;
+    sampler.join();
+    for (auto& server : servers) {
+        server->stop();
+    }
+
+    std::vector<FanoutClient::Result> results = client.results();
+    size_t succeeded = std::count_if(results.begin(), results.end(), [](const FanoutClient::Result& result) {
+        return result.error.empty() && result.exitCode == 0;
+    });
+
+    std::cout << "servers x targets:   " << serverCount << " x " << hostCount << std::endl;
+    std::cout << "concurrency:         " << concurrency << std::endl;
+    std::cout << "wall s:              " << seconds << std::endl;
+    std::cout << "targets/s:           " << hostCount / seconds << std::endl;
+    std::cout << "succeeded:           " << succeeded << std::endl;
+    std::cout << "threads before/peak: " << baseThreads << "/" << peakThreads << std::endl;
+    bool ok = succeeded == results.size();
+    std::cout << "result:              " << (ok ? "PASS" : "FAIL") << std::endl;
+    return ok ? 0 : 1;
+}
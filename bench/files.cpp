@@ -0,0 +1,226 @@
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/protocol/protocol.hpp"
+#include "../src/client/files.hpp"
+
+// A connection that only does file transfers: a TransferManager sending
+// through the socket and a thread feeding it the server's File frames.
+struct FileClient {
+    Socket socket;
+    std::mutex sendMutex;
+    std::atomic<bool> running{ true };
+    std::thread receiver;
+    TransferManager transfers;
+
+    explicit FileClient(size_t parallel)
+        : transfers([this](uint16_t id, const FilePayload& payload, const char* data, uint32_t length) {
+                        std::lock_guard<std::mutex> lock(sendMutex);
+                        return sendFrame(socket, Channel::File, &payload, sizeof(payload), data, length, 0, id);
+                    },
+                    [](const std::string& message) { std::cout << "  " << message << std::endl; }, parallel) {}
+
+    void receive() {
+        FrameReader reader;
+        while (running) {
+            int bytesRead = socket.recv(reader.writePointer(), reader.writableSize());
+            if (bytesRead <= 0) {
+                break;
+            }
+            reader.commit(bytesRead);
+
+            Frame frame;
+            while (reader.next(frame)) {
+                if (frame.channel == Channel::File) {
+                    transfers.handleFrame(frame);
+                }
+            }
+            if (reader.isCorrupt()) {
+                break;
+            }
+        }
+        transfers.disconnected();
+    }
+};
+
+static bool writeTestFile(const std::string& path, uint64_t size, uint32_t seed) {
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    // Not compressible and different per file, so a mix-up shows.
+    std::vector<uint32_t> block(256 * 1024);
+    bool ok = true;
+    while (ok && size > 0) {
+        for (auto& word : block) {
+            seed = seed * 1664525 + 1013904223;
+            word = seed;
+        }
+        DWORD length = (DWORD)std::min<uint64_t>(size, block.size() * sizeof(uint32_t));
+        DWORD written = 0;
+        ok = WriteFile(file, block.data(), length, &written, nullptr) && written == length;
+        size -= length;
+    }
+    CloseHandle(file);
+    return ok;
+}
+
+static bool sameContents(const std::string& first, const std::string& second) {
+    std::ifstream a(first, std::ios::binary);
+    std::ifstream b(second, std::ios::binary);
+    if (!a || !b) {
+        return false;
+    }
+
+    std::vector<char> left(1024 * 1024);
+    std::vector<char> right(left.size());
+    while (a && b) {
+        a.read(left.data(), left.size());
+        b.read(right.data(), right.size());
+        if (a.gcount() != b.gcount() || memcmp(left.data(), right.data(), (size_t)a.gcount()) != 0) {
+            return false;
+        }
+    }
+    return a.eof() && b.eof();
+}
+
+static void removeTree(const std::string& path) {
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((path + "\\*").c_str(), &data);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            std::string name = data.cFileName;
+            if (name == "." || name == "..") {
+                continue;
+            }
+            if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                removeTree(path + "\\" + name);
+            } else {
+                DeleteFileA((path + "\\" + name).c_str());
+            }
+        } while (FindNextFileA(find, &data));
+        FindClose(find);
+    }
+    RemoveDirectoryA(path.c_str());
+}
+
+// Runs the queued transfers to the end and prints their rate; false if any
+// failed or they did not finish in time.
+static bool measure(FileClient& client, const char* label, uint64_t bytes, size_t files, double timeout) {
+    TransferManager::Totals before = client.transfers.totals();
+    double start = nowSeconds();
+    bool finished = client.transfers.waitIdle((DWORD)(timeout * 1000));
+    double seconds = std::max(nowSeconds() - start, 1e-6);
+    TransferManager::Totals after = client.transfers.totals();
+
+    std::cout << label << bytes / 1e6 / seconds << " MB/s, " << files / seconds << " files/s ("
+              << after.files - before.files << " files in " << seconds << " s";
+    if (after.failed > before.failed) {
+        std::cout << ", " << after.failed - before.failed << " failed";
+    }
+    std::cout << ")" << std::endl;
+    return finished && after.failed == before.failed;
+}
+
+// Uploads and downloads one large file and a directory of small ones over
+// loopback. Each file is checksummed chunk by chunk on the way; with
+// --verify the copies are also compared byte for byte at the end.
+int benchFiles(const BenchOptions& options) {
+    uint64_t largeSize = (uint64_t)optionInt(options, "size-mb", 1024) * 1024 * 1024;
+    int count = optionInt(options, "count", 10000);
+    uint64_t smallSize = (uint64_t)optionInt(options, "small-kb", 4) * 1024;
+    size_t parallel = (size_t)optionInt(options, "parallel", FILE_PARALLEL);
+    double timeout = optionInt(options, "timeout-s", 600);
+    bool verify = optionInt(options, "verify", 1) != 0;
+    int loopThreads = optionInt(options, "threads", LOOP_THREADS);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 100);
+
+    char temp[MAX_PATH];
+    GetTempPathA(MAX_PATH, temp);
+    std::string root = optionString(options, "dir", std::string(temp) + "rcbench-files");
+    std::string source = root + "\\source";
+    std::string uploaded = root + "\\uploaded";
+    std::string downloaded = root + "\\downloaded";
+    removeTree(root);
+    createParentDirectories(source + "\\small\\");
+
+    std::cout << "Preparing " << largeSize / (1024 * 1024) << " MB and " << count << " x "
+              << smallSize / 1024 << " KB files in " << root << std::endl;
+    bool ok = writeTestFile(source + "\\large.bin", largeSize, 1);
+    for (int i = 0; ok && i < count; ++i) {
+        ok = writeTestFile(source + "\\small\\" + std::to_string(i) + ".bin", smallSize, i + 2);
+    }
+    if (!ok) {
+        std::cerr << "Cannot write test files: " << GetLastError() << std::endl;
+        removeTree(root);
+        return 1;
+    }
+
+    RelayOptions relay;
+    relay.shell = childCommand();
+    Server server(port, loopThreads, relay);
+    if (!server.initialize()) {
+        removeTree(root);
+        return 1;
+    }
+    server.start();
+
+    FileClient client(parallel);
+    client.socket = connectLoopback(port);
+    if (!client.socket.isValid()) {
+        server.stop();
+        removeTree(root);
+        return 1;
+    }
+    client.socket.setNoDelay(true);
+
+    ControlPayload hello;
+    encodeControl(hello, ControlCode::Hello, FeatureFile);
+    ok = sendFrame(client.socket, Channel::Control, &hello, sizeof(hello));
+    client.receiver = std::thread(&FileClient::receive, &client);
+    client.transfers.start();
+
+    if (ok) {
+        client.transfers.put(source + "\\large.bin", uploaded + "\\large.bin", false);
+        ok = measure(client, "large put:    ", largeSize, 1, timeout) && ok;
+        client.transfers.get(uploaded + "\\large.bin", downloaded + "\\large.bin", false);
+        ok = measure(client, "large get:    ", largeSize, 1, timeout) && ok;
+
+        client.transfers.put(source + "\\small", uploaded + "\\small", false);
+        ok = measure(client, "small put:    ", smallSize * count, count, timeout) && ok;
+        for (int i = 0; i < count; ++i) {
+            std::string name = "\\small\\" + std::to_string(i) + ".bin";
+            client.transfers.get(uploaded + name, downloaded + name, false);
+        }
+        ok = measure(client, "small get:    ", smallSize * count, count, timeout) && ok;
+    }
+
+    client.running = false;
+    client.socket.shutdown();
+    client.receiver.join();
+    client.transfers.stop();
+    client.socket.close();
+
+    const ServerMetrics& metrics = server.metrics().server();
+    uint64_t checksumFailures = metrics.checksumFailures;
+    server.stop();
+
+    if (ok && verify) {
+        bool same = sameContents(source + "\\large.bin", downloaded + "\\large.bin");
+        for (int i = 0; same && i < count; ++i) {
+            std::string name = "\\small\\" + std::to_string(i) + ".bin";
+            same = sameContents(source + name, uploaded + name) && sameContents(source + name, downloaded + name);
+        }
+        std::cout << "verified:      " << (same ? "identical" : "MISMATCH") << std::endl;
+        ok = same;
+    }
+    removeTree(root);
+
+    std::cout << "checksum failures: " << checksumFailures << std::endl;
+    std::cout << "result:        " << (ok ? "PASS" : "FAIL") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/protocol/protocol.hpp"
+
+enum class FloodAnswer {
+    Admitted,
+    Refused,
+    Failed
+};
+
+// One connection of the flood: waits for the server's first word on
+// session 0, which is either its SessionOpened or a refusal.
+static FloodAnswer floodOnce(unsigned short port, DWORD timeoutMs, uint32_t& status) {
+    Socket socket;
+    if (!socket.create() || !socket.connect(HOST, port)) {
+        return FloodAnswer::Failed;
+    }
+    setsockopt(socket.getHandle(), SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeoutMs, sizeof(timeoutMs));
+
+    FrameReader reader;
+    while (true) {
+        int bytesRead = socket.recv(reader.writePointer(), reader.writableSize());
+        if (bytesRead <= 0) {
+            return FloodAnswer::Failed;
+        }
+        reader.commit(bytesRead);
+
+        Frame frame;
+        while (reader.next(frame)) {
+            ControlPayload control;
+            if (frame.session != 0 || frame.channel != Channel::Control || !decodeControl(frame, control) ||
+                (ControlCode)control.code != ControlCode::SessionOpened) {
+                continue;
+            }
+            status = control.value;
+            return status == (uint32_t)OpenStatus::Ok ? FloodAnswer::Admitted : FloodAnswer::Refused;
+        }
+        if (reader.isCorrupt()) {
+            return FloodAnswer::Failed;
+        }
+    }
+}
+
+// Echo round trips on an established session, collected while the flood
+// runs, in milliseconds.
+static bool probeEcho(unsigned short port, DWORD timeoutMs, std::atomic<bool>& flooding,
+                      std::vector<double>& samples) {
+    Socket socket = connectLoopback(port);
+    if (!socket.isValid()) {
+        return false;
+    }
+    socket.setNoDelay(true);
+    setsockopt(socket.getHandle(), SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeoutMs, sizeof(timeoutMs));
+
+    FrameReader reader;
+    std::string output;
+    auto waitFor = [&](const std::string& marker) {
+        while (output.find(marker) == std::string::npos) {
+            int bytesRead = socket.recv(reader.writePointer(), reader.writableSize());
+            if (bytesRead <= 0) {
+                return false;
+            }
+            reader.commit(bytesRead);
+            Frame frame;
+            while (reader.next(frame)) {
+                if (frame.channel != Channel::Stdout) {
+                    continue;
+                }
+                output.append(frame.payload, frame.length);
+                ControlPayload credit;
+                encodeControl(credit, ControlCode::WindowUpdate, frame.length);
+                sendFrame(socket, Channel::Control, &credit, sizeof(credit), 0, frame.session);
+            }
+        }
+        output.erase(0, output.find(marker) + marker.size());
+        return true;
+    };
+
+    if (!waitFor("> ")) {
+        return false;
+    }
+    for (int i = 0; flooding; ++i) {
+        std::string key = "probe" + std::to_string(i);
+        std::string line = key + "\r\n";
+        double sent = nowSeconds();
+        if (!sendFrame(socket, Channel::Stdin, line.data(), (uint32_t)line.size()) || !waitFor(key + "\r\n")) {
+            return false;
+        }
+        samples.push_back((nowSeconds() - sent) * 1000.0);
+        Sleep(10);
+    }
+    return true;
+}
+
+// Floods a server that has small limits with connections from many threads
+// for a while, and checks it stays responsive: every client is admitted or
+// refused with OpenStatus::Busy (none hang or are dropped), an established
+// session keeps echoing within --max-echo-ms at p99, and the server adds no
+// threads per connection.
+int benchFlood(const BenchOptions& options) {
+    int flooders = optionInt(options, "flooders", 16);
+    double seconds = optionInt(options, "seconds", 10);
+    double maxEchoMs = optionInt(options, "max-echo-ms", 250);
+    int maxThreadGrowth = optionInt(options, "max-thread-growth", 16);
+    int loopThreads = optionInt(options, "threads", LOOP_THREADS);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 100);
+    DWORD timeoutMs = (DWORD)optionInt(options, "timeout", 30) * 1000;
+
+    SchedulerOptions limits;
+    limits.workers = optionInt(options, "workers", 2);
+    limits.maxQueued = optionInt(options, "max-queued", 16);
+    limits.maxConnections = optionInt(options, "max-connections", 64);
+    limits.maxSessions = optionInt(options, "max-sessions", 64);
+
+    RelayOptions relay;
+    relay.shell = childCommand();
+    Server server(port, loopThreads, relay, limits);
+    if (!server.initialize()) {
+        return 1;
+    }
+    server.start();
+
+    std::atomic<bool> flooding(true);
+    std::vector<double> echoMs;
+    bool probeOk = false;
+    std::thread probe([&] { probeOk = probeEcho(port, timeoutMs, flooding, echoMs); });
+
+    // Measured once the probe's session is up, before the flood starts.
+    Sleep(1000);
+    size_t baseThreads = processThreadCount();
+    size_t peakThreads = baseThreads;
+
+    std::mutex mutex;
+    int admitted = 0;
+    int refused = 0;
+    int failed = 0;
+    std::map<uint32_t, int> statuses;
+    std::vector<double> answerMs;
+    double deadline = nowSeconds() + seconds;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < flooders; ++i) {
+        threads.emplace_back([&] {
+            while (nowSeconds() < deadline) {
+                uint32_t status = 0;
+                double started = nowSeconds();
+                FloodAnswer answer = floodOnce(port, timeoutMs, status);
+                double elapsed = (nowSeconds() - started) * 1000.0;
+
+                std::lock_guard<std::mutex> lock(mutex);
+                answerMs.push_back(elapsed);
+                if (answer == FloodAnswer::Admitted) {
+                    ++admitted;
+                } else if (answer == FloodAnswer::Refused) {
+                    ++refused;
+                    ++statuses[status];
+                } else {
+                    ++failed;
+                }
+            }
+        });
+    }
+    while (nowSeconds() < deadline) {
+        peakThreads = std::max(peakThreads, processThreadCount());
+        Sleep(200);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    flooding = false;
+    probe.join();
+
+    MetricsRegistry& metrics = server.metrics();
+    uint64_t connectionsRefused = metrics.server().connectionsRefused;
+    uint64_t sessionsRefused = metrics.server().sessionsRefused;
+    uint64_t steals = metrics.server().spawnSteals;
+    server.stop();
+
+    std::sort(answerMs.begin(), answerMs.end());
+    std::sort(echoMs.begin(), echoMs.end());
+    // The flood threads themselves are expected on top of the baseline.
+    long threadGrowth = (long)peakThreads - (long)baseThreads - flooders;
+    double echoP99 = percentile(echoMs, 0.99);
+
+    std::cout << "limits: " << limits.maxConnections << " connections, " << limits.maxSessions << " sessions, "
+              << limits.workers << " workers, " << limits.maxQueued << " queued starts" << std::endl;
+    std::cout << "flood: " << flooders << " threads for " << seconds << " s, " << answerMs.size()
+              << " connections" << std::endl;
+    std::cout << "  admitted:              " << admitted << std::endl;
+    std::cout << "  refused:               " << refused << " (server counted " << connectionsRefused
+              << " connections, " << sessionsRefused << " sessions)" << std::endl;
+    for (const auto& entry : statuses) {
+        std::cout << "    " << describeOpenStatus(entry.first) << ": " << entry.second << std::endl;
+    }
+    std::cout << "  no answer:             " << failed << std::endl;
+    std::cout << "  answer ms p50/p99/max: " << percentile(answerMs, 0.50) << " / " << percentile(answerMs, 0.99)
+              << " / " << (answerMs.empty() ? 0.0 : answerMs.back()) << std::endl;
+    std::cout << "  starts stolen:         " << steals << std::endl;
+    std::cout << "probe echo ms p50/p99:   " << percentile(echoMs, 0.50) << " / " << echoP99 << " ("
+              << echoMs.size() << " samples, limit " << maxEchoMs << ")" << std::endl;
+    std::cout << "threads: " << baseThreads << " before, " << peakThreads << " peak (growth " << threadGrowth
+              << " beyond the flooders, limit " << maxThreadGrowth << ")" << std::endl;
+
+    bool pass = probeOk && failed == 0 && statuses.size() == (size_t)statuses.count((uint32_t)OpenStatus::Busy) &&
+                echoP99 <= maxEchoMs && threadGrowth <= maxThreadGrowth;
+    std::cout << (pass ? "PASS" : "FAIL") << std::endl;
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+#include <algorithm>
+
+#include "bench.hpp"
+#include "../src/protocol/protocol.hpp"
+
+// Connects a loopback socket pair through a temporary listener.
+static bool socketPair(unsigned short port, Socket& left, Socket& right) {
+    Socket listener;
+    if (!listener.create() || !listener.bind(HOST, port) || !listener.listen(1)) {
+        return false;
+    }
+    left = connectLoopback(port);
+    right = listener.accept();
+    return left.isValid() && right.isValid();
+}
+
+static bool sendAll(Socket& socket, const char* data, size_t length) {
+    while (length > 0) {
+        int bytesSent = socket.send(data, length);
+        if (bytesSent <= 0) {
+            return false;
+        }
+        data += bytesSent;
+        length -= bytesSent;
+    }
+    return true;
+}
+
+// Returns MB/s for moving `total` bytes in `chunk`-sized writes, either raw
+// or as Stdout frames parsed by a FrameReader on the receiving side.
+static double measure(unsigned short port, size_t chunk, size_t total, bool framed) {
+    Socket sender, receiver;
+    if (!socketPair(port, sender, receiver)) {
+        std::cerr << "Failed to set up loopback pair on port " << port << std::endl;
+        return 0.0;
+    }
+
+    std::vector<char> payload(chunk, 'x');
+    size_t chunks = total / chunk;
+
+    double started = nowSeconds();
+    std::thread writer([&] {
+        for (size_t i = 0; i < chunks; ++i) {
+            bool ok = framed
+                ? sendFrame(sender, Channel::Stdout, payload.data(), (uint32_t)chunk)
+                : sendAll(sender, payload.data(), chunk);
+            if (!ok) {
+                break;
+            }
+        }
+        sender.shutdown(SD_SEND);
+    });
+
+    size_t received = 0;
+    if (framed) {
+        FrameReader reader(chunk);
+        Frame frame;
+        while (true) {
+            int bytesRead = receiver.recv(reader.writePointer(), reader.writableSize());
+            if (bytesRead <= 0) {
+                break;
+            }
+            reader.commit(bytesRead);
+            while (reader.next(frame)) {
+                received += frame.length;
+            }
+        }
+    } else {
+        std::vector<char> buffer(2 * chunk);
+        while (true) {
+            int bytesRead = receiver.recv(buffer.data(), buffer.size());
+            if (bytesRead <= 0) {
+                break;
+            }
+            received += bytesRead;
+        }
+    }
+
+    writer.join();
+    double elapsed = nowSeconds() - started;
+    return received / elapsed / 1e6;
+}
+
+int benchFraming(const BenchOptions& options) {
+    size_t total = (size_t)optionInt(options, "megabytes", 1024) << 20;
+    int rounds = optionInt(options, "rounds", 3);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 100);
+    double limit = 2.0;
+
+    bool passed = true;
+    const size_t chunkSizes[] = { 4096, 65536 };
+    for (size_t chunk : chunkSizes) {
+        double raw = 0.0;
+        double framed = 0.0;
+
+        // Best of several rounds, alternating so both see similar conditions.
+        for (int round = 0; round < rounds; ++round) {
+            raw = std::max(raw, measure(port, chunk, total, false));
+            framed = std::max(framed, measure(port, chunk, total, true));
+        }
+
+        double overhead = raw > 0.0 ? (raw - framed) / raw * 100.0 : 100.0;
+        std::cout << "chunk " << chunk / 1024 << " KB: raw " << raw << " MB/s, framed "
+                  << framed << " MB/s, overhead " << overhead << "%" << std::endl;
+        if (overhead > limit) {
+            passed = false;
+        }
+    }
+
+    std::cout << (passed ? "PASS" : "FAIL") << ": framing overhead limit " << limit << "%" << std::endl;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+#include <algorithm>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/protocol/protocol.hpp"
+#include "../src/supervisor/supervisor.hpp"
+
+// What the interactive client does around an Interrupt: output that
+// arrives between it and the server's answer is dropped.
+struct InterruptState {
+    uint32_t interrupting = 0;
+    size_t dropped = 0;
+    double answeredAt = 0.0;
+
+    bool onFrame(const Frame& frame) {
+        ControlPayload control;
+        if (frame.channel == Channel::Control && decodeControl(frame, control) &&
+            (ControlCode)control.code == ControlCode::Interrupt && interrupting > 0) {
+            --interrupting;
+            answeredAt = nowSeconds();
+        } else if (frame.channel == Channel::Stdout && frame.session == 0 && interrupting > 0) {
+            dropped += frame.length;
+            return false;
+        }
+        return true;
+    }
+};
+
+struct InterruptRound {
+    double answerMs = 0.0;
+    double stopMs = 0.0;
+    size_t dropped = 0;
+};
+
+// Starts a flood, lets `warmup` bytes of it arrive so every queue on the way
+// is full, interrupts it and waits for the child to say it stopped.
+static bool runRound(BenchClient& client, InterruptState& state, size_t warmup, InterruptRound& round) {
+    size_t before = client.bytes;
+    if (!client.sendLine("flood") || !client.readUntil([&] { return client.bytes - before >= warmup; })) {
+        return false;
+    }
+
+    ++state.interrupting;
+    state.dropped = 0;
+    client.output.clear();
+    double start = nowSeconds();
+    if (!client.sendControl(ControlCode::Interrupt, (uint32_t)InterruptKind::CtrlC) ||
+        !client.readUntil("flood_stopped")) {
+        return false;
+    }
+    round.stopMs = (nowSeconds() - start) * 1000.0;
+    round.answerMs = (state.answeredAt - start) * 1000.0;
+    round.dropped = state.dropped;
+    return client.readUntil("> ");
+}
+
+// A child flooding output, interrupted with Ctrl-C N times (--rounds N)
+// once --warmup-kb of the flood has arrived: time until the server's answer,
+// after which the client shows output again, and until the child's own
+// "stopped" line arrives; output dropped by the server and by the client.
+int benchInterrupt(const BenchOptions& options) {
+    int rounds = std::max(optionInt(options, "rounds", 20), 1);
+    size_t warmup = (size_t)optionInt(options, "warmup-kb", 1024) * 1024;
+    double timeout = optionInt(options, "timeout", 30);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 150);
+
+    char self[MAX_PATH];
+    GetModuleFileNameA(nullptr, self, sizeof(self));
+    RelayOptions relay;
+    relay.shell = childCommand();
+    relay.interruptHelper = "\"" + std::string(self) + "\" raise";
+    SchedulerOptions limits;
+    Server server(port, LOOP_THREADS, relay, limits);
+    if (!server.initialize()) {
+        std::cout << "Server failed to start" << std::endl;
+        return 1;
+    }
+    server.start();
+    Sleep(200);
+
+    BenchClient client;
+    InterruptState state;
+    client.onFrame = [&state](const Frame& frame) { return state.onFrame(frame); };
+    client.transport = loopbackTransport(port, timeout);
+    bool pass = client.transport && client.hello(FeatureInterrupt) &&
+                (client.serverFeatures & FeatureInterrupt) != 0 && client.readUntil("> ");
+    if (!pass) {
+        std::cout << "Session failed to start" << std::endl;
+    }
+
+    std::vector<double> answerMs;
+    std::vector<double> stopMs;
+    size_t clientDropped = 0;
+    uint64_t serverBefore = server.metrics().server().interruptDropped;
+    for (int i = 0; pass && i < rounds; ++i) {
+        InterruptRound round;
+        if (!runRound(client, state, warmup, round)) {
+            std::cout << "Round " << i + 1 << ": the flood did not stop" << std::endl;
+            pass = false;
+            break;
+        }
+        answerMs.push_back(round.answerMs);
+        stopMs.push_back(round.stopMs);
+        clientDropped += round.dropped;
+    }
+    uint64_t serverDropped = server.metrics().server().interruptDropped - serverBefore;
+
+    if (client.transport) {
+        client.sendLine("exit");
+        client.transport->close();
+    }
+    server.stop();
+
+    if (!stopMs.empty()) {
+        std::sort(answerMs.begin(), answerMs.end());
+        std::sort(stopMs.begin(), stopMs.end());
+        std::cout << stopMs.size() << " interrupts of a flooding child" << std::endl;
+        std::cout << "answer ms   p50 " << percentile(answerMs, 0.5) << "  p99 " << percentile(answerMs, 0.99)
+                  << std::endl;
+        std::cout << "stopped ms  p50 " << percentile(stopMs, 0.5) << "  p99 " << percentile(stopMs, 0.99)
+                  << std::endl;
+        std::cout << "dropped KB per interrupt: server " << serverDropped / 1024.0 / stopMs.size() << ", client "
+                  << clientDropped / 1024.0 / stopMs.size() << std::endl;
+    }
+
+    std::cout << (pass ? "PASS" : "FAIL") << std::endl;
+    return pass ? 0 : 1;
+}
+
+// Helper the interrupt scenario's server runs in place of the server
+// executable's -interrupt mode.
+int benchRaise(const BenchOptions& options) {
+    DWORD pid = (DWORD)optionInt(options, "pid", 0);
+    DWORD event = (DWORD)optionInt(options, "event", CTRL_C_EVENT);
+    if (pid == 0) {
+        return 1;
+    }
+    return ProcessSupervisor::raiseConsoleEvent(pid, event);
+}
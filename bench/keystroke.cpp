@@ -0,0 +1,203 @@
+#include <algorithm>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/protocol/protocol.hpp"
+
+struct KeyClient {
+    Socket socket;
+    FrameReader reader;
+    std::string output;
+    uint64_t received = 0;
+};
+
+static bool connectKeyClient(KeyClient& client, unsigned short port, double timeout) {
+    client.socket = connectLoopback(port);
+    if (!client.socket.isValid()) {
+        return false;
+    }
+    client.socket.setNoDelay(true);
+
+    DWORD timeoutMs = (DWORD)(timeout * 1000.0);
+    setsockopt(client.socket.getHandle(), SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeoutMs, sizeof(timeoutMs));
+    return true;
+}
+
+static bool sendKeys(KeyClient& client, const char* data, size_t length) {
+    return sendFrame(client.socket, Channel::Stdin, data, (uint32_t)length);
+}
+
+// Reads frames, returning output credit as it goes, until `done` holds.
+template <typename Done>
+static bool pumpUntil(KeyClient& client, Done done) {
+    while (!done()) {
+        int bytesRead = client.socket.recv(client.reader.writePointer(), client.reader.writableSize());
+        if (bytesRead <= 0) {
+            return false;
+        }
+        client.reader.commit(bytesRead);
+
+        Frame frame;
+        while (client.reader.next(frame)) {
+            if (frame.channel == Channel::Stdout) {
+                client.output.append(frame.payload, frame.length);
+                client.received += frame.length;
+
+                ControlPayload payload;
+                encodeControl(payload, ControlCode::WindowUpdate, frame.length);
+                sendFrame(client.socket, Channel::Control, &payload, sizeof(payload));
+            }
+        }
+        if (client.reader.isCorrupt()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool waitForText(KeyClient& client, const std::string& text) {
+    bool ok = pumpUntil(client, [&] { return client.output.find(text) != std::string::npos; });
+    client.output.clear();
+    return ok;
+}
+
+static bool waitForBytes(KeyClient& client, uint64_t target) {
+    bool ok = pumpUntil(client, [&] { return client.received >= target; });
+    client.output.clear();
+    return ok;
+}
+
+// Line mode, as the default client: keys are typed into the local console
+// line editor and only sent with Enter, so each key's echo waits for the
+// rest of its line.
+static bool runLineMode(KeyClient& client, int lines, int lineLength, int intervalMs,
+                        std::vector<double>& latencyMs) {
+    for (int i = 0; i < lines; ++i) {
+        std::string text(lineLength, (char)('a' + i % 26));
+        std::vector<double> typed;
+        for (int key = 0; key < lineLength; ++key) {
+            typed.push_back(nowSeconds());
+            Sleep(intervalMs);
+        }
+
+        std::string input = text + "\r\n";
+        if (!sendKeys(client, input.data(), input.size()) || !waitForText(client, text + "\r\n> ")) {
+            return false;
+        }
+        double echoed = nowSeconds();
+        for (double at : typed) {
+            latencyMs.push_back((echoed - at) * 1000.0);
+        }
+    }
+    return true;
+}
+
+// Raw mode, as `-c --raw`: every key goes out on its own as it is typed and
+// is echoed by the child.
+static bool runRawMode(KeyClient& client, int lines, int lineLength, int intervalMs,
+                       std::vector<double>& latencyMs) {
+    for (int i = 0; i < lines; ++i) {
+        for (int key = 0; key <= lineLength; ++key) {
+            const char* input = key < lineLength ? "x" : "\r\n";
+            size_t length = key < lineLength ? 1 : 2;
+
+            double typed = nowSeconds();
+            if (!sendKeys(client, input, length) || !waitForBytes(client, client.received + length)) {
+                return false;
+            }
+            if (key < lineLength) {
+                latencyMs.push_back((nowSeconds() - typed) * 1000.0);
+            }
+
+            double elapsedMs = (nowSeconds() - typed) * 1000.0;
+            if (elapsedMs < intervalMs) {
+                Sleep((DWORD)(intervalMs - elapsedMs));
+            }
+        }
+    }
+    return true;
+}
+
+// A paste in raw mode, sent `batch` bytes per frame; returns the time until
+// all of it has been echoed.
+static bool runPaste(KeyClient& client, size_t bytes, size_t batch, double& ms, size_t& frames) {
+    std::string paste(bytes, 'p');
+    uint64_t target = client.received + bytes;
+
+    double start = nowSeconds();
+    frames = 0;
+    for (size_t offset = 0; offset < bytes; offset += batch) {
+        if (!sendKeys(client, paste.data() + offset, std::min(batch, bytes - offset))) {
+            return false;
+        }
+        ++frames;
+    }
+    if (!waitForBytes(client, target)) {
+        return false;
+    }
+    ms = (nowSeconds() - start) * 1000.0;
+    return true;
+}
+
+// Keystroke-to-echo latency of simulated typing in line mode and in raw
+// mode, and the cost of a large paste sent one frame per key vs batched the
+// way the raw client coalesces console input.
+int benchKeystroke(const BenchOptions& options) {
+    int lines = optionInt(options, "lines", 20);
+    int lineLength = optionInt(options, "line", 20);
+    int intervalMs = optionInt(options, "interval-ms", 30);
+    // Kept within the session's stdin window, which the bench does not track.
+    size_t pasteBytes = std::min<size_t>((size_t)optionInt(options, "paste-kb", 16) * 1024, SESSION_WINDOW / 2);
+    size_t batch = (size_t)optionInt(options, "batch", BUFFER_SIZE / 2);
+    double timeout = optionInt(options, "timeout-s", 30);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 100);
+
+    RelayOptions relay;
+    relay.shell = childCommand();
+
+    Server server(port, LOOP_THREADS, relay);
+    if (!server.initialize()) {
+        return 1;
+    }
+    server.start();
+
+    KeyClient client;
+    bool ok = connectKeyClient(client, port, timeout) && waitForText(client, "> ");
+
+    std::vector<double> lineMs;
+    std::vector<double> rawMs;
+    double perKeyPasteMs = 0.0;
+    double batchedPasteMs = 0.0;
+    size_t perKeyFrames = 0;
+    size_t batchedFrames = 0;
+
+    ok = ok && runLineMode(client, lines, lineLength, intervalMs, lineMs);
+
+    // The child echoes byte by byte from here on.
+    std::string raw = "raw\r\n";
+    ok = ok && sendKeys(client, raw.data(), raw.size());
+    ok = ok && runRawMode(client, lines, lineLength, intervalMs, rawMs);
+    ok = ok && runPaste(client, pasteBytes, 1, perKeyPasteMs, perKeyFrames);
+    ok = ok && runPaste(client, pasteBytes, batch, batchedPasteMs, batchedFrames);
+
+    client.socket.close();
+    server.stop();
+
+    if (!ok) {
+        std::cerr << "keystroke run failed" << std::endl;
+        return 1;
+    }
+
+    std::sort(lineMs.begin(), lineMs.end());
+    std::sort(rawMs.begin(), rawMs.end());
+
+    std::cout << "typing interval ms:      " << intervalMs << std::endl;
+    std::cout << "line mode echo p50 ms:   " << percentile(lineMs, 0.50) << std::endl;
+    std::cout << "line mode echo p99 ms:   " << percentile(lineMs, 0.99) << std::endl;
+    std::cout << "raw mode echo p50 ms:    " << percentile(rawMs, 0.50) << std::endl;
+    std::cout << "raw mode echo p99 ms:    " << percentile(rawMs, 0.99) << std::endl;
+    std::cout << "paste KB:                " << pasteBytes / 1024 << std::endl;
+    std::cout << "paste per key ms:        " << perKeyPasteMs << " (" << perKeyFrames << " frames)" << std::endl;
+    std::cout << "paste batched ms:        " << batchedPasteMs << " (" << batchedFrames << " frames)" << std::endl;
+    return 0;
+}
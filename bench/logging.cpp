@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <thread>
+
+#include "bench.hpp"
+#include "../src/log/log.hpp"
+
+#if LOG_COMPILE_LEVEL > 0
+#error "bench/logging.cpp needs trace statements; build with -DLOG_COMPILE_LEVEL=0"
+#endif
+
+// Nanoseconds per LOG_TRACE call from `threads` threads at once.
+static double callCost(int threads, int calls) {
+    std::vector<std::thread> workers;
+    double start = nowSeconds();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([t, calls] {
+            for (int i = 0; i < calls; ++i) {
+                LOG_TRACE("bench", "Read " << i << " bytes from process output, worker " << t);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return (nowSeconds() - start) * 1e9 / ((double)threads * calls);
+}
+
+// Runs the sessions scenario (bulk output over many sessions) once with
+// logging off and once with every per-chunk trace line going to a file,
+// then measures the raw cost of a log call both ways.
+int benchLogging(const BenchOptions& options) {
+    std::string path = optionString(options, "log-file", "bench-log.txt");
+    int threads = optionInt(options, "call-threads", 4);
+    int calls = optionInt(options, "calls", 1000000);
+
+    BenchOptions sessions = options;
+    if (!sessions.count("sessions")) {
+        sessions["sessions"] = "32";
+    }
+    if (!sessions.count("lines")) {
+        sessions["lines"] = "20000";
+    }
+
+    std::cout << "== logging off ==" << std::endl;
+    Logger::configure(LogLevel::Off);
+    int result = benchSessions(sessions);
+
+    std::cout << "== logging trace -> " << path << " ==" << std::endl;
+    Logger::configure(LogLevel::Trace, path);
+    uint64_t dropped = Logger::droppedCount();
+    result |= benchSessions(sessions);
+    std::cout << "dropped log lines:       " << Logger::droppedCount() - dropped << std::endl;
+
+    Logger::configure(LogLevel::Off);
+    double disabled = callCost(threads, calls);
+    Logger::configure(LogLevel::Trace, path);
+    dropped = Logger::droppedCount();
+    double enabled = callCost(threads, calls);
+    uint64_t droppedCalls = Logger::droppedCount() - dropped;
+    Logger::configure(LogLevel::Warn);
+
+    std::cout << "log call ns (disabled):  " << disabled << std::endl;
+    std::cout << "log call ns (enabled):   " << enabled << " (" << threads << " threads, "
+              << droppedCalls << " of " << (uint64_t)threads * calls << " dropped)" << std::endl;
+    return result;
+}
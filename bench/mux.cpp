@@ -0,0 +1,214 @@
+#include <algorithm>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/protocol/protocol.hpp"
+
+struct MuxResult {
+    std::vector<double> openMs;
+    size_t rssBytes = 0;
+    double totalSeconds = 0.0;
+};
+
+static void sendWindowUpdate(Socket& socket, uint16_t session, uint32_t bytes) {
+    ControlPayload payload;
+    encodeControl(payload, ControlCode::WindowUpdate, bytes);
+    sendFrame(socket, Channel::Control, &payload, sizeof(payload), 0, session);
+}
+
+// Every session is opened over one connection: session 0 by connecting and
+// the rest with OpenSession controls sent back to back. A session counts as
+// open when its first Stdout frame (the prompt) arrives.
+static bool runMultiplexed(unsigned short port, int count, double timeout, MuxResult& result) {
+    size_t baseRss = processRssBytes();
+    std::vector<double> started(count, 0.0);
+    std::vector<double> opened(count, -1.0);
+
+    double start = nowSeconds();
+    started[0] = start;
+    Socket socket = connectLoopback(port);
+    if (!socket.isValid()) {
+        std::cerr << "Failed to connect" << std::endl;
+        return false;
+    }
+
+    for (int i = 1; i < count; ++i) {
+        ControlPayload payload;
+        encodeControl(payload, ControlCode::OpenSession);
+        started[i] = nowSeconds();
+        if (!sendFrame(socket, Channel::Control, &payload, sizeof(payload), 0, (uint16_t)i)) {
+            std::cerr << "Failed to open session " << i << std::endl;
+            return false;
+        }
+    }
+
+    DWORD timeoutMs = (DWORD)(timeout * 1000.0);
+    setsockopt(socket.getHandle(), SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeoutMs, sizeof(timeoutMs));
+
+    FrameReader reader;
+    int remaining = count;
+    while (remaining > 0) {
+        int bytesRead = socket.recv(reader.writePointer(), reader.writableSize());
+        if (bytesRead <= 0) {
+            std::cerr << "Connection lost with " << remaining << " sessions unopened" << std::endl;
+            return false;
+        }
+        reader.commit(bytesRead);
+
+        double now = nowSeconds();
+        Frame frame;
+        while (reader.next(frame)) {
+            if (frame.channel != Channel::Stdout || frame.session >= count) {
+                continue;
+            }
+            sendWindowUpdate(socket, frame.session, frame.length);
+            if (opened[frame.session] < 0.0) {
+                opened[frame.session] = now;
+                --remaining;
+            }
+        }
+        if (reader.isCorrupt()) {
+            return false;
+        }
+    }
+
+    result.totalSeconds = nowSeconds() - start;
+    result.rssBytes = processRssBytes() - baseRss;
+    for (int i = 0; i < count; ++i) {
+        result.openMs.push_back((opened[i] - started[i]) * 1000.0);
+    }
+
+    socket.close();
+    return true;
+}
+
+// One connection per session, opened with non-blocking connects so the
+// comparison is not serialized on the client side.
+static bool runSeparate(unsigned short port, int count, double timeout, MuxResult& result) {
+    size_t baseRss = processRssBytes();
+    std::vector<Socket> sockets(count);
+    std::vector<FrameReader> readers(count, FrameReader(BUFFER_SIZE));
+    std::vector<double> started(count, 0.0);
+    std::vector<double> opened(count, -1.0);
+
+    double start = nowSeconds();
+    for (int i = 0; i < count; ++i) {
+        if (!sockets[i].create()) {
+            std::cerr << "Failed to create client socket " << i << std::endl;
+            return false;
+        }
+        sockets[i].setBlocking(false);
+        started[i] = nowSeconds();
+        if (!sockets[i].connect(HOST, port) && WSAGetLastError() != WSAEWOULDBLOCK) {
+            std::cerr << "Connect failed for client " << i << ": " << WSAGetLastError() << std::endl;
+            return false;
+        }
+    }
+
+    std::vector<WSAPOLLFD> fds(count);
+    int remaining = count;
+    double deadline = start + timeout;
+
+    while (remaining > 0 && nowSeconds() < deadline) {
+        for (int i = 0; i < count; ++i) {
+            fds[i].fd = sockets[i].getHandle();
+            fds[i].events = opened[i] < 0.0 ? POLLRDNORM : 0;
+            fds[i].revents = 0;
+        }
+
+        if (WSAPoll(fds.data(), (ULONG)fds.size(), 100) == SOCKET_ERROR) {
+            std::cerr << "WSAPoll failed: " << WSAGetLastError() << std::endl;
+            return false;
+        }
+
+        double now = nowSeconds();
+        for (int i = 0; i < count; ++i) {
+            if (opened[i] >= 0.0 || !(fds[i].revents & (POLLRDNORM | POLLERR | POLLHUP))) {
+                continue;
+            }
+
+            int bytesRead = sockets[i].recv(readers[i].writePointer(), readers[i].writableSize());
+            if (bytesRead <= 0) {
+                std::cerr << "Client " << i << " lost its connection" << std::endl;
+                return false;
+            }
+            readers[i].commit(bytesRead);
+
+            Frame frame;
+            while (readers[i].next(frame)) {
+                if (frame.channel == Channel::Stdout && opened[i] < 0.0) {
+                    opened[i] = now;
+                    --remaining;
+                }
+            }
+        }
+    }
+    if (remaining > 0) {
+        std::cerr << remaining << " sessions did not open in time" << std::endl;
+        return false;
+    }
+
+    result.totalSeconds = nowSeconds() - start;
+    result.rssBytes = processRssBytes() - baseRss;
+    for (int i = 0; i < count; ++i) {
+        result.openMs.push_back((opened[i] - started[i]) * 1000.0);
+    }
+
+    for (auto& socket : sockets) {
+        socket.close();
+    }
+    return true;
+}
+
+static void printResult(const char* label, int count, MuxResult& result) {
+    std::sort(result.openMs.begin(), result.openMs.end());
+    std::cout << label << std::endl;
+    std::cout << "  all open s:            " << result.totalSeconds << std::endl;
+    std::cout << "  open latency p50 ms:   " << percentile(result.openMs, 0.50) << std::endl;
+    std::cout << "  open latency p99 ms:   " << percentile(result.openMs, 0.99) << std::endl;
+    std::cout << "  server RSS per session KB: " << result.rssBytes / 1024.0 / count << std::endl;
+}
+
+// Compares N sessions multiplexed over one connection with N connections of
+// one session each: time until every prompt arrives and server memory.
+int benchMux(const BenchOptions& options) {
+    int count = optionInt(options, "sessions", 64);
+    int loopThreads = optionInt(options, "threads", LOOP_THREADS);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 100);
+    double timeout = optionInt(options, "timeout", 120);
+
+    if (count < 1 || count > MAX_SESSIONS_PER_CONNECTION) {
+        std::cerr << "--sessions must be between 1 and " << MAX_SESSIONS_PER_CONNECTION << std::endl;
+        return 1;
+    }
+
+    MuxResult multiplexed;
+    MuxResult separate;
+    bool ok;
+    {
+        Server server(port, loopThreads);
+        if (!server.initialize()) {
+            return 1;
+        }
+        server.start();
+        ok = runMultiplexed(port, count, timeout, multiplexed);
+        server.stop();
+    }
+    if (ok) {
+        Server server(port + 1, loopThreads);
+        if (!server.initialize()) {
+            return 1;
+        }
+        server.start();
+        ok = runSeparate(port + 1, count, timeout, separate);
+        server.stop();
+    }
+    if (!ok) {
+        return 1;
+    }
+
+    std::cout << "sessions: " << count << std::endl;
+    printResult("multiplexed (1 connection):", count, multiplexed);
+    printResult("separate (1 connection each):", count, separate);
+    return 0;
+}
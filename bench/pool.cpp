@@ -0,0 +1,59 @@
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+
+static bool runBurst(unsigned short port, int loopThreads, int clients, size_t poolSize, double timeout,
+                     StormResult& result, uint64_t& spawnP50) {
+    Server server(port, loopThreads);
+    if (!server.initialize()) {
+        return false;
+    }
+
+    PoolOptions pool;
+    pool.size = poolSize;
+    server.startPool(pool);
+    server.start();
+
+    // Measure the burst against a full pool, not one still spawning.
+    double deadline = nowSeconds() + timeout;
+    while (server.pool() && server.pool()->readyCount() < poolSize && nowSeconds() < deadline) {
+        Sleep(50);
+    }
+
+    bool ok = measureFirstPrompts(port, clients, timeout, result);
+    spawnP50 = server.metrics().server().spawnTime.percentile(0.50);
+    server.stop();
+    return ok;
+}
+
+static void printBurst(const char* label, const StormResult& result, uint64_t spawnP50) {
+    std::cout << label << std::endl;
+    std::cout << "  first prompt p50 ms:   " << percentile(result.promptMs, 0.50) << std::endl;
+    std::cout << "  first prompt p99 ms:   " << percentile(result.promptMs, 0.99) << std::endl;
+    std::cout << "  first prompt max ms:   " << percentile(result.promptMs, 1.00) << std::endl;
+    std::cout << "  server spawn p50 us:   " << spawnP50 << std::endl;
+}
+
+// Time to first prompt for a burst of connections, spawning every shell on
+// demand vs taking them from a pre-filled warm pool.
+int benchPool(const BenchOptions& options) {
+    int clients = optionInt(options, "clients", 32);
+    int poolSize = optionInt(options, "pool", clients);
+    int loopThreads = optionInt(options, "threads", LOOP_THREADS);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 100);
+    double timeout = optionInt(options, "timeout", 120);
+
+    StormResult cold;
+    StormResult warm;
+    uint64_t coldSpawn = 0;
+    uint64_t warmSpawn = 0;
+    if (!runBurst(port, loopThreads, clients, 0, timeout, cold, coldSpawn) ||
+        !runBurst(port + 1, loopThreads, clients, poolSize, timeout, warm, warmSpawn)) {
+        std::cerr << "Burst did not complete" << std::endl;
+        return 1;
+    }
+
+    std::cout << "clients: " << clients << ", pool: " << poolSize << std::endl;
+    printBurst("spawn on demand:", cold, coldSpawn);
+    printBurst("warm pool:", warm, warmSpawn);
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <random>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/protocol/protocol.hpp"
+
+struct RelayRun {
+    double megabytes = 0.0;
+    double seconds = 0.0;
+    uint64_t fullRings = 0;
+};
+
+static bool runDepth(size_t depth, unsigned short port, const std::string& command, int receiveBuffer, int every,
+                     int pauseMs, double timeout, RelayRun& run) {
+    RelayOptions relay;
+    relay.shell = childCommand();
+    relay.relayDepth = depth;
+    SchedulerOptions limits;
+    Server server(port, LOOP_THREADS, relay, limits);
+    if (!server.initialize()) {
+        return false;
+    }
+    server.start();
+    Sleep(200);
+
+    BenchClient client;
+    // A small receive buffer so the jitter reaches the server's sends.
+    client.transport = loopbackTransport(port, timeout, receiveBuffer);
+    bool ok = client.transport && client.readUntil("> ");
+
+    if (ok) {
+        // The same pauses at every depth: after about one receive in
+        // `every` the client stops reading for up to `pauseMs`, as a reader
+        // on a busy machine or a congested link would.
+        std::mt19937 jitter(42);
+        client.afterReceive = [&] {
+            if (jitter() % every == 0) {
+                Sleep(1 + jitter() % pauseMs);
+            }
+        };
+        uint64_t fullBefore = server.metrics().server().relayFull;
+        size_t before = client.bytes;
+        double start = nowSeconds();
+        ok = client.send(Channel::Stdin, command.data(), (uint32_t)command.size()) && client.readUntil("bulk_done");
+        run.seconds = nowSeconds() - start;
+        run.megabytes = (client.bytes - before) / 1e6;
+        run.fullRings = server.metrics().server().relayFull - fullBefore;
+
+        client.afterReceive = nullptr;
+        client.sendLine("exit");
+    }
+    if (client.transport) {
+        client.transport->close();
+    }
+    server.stop();
+    return ok;
+}
+
+// A child writing in bursts with gaps in between, read by a client that
+// pauses now and then, at relay depths 1 (read and send in turn, as before
+// the relay was split into stages), 2, 4 and 8 (or --depth N alone). The
+// deeper the ring, the more of a burst the relay takes from the child while
+// a send waits on the client, and the less the child stalls.
+int benchRelay(const BenchOptions& options) {
+    int bursts = optionInt(options, "bursts", 64);
+    size_t burstBytes = (size_t)optionInt(options, "burst-kb", 256) * 1024;
+    int gapMs = optionInt(options, "gap-ms", 5);
+    int every = std::max(optionInt(options, "jitter-every", 8), 1);
+    int pauseMs = std::max(optionInt(options, "jitter-ms", 4), 1);
+    int receiveBuffer = optionInt(options, "rcvbuf", 65536);
+    int onlyDepth = optionInt(options, "depth", 0);
+    double timeout = optionInt(options, "timeout", 60);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 130);
+
+    std::vector<size_t> depths = { 1, 2, 4, 8 };
+    if (onlyDepth > 0) {
+        depths = { (size_t)onlyDepth };
+    }
+
+    std::string command = "burst " + std::to_string(bursts) + " " + std::to_string(burstBytes) + " " +
+                          std::to_string(gapMs) + "\r\n";
+    std::cout << bursts << " bursts of " << burstBytes / 1024 << " KB, " << gapMs << " ms apart; client pauses up to "
+              << pauseMs << " ms after 1 in " << every << " reads" << std::endl;
+    std::cout << "depth  MB/s     seconds  full rings" << std::endl;
+
+    bool pass = true;
+    double baseline = 0.0;
+    for (size_t i = 0; i < depths.size(); ++i) {
+        RelayRun run;
+        if (!runDepth(depths[i], (unsigned short)(port + i), command, receiveBuffer, every, pauseMs, timeout, run)) {
+            std::cout << depths[i] << ": failed" << std::endl;
+            pass = false;
+            continue;
+        }
+        double rate = run.seconds > 0.0 ? run.megabytes / run.seconds : 0.0;
+        if (depths[i] == 1) {
+            baseline = rate;
+        }
+        std::cout << depths[i] << "      " << rate << "  " << run.seconds << "  " << run.fullRings;
+        if (baseline > 0.0 && depths[i] > 1) {
+            std::cout << "  (" << rate / baseline << "x depth 1)";
+        }
+        std::cout << std::endl;
+    }
+
+    std::cout << (pass ? "PASS" : "FAIL") << std::endl;
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+#include <algorithm>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/protocol/protocol.hpp"
+#include "../src/screen/screen.hpp"
+
+// A terminal of the client's own: the time it spends drawing there is what
+// a console would spend.
+struct ScreenTerminal {
+    ScreenModel model;
+    double drawSeconds = 0.0;
+
+    ScreenTerminal() : model(SCREEN_COLUMNS, SCREEN_ROWS) {}
+
+    void draw(const char* data, size_t length) {
+        double start = nowSeconds();
+        model.write(data, length);
+        drawSeconds += nowSeconds() - start;
+    }
+
+    // The marker is on the screen as a line of its own.
+    bool shows(const std::string& marker) const {
+        for (int row = 0; row < model.rows(); ++row) {
+            if (model.rowText(row) == marker) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+struct ScreenRun {
+    double seconds = 0.0;
+    double drawSeconds = 0.0;
+    size_t wireBytes = 0;
+    size_t frames = 0;
+    std::vector<std::string> rows;
+};
+
+// Raw output ends at the marker in the stream; screen updates once the
+// marker is on the screen.
+static bool runMode(unsigned short port, bool screen, size_t bytes, double timeout, ScreenRun& run) {
+    BenchClient client;
+    ScreenTerminal terminal;
+    // Output is drawn and credited; Screen frames are only drawn.
+    client.onFrame = [&terminal](const Frame& frame) {
+        if ((frame.channel == Channel::Screen || frame.channel == Channel::Stdout) && frame.session == 0) {
+            terminal.draw(frame.payload, frame.length);
+        }
+        return true;
+    };
+    auto waitForMarker = [&](const std::string& marker) {
+        return screen ? client.readUntil([&] { return terminal.shows(marker); }) : client.readUntil(marker);
+    };
+
+    client.transport = loopbackTransport(port, timeout);
+    if (!client.transport || !client.sendControl(ControlCode::Hello, screen ? FeatureScreen : 0)) {
+        return false;
+    }
+    if (screen && !client.sendControl(ControlCode::WindowSize, (uint32_t)SCREEN_COLUMNS << 16 | SCREEN_ROWS)) {
+        return false;
+    }
+    if (!client.readUntil([&] { return client.helloSeen; }) ||
+        ((client.serverFeatures & FeatureScreen) != 0) != screen ||
+        !client.readUntil([&] { return terminal.shows(">"); })) {
+        return false;
+    }
+
+    size_t wireBefore = client.wireBytes;
+    size_t framesBefore = client.frames;
+    double drawBefore = terminal.drawSeconds;
+    double start = nowSeconds();
+    if (!client.sendLine("bulk " + std::to_string(bytes)) || !waitForMarker("bulk_done")) {
+        return false;
+    }
+    run.seconds = nowSeconds() - start;
+
+    // Let the prompt and the last update in, so the screens can be compared.
+    Sleep(200);
+    if (!client.drain()) {
+        return false;
+    }
+    run.wireBytes = client.wireBytes - wireBefore;
+    run.frames = client.frames - framesBefore;
+    run.drawSeconds = terminal.drawSeconds - drawBefore;
+    for (int row = 0; row < terminal.model.rows(); ++row) {
+        run.rows.push_back(terminal.model.rowText(row));
+    }
+
+    client.sendLine("exit");
+    return true;
+}
+
+// A child flooding 100 MB (--mb N) of output, shown by a client that gets
+// all of it and by one that gets screen updates: time until the last line
+// is on the client's screen, bytes and frames on the wire, and the time the
+// client spends drawing. Both clients must end up showing the same screen.
+int benchScreen(const BenchOptions& options) {
+    size_t bytes = (size_t)optionInt(options, "mb", 100) * 1000 * 1000;
+    int fps = optionInt(options, "fps", SCREEN_FPS);
+    double timeout = optionInt(options, "timeout", 120);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 140);
+
+    RelayOptions relay;
+    relay.shell = childCommand();
+    relay.screenFps = (uint32_t)std::max(fps, 1);
+    SchedulerOptions limits;
+    Server server(port, LOOP_THREADS, relay, limits);
+    if (!server.initialize()) {
+        std::cout << "Server failed to start" << std::endl;
+        return 1;
+    }
+    server.start();
+    Sleep(200);
+
+    std::cout << bytes / 1e6 << " MB of output, screen updates at " << relay.screenFps << " fps" << std::endl;
+    std::cout << "mode    seconds  wire MB  frames  draw ms" << std::endl;
+
+    bool pass = true;
+    ScreenRun runs[2];
+    for (int screen = 0; screen < 2; ++screen) {
+        ScreenRun& run = runs[screen];
+        if (!runMode(port, screen != 0, bytes, timeout, run)) {
+            std::cout << (screen ? "screen" : "raw") << ": failed" << std::endl;
+            pass = false;
+            continue;
+        }
+        std::cout << (screen ? "screen  " : "raw     ") << run.seconds << "  " << run.wireBytes / 1e6 << "  "
+                  << run.frames << "  " << run.drawSeconds * 1000.0 << std::endl;
+    }
+    server.stop();
+
+    if (pass) {
+        if (runs[1].seconds > 0.0 && runs[1].wireBytes > 0) {
+            std::cout << "screen updates: " << runs[0].seconds / runs[1].seconds << "x faster, "
+                      << (double)runs[0].wireBytes / runs[1].wireBytes << "x fewer bytes" << std::endl;
+        }
+        if (runs[0].rows != runs[1].rows) {
+            std::cout << "Final screens differ" << std::endl;
+            pass = false;
+        }
+    }
+
+    std::cout << (pass ? "PASS" : "FAIL") << std::endl;
+    return pass ? 0 : 1;
+}
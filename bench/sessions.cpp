@@ -0,0 +1,180 @@
+#include <algorithm>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/protocol/protocol.hpp"
+
+// Marker split by a caret so the echoed command line never matches it.
+static const char* s_doneMarker = "done_marker";
+
+struct BenchSession {
+    Socket socket;
+    FrameReader reader{BUFFER_SIZE};
+    bool prompted = false;
+    bool done = false;
+    size_t bytes = 0;
+    double started = 0.0;
+    double finished = 0.0;
+    std::string tail;
+};
+
+static bool drainSession(BenchSession& session, bool lookForMarker) {
+    int bytesRead = session.socket.recv(session.reader.writePointer(), session.reader.writableSize());
+    if (bytesRead <= 0) {
+        return WSAGetLastError() == WSAEWOULDBLOCK;
+    }
+    session.reader.commit(bytesRead);
+
+    Frame frame;
+    uint32_t consumed = 0;
+    while (session.reader.next(frame)) {
+        if (frame.channel != Channel::Stdout) {
+            continue;
+        }
+
+        consumed += frame.length;
+
+        session.prompted = true;
+        if (!lookForMarker) {
+            continue;
+        }
+
+        session.bytes += frame.length;
+        session.tail.append(frame.payload, frame.length);
+        if (session.tail.find(s_doneMarker) != std::string::npos) {
+            session.done = true;
+            session.finished = nowSeconds();
+        }
+        if (session.tail.size() > 64) {
+            session.tail.erase(0, session.tail.size() - 64);
+        }
+    }
+
+    // Return the output window so bulk transfers are not throttled.
+    if (consumed > 0) {
+        ControlPayload payload;
+        encodeControl(payload, ControlCode::WindowUpdate, consumed);
+        sendFrame(session.socket, Channel::Control, &payload, sizeof(payload));
+    }
+    return !session.reader.isCorrupt();
+}
+
+// Polls every session socket from a single thread until the predicate holds
+// for all of them or the timeout expires.
+template <typename Predicate>
+static bool pollSessions(std::vector<BenchSession>& sessions, bool lookForMarker,
+                         double timeout, Predicate isComplete) {
+    std::vector<WSAPOLLFD> fds(sessions.size());
+    double deadline = nowSeconds() + timeout;
+
+    while (nowSeconds() < deadline) {
+        size_t remaining = 0;
+        for (size_t i = 0; i < sessions.size(); ++i) {
+            fds[i].fd = sessions[i].socket.getHandle();
+            fds[i].events = isComplete(sessions[i]) ? 0 : POLLRDNORM;
+            fds[i].revents = 0;
+            if (!isComplete(sessions[i])) {
+                ++remaining;
+            }
+        }
+        if (remaining == 0) {
+            return true;
+        }
+
+        if (WSAPoll(fds.data(), (ULONG)fds.size(), 100) == SOCKET_ERROR) {
+            std::cerr << "WSAPoll failed: " << WSAGetLastError() << std::endl;
+            return false;
+        }
+
+        for (size_t i = 0; i < sessions.size(); ++i) {
+            if (fds[i].revents & (POLLRDNORM | POLLERR | POLLHUP)) {
+                if (!drainSession(sessions[i], lookForMarker)) {
+                    std::cerr << "Session " << i << " lost its connection" << std::endl;
+                    return false;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+int benchSessions(const BenchOptions& options) {
+    int count = optionInt(options, "sessions", 1000);
+    int lines = optionInt(options, "lines", 2000);
+    int loopThreads = optionInt(options, "threads", LOOP_THREADS);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 100);
+
+    size_t baseThreads = processThreadCount();
+    size_t baseRss = processRssBytes();
+
+    Server server(port, loopThreads);
+    if (!server.initialize()) {
+        return 1;
+    }
+    server.start();
+
+    std::vector<BenchSession> sessions(count);
+    double connectStart = nowSeconds();
+    for (int i = 0; i < count; ++i) {
+        sessions[i].socket = connectLoopback(port);
+        if (!sessions[i].socket.isValid()) {
+            std::cerr << "Failed to open session " << i << std::endl;
+            server.stop();
+            return 1;
+        }
+        sessions[i].socket.setBlocking(false);
+    }
+
+    bool ready = pollSessions(sessions, false, 300.0,
+                              [](const BenchSession& session) { return session.prompted; });
+    double connectTime = nowSeconds() - connectStart;
+    if (!ready) {
+        std::cerr << "Not every session produced a prompt" << std::endl;
+        server.stop();
+        return 1;
+    }
+
+    size_t sessionThreads = processThreadCount();
+    size_t sessionRss = processRssBytes();
+
+    std::string command = "for /L %i in (1,1," + std::to_string(lines) +
+        ") do @echo 0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef\r\n"
+        "echo done^_marker\r\n";
+
+    double transferStart = nowSeconds();
+    for (auto& session : sessions) {
+        session.started = nowSeconds();
+        sendFrame(session.socket, Channel::Stdin, command.c_str(), (uint32_t)command.size());
+    }
+
+    bool finished = pollSessions(sessions, true, 600.0,
+                                 [](const BenchSession& session) { return session.done; });
+    double transferTime = nowSeconds() - transferStart;
+
+    std::vector<double> rates;
+    size_t totalBytes = 0;
+    for (const auto& session : sessions) {
+        if (session.done && session.finished > session.started) {
+            rates.push_back(session.bytes / (session.finished - session.started) / 1e6);
+        }
+        totalBytes += session.bytes;
+    }
+    std::sort(rates.begin(), rates.end());
+
+    std::cout << "sessions:                " << count << std::endl;
+    std::cout << "connect+prompt time s:   " << connectTime << std::endl;
+    std::cout << "threads (delta):         " << (sessionThreads - baseThreads) << std::endl;
+    std::cout << "rss per session KB:      " << (sessionRss - baseRss) / 1024.0 / count << std::endl;
+    std::cout << "aggregate MB/s:          " << totalBytes / transferTime / 1e6 << std::endl;
+    if (!rates.empty()) {
+        std::cout << "per-session MB/s min:    " << rates.front() << std::endl;
+        std::cout << "per-session MB/s median: " << rates[rates.size() / 2] << std::endl;
+    }
+    std::cout << "completed sessions:      " << rates.size() << "/" << count << std::endl;
+
+    for (auto& session : sessions) {
+        session.socket.close();
+    }
+    server.stop();
+    return finished ? 0 : 1;
+}
@@ -0,0 +1,153 @@
+#include <algorithm>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/protocol/protocol.hpp"
+
+struct SlowReader {
+    Socket socket;
+    FrameReader reader;
+    uint64_t received = 0;
+    uint64_t credited = 0;
+    uint64_t maxOutstanding = 0;
+    bool exited = false;
+};
+
+static void sendCredit(SlowReader& client, uint32_t bytes) {
+    ControlPayload payload;
+    encodeControl(payload, ControlCode::WindowUpdate, bytes);
+    sendFrame(client.socket, Channel::Control, &payload, sizeof(payload));
+    client.credited += bytes;
+}
+
+// One receive (or a receive timeout). With `credit`, everything read is
+// credited back at once; otherwise it stays outstanding.
+static bool receiveOnce(SlowReader& client, bool credit) {
+    int bytesRead = client.socket.recv(client.reader.writePointer(), client.reader.writableSize());
+    if (bytesRead == 0 || (bytesRead < 0 && WSAGetLastError() != WSAETIMEDOUT)) {
+        return false;
+    }
+    if (bytesRead < 0) {
+        return true;
+    }
+    client.reader.commit(bytesRead);
+
+    uint32_t stdoutBytes = 0;
+    Frame frame;
+    while (client.reader.next(frame)) {
+        if (frame.channel == Channel::Stdout || frame.channel == Channel::Stderr) {
+            stdoutBytes += frame.length;
+        } else if (frame.channel == Channel::ExitStatus) {
+            client.exited = true;
+        }
+    }
+    client.received += stdoutBytes;
+    if (credit && stdoutBytes > 0) {
+        sendCredit(client, stdoutBytes);
+    }
+    client.maxOutstanding = std::max(client.maxOutstanding, client.received - client.credited);
+    return !client.reader.isCorrupt();
+}
+
+// A client that stops reading and then reads at a trickle while the child
+// writes as fast as it can. Passes if the output the server sent without
+// credit never exceeded the high watermark and the server's memory stayed
+// within --max-rss-mb of where it started.
+int benchSlowReader(const BenchOptions& options) {
+    double stallSeconds = optionInt(options, "stall-s", 2);
+    double trickleSeconds = optionInt(options, "trickle-s", 5);
+    size_t rate = (size_t)optionInt(options, "rate-kb", 64) * 1024;
+    size_t maxRssGrowth = (size_t)optionInt(options, "max-rss-mb", 16) * 1024 * 1024;
+    int loopThreads = optionInt(options, "threads", LOOP_THREADS);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 100);
+
+    RelayOptions relay;
+    relay.shell = childCommand();
+    relay.outputHighWater = optionInt(options, "window-high", OUTPUT_HIGH_WATER);
+    relay.outputLowWater = optionInt(options, "window-low", OUTPUT_LOW_WATER);
+
+    Server server(port, loopThreads, relay);
+    if (!server.initialize()) {
+        return 1;
+    }
+    server.start();
+
+    SlowReader client;
+    client.socket = connectLoopback(port);
+    if (!client.socket.isValid()) {
+        server.stop();
+        return 1;
+    }
+    DWORD timeoutMs = 20;
+    setsockopt(client.socket.getHandle(), SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeoutMs, sizeof(timeoutMs));
+
+    bool ok = true;
+    while (ok && client.received == 0) {
+        ok = receiveOnce(client, true);
+    }
+
+    size_t baseRss = processRssBytes();
+    size_t peakRss = baseRss;
+
+    // Far more than the slow phases can take, so the child never runs dry.
+    std::string command = "bulk 100000000000\r\n";
+    ok = ok && sendFrame(client.socket, Channel::Stdin, command.c_str(), (uint32_t)command.size());
+
+    // Not reading at all: sends back up into the socket buffers.
+    double stallEnd = nowSeconds() + stallSeconds;
+    while (ok && nowSeconds() < stallEnd) {
+        Sleep(50);
+        peakRss = std::max(peakRss, processRssBytes());
+    }
+
+    // Reading everything but returning credit at `rate` bytes per second.
+    double trickleStart = nowSeconds();
+    double trickleEnd = trickleStart + trickleSeconds;
+    double lastCredit = trickleStart;
+    uint64_t trickleReceived = client.received;
+    while (ok && nowSeconds() < trickleEnd) {
+        ok = receiveOnce(client, false);
+
+        double now = nowSeconds();
+        uint64_t outstanding = client.received - client.credited;
+        uint32_t grant = (uint32_t)std::min<double>((double)outstanding, (now - lastCredit) * rate);
+        if (grant > 0) {
+            sendCredit(client, grant);
+            lastCredit = now;
+        }
+        peakRss = std::max(peakRss, processRssBytes());
+    }
+    double trickleRate = (client.received - trickleReceived) / (nowSeconds() - trickleStart) / 1e6;
+
+    // Kill the child and drain what is left, crediting everything.
+    ControlPayload close;
+    encodeControl(close, ControlCode::CloseSession);
+    ok = ok && sendFrame(client.socket, Channel::Control, &close, sizeof(close));
+    if (ok && client.received > client.credited) {
+        sendCredit(client, (uint32_t)(client.received - client.credited));
+    }
+    double drainEnd = nowSeconds() + 30.0;
+    while (ok && !client.exited && nowSeconds() < drainEnd) {
+        ok = receiveOnce(client, true);
+    }
+
+    const ServerMetrics& metrics = server.metrics().server();
+    uint64_t throttles = metrics.outputThrottles;
+    client.socket.close();
+    server.stop();
+    uint64_t throttledMicros = metrics.closedThrottledMicros;
+
+    bool withinWindow = client.maxOutstanding <= relay.outputHighWater;
+    bool withinMemory = peakRss - baseRss <= maxRssGrowth;
+
+    std::cout << "high/low watermark KB:   " << relay.outputHighWater / 1024 << "/"
+              << relay.outputLowWater / 1024 << std::endl;
+    std::cout << "max uncredited KB:       " << client.maxOutstanding / 1024.0 << std::endl;
+    std::cout << "peak RSS growth KB:      " << (peakRss - baseRss) / 1024.0 << std::endl;
+    std::cout << "trickle MB/s:            " << trickleRate << std::endl;
+    std::cout << "output throttles:        " << throttles << std::endl;
+    std::cout << "throttled ms:            " << throttledMicros / 1000.0 << std::endl;
+    std::cout << "result:                  "
+              << (ok && client.exited && withinWindow && withinMemory ? "PASS" : "FAIL") << std::endl;
+    return ok && client.exited && withinWindow && withinMemory ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+#include <algorithm>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+
+bool measureFirstPrompts(unsigned short port, int count, double timeout, StormResult& result) {
+    std::vector<Socket> sockets(count);
+    std::vector<double> started(count, 0.0);
+    std::vector<double> latencies(count, -1.0);
+
+    double stormStart = nowSeconds();
+    for (int i = 0; i < count; ++i) {
+        if (!sockets[i].create()) {
+            std::cerr << "Failed to create client socket " << i << std::endl;
+            return false;
+        }
+        sockets[i].setBlocking(false);
+        started[i] = nowSeconds();
+        if (!sockets[i].connect(HOST, port) && WSAGetLastError() != WSAEWOULDBLOCK) {
+            std::cerr << "Connect failed for client " << i << ": " << WSAGetLastError() << std::endl;
+            return false;
+        }
+    }
+
+    std::vector<WSAPOLLFD> fds(count);
+    int remaining = count;
+    int failed = 0;
+    double deadline = stormStart + timeout;
+
+    while (remaining > 0 && nowSeconds() < deadline) {
+        for (int i = 0; i < count; ++i) {
+            fds[i].fd = sockets[i].getHandle();
+            fds[i].events = latencies[i] < 0.0 ? POLLRDNORM : 0;
+            fds[i].revents = 0;
+        }
+
+        if (WSAPoll(fds.data(), (ULONG)fds.size(), 100) == SOCKET_ERROR) {
+            std::cerr << "WSAPoll failed: " << WSAGetLastError() << std::endl;
+            break;
+        }
+
+        double now = nowSeconds();
+        for (int i = 0; i < count; ++i) {
+            if (latencies[i] >= 0.0 || !(fds[i].revents & (POLLRDNORM | POLLERR | POLLHUP))) {
+                continue;
+            }
+
+            char buffer[BUFFER_SIZE];
+            int bytesRead = sockets[i].recv(buffer, sizeof(buffer));
+            if (bytesRead > 0) {
+                latencies[i] = now - started[i];
+            } else {
+                latencies[i] = 0.0;
+                ++failed;
+            }
+            --remaining;
+        }
+    }
+    result.seconds = nowSeconds() - stormStart;
+    result.failed = failed;
+    result.timedOut = remaining;
+
+    result.promptMs.clear();
+    for (int i = 0; i < count; ++i) {
+        if (latencies[i] > 0.0) {
+            result.promptMs.push_back(latencies[i] * 1000.0);
+        }
+    }
+    std::sort(result.promptMs.begin(), result.promptMs.end());
+
+    for (auto& socket : sockets) {
+        socket.close();
+    }
+    return remaining == 0 && failed == 0;
+}
+
+// Opens every client at once with non-blocking connects and measures how long
+// each waits for its first byte of output (the shell prompt).
+int benchStorm(const BenchOptions& options) {
+    int count = optionInt(options, "clients", 500);
+    int loopThreads = optionInt(options, "threads", LOOP_THREADS);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 100);
+
+    Server server(port, loopThreads);
+    if (!server.initialize()) {
+        return 1;
+    }
+    server.start();
+
+    StormResult result;
+    bool ok = measureFirstPrompts(port, count, optionInt(options, "timeout", 120), result);
+    server.stop();
+
+    const std::vector<double>& prompts = result.promptMs;
+    std::cout << "clients:                 " << count << std::endl;
+    std::cout << "prompted:                " << prompts.size() << std::endl;
+    std::cout << "failed:                  " << result.failed << std::endl;
+    std::cout << "timed out:               " << result.timedOut << std::endl;
+    std::cout << "storm duration s:        " << result.seconds << std::endl;
+    std::cout << "first prompt p50 ms:     " << percentile(prompts, 0.50) << std::endl;
+    std::cout << "first prompt p90 ms:     " << percentile(prompts, 0.90) << std::endl;
+    std::cout << "first prompt p99 ms:     " << percentile(prompts, 0.99) << std::endl;
+    std::cout << "first prompt max ms:     " << percentile(prompts, 1.00) << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/protocol/protocol.hpp"
+
+struct SuiteClient {
+    Socket socket;
+    FrameReader reader;
+    // Recent Stdout per session, searched for markers.
+    std::map<uint16_t, std::string> output;
+    std::set<uint16_t> exited;
+    size_t bytes = 0;
+};
+
+static bool connectClient(SuiteClient& client, unsigned short port, double timeout) {
+    client.socket = connectLoopback(port);
+    if (!client.socket.isValid()) {
+        return false;
+    }
+    client.socket.setNoDelay(true);
+
+    DWORD timeoutMs = (DWORD)(timeout * 1000.0);
+    setsockopt(client.socket.getHandle(), SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeoutMs, sizeof(timeoutMs));
+    return true;
+}
+
+static bool sendLine(SuiteClient& client, uint16_t session, const std::string& line) {
+    std::string input = line + "\r\n";
+    return sendFrame(client.socket, Channel::Stdin, input.c_str(), (uint32_t)input.size(), 0, session);
+}
+
+static bool sendControl(SuiteClient& client, uint16_t session, ControlCode code, uint32_t value = 0) {
+    ControlPayload payload;
+    encodeControl(payload, code, value);
+    return sendFrame(client.socket, Channel::Control, &payload, sizeof(payload), 0, session);
+}
+
+// Consumes `marker` and everything before it from the session's output.
+static bool takeMarker(SuiteClient& client, uint16_t session, const std::string& marker) {
+    std::string& output = client.output[session];
+    size_t found = output.find(marker);
+    if (found == std::string::npos) {
+        // Only the tail can still hold the start of a marker.
+        if (output.size() > 65536) {
+            output.erase(0, output.size() - 256);
+        }
+        return false;
+    }
+    output.erase(0, found + marker.size());
+    return true;
+}
+
+// Reads frames, returning output credit as it goes, until `done` holds.
+template <typename Done>
+static bool pumpUntil(SuiteClient& client, Done done) {
+    while (!done()) {
+        int bytesRead = client.socket.recv(client.reader.writePointer(), client.reader.writableSize());
+        if (bytesRead <= 0) {
+            return false;
+        }
+        client.reader.commit(bytesRead);
+
+        Frame frame;
+        while (client.reader.next(frame)) {
+            if (frame.channel == Channel::Stdout) {
+                client.output[frame.session].append(frame.payload, frame.length);
+                client.bytes += frame.length;
+                sendControl(client, frame.session, ControlCode::WindowUpdate, frame.length);
+            } else if (frame.channel == Channel::ExitStatus) {
+                client.exited.insert(frame.session);
+            }
+        }
+        if (client.reader.isCorrupt()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool waitForMarker(SuiteClient& client, uint16_t session, const std::string& marker) {
+    return pumpUntil(client, [&] { return takeMarker(client, session, marker); });
+}
+
+// Flat JSON object with one metric per line, in a fixed order, so results
+// from two builds can be compared with a plain diff.
+class SuiteReport {
+private:
+    std::vector<std::pair<std::string, std::string>> m_values;
+
+public:
+    void add(const std::string& name, double value) {
+        char text[64];
+        snprintf(text, sizeof(text), "%.3f", value);
+        m_values.emplace_back(name, text);
+    }
+
+    void add(const std::string& name, const std::string& value) {
+        m_values.emplace_back(name, "\"" + value + "\"");
+    }
+
+    std::string render() const {
+        std::ostringstream out;
+        out << "{" << std::endl;
+        for (size_t i = 0; i < m_values.size(); ++i) {
+            out << "  \"" << m_values[i].first << "\": " << m_values[i].second
+                << (i + 1 < m_values.size() ? "," : "") << std::endl;
+        }
+        out << "}" << std::endl;
+        return out.str();
+    }
+};
+
+std::string childCommand() {
+    char self[MAX_PATH];
+    GetModuleFileNameA(nullptr, self, sizeof(self));
+    return "\"" + std::string(self) + "\" child";
+}
+
+bool measureBulk(unsigned short port, size_t bytes, double timeout, BulkResult& result) {
+    SuiteClient client;
+    if (!connectClient(client, port, timeout) || !waitForMarker(client, 0, "> ")) {
+        return false;
+    }
+
+    size_t before = client.bytes;
+    double cpuStart = processCpuSeconds();
+    double start = nowSeconds();
+    if (!sendLine(client, 0, "bulk " + std::to_string(bytes)) ||
+        !waitForMarker(client, 0, "bulk_done")) {
+        return false;
+    }
+    result.seconds = nowSeconds() - start;
+    result.cpuSeconds = processCpuSeconds() - cpuStart;
+    result.megabytes = (client.bytes - before) / 1e6;
+
+    sendLine(client, 0, "exit");
+    pumpUntil(client, [&] { return client.exited.count(0) != 0; });
+    return true;
+}
+
+// Bulk output at line rate on one session: MB/s and CPU spent in this
+// process (server and reading client) per MB relayed.
+static bool runBulk(unsigned short port, double timeout, size_t bytes, SuiteReport& report) {
+    BulkResult result;
+    if (!measureBulk(port, bytes, timeout, result)) {
+        return false;
+    }
+
+    report.add("bulk_mb", result.megabytes);
+    report.add("bulk_mb_per_s", result.megabytes / result.seconds);
+    report.add("bulk_cpu_ms_per_mb", result.cpuSeconds * 1000.0 / result.megabytes);
+    return true;
+}
+
+// Keystroke round trip: a short line goes to the child and the time until
+// its echo comes back is recorded.
+static bool runEcho(unsigned short port, double timeout, int count, SuiteReport& report) {
+    SuiteClient client;
+    if (!connectClient(client, port, timeout) || !waitForMarker(client, 0, "> ")) {
+        return false;
+    }
+
+    std::vector<double> samples;
+    for (int i = 0; i < count; ++i) {
+        std::string key = "k" + std::to_string(i);
+        double sent = nowSeconds();
+        if (!sendLine(client, 0, key) || !waitForMarker(client, 0, key + "\r\n")) {
+            return false;
+        }
+        samples.push_back((nowSeconds() - sent) * 1e6);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    report.add("echo_samples", count);
+    report.add("echo_p50_us", percentile(samples, 0.50));
+    report.add("echo_p99_us", percentile(samples, 0.99));
+    report.add("echo_p999_us", percentile(samples, 0.999));
+
+    sendLine(client, 0, "exit");
+    pumpUntil(client, [&] { return client.exited.count(0) != 0; });
+    return true;
+}
+
+// Sessions opened one after another over a single connection, each until
+// its first prompt, then exited before the next one starts.
+static bool runSpawn(unsigned short port, double timeout, int count, SuiteReport& report) {
+    SuiteClient client;
+    if (!connectClient(client, port, timeout) || !waitForMarker(client, 0, "> ")) {
+        return false;
+    }
+
+    std::vector<double> samples;
+    double start = nowSeconds();
+    for (int i = 1; i <= count; ++i) {
+        uint16_t session = (uint16_t)i;
+        double opened = nowSeconds();
+        if (!sendControl(client, session, ControlCode::OpenSession) ||
+            !waitForMarker(client, session, "> ")) {
+            std::cerr << "Session " << i << " did not start" << std::endl;
+            return false;
+        }
+        samples.push_back((nowSeconds() - opened) * 1000.0);
+
+        if (!sendLine(client, session, "exit") ||
+            !pumpUntil(client, [&] { return client.exited.count(session) != 0; })) {
+            return false;
+        }
+        client.output.erase(session);
+    }
+    double seconds = nowSeconds() - start;
+    std::sort(samples.begin(), samples.end());
+
+    report.add("spawn_count", count);
+    report.add("spawn_per_s", count / seconds);
+    report.add("spawn_p50_ms", percentile(samples, 0.50));
+    report.add("spawn_p99_ms", percentile(samples, 0.99));
+    report.add("spawn_p999_ms", percentile(samples, 0.999));
+
+    sendLine(client, 0, "exit");
+    pumpUntil(client, [&] { return client.exited.count(0) != 0; });
+    return true;
+}
+
+// Many connected sessions doing nothing: what each one costs the server
+// process while it sits at the prompt.
+static bool runIdle(unsigned short port, double timeout, int count, SuiteReport& report) {
+    size_t baseThreads = processThreadCount();
+    size_t baseRss = processRssBytes();
+
+    std::vector<SuiteClient> clients(count);
+    for (auto& client : clients) {
+        if (!connectClient(client, port, timeout)) {
+            return false;
+        }
+    }
+    for (auto& client : clients) {
+        if (!waitForMarker(client, 0, "> ")) {
+            return false;
+        }
+    }
+
+    report.add("idle_sessions", count);
+    report.add("idle_rss_kb_per_session", (double)(processRssBytes() - baseRss) / 1024.0 / count);
+    report.add("idle_threads_delta", (double)processThreadCount() - (double)baseThreads);
+
+    for (auto& client : clients) {
+        client.socket.close();
+    }
+    return true;
+}
+
+// The release comparison suite: bulk throughput, keystroke latency, spawn
+// rate and idle session cost against this same executable running as the
+// child (see benchChild), printed as JSON.
+int benchSuite(const BenchOptions& options) {
+    size_t bulkBytes = (size_t)optionInt(options, "bulk-mb", 64) * 1000 * 1000;
+    int echoes = optionInt(options, "echoes", 2000);
+    int spawns = std::min(optionInt(options, "spawns", 200), 65535);
+    int idle = optionInt(options, "idle", 200);
+    int loopThreads = optionInt(options, "threads", LOOP_THREADS);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 100);
+    double timeout = optionInt(options, "timeout", 120);
+    std::string outPath = optionString(options, "out", "");
+
+    RelayOptions relay;
+    relay.shell = optionString(options, "child", childCommand());
+
+    Server server(port, loopThreads, relay);
+    if (!server.initialize()) {
+        return 1;
+    }
+    server.start();
+
+    SuiteReport report;
+    report.add("scenario", "suite");
+    report.add("child", relay.shell);
+
+    bool ok = runBulk(port, timeout, bulkBytes, report) &&
+              runEcho(port, timeout, echoes, report) &&
+              runSpawn(port, timeout, spawns, report) &&
+              runIdle(port, timeout, idle, report);
+
+    server.stop();
+    if (!ok) {
+        std::cerr << "Suite did not complete" << std::endl;
+        return 1;
+    }
+
+    std::string text = report.render();
+    std::cout << text;
+    if (!outPath.empty()) {
+        std::ofstream out(outPath);
+        out << text;
+        if (!out) {
+            std::cerr << "Failed to write " << outPath << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
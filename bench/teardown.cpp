@@ -0,0 +1,64 @@
+#include <algorithm>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/protocol/protocol.hpp"
+
+// Reads until the server closes the connection; returns false on error.
+static bool readUntilClosed(Socket& socket) {
+    char buffer[BUFFER_SIZE];
+    while (true) {
+        int bytesRead = socket.recv(buffer, sizeof(buffer));
+        if (bytesRead == 0) {
+            return true;
+        }
+        if (bytesRead < 0) {
+            return false;
+        }
+    }
+}
+
+// Runs short sessions back to back and measures the time from sending
+// "exit" to the server closing the connection.
+int benchTeardown(const BenchOptions& options) {
+    int count = optionInt(options, "sessions", 200);
+    int loopThreads = optionInt(options, "threads", LOOP_THREADS);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 100);
+
+    Server server(port, loopThreads);
+    if (!server.initialize()) {
+        return 1;
+    }
+    server.start();
+
+    const char command[] = "exit\r\n";
+    std::vector<double> latencies;
+    int failed = 0;
+
+    for (int i = 0; i < count; ++i) {
+        Socket socket = connectLoopback(port);
+        char buffer[BUFFER_SIZE];
+        if (!socket.isValid() || socket.recv(buffer, sizeof(buffer)) <= 0) {
+            ++failed;
+            continue;
+        }
+
+        double sent = nowSeconds();
+        sendFrame(socket, Channel::Stdin, command, sizeof(command) - 1);
+        if (readUntilClosed(socket)) {
+            latencies.push_back((nowSeconds() - sent) * 1000.0);
+        } else {
+            ++failed;
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    std::cout << "sessions:                " << count << std::endl;
+    std::cout << "failed:                  " << failed << std::endl;
+    std::cout << "exit->close p50 ms:      " << percentile(latencies, 0.50) << std::endl;
+    std::cout << "exit->close p99 ms:      " << percentile(latencies, 0.99) << std::endl;
+    std::cout << "exit->close max ms:      " << percentile(latencies, 1.00) << std::endl;
+
+    server.stop();
+    return failed == 0 ? 0 : 1;
+}
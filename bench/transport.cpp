@@ -0,0 +1,113 @@
+#include <algorithm>
+
+#include "bench.hpp"
+#include "../src/server/server.hpp"
+#include "../src/protocol/protocol.hpp"
+#include "../src/transport/transport.hpp"
+
+struct TransportResult {
+    std::vector<double> rttUs;
+    double megabytes = 0.0;
+    double seconds = 0.0;
+};
+
+// Ping round trips once the shell has prompted, then rounds of bulk output.
+static bool runTransport(std::unique_ptr<Transport> transport, int pings, size_t bytes, int rounds,
+                         TransportResult& result) {
+    BenchClient client;
+    uint32_t pongs = 0;
+    client.onFrame = [&pongs](const Frame& frame) {
+        ControlPayload control;
+        if (frame.channel == Channel::Control && decodeControl(frame, control) &&
+            (ControlCode)control.code == ControlCode::Pong) {
+            ++pongs;
+        }
+        return true;
+    };
+    client.transport = std::move(transport);
+    if (!client.transport) {
+        return false;
+    }
+    client.transport->setNoDelay(true);
+    if (!client.readUntil("> ")) {
+        return false;
+    }
+
+    for (int i = 0; i < pings; ++i) {
+        uint32_t expected = pongs + 1;
+        double start = nowSeconds();
+        if (!client.sendControl(ControlCode::Ping, (uint32_t)i) ||
+            !client.readUntil([&] { return pongs >= expected; })) {
+            return false;
+        }
+        result.rttUs.push_back((nowSeconds() - start) * 1e6);
+    }
+    std::sort(result.rttUs.begin(), result.rttUs.end());
+
+    for (int i = 0; i < rounds; ++i) {
+        size_t before = client.bytes;
+        double start = nowSeconds();
+        if (!client.sendLine("bulk " + std::to_string(bytes)) || !client.readUntil("bulk_done")) {
+            return false;
+        }
+        result.seconds += nowSeconds() - start;
+        result.megabytes += (client.bytes - before) / 1e6;
+    }
+
+    client.sendLine("exit");
+    return true;
+}
+
+// Small-message round trip and bulk output over TCP loopback, an AF_UNIX
+// socket and shared memory, all served by one server. The round trip is a
+// Ping answered by the connection's loop, so it measures the transport and
+// the dispatch, not the shell.
+int benchTransport(const BenchOptions& options) {
+    int pings = optionInt(options, "pings", 10000);
+    size_t bytes = (size_t)optionInt(options, "mb", 64) * 1000 * 1000;
+    int rounds = optionInt(options, "rounds", 3);
+    int loopThreads = optionInt(options, "threads", LOOP_THREADS);
+    unsigned short port = (unsigned short)optionInt(options, "port", PORT + 120);
+    char temp[MAX_PATH];
+    GetTempPathA(MAX_PATH, temp);
+    std::string path = optionString(options, "path", std::string(temp) + "rcbench.sock");
+    std::string shm = optionString(options, "shm", "rcbench");
+
+    RelayOptions relay;
+    relay.shell = childCommand();
+    SchedulerOptions limits;
+    Server server(port, loopThreads, relay, limits);
+    if (!server.initialize() || !server.listenPath(path) || !server.listenShm(shm)) {
+        std::cout << "Server failed to start" << std::endl;
+        return 1;
+    }
+    server.start();
+    Sleep(200);
+
+    const std::vector<std::pair<std::string, std::string>> transports = {
+        { "tcp", HOST },
+        { "unix", "unix:" + path },
+        { "shm", "shm:" + shm },
+    };
+
+    std::cout << pings << " pings, " << rounds << " x " << bytes / 1e6 << " MB bulk per transport" << std::endl;
+    std::cout << "transport  rtt us p50/p99/max        bulk MB/s" << std::endl;
+
+    bool pass = true;
+    for (const auto& transport : transports) {
+        TransportResult result;
+        if (!runTransport(connectTransport(transport.second, port), pings, bytes, rounds, result)) {
+            std::cout << transport.first << ": failed" << std::endl;
+            pass = false;
+            continue;
+        }
+        double rate = result.seconds > 0.0 ? result.megabytes / result.seconds : 0.0;
+        std::cout << transport.first << "        " << percentile(result.rttUs, 0.50) << " / "
+                  << percentile(result.rttUs, 0.99) << " / " << (result.rttUs.empty() ? 0.0 : result.rttUs.back())
+                  << "        " << rate << std::endl;
+    }
+    server.stop();
+
+    std::cout << (pass ? "PASS" : "FAIL") << std::endl;
+    return pass ? 0 : 1;
+}
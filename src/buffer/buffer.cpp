@@ -0,0 +1,106 @@
+#include <algorithm>
+
+#include "buffer.hpp"
+
+void PooledBuffer::reset() {
+    if (m_data) {
+        BufferPool::shared().release(m_data, m_capacity);
+        m_data = nullptr;
+        m_capacity = 0;
+    }
+}
+
+BufferPool::BufferPool() : m_cachedBytes(0), m_allocations(0) {}
+
+BufferPool::~BufferPool() {
+    for (auto& sizeClass : m_classes) {
+        for (char* data : sizeClass.free) {
+            delete[] data;
+        }
+    }
+}
+
+BufferPool& BufferPool::shared() {
+    static BufferPool pool;
+    return pool;
+}
+
+int BufferPool::sizeClass(size_t size) {
+    int index = 0;
+    size_t capacity = MIN_SIZE;
+    while (capacity < size) {
+        capacity <<= 1;
+        ++index;
+    }
+    return index;
+}
+
+PooledBuffer BufferPool::acquire(size_t size) {
+    if (size > MAX_SIZE) {
+        ++m_allocations;
+        return PooledBuffer(new char[size], size);
+    }
+
+    int index = sizeClass(size);
+    size_t capacity = MIN_SIZE << index;
+    {
+        SizeClass& sizeClass = m_classes[index];
+        std::lock_guard<std::mutex> lock(sizeClass.mutex);
+        if (!sizeClass.free.empty()) {
+            char* data = sizeClass.free.back();
+            sizeClass.free.pop_back();
+            m_cachedBytes -= capacity;
+            return PooledBuffer(data, capacity);
+        }
+    }
+
+    ++m_allocations;
+    return PooledBuffer(new char[capacity], capacity);
+}
+
+void BufferPool::release(char* data, size_t capacity) {
+    int index = sizeClass(capacity);
+    if (capacity <= MAX_SIZE && capacity == MIN_SIZE << index) {
+        // Reserved before the check, so concurrent releases cannot all fit
+        // under the cap and overshoot it together.
+        if (m_cachedBytes.fetch_add(capacity) + capacity <= BUFFER_POOL_MAX_CACHED) {
+            SizeClass& sizeClass = m_classes[index];
+            std::lock_guard<std::mutex> lock(sizeClass.mutex);
+            sizeClass.free.push_back(data);
+            return;
+        }
+        m_cachedBytes.fetch_sub(capacity);
+    }
+    delete[] data;
+}
+
+ChunkRing::ChunkRing(size_t capacity)
+    : m_head(0), m_tail(0), m_capacity(std::max<size_t>(capacity, 1)), m_slots(new RelayChunk[m_capacity]) {}
+
+RelayChunk* ChunkRing::reserve() {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load() >= m_capacity) {
+        return nullptr;
+    }
+    return &m_slots[head % m_capacity];
+}
+
+void ChunkRing::publish() {
+    m_head.fetch_add(1);
+}
+
+RelayChunk* ChunkRing::front() {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (m_head.load() == tail) {
+        return nullptr;
+    }
+    return &m_slots[tail % m_capacity];
+}
+
+void ChunkRing::pop() {
+    m_tail.fetch_add(1);
+}
+
+size_t ChunkRing::size() const {
+    return m_head.load() - m_tail.load();
+}
@@ -0,0 +1,139 @@
+#pragma once
+#ifndef BUFFER_HPP
+#define BUFFER_HPP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../utils.hpp"
+#include "../define.hpp"
+
+class BufferPool;
+
+// A transfer buffer borrowed from a BufferPool; returned to it on reset or
+// destruction. Move-only.
+class PooledBuffer {
+private:
+    char* m_data;
+    size_t m_capacity;
+
+public:
+    PooledBuffer() : m_data(nullptr), m_capacity(0) {}
+    PooledBuffer(char* data, size_t capacity) : m_data(data), m_capacity(capacity) {}
+    ~PooledBuffer() { reset(); }
+
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    PooledBuffer(PooledBuffer&& other) noexcept : m_data(other.m_data), m_capacity(other.m_capacity) {
+        other.m_data = nullptr;
+        other.m_capacity = 0;
+    }
+
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept {
+        if (this != &other) {
+            reset();
+            m_data = other.m_data;
+            m_capacity = other.m_capacity;
+            other.m_data = nullptr;
+            other.m_capacity = 0;
+        }
+        return *this;
+    }
+
+    void reset();
+
+    char* data() const { return m_data; }
+    size_t capacity() const { return m_capacity; }
+    explicit operator bool() const { return m_data != nullptr; }
+};
+
+// Power-of-two size classes from 4 KB to 128 KB (enough for a compressed
+// 64 KB block), shared by every session so memory follows the sessions that
+// are moving data rather than the number that are open. Freed buffers are
+// cached per class up to BUFFER_POOL_MAX_CACHED bytes in total; beyond that
+// they go back to the heap.
+class BufferPool {
+public:
+    static const size_t MIN_SIZE = 4096;
+    static const int CLASSES = 6;
+    static const size_t MAX_SIZE = MIN_SIZE << (CLASSES - 1);
+
+private:
+    struct SizeClass {
+        std::mutex mutex;
+        std::vector<char*> free;
+    };
+
+    SizeClass m_classes[CLASSES];
+    std::atomic<size_t> m_cachedBytes;
+    std::atomic<uint64_t> m_allocations;
+
+public:
+    BufferPool();
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    static BufferPool& shared();
+
+    // At least `size` bytes; sizes above MAX_SIZE are allocated unpooled.
+    PooledBuffer acquire(size_t size);
+    void release(char* data, size_t capacity);
+
+    size_t cachedBytes() const { return m_cachedBytes.load(std::memory_order_relaxed); }
+    // Buffers that had to come from the heap rather than a free list.
+    uint64_t allocations() const { return m_allocations.load(std::memory_order_relaxed); }
+
+    static int sizeClass(size_t size);
+};
+
+// A pooled buffer and how much of it holds data.
+struct RelayChunk {
+    PooledBuffer buffer;
+    DWORD length;
+    // Left to the producer; the output relay keeps the interrupt count the
+    // chunk started filling under.
+    uint32_t tag;
+
+    RelayChunk() : length(0), tag(0) {}
+};
+
+// Fixed ring of chunks between one producer thread and one consumer thread,
+// with no lock. The producer fills the slot reserve() gives it and makes it
+// visible with publish(); the consumer takes front() and hands the slot
+// back with pop(). head and tail count every publish and pop and sit on
+// cache lines of their own, so the two sides only share a line when one
+// reads the other's counter. The counters are sequentially consistent so a
+// side that finds the ring empty or full and then raises a flag cannot miss
+// the other side's update (see ProcessHandler's relay stages).
+class ChunkRing {
+private:
+    alignas(64) std::atomic<size_t> m_head;
+    alignas(64) std::atomic<size_t> m_tail;
+    alignas(64) size_t m_capacity;
+    std::unique_ptr<RelayChunk[]> m_slots;
+
+public:
+    explicit ChunkRing(size_t capacity);
+
+    ChunkRing(const ChunkRing&) = delete;
+    ChunkRing& operator=(const ChunkRing&) = delete;
+
+    // Producer side: the next free slot, the same one until it is
+    // published, or null while the ring is full.
+    RelayChunk* reserve();
+    void publish();
+
+    // Consumer side: the oldest published chunk, or null while empty.
+    RelayChunk* front();
+    void pop();
+
+    size_t size() const;
+    size_t capacity() const { return m_capacity; }
+};
+
+#endif // BUFFER_HPP
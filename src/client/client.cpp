@@ -1,17 +1,78 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
 #include "client.hpp"
 
-Client::Client(const std::string& serverAddress, unsigned short port) 
-    : m_running(false) {
+// Ctrl-]: in raw mode, the next line is a client command.
+static const char COMMAND_KEY = 0x1D;
+// Ctrl-C, as raw mode reads it.
+static const char INTERRUPT_KEY = 0x03;
+
+// The client whose run() gets the console's control events.
+static std::atomic<Client*> s_consoleClient(nullptr);
+
+ConsoleWriter::ConsoleWriter(size_t capacity)
+    : m_handle(nullptr), m_buffer(capacity), m_used(0) {}
+
+void ConsoleWriter::write(HANDLE handle, const char* data, size_t length) {
+    if (handle != m_handle) {
+        flush();
+        m_handle = handle;
+    }
+    while (length > 0) {
+        if (m_used == m_buffer.size()) {
+            flush();
+        }
+        size_t chunk = std::min(length, m_buffer.size() - m_used);
+        memcpy(m_buffer.data() + m_used, data, chunk);
+        m_used += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+void ConsoleWriter::flush() {
+    if (m_used == 0) {
+        return;
+    }
+    // Status lines go through the streams; keep them in order with output.
+    std::cout.flush();
+    std::cerr.flush();
+
+    const char* data = m_buffer.data();
+    size_t remaining = m_used;
+    m_used = 0;
+    while (remaining > 0) {
+        DWORD written = 0;
+        if (!WriteFile(m_handle, data, (DWORD)remaining, &written, nullptr) || written == 0) {
+            return;
+        }
+        data += written;
+        remaining -= written;
+    }
+}
+
+Client::Client(const std::string& serverAddress, unsigned short port, const ClientOptions& options)
+    : m_serverAddress(serverAddress), m_port(port), m_running(false), m_exitCode(-1), m_options(options),
+      m_detaching(false), m_inputInterrupted(CreateEventA(nullptr, FALSE, FALSE, nullptr)),
+      m_inputBuffer(MAX_FRAME_PAYLOAD), m_inputRecords(BUFFER_SIZE / 2),
+      m_savedInputMode(0), m_savedOutputMode(0), m_sealBuffer(sizeof(FilePayload) + MAX_FRAME_PAYLOAD),
+      m_activeSession(0), m_nextSession(1), m_serverFeatures(0),
+      m_transfers([this](uint16_t id, const FilePayload& payload, const char* data, uint32_t length) {
+                      return sendFile(id, payload, data, length);
+                  },
+                  [](const std::string& message) { std::cout << "\n[" << message << "]" << std::endl; }) {
     
+    m_sessions[0] = Session();
+
     WSADATA wsaData;
     WSAStartup(MAKEWORD(2, 2), &wsaData);
     
-    if (!m_socket.create()) {
-        std::cerr << "Failed to create client socket" << std::endl;
-        return;
-    }
-    
-    if (!m_socket.connect(serverAddress, port)) {
+    m_transport = connectTransport(serverAddress, port);
+    if (!m_transport) {
         std::cerr << "Failed to connect to server" << std::endl;
         return;
     }
@@ -19,61 +80,881 @@ Client::Client(const std::string& serverAddress, unsigned short port)
 
 Client::~Client() {
     stop();
+    if (m_inputInterrupted) {
+        CloseHandle(m_inputInterrupted);
+    }
     WSACleanup();
 }
 
 void Client::run() {
-    if (!m_socket.isValid()) {
-        std::cerr << "Cannot start client: invalid socket" << std::endl;
+    if (!m_transport) {
+        std::cerr << "Cannot start client: not connected" << std::endl;
         return;
     }
 
-    if (!m_socket.setBlocking(true)) {
+    if (!m_transport->setBlocking(true)) {
         std::cerr << "Warning: failed to set blocking mode" << std::endl;
     }
+    m_transport->setNoDelay(true);
     
     m_running = true;
     std::cout << "Connected to server. Type commands below:" << std::endl;
+
+    if (m_options.encrypt) {
+        std::vector<HeldFrame> early;
+        if (!clientHandshake(*m_transport, m_reader, m_layer, features(), early)) {
+            bool refused = std::any_of(early.begin(), early.end(), [](HeldFrame& held) {
+                return isRefusal(held.frame());
+            });
+            std::cerr << (refused ? "Server is at its connection limit, try again later"
+                                  : "Key exchange with the server failed")
+                      << std::endl;
+            m_running = false;
+            return;
+        }
+        reportEncryption();
+        for (auto& held : early) {
+            Frame frame = held.frame();
+            handleFrame(frame);
+        }
+        m_console.flush();
+    } else {
+        sendControl(0, ControlCode::Hello, features());
+    }
+
+    // Resuming a session from an earlier client: take it over under a new
+    // number and drop the fresh session the server opened for us.
+    if (m_options.attachToken) {
+        uint16_t session;
+        {
+            std::lock_guard<std::mutex> lock(m_sessionsMutex);
+            session = m_nextSession++;
+            Session& resumed = m_sessions[session];
+            resumed.token = m_options.attachToken;
+            resumed.resuming = true;
+            resumed.stdinCredit = 0;
+            m_sessions.erase(0);
+            m_activeSession = session;
+        }
+        sendResume(session, m_options.attachToken, 0);
+        sendControl(0, ControlCode::CloseSession);
+    }
     
+    m_transfers.start();
+    s_consoleClient = this;
+    SetConsoleCtrlHandler(onConsoleEvent, TRUE);
     std::thread inputThread(&Client::handleUserInput, this);
     handleServerOutput();
     
     if (inputThread.joinable()) {
         inputThread.join();
     }
+    SetConsoleCtrlHandler(onConsoleEvent, FALSE);
+    s_consoleClient = nullptr;
+    m_transfers.stop();
 }
 
 void Client::handleServerOutput() {
-    char buffer[4096];
-    
     while (m_running) {
-        int bytesRead = m_socket.recv(buffer, sizeof(buffer));
+        int bytesRead = m_transport->recv(m_reader.writePointer(), m_reader.writableSize());
         if (bytesRead > 0) {
-            std::cout.write(buffer, bytesRead);
+            m_reader.commit(bytesRead);
+            m_metrics.bytesIn.fetch_add(bytesRead, std::memory_order_relaxed);
+
+            // Output of the whole receive is written at once; anything that
+            // prints a status line flushes it first to keep the order.
+            Frame frame;
+            bool open = true;
+            while (open && m_reader.next(frame)) {
+                if (m_layer.isSecure() && !m_layer.open(frame)) {
+                    m_console.flush();
+                    std::cerr << "\nRecord from server failed to authenticate" << std::endl;
+                    open = false;
+                    break;
+                }
+                m_metrics.framesIn.fetch_add(1, std::memory_order_relaxed);
+                if (frame.channel != Channel::Stdout && frame.channel != Channel::Stderr) {
+                    m_console.flush();
+                }
+                open = handleFrame(frame);
+            }
+
+            if (!m_console.isEmpty()) {
+                uint64_t writeStart = monotonicMicros();
+                m_console.flush();
+                m_metrics.consoleWrite.record(monotonicMicros() - writeStart);
+            }
             std::cout.flush();
-        } else if (bytesRead == 0) {
-            std::cout << "\nConnection closed by server" << std::endl;
+
+            if (m_reader.isCorrupt()) {
+                std::cerr << "\nMalformed frame from server" << std::endl;
+                break;
+            }
+            if (!open) {
+                break;
+            }
+        } else if (!m_running) {
             break;
         } else {
-            std::cerr << "\nReceive error: " << WSAGetLastError() << std::endl;
-            break;
+            if (bytesRead == 0) {
+                std::cout << "\nConnection closed by server" << std::endl;
+            } else {
+                std::cerr << "\nReceive error: " << WSAGetLastError() << std::endl;
+            }
+            m_transfers.disconnected();
+            if (!reconnect()) {
+                break;
+            }
         }
     }
     
     m_running = false;
+    m_creditAvailable.notify_all();
+}
+
+bool Client::handleFrame(const Frame& frame) {
+    switch (frame.channel) {
+    case Channel::Stdout:
+    case Channel::Stderr: {
+        const char* data = frame.payload;
+        size_t length = frame.length;
+
+        StreamDecompressor& decompressor = m_decompressors[(uint32_t)frame.session << 8 | (uint8_t)frame.channel];
+        if (frame.flags & FrameCompressed) {
+            if (!decompressor.decompress(frame.payload, frame.length, data, length)) {
+                m_console.flush();
+                std::cerr << "\nCorrupt compressed output on session " << frame.session << std::endl;
+                return false;
+            }
+        } else {
+            decompressor.append(frame.payload, frame.length);
+        }
+
+        bool visible;
+        bool dropped;
+        {
+            std::lock_guard<std::mutex> lock(m_sessionsMutex);
+            visible = frame.session == m_activeSession;
+            auto it = m_sessions.find(frame.session);
+            if (it != m_sessions.end()) {
+                it->second.received += length;
+            }
+            // Read before an interrupt: still counted, so the resume offset
+            // stays right, but not shown.
+            dropped = it != m_sessions.end() && it->second.interrupting > 0;
+            if (dropped) {
+                visible = false;
+            }
+            if (it != m_sessions.end() && it->second.inputSentAt) {
+                m_metrics.inputToOutput.record(monotonicMicros() - it->second.inputSentAt);
+                it->second.inputSentAt = 0;
+            }
+            if (!visible && !dropped && it != m_sessions.end()) {
+                std::string& backlog = it->second.backlog;
+                backlog.append(data, length);
+                if (backlog.size() > SESSION_WINDOW) {
+                    backlog.erase(0, backlog.size() - SESSION_WINDOW);
+                }
+            }
+        }
+
+        if (visible) {
+            m_console.write(GetStdHandle(frame.channel == Channel::Stdout ? STD_OUTPUT_HANDLE : STD_ERROR_HANDLE),
+                            data, length);
+        }
+
+        // Output is consumed as soon as it is printed or buffered, so the
+        // server may send the same amount again.
+        sendControl(frame.session, ControlCode::WindowUpdate, (uint32_t)length);
+        break;
+    }
+
+    case Channel::Screen: {
+        bool visible;
+        {
+            std::lock_guard<std::mutex> lock(m_sessionsMutex);
+            visible = frame.session == m_activeSession;
+        }
+        // A background session is repainted when it is switched to.
+        if (visible) {
+            m_console.write(GetStdHandle(STD_OUTPUT_HANDLE), frame.payload, frame.length);
+        }
+        break;
+    }
+
+    case Channel::Control:
+        handleControl(frame);
+        break;
+
+    case Channel::Resume:
+        handleResume(frame);
+        break;
+
+    case Channel::File:
+        m_transfers.handleFrame(frame);
+        break;
+
+    case Channel::ExitStatus: {
+        ExitStatusPayload status;
+        decodeExitStatus(frame, status);
+        m_decompressors.erase((uint32_t)frame.session << 8 | (uint8_t)Channel::Stdout);
+        m_decompressors.erase((uint32_t)frame.session << 8 | (uint8_t)Channel::Stderr);
+
+        bool last;
+        {
+            std::lock_guard<std::mutex> lock(m_sessionsMutex);
+            // Sessions dropped in favour of resumed ones exit silently.
+            if (!m_sessions.erase(frame.session)) {
+                break;
+            }
+            last = m_sessions.empty();
+        }
+        m_exitCode = (int)status.exitCode;
+        m_creditAvailable.notify_all();
+
+        std::cout << "\n[Session " << frame.session << " exited with code " << status.exitCode << "]" << std::endl;
+        return !last;
+    }
+
+    default:
+        break;
+    }
+    return true;
+}
+
+void Client::handleControl(const Frame& frame) {
+    ControlPayload control;
+    if (!decodeControl(frame, control)) {
+        return;
+    }
+
+    switch ((ControlCode)control.code) {
+    case ControlCode::WindowUpdate: {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        auto it = m_sessions.find(frame.session);
+        if (it != m_sessions.end()) {
+            it->second.stdinCredit += control.value;
+        }
+        m_creditAvailable.notify_all();
+        break;
+    }
+
+    case ControlCode::Hello:
+        m_serverFeatures = control.value;
+        if (control.value & FeatureCompression) {
+            std::cout << "[Output compression enabled]" << std::endl;
+        }
+        if (!(control.value & FeatureResume)) {
+            std::cout << "[Sessions end when the connection drops]" << std::endl;
+        }
+        if (control.value & FeatureScreen) {
+            std::cout << "[Screen updates enabled]" << std::endl;
+            HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
+            DWORD mode = 0;
+            if (GetConsoleMode(output, &mode)) {
+                SetConsoleMode(output, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+            }
+            uint16_t session;
+            {
+                std::lock_guard<std::mutex> lock(m_sessionsMutex);
+                session = m_activeSession;
+            }
+            sendWindowSize(session);
+        }
+        break;
+
+    case ControlCode::Interrupt: {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        auto it = m_sessions.find(frame.session);
+        if (it != m_sessions.end() && it->second.interrupting > 0) {
+            --it->second.interrupting;
+        }
+        break;
+    }
+
+    case ControlCode::SessionOpened:
+        if (control.value == (uint32_t)OpenStatus::Ok) {
+            std::cout << "\n[Session " << frame.session << " opened]" << std::endl;
+            if (m_serverFeatures & FeatureScreen) {
+                sendWindowSize(frame.session);
+            }
+        } else {
+            std::cerr << "\n[Session " << frame.session << " failed to open: " << describeOpenStatus(control.value)
+                      << "]" << std::endl;
+            std::lock_guard<std::mutex> lock(m_sessionsMutex);
+            m_sessions.erase(frame.session);
+            m_creditAvailable.notify_all();
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+void Client::handleResume(const Frame& frame) {
+    uint64_t token;
+    uint64_t offset;
+    if (!decodeResume(frame, token, offset)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_sessionsMutex);
+    auto it = m_sessions.find(frame.session);
+    if (it == m_sessions.end()) {
+        return;
+    }
+    Session& session = it->second;
+    session.token = token;
+
+    if (!session.resuming) {
+        std::cout << "\n[Session " << frame.session << " can be resumed with token "
+                  << std::hex << std::setw(16) << std::setfill('0') << token << std::dec << std::setfill(' ')
+                  << "]" << std::endl;
+        return;
+    }
+
+    // The server replays from `offset`; anything between what we had and
+    // that point fell out of its scrollback.
+    session.resuming = false;
+    if (offset > session.received) {
+        std::cerr << "\n[" << offset - session.received << " bytes of output were lost]" << std::endl;
+    }
+    session.received = offset;
+    std::cout << "\n[Session " << frame.session << " resumed]" << std::endl;
+}
+
+bool Client::handleCommand(const std::string& line) {
+    std::istringstream command(line.substr(1));
+    std::string name;
+    command >> name;
+
+    if (name == "get" || name == "put" || name == "transfers" || name == "cancel") {
+        handleTransferCommand(name, command);
+        return true;
+    }
+
+    std::unique_lock<std::mutex> lock(m_sessionsMutex);
+
+    if (name == "new") {
+        uint16_t session = m_nextSession++;
+        m_sessions[session] = Session();
+        m_activeSession = session;
+        lock.unlock();
+        return sendControl(session, ControlCode::OpenSession);
+    }
+
+    if (name == "switch") {
+        int session = -1;
+        command >> session;
+        auto it = m_sessions.find((uint16_t)session);
+        if (session < 0 || it == m_sessions.end()) {
+            std::cerr << "No such session" << std::endl;
+            return true;
+        }
+        m_activeSession = (uint16_t)session;
+        std::cout << it->second.backlog;
+        std::cout.flush();
+        it->second.backlog.clear();
+        lock.unlock();
+        if (m_serverFeatures & FeatureScreen) {
+            return sendWindowSize((uint16_t)session);
+        }
+        return true;
+    }
+
+    if (name == "close") {
+        int session = m_activeSession;
+        command >> session;
+        lock.unlock();
+        return sendControl((uint16_t)session, ControlCode::CloseSession);
+    }
+
+    if (name == "stats") {
+        std::cout << m_metrics.renderText();
+        std::cout.flush();
+        return true;
+    }
+
+    if (name == "list") {
+        for (auto& entry : m_sessions) {
+            std::cout << (entry.first == m_activeSession ? "* " : "  ") << entry.first
+                      << " (" << entry.second.backlog.size() << " bytes buffered";
+            if (entry.second.token) {
+                std::cout << ", token " << std::hex << std::setw(16) << std::setfill('0') << entry.second.token
+                          << std::dec << std::setfill(' ');
+            }
+            std::cout << ")" << std::endl;
+        }
+        return true;
+    }
+
+    if (name == "detach") {
+        bool any = false;
+        for (auto& entry : m_sessions) {
+            if (entry.second.token) {
+                std::cout << "Session " << entry.first << ": RemoteConsole -c --attach "
+                          << std::hex << std::setw(16) << std::setfill('0') << entry.second.token
+                          << std::dec << std::setfill(' ') << std::endl;
+                any = true;
+            }
+        }
+        if (!any) {
+            std::cerr << "No resumable sessions; they would end on disconnect" << std::endl;
+            return true;
+        }
+        m_detaching = true;
+        m_running = false;
+        lock.unlock();
+        m_creditAvailable.notify_all();
+        m_transport->shutdown();
+        return false;
+    }
+
+    std::cerr << "Unknown command: " << line << std::endl;
+    return true;
+}
+
+void Client::handleTransferCommand(const std::string& name, std::istream& command) {
+    if (name == "transfers") {
+        std::cout << m_transfers.describe();
+        std::cout.flush();
+        return;
+    }
+    if (name == "cancel") {
+        m_transfers.cancelAll();
+        return;
+    }
+
+    if (!(m_serverFeatures & FeatureFile)) {
+        std::cerr << "The server does not accept file transfers" << std::endl;
+        return;
+    }
+
+    // Paths may be quoted to hold spaces.
+    bool resume = false;
+    std::string first;
+    std::string second;
+    command >> std::quoted(first);
+    if (first == "-c") {
+        resume = true;
+        command >> std::quoted(first);
+    }
+    command >> std::quoted(second);
+    if (first.empty()) {
+        std::cerr << "Usage: ~" << name << (name == "get" ? " [-c] REMOTE [LOCAL]" : " [-c] LOCAL [REMOTE]")
+                  << std::endl;
+        return;
+    }
+
+    if (name == "get") {
+        m_transfers.get(first, second, resume);
+    } else if (!m_transfers.put(first, second, resume)) {
+        std::cerr << "No such file or directory: " << first << std::endl;
+    }
 }
 
 void Client::handleUserInput() {
+    if (m_options.raw) {
+        if (setRawMode(true)) {
+            handleRawInput();
+            setRawMode(false);
+            return;
+        }
+        std::cerr << "Input is not a console, falling back to line mode" << std::endl;
+    }
+    handleLineInput();
+}
+
+void Client::handleLineInput() {
     std::string input;
+    DWORD mode;
+    bool console = GetConsoleMode(GetStdHandle(STD_INPUT_HANDLE), &mode) != FALSE;
     
     while (m_running) {
         std::getline(std::cin, input);
         if (!m_running) break;
+
+        if (!std::cin && console) {
+            // A forwarded Ctrl-C also cuts a console read short. The handler
+            // runs on a thread of its own and signals once it has sent the
+            // interrupt; the end of the input never does.
+            if (WaitForSingleObject(m_inputInterrupted, INTERRUPT_INPUT_WAIT_MS) == WAIT_OBJECT_0) {
+                std::cin.clear();
+                continue;
+            }
+        }
+
+        // Failed sends while reconnecting just drop the line.
+        if (!input.empty() && input[0] == '~') {
+            if (!handleCommand(input) && !m_running) {
+                break;
+            }
+            continue;
+        }
+
+        if (input.size() + 2 > m_inputBuffer.size()) {
+            std::cerr << "Input line too long" << std::endl;
+            continue;
+        }
+        memcpy(m_inputBuffer.data(), input.data(), input.size());
+        memcpy(m_inputBuffer.data() + input.size(), "\r\n", 2);
+
+        uint16_t session;
+        {
+            std::lock_guard<std::mutex> lock(m_sessionsMutex);
+            session = m_activeSession;
+        }
         
-        input += "\r\n";
-        
-        if (m_socket.send(input.c_str(), input.size()) <= 0) {
+        if (!sendInput(session, m_inputBuffer.data(), input.size() + 2) && !m_running) {
             break;
         }
     }
-}
\ No newline at end of file
+}
+
+// Keys are read as console input records rather than with ReadFile, so the
+// client can see how much is already waiting: a burst of typing or a paste
+// is drained into m_inputBuffer and sent as one frame. Enter is sent as
+// CR LF, since the child reads its stdin as a pipe.
+void Client::handleRawInput() {
+    HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+    std::cout << "[Raw input: keys are sent as typed, Ctrl-] for a command]" << std::endl;
+
+    while (m_running) {
+        // Wakes up now and then to notice the connection ending.
+        if (WaitForSingleObject(input, 100) != WAIT_OBJECT_0) {
+            continue;
+        }
+
+        size_t length = 0;
+        bool command = false;
+        bool interrupt = false;
+        bool resized = false;
+        DWORD pending = 0;
+        while (!command && !interrupt && GetNumberOfConsoleInputEvents(input, &pending) && pending > 0) {
+            // Each record yields at most two bytes (CR becomes CR LF).
+            size_t room = (m_inputBuffer.size() - length) / 2;
+            DWORD wanted = (DWORD)std::min<size_t>({ pending, m_inputRecords.size(), room });
+            DWORD count = 0;
+            if (wanted == 0 || !ReadConsoleInputA(input, m_inputRecords.data(), wanted, &count)) {
+                break;
+            }
+
+            for (DWORD i = 0; i < count && !command && !interrupt; ++i) {
+                const INPUT_RECORD& record = m_inputRecords[i];
+                if (record.EventType == WINDOW_BUFFER_SIZE_EVENT) {
+                    resized = true;
+                    continue;
+                }
+                if (record.EventType != KEY_EVENT || !record.Event.KeyEvent.bKeyDown) {
+                    continue;
+                }
+                char key = record.Event.KeyEvent.uChar.AsciiChar;
+                if (key == COMMAND_KEY) {
+                    command = true;
+                } else if (key == INTERRUPT_KEY && (m_serverFeatures & FeatureInterrupt)) {
+                    // The server drops unwritten input anyway.
+                    interrupt = true;
+                    length = 0;
+                } else if (key == '\r') {
+                    m_inputBuffer[length++] = '\r';
+                    m_inputBuffer[length++] = '\n';
+                } else if (key != 0) {
+                    m_inputBuffer[length++] = key;
+                }
+            }
+        }
+
+        uint16_t session;
+        {
+            std::lock_guard<std::mutex> lock(m_sessionsMutex);
+            session = m_activeSession;
+        }
+        if (resized && (m_serverFeatures & FeatureScreen)) {
+            sendWindowSize(session);
+        }
+        if (length > 0 && !sendInput(session, m_inputBuffer.data(), length) && !m_running) {
+            break;
+        }
+        if (interrupt) {
+            sendInterrupt(InterruptKind::CtrlC);
+        }
+
+        if (command && !readCommand()) {
+            break;
+        }
+    }
+}
+
+// Reads one command line in cooked mode; false once the client should stop.
+bool Client::readCommand() {
+    setRawMode(false);
+    std::cout << "\ncommand> ";
+    std::cout.flush();
+
+    std::string line;
+    std::getline(std::cin, line);
+    if (!line.empty()) {
+        handleCommand(line[0] == '~' ? line : "~" + line);
+    }
+
+    if (m_running) {
+        setRawMode(true);
+    }
+    return m_running;
+}
+
+BOOL WINAPI Client::onConsoleEvent(DWORD event) {
+    Client* client = s_consoleClient;
+    if (!client || (event != CTRL_C_EVENT && event != CTRL_BREAK_EVENT)) {
+        return FALSE;
+    }
+    if (!client->sendInterrupt(event == CTRL_BREAK_EVENT ? InterruptKind::CtrlBreak : InterruptKind::CtrlC)) {
+        // The server cannot interrupt; the client ends as it always did.
+        return FALSE;
+    }
+    SetEvent(client->m_inputInterrupted);
+    return TRUE;
+}
+
+bool Client::setRawMode(bool enable) {
+    HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+    HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
+
+    if (!enable) {
+        SetConsoleMode(output, m_savedOutputMode);
+        return SetConsoleMode(input, m_savedInputMode) != 0;
+    }
+
+    if (!GetConsoleMode(input, &m_savedInputMode) || !GetConsoleMode(output, &m_savedOutputMode)) {
+        return false;
+    }
+    // Ctrl-C, arrows and the like go to the child; the console interprets
+    // the escape sequences full-screen programs write back.
+    // Resizes are reported too, for screen updates.
+    DWORD mode = m_savedInputMode & ~(ENABLE_LINE_INPUT | ENABLE_ECHO_INPUT | ENABLE_PROCESSED_INPUT);
+    SetConsoleMode(output, m_savedOutputMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+    return SetConsoleMode(input, mode | ENABLE_VIRTUAL_TERMINAL_INPUT | ENABLE_WINDOW_INPUT) != 0;
+}
+
+bool Client::sendInput(uint16_t session, const char* data, size_t length) {
+    // Stdin is bounded by the session's window; wait for the server to return
+    // credit rather than overrunning it.
+    {
+        std::unique_lock<std::mutex> lock(m_sessionsMutex);
+        m_creditAvailable.wait(lock, [&] {
+            auto it = m_sessions.find(session);
+            return !m_running || it == m_sessions.end() ||
+                   it->second.stdinCredit >= (int64_t)length;
+        });
+
+        auto it = m_sessions.find(session);
+        if (!m_running) {
+            return false;
+        }
+        if (it == m_sessions.end()) {
+            std::cerr << "Session " << session << " is closed" << std::endl;
+            return true;
+        }
+        it->second.stdinCredit -= length;
+        if (!it->second.inputSentAt) {
+            it->second.inputSentAt = monotonicMicros();
+        }
+    }
+
+    m_metrics.bytesOut.fetch_add(sizeof(FrameHeader) + length, std::memory_order_relaxed);
+    m_metrics.framesOut.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    OutgoingFrame frame;
+    frame.prepare(Channel::Stdin, data, (uint32_t)length, 0, session);
+    return send(frame);
+}
+
+bool Client::send(OutgoingFrame& frame) {
+    if (m_layer.isSecure()) {
+        m_layer.seal(frame, m_sealBuffer.data());
+    }
+    return sendFrame(*m_transport, frame);
+}
+
+uint32_t Client::features() const {
+    return (m_options.compress ? FeatureCompression : 0) | FeatureResume | FeatureFile | FeatureInterrupt |
+           (m_options.screen ? FeatureScreen : 0);
+}
+
+void Client::reportEncryption() {
+    if (m_layer.isSecure()) {
+        std::cout << "[Encrypted: X25519, ChaCha20-Poly1305 (" << cipherKernelName(cipherKernel()) << ")]"
+                  << std::endl;
+    } else {
+        std::cout << "[The server does not encrypt; traffic is sent in the clear]" << std::endl;
+    }
+}
+
+bool Client::reconnect() {
+    std::map<uint16_t, Session> resumable;
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        for (auto& entry : m_sessions) {
+            if (entry.second.token) {
+                resumable.insert(entry);
+            }
+        }
+    }
+    if (resumable.empty() || m_detaching) {
+        return false;
+    }
+
+    std::unique_ptr<Transport> transport;
+    for (int attempt = 1; attempt <= RECONNECT_ATTEMPTS && m_running && !transport; ++attempt) {
+        std::cout << "[Reconnecting, attempt " << attempt << " of " << RECONNECT_ATTEMPTS << "]" << std::endl;
+        Sleep(RECONNECT_DELAY_MS);
+        transport = connectTransport(m_serverAddress, m_port);
+    }
+    if (!transport) {
+        return false;
+    }
+    transport->setNoDelay(true);
+
+    // Keys are exchanged before the transport is handed to the other threads.
+    // Of what arrives first only the controls matter, such as the server's
+    // Hello: the output is that of the new session 0, which is closed below.
+    m_reader = FrameReader();
+    RecordLayer layer;
+    if (m_options.encrypt) {
+        std::vector<HeldFrame> early;
+        if (!clientHandshake(*transport, m_reader, layer, features(), early)) {
+            std::cerr << "[Key exchange with the server failed]" << std::endl;
+            return false;
+        }
+        for (auto& held : early) {
+            Frame frame = held.frame();
+            if (frame.channel == Channel::Control) {
+                handleControl(frame);
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        m_transport = std::move(transport);
+        m_layer = layer;
+    }
+    m_decompressors.clear();
+
+    // Session numbers belong to a connection, so resumed sessions get new
+    // ones; the server grants stdin credit again once each is attached.
+    std::map<uint16_t, Session> sessions;
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        for (auto& entry : resumable) {
+            uint16_t id = m_nextSession++;
+            Session& session = sessions[id];
+            session = entry.second;
+            session.stdinCredit = 0;
+            session.inputSentAt = 0;
+            session.resuming = true;
+            // The new connection will not answer an interrupt sent on the old.
+            session.interrupting = 0;
+            if (entry.first == m_activeSession) {
+                m_activeSession = id;
+            }
+            std::cout << "[Resuming session " << entry.first << " as " << id << "]" << std::endl;
+        }
+        if (!sessions.count(m_activeSession)) {
+            m_activeSession = sessions.begin()->first;
+        }
+        m_sessions.swap(sessions);
+    }
+    m_creditAvailable.notify_all();
+
+    if (!m_options.encrypt) {
+        sendControl(0, ControlCode::Hello, features());
+    }
+    std::vector<std::pair<uint16_t, Session>> requests;
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        requests.assign(m_sessions.begin(), m_sessions.end());
+    }
+    for (auto& entry : requests) {
+        sendResume(entry.first, entry.second.token, entry.second.received);
+    }
+    sendControl(0, ControlCode::CloseSession);
+    m_transfers.reconnected();
+    return true;
+}
+
+bool Client::sendResume(uint16_t session, uint64_t token, uint64_t offset) {
+    ResumePayload payload;
+    encodeResume(payload, token, offset);
+
+    m_metrics.bytesOut.fetch_add(sizeof(FrameHeader) + sizeof(payload), std::memory_order_relaxed);
+    m_metrics.framesOut.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    OutgoingFrame frame;
+    frame.prepare(Channel::Resume, &payload, sizeof(payload), 0, session);
+    return send(frame);
+}
+
+bool Client::sendInterrupt(InterruptKind kind) {
+    if (!(m_serverFeatures & FeatureInterrupt)) {
+        return false;
+    }
+    uint16_t session;
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        session = m_activeSession;
+        auto it = m_sessions.find(session);
+        if (it == m_sessions.end()) {
+            return false;
+        }
+        ++it->second.interrupting;
+    }
+    // A control frame, so it does not wait for stdin credit.
+    if (sendControl(session, ControlCode::Interrupt, (uint32_t)kind)) {
+        return true;
+    }
+    // Never sent, so never answered.
+    std::lock_guard<std::mutex> lock(m_sessionsMutex);
+    auto it = m_sessions.find(session);
+    if (it != m_sessions.end() && it->second.interrupting > 0) {
+        --it->second.interrupting;
+    }
+    return false;
+}
+
+bool Client::sendWindowSize(uint16_t session) {
+    uint32_t columns = SCREEN_COLUMNS;
+    uint32_t rows = SCREEN_ROWS;
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) {
+        columns = info.srWindow.Right - info.srWindow.Left + 1;
+        rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+    }
+    return sendControl(session, ControlCode::WindowSize, columns << 16 | rows);
+}
+
+bool Client::sendControl(uint16_t session, ControlCode code, uint32_t value) {
+    ControlPayload payload;
+    encodeControl(payload, code, value);
+
+    m_metrics.bytesOut.fetch_add(sizeof(FrameHeader) + sizeof(payload), std::memory_order_relaxed);
+    m_metrics.framesOut.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    OutgoingFrame frame;
+    frame.prepare(Channel::Control, &payload, sizeof(payload), 0, session);
+    return send(frame);
+}
+
+bool Client::sendFile(uint16_t id, const FilePayload& payload, const char* data, uint32_t length) {
+    m_metrics.bytesOut.fetch_add(sizeof(FrameHeader) + sizeof(payload) + length, std::memory_order_relaxed);
+    m_metrics.framesOut.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    OutgoingFrame frame;
+    frame.prepare(Channel::File, &payload, sizeof(payload), data, length, 0, id);
+    return send(frame);
+}
@@ -2,26 +2,195 @@
 #ifndef CLIENT_HPP
 #define CLIENT_HPP
 
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include "../utils.hpp"
 #include "../define.hpp"
+#include "../protocol/protocol.hpp"
+#include "../compress/compress.hpp"
+#include "../metrics/metrics.hpp"
+#include "../transport/transport.hpp"
+#include "files.hpp"
+
+// How the client talks to the server and reads the keyboard.
+struct ClientOptions {
+    // Ask the server to compress output.
+    bool compress;
+    // Send keys as they are typed rather than whole lines; escape commands
+    // are then entered after Ctrl-].
+    bool raw;
+    // Resume this detached session instead of using a new shell, if not 0.
+    uint64_t attachToken;
+    // Exchange keys on connect and send everything after as sealed records.
+    bool encrypt;
+    // Ask for screen updates: the server keeps each session's screen and
+    // sends what changed a few times a second instead of all the output.
+    bool screen;
+
+    ClientOptions() : compress(true), raw(false), attachToken(0), encrypt(true), screen(false) {}
+};
+
+// Collects the output of a batch of frames and writes it to the console
+// with one WriteFile per run of the same handle, instead of a stream write
+// and flush per frame.
+class ConsoleWriter {
+private:
+    HANDLE m_handle;
+    std::vector<char> m_buffer;
+    size_t m_used;
 
+public:
+    explicit ConsoleWriter(size_t capacity = MAX_FRAME_PAYLOAD);
+
+    void write(HANDLE handle, const char* data, size_t length);
+    void flush();
+    bool isEmpty() const { return m_used == 0; }
+};
+
+// Interactive client. Session 0 is opened by the server on connect; more
+// sessions share the same connection and are driven with escape lines:
+//   ~new         open a session and switch to it
+//   ~switch N    show session N and send input to it
+//   ~close [N]   terminate session N (default: the active one)
+//   ~list        list open sessions and their resume tokens
+//   ~stats       show traffic counters and latency percentiles
+//   ~detach      disconnect, leaving the sessions running on the server
+//   ~get [-c] REMOTE [LOCAL]   download a file (-c: continue a partial one)
+//   ~put [-c] LOCAL [REMOTE]   upload a file or a directory tree
+//   ~transfers   list running and queued transfers
+//   ~cancel      cancel all transfers
+// Output of background sessions is buffered and shown on switch.
+// Sessions the server made resumable survive a dropped connection: the
+// client reconnects and resumes each from the last output byte it received,
+// under a new session number. `-c --attach TOKEN` resumes one from a new
+// client. With ClientOptions::raw, keystrokes are streamed as they arrive:
+// whatever has been typed or pasted by the time the client looks is sent
+// as one frame. File transfers run alongside the sessions on the same
+// connection, see TransferManager. Unless ClientOptions::encrypt is off, the
+// connection starts with the key exchange and every frame after it is a
+// sealed record. With ClientOptions::screen, Screen frames are written to
+// the console as they come; background sessions drop theirs, and the server
+// repaints a session's screen when the client switches to it or resizes.
+// Ctrl-C and Ctrl-Break interrupt the active session on servers that accept
+// FeatureInterrupt: the server drops the session's queued input and output
+// and raises the event on the child, and the client drops the output that
+// arrives before the server's answer.
 class Client : public Thread {
 private:
-    Socket m_socket;
+    struct Session {
+        int64_t stdinCredit;
+        std::string backlog;
+        // When the last input line was sent, until its first output arrives.
+        uint64_t inputSentAt;
+        // Resume token (0 if not resumable), output bytes received so far,
+        // and whether a resume request is waiting for its answer.
+        uint64_t token;
+        uint64_t received;
+        bool resuming;
+        // Interrupts waiting for their answers; output until the last one
+        // was read before it and is dropped.
+        uint32_t interrupting;
+
+        Session()
+            : stdinCredit(SESSION_WINDOW), inputSentAt(0), token(0), received(0), resuming(false),
+              interrupting(0) {}
+    };
+
+    std::string m_serverAddress;
+    unsigned short m_port;
+    std::unique_ptr<Transport> m_transport;
     std::atomic<bool> m_running;
+    FrameReader m_reader;
+    std::atomic<int> m_exitCode;
+    ClientOptions m_options;
+    std::atomic<bool> m_detaching;
+    ClientMetrics m_metrics;
+    // Auto-reset event set once a Ctrl-C was forwarded, which also cuts
+    // short a line being read.
+    HANDLE m_inputInterrupted;
+
+    // Used by the input thread only: the frame being assembled, console
+    // records read in one go, and the console mode to restore.
+    std::vector<char> m_inputBuffer;
+    std::vector<INPUT_RECORD> m_inputRecords;
+    DWORD m_savedInputMode;
+    DWORD m_savedOutputMode;
+
+    // Used by the output thread only.
+    ConsoleWriter m_console;
+
+    // Keyed by session << 8 | channel; used by the output thread only.
+    std::map<uint32_t, StreamDecompressor> m_decompressors;
+
+    // Guards sending and the layer's sending side; the output thread is the
+    // only one that opens records or replaces the layer.
+    std::mutex m_sendMutex;
+    RecordLayer m_layer;
+    // Records are encrypted into this rather than over the caller's data.
+    std::vector<char> m_sealBuffer;
+
+    std::mutex m_sessionsMutex;
+    std::condition_variable m_creditAvailable;
+    std::map<uint16_t, Session> m_sessions;
+    uint16_t m_activeSession;
+    uint16_t m_nextSession;
+
+    // Features the server accepted in its Hello.
+    std::atomic<uint32_t> m_serverFeatures;
+    // Last, so its thread is stopped before anything it sends through.
+    TransferManager m_transfers;
     
 public:
-    Client(const std::string& serverAddress = HOST, unsigned short port = PORT);
+    Client(const std::string& serverAddress = HOST, unsigned short port = PORT,
+           const ClientOptions& options = ClientOptions());
     ~Client();
     
     bool connect();
+
+    // Exit code reported by the server for the last session to exit, or -1
+    // if the connection ended without one.
+    int exitCode() const { return m_exitCode; }
     
 protected:
     void run() override;
     
 private:
     void handleUserInput();
+    void handleLineInput();
+    void handleRawInput();
+    bool setRawMode(bool enable);
+    bool readCommand();
+    // Console control handler: forwards Ctrl-C and Ctrl-Break while run()
+    // is relaying.
+    static BOOL WINAPI onConsoleEvent(DWORD event);
     void handleServerOutput();
+    bool handleFrame(const Frame& frame);
+    void handleControl(const Frame& frame);
+    void handleResume(const Frame& frame);
+    bool handleCommand(const std::string& line);
+    void handleTransferCommand(const std::string& name, std::istream& command);
+
+    uint32_t features() const;
+    void reportEncryption();
+    // Reconnects after the connection dropped and resumes every session
+    // that has a token; false if there is nothing to resume or it failed.
+    bool reconnect();
+
+    // Sends a prepared frame, sealed if keys were exchanged; called with
+    // m_sendMutex held.
+    bool send(OutgoingFrame& frame);
+    bool sendInput(uint16_t session, const char* data, size_t length);
+    bool sendControl(uint16_t session, ControlCode code, uint32_t value = 0);
+    bool sendResume(uint16_t session, uint64_t token, uint64_t offset);
+    // Interrupts the active session; false if the server cannot.
+    bool sendInterrupt(InterruptKind kind);
+    // Tells the server the size of the console window, for screen updates.
+    bool sendWindowSize(uint16_t session);
+    bool sendFile(uint16_t id, const FilePayload& payload, const char* data, uint32_t length);
 };
 
-#endif // CLIENT_HPP
\ No newline at end of file
+#endif // CLIENT_HPP
@@ -0,0 +1,261 @@
+#include <algorithm>
+
+#include "exec.hpp"
+
+// The command runs as session 1; session 0 is the shell the server opens
+// for every connection, which exec mode closes right away.
+static const uint16_t EXEC_SESSION = 1;
+
+ExecClient::ExecClient(const std::string& serverAddress, unsigned short port, const std::string& command,
+                       const ClientOptions& options)
+    : m_serverAddress(serverAddress), m_port(port), m_command(command), m_options(options), m_running(false),
+      m_sealBuffer(std::max<size_t>(MAX_FRAME_PAYLOAD, command.size())), m_stdinCredit(SESSION_WINDOW),
+      m_inputThreadId(0), m_inputDone(false), m_inputBuffer(MAX_FRAME_PAYLOAD) {
+
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+    m_transport = connectTransport(serverAddress, port);
+    if (!m_transport) {
+        std::cerr << "Failed to connect to server" << std::endl;
+    }
+}
+
+ExecClient::~ExecClient() {
+    stopInput();
+    m_transport.reset();
+    WSACleanup();
+}
+
+int ExecClient::run() {
+    if (!m_transport) {
+        return EXEC_ERROR_EXIT_CODE;
+    }
+    m_transport->setBlocking(true);
+    m_transport->setNoDelay(true);
+    m_running = true;
+
+    // Whatever arrives during the key exchange belongs to session 0, which
+    // is about to be closed.
+    uint32_t features = m_options.compress ? FeatureCompression : 0;
+    if (m_options.encrypt) {
+        std::vector<HeldFrame> early;
+        if (!clientHandshake(*m_transport, m_reader, m_layer, features, early)) {
+            bool refused = std::any_of(early.begin(), early.end(), [](HeldFrame& held) {
+                return isRefusal(held.frame());
+            });
+            std::cerr << (refused ? "Server is at its connection limit, try again later"
+                                  : "Key exchange with the server failed")
+                      << std::endl;
+            return EXEC_ERROR_EXIT_CODE;
+        }
+    }
+
+    // The command is opened before session 0 is closed, so the connection
+    // never runs out of sessions in between.
+    bool ok = m_options.encrypt || sendControl(0, ControlCode::Hello, features);
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        OutgoingFrame frame;
+        frame.prepare(Channel::Exec, m_command.data(), (uint32_t)m_command.size(), 0, EXEC_SESSION);
+        ok = ok && send(frame);
+    }
+    ok = ok && sendControl(0, ControlCode::CloseSession);
+    if (!ok) {
+        std::cerr << "Failed to send command: " << WSAGetLastError() << std::endl;
+        return EXEC_ERROR_EXIT_CODE;
+    }
+
+    m_inputThread = std::thread(&ExecClient::pumpInput, this);
+
+    int exitCode = EXEC_ERROR_EXIT_CODE;
+    bool open = true;
+    while (open) {
+        int bytesRead = m_transport->recv(m_reader.writePointer(), m_reader.writableSize());
+        if (bytesRead <= 0) {
+            std::cerr << "Connection lost before the command finished" << std::endl;
+            break;
+        }
+        m_reader.commit(bytesRead);
+
+        // Output is credited back once per receive rather than per frame.
+        uint32_t credit = 0;
+        Frame frame;
+        while (open && m_reader.next(frame)) {
+            if (m_layer.isSecure() && !m_layer.open(frame)) {
+                m_output.flush();
+                std::cerr << "Record from server failed to authenticate" << std::endl;
+                stopInput();
+                return EXEC_ERROR_EXIT_CODE;
+            }
+            open = handleFrame(frame, credit, exitCode);
+        }
+        m_output.flush();
+
+        if (m_reader.isCorrupt()) {
+            std::cerr << "Malformed frame from server" << std::endl;
+            break;
+        }
+        if (open && credit > 0) {
+            sendControl(EXEC_SESSION, ControlCode::WindowUpdate, credit);
+        }
+    }
+
+    stopInput();
+    return exitCode;
+}
+
+bool ExecClient::handleFrame(const Frame& frame, uint32_t& credit, int& exitCode) {
+    if (isRefusal(frame)) {
+        m_output.flush();
+        std::cerr << "Server is at its connection limit, try again later" << std::endl;
+        return false;
+    }
+    if (frame.session != EXEC_SESSION) {
+        // The closed shell session's prompt and exit.
+        return true;
+    }
+
+    switch (frame.channel) {
+    case Channel::Stdout:
+    case Channel::Stderr: {
+        const char* data = frame.payload;
+        size_t length = frame.length;
+        StreamDecompressor& decompressor = m_decompressors[(uint8_t)frame.channel];
+        if (frame.flags & FrameCompressed) {
+            if (!decompressor.decompress(frame.payload, frame.length, data, length)) {
+                std::cerr << "Corrupt compressed output" << std::endl;
+                return false;
+            }
+        } else {
+            decompressor.append(frame.payload, frame.length);
+        }
+
+        m_output.write(GetStdHandle(frame.channel == Channel::Stdout ? STD_OUTPUT_HANDLE : STD_ERROR_HANDLE),
+                       data, length);
+        credit += (uint32_t)length;
+        return true;
+    }
+
+    case Channel::Control: {
+        ControlPayload control;
+        if (!decodeControl(frame, control)) {
+            return true;
+        }
+        if ((ControlCode)control.code == ControlCode::WindowUpdate) {
+            std::lock_guard<std::mutex> lock(m_creditMutex);
+            m_stdinCredit += control.value;
+            m_creditAvailable.notify_all();
+        } else if ((ControlCode)control.code == ControlCode::SessionOpened &&
+                   control.value != (uint32_t)OpenStatus::Ok) {
+            m_output.flush();
+            std::cerr << "Cannot run command: " << describeOpenStatus(control.value) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    case Channel::ExitStatus: {
+        ExitStatusPayload status;
+        decodeExitStatus(frame, status);
+        exitCode = (int)status.exitCode;
+        return false;
+    }
+
+    default:
+        return true;
+    }
+}
+
+void ExecClient::pumpInput() {
+    m_inputThreadId = GetCurrentThreadId();
+    HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+    bool console = GetFileType(input) == FILE_TYPE_CHAR;
+
+    while (m_running) {
+        DWORD wanted;
+        {
+            std::unique_lock<std::mutex> lock(m_creditMutex);
+            m_creditAvailable.wait(lock, [&] { return !m_running || m_stdinCredit > 0; });
+            if (!m_running) {
+                break;
+            }
+            wanted = (DWORD)std::min<int64_t>(m_stdinCredit, (int64_t)m_inputBuffer.size());
+        }
+
+        // Waiting on a console first lets stopInput be noticed while nothing
+        // is typed.
+        if (console && WaitForSingleObject(input, 100) != WAIT_OBJECT_0) {
+            continue;
+        }
+
+        DWORD bytesRead = 0;
+        if (!ReadFile(input, m_inputBuffer.data(), wanted, &bytesRead, nullptr) || bytesRead == 0) {
+            // End of input, or stopInput cancelled the read.
+            if (m_running) {
+                sendControl(EXEC_SESSION, ControlCode::CloseStdin);
+            }
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_creditMutex);
+            m_stdinCredit -= bytesRead;
+        }
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        OutgoingFrame frame;
+        frame.prepare(Channel::Stdin, m_inputBuffer.data(), bytesRead, 0, EXEC_SESSION);
+        if (!send(frame)) {
+            break;
+        }
+    }
+    m_inputDone = true;
+}
+
+void ExecClient::stopInput() {
+    {
+        std::lock_guard<std::mutex> lock(m_creditMutex);
+        m_running = false;
+    }
+    m_creditAvailable.notify_all();
+    if (!m_inputThread.joinable()) {
+        return;
+    }
+
+    // The command may finish without reading all of stdin, leaving the
+    // input thread blocked in ReadFile; cancel the read, retrying in case it
+    // had not started yet.
+    for (int attempt = 0; attempt < 50 && !m_inputDone; ++attempt) {
+        HANDLE thread = m_inputThreadId ? OpenThread(THREAD_TERMINATE, FALSE, m_inputThreadId) : nullptr;
+        if (thread) {
+            CancelSynchronousIo(thread);
+            CloseHandle(thread);
+        }
+        Sleep(10);
+    }
+
+    if (m_inputDone) {
+        m_inputThread.join();
+    } else {
+        // A console read that is already waiting for a line cannot always be
+        // cancelled; it ends with the process.
+        m_inputThread.detach();
+    }
+}
+
+bool ExecClient::sendControl(uint16_t session, ControlCode code, uint32_t value) {
+    ControlPayload payload;
+    encodeControl(payload, code, value);
+
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    OutgoingFrame frame;
+    frame.prepare(Channel::Control, &payload, sizeof(payload), 0, session);
+    return send(frame);
+}
+
+bool ExecClient::send(OutgoingFrame& frame) {
+    if (m_layer.isSecure()) {
+        m_layer.seal(frame, m_sealBuffer.data());
+    }
+    return sendFrame(*m_transport, frame);
+}
@@ -0,0 +1,71 @@
+#pragma once
+#ifndef EXEC_HPP
+#define EXEC_HPP
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "../utils.hpp"
+#include "../define.hpp"
+#include "../protocol/protocol.hpp"
+#include "../compress/compress.hpp"
+#include "client.hpp"
+
+// Runs one command on the server as if it were local, for scripts
+// (`-e COMMAND`). The command is opened with an Exec frame, so the server
+// starts it directly instead of in a shell, and the shell session it opened
+// on connect is closed. The child's stdout and stderr go to ours unchanged;
+// our stdin is streamed to it as fast as its window allows and closed with
+// CloseStdin at EOF. Keys are exchanged first, as in Client, unless
+// ClientOptions::encrypt is off. run() returns the child's exit code, or
+// EXEC_ERROR_EXIT_CODE if it could not be run or the connection was lost.
+class ExecClient {
+private:
+    std::string m_serverAddress;
+    unsigned short m_port;
+    std::string m_command;
+    ClientOptions m_options;
+    std::unique_ptr<Transport> m_transport;
+    std::atomic<bool> m_running;
+
+    // Used by the receiving thread only.
+    FrameReader m_reader;
+    ConsoleWriter m_output;
+    std::map<uint8_t, StreamDecompressor> m_decompressors;
+
+    // Guards sending and the layer's sending side.
+    std::mutex m_sendMutex;
+    RecordLayer m_layer;
+    std::vector<char> m_sealBuffer;
+
+    std::mutex m_creditMutex;
+    std::condition_variable m_creditAvailable;
+    int64_t m_stdinCredit;
+
+    // The input thread, and how to interrupt its blocking read.
+    std::thread m_inputThread;
+    std::atomic<DWORD> m_inputThreadId;
+    std::atomic<bool> m_inputDone;
+    std::vector<char> m_inputBuffer;
+
+public:
+    ExecClient(const std::string& serverAddress, unsigned short port, const std::string& command,
+               const ClientOptions& options = ClientOptions());
+    ~ExecClient();
+
+    int run();
+
+private:
+    void pumpInput();
+    void stopInput();
+    // Returns false once the command has ended; sets `exitCode` if it ran.
+    bool handleFrame(const Frame& frame, uint32_t& credit, int& exitCode);
+    // Called with m_sendMutex held.
+    bool send(OutgoingFrame& frame);
+    bool sendControl(uint16_t session, ControlCode code, uint32_t value = 0);
+};
+
+#endif // EXEC_HPP
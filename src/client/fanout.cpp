@@ -0,0 +1,488 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include "fanout.hpp"
+#include "../metrics/metrics.hpp"
+
+// As in exec mode, the command runs as session 1 and the shell the server
+// opens as session 0 is closed.
+static const uint16_t EXEC_SESSION = 1;
+
+static std::string trim(const std::string& text) {
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) {
+        return std::string();
+    }
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+bool parseTargets(const std::string& text, std::vector<FanoutTarget>& targets) {
+    std::string normalized = text;
+    std::replace(normalized.begin(), normalized.end(), ',', '\n');
+
+    std::istringstream lines(normalized);
+    std::string line;
+    while (std::getline(lines, line)) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        FanoutTarget target;
+        target.name = line;
+        target.host = line;
+        target.port = PORT;
+        size_t colon = line.rfind(':');
+        if (colon != std::string::npos) {
+            unsigned long port = std::strtoul(line.c_str() + colon + 1, nullptr, 10);
+            if (port == 0 || port > 65535) {
+                std::cerr << "Bad port in host entry: " << line << std::endl;
+                return false;
+            }
+            target.host = line.substr(0, colon);
+            target.port = (unsigned short)port;
+        }
+        targets.push_back(target);
+    }
+    return true;
+}
+
+// Numeric addresses are used as they are; names are looked up, which
+// blocks the loop briefly for each host as it is started.
+static bool resolveHost(const std::string& host, unsigned short port, sockaddr_in& address) {
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) == 1) {
+        return true;
+    }
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &found) != 0 || !found) {
+        return false;
+    }
+    address.sin_addr = ((sockaddr_in*)found->ai_addr)->sin_addr;
+    freeaddrinfo(found);
+    return true;
+}
+
+FanoutClient::FanoutClient(const std::vector<FanoutTarget>& targets, const std::string& command,
+                           const FanoutOptions& options)
+    : m_hosts(targets.size()), m_command(command), m_options(options) {
+    for (size_t i = 0; i < targets.size(); ++i) {
+        m_hosts[i].target = targets[i];
+        m_hosts[i].result.name = targets[i].name;
+    }
+    m_options.concurrency = std::max<size_t>(m_options.concurrency, 1);
+
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+}
+
+FanoutClient::~FanoutClient() {
+    m_hosts.clear();
+    WSACleanup();
+}
+
+int FanoutClient::run() {
+    uint64_t started = monotonicMicros();
+    size_t next = 0;
+    std::vector<WSAPOLLFD> fds;
+    std::vector<Host*> polled;
+
+    while (true) {
+        size_t active = 0;
+        for (auto& host : m_hosts) {
+            active += host.state == State::Connecting || host.state == State::Running;
+        }
+        while (active < m_options.concurrency && next < m_hosts.size()) {
+            Host& host = m_hosts[next++];
+            startHost(host);
+            active += host.state != State::Done;
+        }
+        if (active == 0 && next == m_hosts.size()) {
+            break;
+        }
+
+        fds.clear();
+        polled.clear();
+        for (auto& host : m_hosts) {
+            if (host.state != State::Connecting && host.state != State::Running) {
+                continue;
+            }
+            WSAPOLLFD fd;
+            fd.fd = host.socket.getHandle();
+            fd.events = POLLRDNORM;
+            if (host.state == State::Connecting || !host.outbox.empty()) {
+                fd.events |= POLLWRNORM;
+            }
+            fd.revents = 0;
+            fds.push_back(fd);
+            polled.push_back(&host);
+        }
+
+        // Short enough to notice deadlines without a timer per host.
+        if (WSAPoll(fds.data(), (ULONG)fds.size(), 100) == SOCKET_ERROR) {
+            std::cerr << "WSAPoll failed: " << WSAGetLastError() << std::endl;
+            break;
+        }
+
+        uint64_t now = monotonicMicros();
+        for (size_t i = 0; i < fds.size(); ++i) {
+            Host& host = *polled[i];
+            short events = fds[i].revents;
+
+            if (host.state == State::Connecting) {
+                if (events & (POLLERR | POLLHUP)) {
+                    int error = 0;
+                    int length = sizeof(error);
+                    getsockopt(host.socket.getHandle(), SOL_SOCKET, SO_ERROR, (char*)&error, &length);
+                    finishHost(host, -1, "connect failed (error " + std::to_string(error) + ")");
+                } else if (events & POLLWRNORM) {
+                    host.state = State::Running;
+                    onWritable(host);
+                } else if (now >= host.connectDeadline) {
+                    // Also covers WSAPoll versions that never report a
+                    // refused connect.
+                    finishHost(host, -1, "connect timed out");
+                }
+                continue;
+            }
+
+            if (events & POLLWRNORM) {
+                onWritable(host);
+            }
+            if (host.state == State::Running && (events & (POLLRDNORM | POLLERR | POLLHUP))) {
+                onReadable(host);
+            }
+            if (host.state == State::Running && host.deadline && now >= host.deadline) {
+                finishHost(host, -1, "timed out");
+            }
+        }
+
+        if (!m_stdout.empty()) {
+            std::cout << m_stdout;
+            std::cout.flush();
+            m_stdout.clear();
+        }
+        if (!m_stderr.empty()) {
+            std::cerr << m_stderr;
+            std::cerr.flush();
+            m_stderr.clear();
+        }
+    }
+
+    printSummary((monotonicMicros() - started) / 1e6);
+
+    bool unreachable = false;
+    bool failed = false;
+    for (const auto& host : m_hosts) {
+        unreachable = unreachable || !host.result.error.empty();
+        failed = failed || host.result.exitCode != 0;
+    }
+    return unreachable ? EXEC_ERROR_EXIT_CODE : failed ? 1 : 0;
+}
+
+std::vector<FanoutClient::Result> FanoutClient::results() const {
+    std::vector<Result> results;
+    for (const auto& host : m_hosts) {
+        results.push_back(host.result);
+    }
+    return results;
+}
+
+void FanoutClient::startHost(Host& host) {
+    uint64_t now = monotonicMicros();
+    host.startedAt = now;
+
+    sockaddr_in address;
+    if (!resolveHost(host.target.host, host.target.port, address)) {
+        finishHost(host, -1, "cannot resolve " + host.target.host);
+        return;
+    }
+    if (!host.socket.create() || !host.socket.setBlocking(false)) {
+        finishHost(host, -1, "cannot create socket (error " + std::to_string(WSAGetLastError()) + ")");
+        return;
+    }
+    host.socket.setNoDelay(true);
+    if (::connect(host.socket.getHandle(), (sockaddr*)&address, sizeof(address)) == SOCKET_ERROR &&
+        WSAGetLastError() != WSAEWOULDBLOCK) {
+        finishHost(host, -1, "connect failed (error " + std::to_string(WSAGetLastError()) + ")");
+        return;
+    }
+
+    host.state = State::Connecting;
+    host.reader = std::make_unique<FrameReader>();
+    host.connectDeadline = now + (uint64_t)m_options.connectTimeoutMs * 1000;
+    host.deadline = m_options.timeoutMs ? now + (uint64_t)m_options.timeoutMs * 1000 : 0;
+
+    // Goes out as soon as the connection is up. With encryption the command
+    // has to wait for the server's Key.
+    uint32_t features = m_options.compress ? FeatureCompression : 0;
+    if (!m_options.encrypt) {
+        queueControl(host, 0, ControlCode::Hello, features);
+        queueCommand(host);
+        return;
+    }
+    host.layer = std::make_unique<RecordLayer>();
+    if (!host.layer->begin()) {
+        finishHost(host, -1, "cannot generate a key pair");
+        return;
+    }
+    queueControl(host, 0, ControlCode::Hello, features | FeatureEncryption);
+    queueFrame(host, Channel::Key, host.layer->publicKey(), CRYPTO_KEY_SIZE, 0);
+}
+
+void FanoutClient::queueCommand(Host& host) {
+    queueFrame(host, Channel::Exec, m_command.data(), (uint32_t)m_command.size(), EXEC_SESSION);
+    queueControl(host, EXEC_SESSION, ControlCode::CloseStdin);
+    queueControl(host, 0, ControlCode::CloseSession);
+}
+
+// Before the keys only the server's Key, or its Hello turning encryption
+// down, matter; anything else is session 0's.
+void FanoutClient::continueHandshake(Host& host, const Frame& frame) {
+    if (isRefusal(frame)) {
+        finishHost(host, -1, "server at its connection limit");
+        return;
+    }
+    if (frame.channel == Channel::Key) {
+        if (!host.layer->complete(frame, true)) {
+            finishHost(host, -1, "key exchange failed");
+            return;
+        }
+        queueCommand(host);
+        return;
+    }
+
+    ControlPayload control;
+    if (frame.channel == Channel::Control && decodeControl(frame, control) &&
+        (ControlCode)control.code == ControlCode::Hello && !(control.value & FeatureEncryption)) {
+        host.layer.reset();
+        queueCommand(host);
+    }
+}
+
+void FanoutClient::onWritable(Host& host) {
+    while (!host.outbox.empty()) {
+        int bytesSent = host.socket.send(host.outbox.data(), host.outbox.size());
+        if (bytesSent > 0) {
+            host.outbox.erase(0, bytesSent);
+        } else if (WSAGetLastError() == WSAEWOULDBLOCK) {
+            return;
+        } else {
+            finishHost(host, -1, "send failed (error " + std::to_string(WSAGetLastError()) + ")");
+            return;
+        }
+    }
+}
+
+void FanoutClient::onReadable(Host& host) {
+    FrameReader& reader = *host.reader;
+    int bytesRead = host.socket.recv(reader.writePointer(), reader.writableSize());
+    if (bytesRead == 0) {
+        finishHost(host, -1, "connection closed before the command finished");
+        return;
+    }
+    if (bytesRead < 0) {
+        if (WSAGetLastError() != WSAEWOULDBLOCK) {
+            finishHost(host, -1, "receive failed (error " + std::to_string(WSAGetLastError()) + ")");
+        }
+        return;
+    }
+    reader.commit(bytesRead);
+
+    uint32_t credit = 0;
+    Frame frame;
+    bool queued = false;
+    while (host.state == State::Running && reader.next(frame)) {
+        if (host.layer && !host.layer->isSecure()) {
+            continueHandshake(host, frame);
+            queued = true;
+            continue;
+        }
+        if (host.layer && !host.layer->open(frame)) {
+            finishHost(host, -1, "record from server failed to authenticate");
+            return;
+        }
+        handleFrame(host, frame, credit);
+    }
+    if (host.state != State::Running) {
+        return;
+    }
+    if (reader.isCorrupt()) {
+        finishHost(host, -1, "malformed frame from server");
+        return;
+    }
+    if (credit > 0) {
+        queueControl(host, EXEC_SESSION, ControlCode::WindowUpdate, credit);
+        queued = true;
+    }
+    if (queued) {
+        onWritable(host);
+    }
+}
+
+bool FanoutClient::handleFrame(Host& host, const Frame& frame, uint32_t& credit) {
+    if (isRefusal(frame)) {
+        finishHost(host, -1, "server at its connection limit");
+        return false;
+    }
+    if (frame.session != EXEC_SESSION) {
+        return true;
+    }
+
+    switch (frame.channel) {
+    case Channel::Stdout:
+    case Channel::Stderr: {
+        const char* data = frame.payload;
+        size_t length = frame.length;
+        StreamDecompressor& decompressor = host.decompressors[(uint8_t)frame.channel];
+        if (frame.flags & FrameCompressed) {
+            if (!decompressor.decompress(frame.payload, frame.length, data, length)) {
+                finishHost(host, -1, "corrupt compressed output");
+                return false;
+            }
+        } else {
+            decompressor.append(frame.payload, frame.length);
+        }
+        printOutput(host, frame.channel, data, length);
+        credit += (uint32_t)length;
+        return true;
+    }
+
+    case Channel::Control: {
+        ControlPayload control;
+        if (decodeControl(frame, control) && (ControlCode)control.code == ControlCode::SessionOpened &&
+            control.value != (uint32_t)OpenStatus::Ok) {
+            finishHost(host, -1, std::string("cannot run command: ") + describeOpenStatus(control.value));
+            return false;
+        }
+        return true;
+    }
+
+    case Channel::ExitStatus: {
+        ExitStatusPayload status;
+        decodeExitStatus(frame, status);
+        finishHost(host, (int)status.exitCode, std::string());
+        return false;
+    }
+
+    default:
+        return true;
+    }
+}
+
+void FanoutClient::queueControl(Host& host, uint16_t session, ControlCode code, uint32_t value) {
+    ControlPayload payload;
+    encodeControl(payload, code, value);
+    queueFrame(host, Channel::Control, &payload, sizeof(payload), session);
+}
+
+void FanoutClient::queueFrame(Host& host, Channel channel, const void* payload, uint32_t length, uint16_t session) {
+    OutgoingFrame frame;
+    frame.prepare(channel, payload, length, 0, session);
+    if (host.layer && host.layer->isSecure()) {
+        if (m_sealBuffer.size() < length) {
+            m_sealBuffer.resize(length);
+        }
+        host.layer->seal(frame, m_sealBuffer.data());
+    }
+    for (DWORD i = 0; i < frame.count; ++i) {
+        host.outbox.append(frame.buffers[i].buf, frame.buffers[i].len);
+    }
+}
+
+void FanoutClient::printOutput(Host& host, Channel channel, const char* data, size_t length) {
+    if (m_options.quiet) {
+        return;
+    }
+    bool isStdout = channel == Channel::Stdout;
+    std::string& partial = host.partial[isStdout ? 0 : 1];
+    std::string& out = isStdout ? m_stdout : m_stderr;
+
+    // Only whole lines are printed, so hosts do not interleave mid-line.
+    partial.append(data, length);
+    size_t start = 0;
+    size_t end;
+    while ((end = partial.find('\n', start)) != std::string::npos) {
+        out += host.target.name;
+        out += ": ";
+        out.append(partial, start, end + 1 - start);
+        start = end + 1;
+    }
+    partial.erase(0, start);
+}
+
+void FanoutClient::finishHost(Host& host, int exitCode, const std::string& error) {
+    for (int i = 0; i < 2; ++i) {
+        if (!host.partial[i].empty()) {
+            printOutput(host, i == 0 ? Channel::Stdout : Channel::Stderr, "\n", 1);
+        }
+    }
+
+    host.result.exitCode = exitCode;
+    host.result.error = error;
+    host.result.seconds = (monotonicMicros() - host.startedAt) / 1e6;
+    host.state = State::Done;
+
+    // Only the result is kept, so finished hosts cost next to nothing.
+    host.socket.close();
+    host.reader.reset();
+    host.decompressors.clear();
+    host.layer.reset();
+    host.outbox.clear();
+}
+
+void FanoutClient::printSummary(double seconds) {
+    size_t width = 0;
+    for (const auto& host : m_hosts) {
+        width = std::max(width, host.target.name.size());
+    }
+
+    std::map<int, size_t> exitCodes;
+    size_t errors = 0;
+    std::vector<double> times;
+    std::cout << std::fixed << std::setprecision(3);
+    for (const auto& host : m_hosts) {
+        const Result& result = host.result;
+        times.push_back(result.seconds);
+        if (result.error.empty()) {
+            ++exitCodes[result.exitCode];
+        } else {
+            ++errors;
+        }
+        if (m_options.quiet) {
+            continue;
+        }
+
+        std::cout << std::left << std::setw((int)width) << result.name << std::right << "  ";
+        if (result.error.empty()) {
+            std::cout << "exit " << std::setw(4) << result.exitCode;
+        } else {
+            std::cout << "error: " << result.error;
+        }
+        std::cout << "  " << result.seconds << " s" << std::endl;
+    }
+    std::sort(times.begin(), times.end());
+
+    std::cout << m_hosts.size() << " hosts in " << seconds << " s";
+    for (const auto& entry : exitCodes) {
+        std::cout << ", " << entry.second << " exit " << entry.first;
+    }
+    if (errors > 0) {
+        std::cout << ", " << errors << " unreachable";
+    }
+    if (!times.empty()) {
+        std::cout << "; per host median " << times[times.size() / 2] << " s, max " << times.back() << " s";
+    }
+    std::cout << std::endl;
+    std::cout << std::defaultfloat << std::setprecision(6);
+}
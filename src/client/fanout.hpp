@@ -0,0 +1,127 @@
+#pragma once
+#ifndef FANOUT_HPP
+#define FANOUT_HPP
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../utils.hpp"
+#include "../define.hpp"
+#include "../protocol/protocol.hpp"
+#include "../compress/compress.hpp"
+
+struct FanoutOptions {
+    // Hosts connected or running at once.
+    size_t concurrency;
+    // Per host: time to get connected, and to finish altogether (0 = none).
+    uint32_t connectTimeoutMs;
+    uint32_t timeoutMs;
+    // Ask the servers to compress output.
+    bool compress;
+    // Print only the totals line: no output and no line per host.
+    bool quiet;
+    // Exchange keys with every host before sending the command.
+    bool encrypt;
+
+    FanoutOptions()
+        : concurrency(FANOUT_CONCURRENCY),
+          connectTimeoutMs(FANOUT_CONNECT_TIMEOUT_MS),
+          timeoutMs(FANOUT_TIMEOUT_MS),
+          compress(true),
+          quiet(false),
+          encrypt(true) {}
+};
+
+// A host to run on, as given ("name" or "name:port"), and where it is.
+struct FanoutTarget {
+    std::string name;
+    std::string host;
+    unsigned short port;
+};
+
+// Parses "host[:port]" entries, one per line or separated by commas;
+// blank lines and lines starting with '#' are skipped.
+bool parseTargets(const std::string& text, std::vector<FanoutTarget>& targets);
+
+// Runs one command on many servers at once (`-m COMMAND --hosts ...`), the
+// way `-e` runs it on one. Every host is a non-blocking socket driven by a
+// single WSAPoll loop on the calling thread, so a thousand targets cost a
+// thousand sockets but no extra threads; at most `concurrency` of them are
+// open at a time and the rest wait their turn. Output is printed as it
+// arrives, one line at a time prefixed with the host, stderr lines on
+// stderr. At the end every host's exit code or error is listed with its
+// time, followed by totals. With encryption the command is queued only once
+// the host's Key frame has arrived.
+class FanoutClient {
+public:
+    struct Result {
+        std::string name;
+        // Exit code of the command, or -1 with `error` set.
+        int exitCode = -1;
+        std::string error;
+        double seconds = 0.0;
+    };
+
+private:
+    enum class State {
+        Queued,
+        Connecting,
+        Running,
+        Done
+    };
+
+    struct Host {
+        FanoutTarget target;
+        State state = State::Queued;
+        Socket socket;
+        std::unique_ptr<FrameReader> reader;
+        std::map<uint8_t, StreamDecompressor> decompressors;
+        // Set while encrypting; not yet secure during the key exchange.
+        std::unique_ptr<RecordLayer> layer;
+        // Frames not yet accepted by the socket.
+        std::string outbox;
+        // Unfinished last line of stdout and stderr.
+        std::string partial[2];
+        uint64_t startedAt = 0;
+        uint64_t connectDeadline = 0;
+        uint64_t deadline = 0;
+        Result result;
+    };
+
+    std::vector<Host> m_hosts;
+    std::string m_command;
+    FanoutOptions m_options;
+    std::string m_stdout;
+    std::string m_stderr;
+    // Records are encrypted into this on their way to an outbox.
+    std::vector<char> m_sealBuffer;
+
+public:
+    FanoutClient(const std::vector<FanoutTarget>& targets, const std::string& command,
+                 const FanoutOptions& options = FanoutOptions());
+    ~FanoutClient();
+
+    // Runs everywhere and prints the summary. Returns 0 if the command exited
+    // 0 on every host, 1 if it failed somewhere, or EXEC_ERROR_EXIT_CODE if a
+    // host could not run it at all.
+    int run();
+    std::vector<Result> results() const;
+
+private:
+    void startHost(Host& host);
+    void onWritable(Host& host);
+    void onReadable(Host& host);
+    void continueHandshake(Host& host, const Frame& frame);
+    void queueCommand(Host& host);
+    // Returns false once the host is done.
+    bool handleFrame(Host& host, const Frame& frame, uint32_t& credit);
+    void queueControl(Host& host, uint16_t session, ControlCode code, uint32_t value = 0);
+    void queueFrame(Host& host, Channel channel, const void* payload, uint32_t length, uint16_t session);
+    void printOutput(Host& host, Channel channel, const char* data, size_t length);
+    void finishHost(Host& host, int exitCode, const std::string& error);
+    void printSummary(double seconds);
+};
+
+#endif // FANOUT_HPP
@@ -0,0 +1,502 @@
+#include <algorithm>
+#include <sstream>
+
+#include "files.hpp"
+
+static const char* statusName(FileStatus status) {
+    switch (status) {
+    case FileStatus::Ok:
+        return "ok";
+    case FileStatus::NotFound:
+        return "not found";
+    case FileStatus::AccessDenied:
+        return "access denied";
+    case FileStatus::Checksum:
+        return "checksum mismatch";
+    case FileStatus::Cancelled:
+        return "cancelled";
+    case FileStatus::Limit:
+        return "too many transfers";
+    default:
+        return "failed";
+    }
+}
+
+static std::string baseName(const std::string& path) {
+    size_t slash = path.find_last_of("\\/");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+TransferManager::Transfer::Transfer(FileOp op, const std::string& localPath, const std::string& remotePath,
+                                    bool resumeExisting)
+    : direction(op),
+      local(localPath),
+      remote(remotePath),
+      resume(resumeExisting),
+      attempts(0),
+      ready(false),
+      localStatus(FileStatus::Ok),
+      size(0),
+      complete(0),
+      next(0),
+      credit(FILE_WINDOW),
+      file(INVALID_HANDLE_VALUE) {}
+
+TransferManager::Transfer::~Transfer() {
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+    }
+}
+
+TransferManager::TransferManager(Sender send, Reporter report, size_t parallel)
+    : m_send(std::move(send)),
+      m_report(std::move(report)),
+      m_parallel(std::max<size_t>(parallel, 1)),
+      m_nextId(1),
+      m_lastSent(0),
+      m_connected(true),
+      m_running(false),
+      m_batchStartedAt(0.0) {}
+
+TransferManager::~TransferManager() {
+    stop();
+}
+
+void TransferManager::start() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_running) {
+        m_running = true;
+        m_thread = std::thread(&TransferManager::run, this);
+    }
+}
+
+void TransferManager::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+    m_wake.notify_all();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.clear();
+    m_active.clear();
+    m_idle.notify_all();
+}
+
+void TransferManager::get(const std::string& remote, const std::string& local, bool resume) {
+    std::deque<TransferPtr> transfers;
+    transfers.push_back(std::make_shared<Transfer>(FileOp::Get, local.empty() ? baseName(remote) : local,
+                                                   remote, resume));
+    queue(transfers);
+}
+
+bool TransferManager::put(const std::string& local, const std::string& remote, bool resume) {
+    DWORD attributes = GetFileAttributesA(local.c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES) {
+        return false;
+    }
+
+    std::string target = remote.empty() ? baseName(local) : remote;
+    std::deque<TransferPtr> transfers;
+    if (attributes & FILE_ATTRIBUTE_DIRECTORY) {
+        queueDirectory(local, target, resume, transfers);
+    } else {
+        transfers.push_back(std::make_shared<Transfer>(FileOp::Put, local, target, resume));
+    }
+    queue(transfers);
+    return true;
+}
+
+void TransferManager::queueDirectory(const std::string& local, const std::string& remote, bool resume,
+                                     std::deque<TransferPtr>& transfers) {
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((local + "\\*").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    do {
+        std::string name = data.cFileName;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            queueDirectory(local + "\\" + name, remote + "\\" + name, resume, transfers);
+        } else {
+            transfers.push_back(std::make_shared<Transfer>(FileOp::Put, local + "\\" + name,
+                                                           remote + "\\" + name, resume));
+        }
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+}
+
+void TransferManager::queue(std::deque<TransferPtr>& transfers) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queue.empty() && m_active.empty()) {
+            m_batchStart = m_totals;
+            m_batchStartedAt = monotonicMicros() / 1e6;
+        }
+        for (auto& transfer : transfers) {
+            m_queue.push_back(std::move(transfer));
+        }
+    }
+    m_wake.notify_all();
+}
+
+void TransferManager::cancelAll() {
+    std::vector<uint16_t> ids;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.clear();
+        for (auto& entry : m_active) {
+            if (entry.second->localStatus == FileStatus::Ok) {
+                entry.second->localStatus = FileStatus::Cancelled;
+                ids.push_back(entry.first);
+            }
+        }
+        checkIdle();
+    }
+
+    FilePayload payload;
+    encodeFile(payload, FileOp::Cancel, 0, 0);
+    for (uint16_t id : ids) {
+        m_send(id, payload, nullptr, 0);
+    }
+}
+
+void TransferManager::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        // Start queued transfers while there is room. The entry is made
+        // before the request goes out, so its answer always finds it.
+        if (m_connected && !m_queue.empty() && m_active.size() < m_parallel) {
+            TransferPtr transfer = m_queue.front();
+            m_queue.pop_front();
+            uint16_t id = allocateId();
+            m_active[id] = transfer;
+            lock.unlock();
+
+            bool opened = openLocal(*transfer);
+            bool sent = opened && request(id, *transfer);
+
+            lock.lock();
+            if (!opened) {
+                m_active.erase(id);
+                ++m_totals.failed;
+                m_report("Cannot open " + transfer->local + ": error " + std::to_string(GetLastError()));
+                checkIdle();
+            } else if (!sent) {
+                m_connected = false;
+            }
+            continue;
+        }
+
+        uint16_t id;
+        TransferPtr transfer;
+        uint64_t offset;
+        uint32_t length;
+        if (m_connected && takeChunk(id, transfer, offset, length)) {
+            lock.unlock();
+            bool sent = sendChunk(id, *transfer, offset, length);
+            lock.lock();
+            if (!sent) {
+                m_connected = false;
+            }
+            continue;
+        }
+
+        m_wake.wait(lock);
+    }
+}
+
+bool TransferManager::openLocal(Transfer& transfer) {
+    if (transfer.direction == FileOp::Put) {
+        if (!transfer.source.open(transfer.local)) {
+            return false;
+        }
+        transfer.size = transfer.source.size();
+        return true;
+    }
+
+    createParentDirectories(transfer.local);
+    transfer.file = CreateFileA(transfer.local.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                                transfer.resume ? OPEN_ALWAYS : CREATE_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (transfer.file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    // Downloads are only ever written in order after their checksum passed,
+    // so whatever is on disk is good to continue from.
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(transfer.file, &size) || !SetFilePointerEx(transfer.file, size, nullptr, FILE_BEGIN)) {
+        return false;
+    }
+    transfer.complete = (uint64_t)size.QuadPart;
+    return true;
+}
+
+bool TransferManager::request(uint16_t id, const Transfer& transfer) {
+    FilePayload payload;
+    if (transfer.direction == FileOp::Get) {
+        encodeFile(payload, FileOp::Get, 0, transfer.complete);
+    } else {
+        encodeFile(payload, FileOp::Put, transfer.resume ? FileResume : 0, 0, transfer.size);
+    }
+    return m_send(id, payload, transfer.remote.data(), (uint32_t)transfer.remote.size());
+}
+
+bool TransferManager::takeChunk(uint16_t& id, TransferPtr& transfer, uint64_t& offset, uint32_t& length) {
+    // Round-robin from the transfer served last, so one large upload does
+    // not starve the rest.
+    auto start = m_active.upper_bound(m_lastSent);
+    for (size_t i = 0; i < m_active.size(); ++i, ++start) {
+        if (start == m_active.end()) {
+            start = m_active.begin();
+        }
+        Transfer& candidate = *start->second;
+        if (candidate.direction != FileOp::Put || !candidate.ready ||
+            candidate.localStatus != FileStatus::Ok || candidate.next >= candidate.size) {
+            continue;
+        }
+
+        uint32_t chunk = fileChunkAt(candidate.next, candidate.size);
+        if (candidate.credit < (int64_t)chunk) {
+            continue;
+        }
+
+        id = start->first;
+        transfer = start->second;
+        offset = candidate.next;
+        length = chunk;
+        candidate.next += chunk;
+        candidate.credit -= chunk;
+        m_lastSent = id;
+        return true;
+    }
+    return false;
+}
+
+bool TransferManager::sendChunk(uint16_t id, Transfer& transfer, uint64_t offset, uint32_t length) {
+    // Only this thread touches an upload's mapped file.
+    const char* data = transfer.source.acquire(offset, length);
+    if (!data) {
+        FilePayload cancel;
+        encodeFile(cancel, FileOp::Cancel, 0, 0);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            transfer.localStatus = FileStatus::Failed;
+        }
+        return m_send(id, cancel, nullptr, 0);
+    }
+
+    FilePayload payload;
+    encodeFile(payload, FileOp::Data, adler32(data, length), offset);
+    bool sent = m_send(id, payload, data, length);
+    transfer.source.release(offset);
+    return sent;
+}
+
+void TransferManager::handleFrame(const Frame& frame) {
+    FileMessage message;
+    if (!decodeFile(frame, message)) {
+        return;
+    }
+
+    FilePayload reply;
+    bool sendReply = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_active.find(frame.session);
+        if (it == m_active.end()) {
+            return;
+        }
+        Transfer& transfer = *it->second;
+
+        switch (message.op) {
+        case FileOp::Ready:
+            transfer.ready = true;
+            transfer.size = message.size;
+            if (transfer.direction == FileOp::Put) {
+                transfer.next = transfer.complete = message.offset;
+                m_wake.notify_all();
+            } else if (message.offset < transfer.complete) {
+                // The server's copy is shorter than ours; start over there.
+                LARGE_INTEGER position;
+                position.QuadPart = (LONGLONG)message.offset;
+                truncateFile(transfer.file, message.offset);
+                SetFilePointerEx(transfer.file, position, nullptr, FILE_BEGIN);
+                transfer.complete = message.offset;
+            }
+            break;
+
+        case FileOp::Data:
+            sendReply = transfer.direction == FileOp::Get && receiveData(transfer, message, reply);
+            break;
+
+        case FileOp::Ack:
+            transfer.credit += message.value;
+            transfer.complete = std::max(transfer.complete, message.offset);
+            m_totals.bytes += message.value;
+            m_wake.notify_all();
+            break;
+
+        case FileOp::Done:
+            finishTransfer(frame.session, (FileStatus)message.value, message.offset);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    if (sendReply) {
+        m_send(frame.session, reply, nullptr, 0);
+    }
+}
+
+bool TransferManager::receiveData(Transfer& transfer, const FileMessage& message, FilePayload& reply) {
+    // Ready travels with the server's control replies and Data does not,
+    // so the first chunks may overtake it; they start where we asked.
+    if (transfer.localStatus != FileStatus::Ok) {
+        // Still arriving after we cancelled.
+        return false;
+    }
+
+    DWORD written = 0;
+    if (message.offset != transfer.complete) {
+        transfer.localStatus = FileStatus::Failed;
+    } else if (adler32(message.data, message.length) != message.value) {
+        transfer.localStatus = FileStatus::Checksum;
+    } else if (!WriteFile(transfer.file, message.data, message.length, &written, nullptr) ||
+               written != message.length) {
+        transfer.localStatus = fileStatusFromError(GetLastError());
+    } else {
+        transfer.complete += message.length;
+        m_totals.bytes += message.length;
+        encodeFile(reply, FileOp::Ack, message.length, transfer.complete);
+        return true;
+    }
+
+    encodeFile(reply, FileOp::Cancel, 0, 0);
+    return true;
+}
+
+void TransferManager::finishTransfer(uint16_t id, FileStatus status, uint64_t complete) {
+    TransferPtr transfer = m_active[id];
+    m_active.erase(id);
+
+    FileStatus result = transfer->localStatus != FileStatus::Ok ? transfer->localStatus : status;
+    if (result == FileStatus::Ok && transfer->direction == FileOp::Get && transfer->complete != complete) {
+        result = FileStatus::Failed;
+    }
+
+    bool retryable = result == FileStatus::Checksum || result == FileStatus::Failed || result == FileStatus::Limit;
+    if (retryable && transfer->attempts + 1 < FILE_RETRIES) {
+        // A fresh entry, since the sending thread may still hold this one;
+        // it continues from what the receiving side verified.
+        TransferPtr retry = std::make_shared<Transfer>(transfer->direction, transfer->local, transfer->remote, true);
+        retry->attempts = transfer->attempts + 1;
+        m_queue.push_front(retry);
+        m_wake.notify_all();
+        return;
+    }
+
+    if (result == FileStatus::Ok) {
+        ++m_totals.files;
+    } else {
+        ++m_totals.failed;
+        if (result != FileStatus::Cancelled) {
+            m_report(std::string(transfer->direction == FileOp::Get ? "Get " : "Put ") + transfer->remote +
+                     " failed: " + statusName(result));
+        }
+    }
+    m_wake.notify_all();
+    checkIdle();
+}
+
+void TransferManager::checkIdle() {
+    if (!m_queue.empty() || !m_active.empty()) {
+        return;
+    }
+
+    uint64_t files = m_totals.files - m_batchStart.files;
+    uint64_t failed = m_totals.failed - m_batchStart.failed;
+    uint64_t bytes = m_totals.bytes - m_batchStart.bytes;
+    if (files + failed > 0) {
+        double seconds = std::max(monotonicMicros() / 1e6 - m_batchStartedAt, 1e-6);
+        std::ostringstream message;
+        message << "Transferred " << files << " file" << (files == 1 ? "" : "s") << ", "
+                << bytes / 1e6 << " MB in " << seconds << " s (" << bytes / 1e6 / seconds << " MB/s)";
+        if (failed > 0) {
+            message << ", " << failed << " failed";
+        }
+        m_report(message.str());
+    }
+    m_batchStart = m_totals;
+    m_idle.notify_all();
+}
+
+void TransferManager::disconnected() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_connected = false;
+}
+
+void TransferManager::reconnected() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_active.rbegin(); it != m_active.rend(); ++it) {
+            const Transfer& transfer = *it->second;
+            if (transfer.localStatus == FileStatus::Cancelled) {
+                continue;
+            }
+            TransferPtr retry = std::make_shared<Transfer>(transfer.direction, transfer.local, transfer.remote, true);
+            retry->attempts = transfer.attempts;
+            m_queue.push_front(retry);
+        }
+        m_active.clear();
+        m_connected = true;
+        checkIdle();
+    }
+    m_wake.notify_all();
+}
+
+bool TransferManager::waitIdle(DWORD timeoutMs) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_idle.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                           [&] { return m_queue.empty() && m_active.empty(); });
+}
+
+TransferManager::Totals TransferManager::totals() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_totals;
+}
+
+std::string TransferManager::describe() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::ostringstream out;
+    for (auto& entry : m_active) {
+        const Transfer& transfer = *entry.second;
+        out << "  " << entry.first << (transfer.direction == FileOp::Get ? " get " : " put ")
+            << transfer.remote << ": " << transfer.complete << " of " << transfer.size << " bytes" << std::endl;
+    }
+    out << m_queue.size() << " queued" << std::endl;
+    return out.str();
+}
+
+uint16_t TransferManager::allocateId() {
+    // Ids advance round-robin so one is not reused right after its Done,
+    // while the server may still be tearing the old transfer down.
+    uint16_t id;
+    do {
+        id = m_nextId++;
+        if (m_nextId == 0) {
+            m_nextId = 1;
+        }
+    } while (m_active.count(id));
+    return id;
+}
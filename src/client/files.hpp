@@ -0,0 +1,132 @@
+#pragma once
+#ifndef FILES_HPP
+#define FILES_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "../utils.hpp"
+#include "../define.hpp"
+#include "../protocol/protocol.hpp"
+#include "../metrics/metrics.hpp"
+#include "../file/file.hpp"
+
+// Client side of file transfers. Gets and puts are queued and up to
+// `parallel` of them run at once over the connection, so a directory of
+// small files does not pay a round trip per file. Downloads are checked
+// and written by the thread that receives their Data frames; uploads are
+// read from mapped files and sent by the manager's own thread, within
+// FILE_WINDOW bytes of credit each, so a blocked send never holds up the
+// receiving side. A transfer that fails on a checksum or a dropped
+// connection is requested again, resuming from what was verified.
+class TransferManager {
+public:
+    // Sends one File frame for transfer `id`: the payload, then `length`
+    // bytes of data (a path or file data). False if the connection is gone.
+    typedef std::function<bool(uint16_t id, const FilePayload& payload, const char* data, uint32_t length)> Sender;
+    // Shows a failure or a finished batch to the user.
+    typedef std::function<void(const std::string& message)> Reporter;
+
+    struct Totals {
+        uint64_t files = 0;
+        uint64_t failed = 0;
+        uint64_t bytes = 0;
+    };
+
+private:
+    struct Transfer {
+        FileOp direction;
+        std::string local;
+        std::string remote;
+        bool resume;
+        int attempts;
+
+        // State of the current attempt. `complete` is how much of the file
+        // is verified on the receiving side; an upload has sent up to `next`.
+        bool ready;
+        FileStatus localStatus;
+        uint64_t size;
+        uint64_t complete;
+        uint64_t next;
+        int64_t credit;
+        HANDLE file;
+        MappedFile source;
+
+        Transfer(FileOp op, const std::string& localPath, const std::string& remotePath, bool resumeExisting);
+        ~Transfer();
+    };
+    typedef std::shared_ptr<Transfer> TransferPtr;
+
+    Sender m_send;
+    Reporter m_report;
+    size_t m_parallel;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    std::deque<TransferPtr> m_queue;
+    std::map<uint16_t, TransferPtr> m_active;
+    uint16_t m_nextId;
+    uint16_t m_lastSent;
+    bool m_connected;
+    bool m_running;
+    Totals m_totals;
+    Totals m_batchStart;
+    double m_batchStartedAt;
+    std::thread m_thread;
+
+public:
+    TransferManager(Sender send, Reporter report, size_t parallel = FILE_PARALLEL);
+    ~TransferManager();
+
+    void start();
+    void stop();
+
+    // Queues a download of `remote` into `local`. With `resume`, an
+    // existing local file is kept and only the rest is fetched.
+    void get(const std::string& remote, const std::string& local, bool resume);
+    // Queues an upload of `local`, or of every file under it if it is a
+    // directory, to `remote`. False if `local` does not exist.
+    bool put(const std::string& local, const std::string& remote, bool resume);
+    // Drops queued transfers and cancels running ones.
+    void cancelAll();
+
+    // Called by the receiving thread for every File frame.
+    void handleFrame(const Frame& frame);
+
+    // The connection dropped; nothing is sent until reconnected().
+    void disconnected();
+    // Requests every running transfer again on the new connection, each
+    // resuming from what it has verified so far.
+    void reconnected();
+
+    // Waits until nothing is queued or running; false on timeout.
+    bool waitIdle(DWORD timeoutMs);
+    Totals totals();
+    // One line per running transfer and a count of queued ones.
+    std::string describe();
+
+private:
+    void run();
+    void queue(std::deque<TransferPtr>& transfers);
+    void queueDirectory(const std::string& local, const std::string& remote, bool resume,
+                        std::deque<TransferPtr>& transfers);
+    bool openLocal(Transfer& transfer);
+    bool request(uint16_t id, const Transfer& transfer);
+    bool takeChunk(uint16_t& id, TransferPtr& transfer, uint64_t& offset, uint32_t& length);
+    bool sendChunk(uint16_t id, Transfer& transfer, uint64_t offset, uint32_t length);
+
+    // The rest need m_mutex held.
+    uint16_t allocateId();
+    bool receiveData(Transfer& transfer, const FileMessage& message, FilePayload& reply);
+    void finishTransfer(uint16_t id, FileStatus status, uint64_t complete);
+    void checkIdle();
+};
+
+#endif // FILES_HPP
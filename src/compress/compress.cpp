@@ -0,0 +1,250 @@
+#include <cstring>
+
+#include "compress.hpp"
+
+#define HASH_BITS 12
+#define MIN_MATCH 4
+#define LAST_LITERALS 5
+#define MATCH_FIND_LIMIT 12
+
+// Blocks that fail to compress this many times in a row put the stream into
+// a sampling mode where only one block in SKIP_INTERVAL is tried.
+#define MISS_THRESHOLD 4
+#define SKIP_INTERVAL 8
+
+static inline uint32_t read32(const char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t hashSequence(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static inline char* writeLength(char* out, size_t length) {
+    while (length >= 255) {
+        *out++ = (char)255;
+        length -= 255;
+    }
+    *out++ = (char)length;
+    return out;
+}
+
+static char* writeSequence(char* out, const char* literals, size_t literalCount,
+                           size_t matchLength, uint32_t distance) {
+    char* token = out++;
+    uint8_t value = 0;
+
+    if (literalCount >= 15) {
+        value = 15 << 4;
+        out = writeLength(out, literalCount - 15);
+    } else {
+        value = (uint8_t)(literalCount << 4);
+    }
+    memcpy(out, literals, literalCount);
+    out += literalCount;
+
+    if (matchLength > 0) {
+        *out++ = (char)(distance & 0xFF);
+        *out++ = (char)(distance >> 8);
+
+        size_t code = matchLength - MIN_MATCH;
+        if (code >= 15) {
+            value |= 15;
+            out = writeLength(out, code - 15);
+        } else {
+            value |= (uint8_t)code;
+        }
+    }
+
+    *token = (char)value;
+    return out;
+}
+
+StreamHistory::StreamHistory() : m_size(0), m_base(0) {}
+
+void StreamHistory::reserve(size_t length) {
+    if (m_buffer.empty()) {
+        m_buffer.resize(COMPRESS_WINDOW + MAX_FRAME_PAYLOAD);
+    }
+    if (m_size + length <= m_buffer.size()) {
+        return;
+    }
+
+    size_t shift = m_size - COMPRESS_WINDOW;
+    memmove(m_buffer.data(), m_buffer.data() + shift, COMPRESS_WINDOW);
+    m_size = COMPRESS_WINDOW;
+    m_base += (uint32_t)shift;
+}
+
+StreamCompressor::StreamCompressor() : m_misses(0), m_skipped(0) {}
+
+size_t StreamCompressor::compress(const char* data, size_t length, char* out) {
+    bool attempt = length >= COMPRESS_MIN_BLOCK;
+    if (attempt && m_misses >= MISS_THRESHOLD) {
+        attempt = ++m_skipped % SKIP_INTERVAL == 0;
+    }
+
+    // Before the first compressed block the receiver keeps no history, so
+    // raw blocks are not recorded either.
+    if (!attempt && !isStarted()) {
+        return 0;
+    }
+
+    reserve(length);
+    memcpy(m_buffer.data() + m_size, data, length);
+
+    size_t compressed = 0;
+    if (attempt) {
+        if (m_table.empty()) {
+            m_table.assign(1 << HASH_BITS, 0);
+        }
+        compressed = encode(m_size, m_size + length, out);
+
+        if (compressed >= length - length / 16) {
+            compressed = 0;
+            ++m_misses;
+        } else {
+            m_misses = 0;
+            m_skipped = 0;
+        }
+    }
+
+    if (compressed > 0 || isStarted()) {
+        m_size += length;
+    }
+    return compressed;
+}
+
+size_t StreamCompressor::encode(size_t start, size_t end, char* out) {
+    const char* buffer = m_buffer.data();
+    char* cursor = out;
+    size_t anchor = start;
+    size_t i = start;
+
+    if (end - start > MATCH_FIND_LIMIT) {
+        size_t findLimit = end - MATCH_FIND_LIMIT;
+        size_t matchLimit = end - LAST_LITERALS;
+
+        while (i < findLimit) {
+            uint32_t sequence = read32(buffer + i);
+            uint32_t& slot = m_table[hashSequence(sequence)];
+            uint32_t distance = (m_base + (uint32_t)i) - slot;
+            slot = m_base + (uint32_t)i;
+
+            // Entries are only hints: they may be stale or belong to a block
+            // that was never committed, so the bytes are always compared.
+            if (distance == 0 || distance > COMPRESS_WINDOW || distance > i ||
+                read32(buffer + i - distance) != sequence) {
+                // Step faster through data that keeps missing.
+                i += 1 + ((i - anchor) >> 6);
+                continue;
+            }
+
+            while (i > anchor && i - distance > 0 && buffer[i - 1] == buffer[i - distance - 1]) {
+                --i;
+            }
+
+            size_t matchEnd = i + MIN_MATCH;
+            while (matchEnd < matchLimit && buffer[matchEnd] == buffer[matchEnd - distance]) {
+                ++matchEnd;
+            }
+
+            cursor = writeSequence(cursor, buffer + anchor, i - anchor, matchEnd - i, distance);
+            i = matchEnd;
+            anchor = i;
+        }
+    }
+
+    cursor = writeSequence(cursor, buffer + anchor, end - anchor, 0, 0);
+    return cursor - out;
+}
+
+bool StreamDecompressor::decompress(const char* data, size_t length, const char*& out, size_t& outLength) {
+    reserve(MAX_FRAME_PAYLOAD);
+
+    char* buffer = m_buffer.data();
+    const uint8_t* input = (const uint8_t*)data;
+    const uint8_t* inputEnd = input + length;
+    size_t start = m_size;
+    size_t cursor = m_size;
+    size_t capacity = m_size + MAX_FRAME_PAYLOAD;
+
+    for (;;) {
+        if (input >= inputEnd) {
+            return false;
+        }
+        uint8_t token = *input++;
+
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t extra;
+            do {
+                if (input >= inputEnd) {
+                    return false;
+                }
+                extra = *input++;
+                literals += extra;
+            } while (extra == 255);
+        }
+        if (literals > (size_t)(inputEnd - input) || literals > capacity - cursor) {
+            return false;
+        }
+        memcpy(buffer + cursor, input, literals);
+        cursor += literals;
+        input += literals;
+
+        if (input == inputEnd) {
+            break;
+        }
+
+        if (inputEnd - input < 2) {
+            return false;
+        }
+        size_t distance = input[0] | (input[1] << 8);
+        input += 2;
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15) {
+            uint8_t extra;
+            do {
+                if (input >= inputEnd) {
+                    return false;
+                }
+                extra = *input++;
+                matchLength += extra;
+            } while (extra == 255);
+        }
+        matchLength += MIN_MATCH;
+
+        if (distance == 0 || distance > cursor || matchLength > capacity - cursor) {
+            return false;
+        }
+
+        // Overlapping matches repeat the last `distance` bytes.
+        const char* source = buffer + cursor - distance;
+        if (distance >= matchLength) {
+            memcpy(buffer + cursor, source, matchLength);
+        } else {
+            for (size_t k = 0; k < matchLength; ++k) {
+                buffer[cursor + k] = source[k];
+            }
+        }
+        cursor += matchLength;
+    }
+
+    out = buffer + start;
+    outLength = cursor - start;
+    m_size = cursor;
+    return true;
+}
+
+void StreamDecompressor::append(const char* data, size_t length) {
+    if (!isStarted()) {
+        return;
+    }
+    reserve(length);
+    memcpy(m_buffer.data() + m_size, data, length);
+    m_size += length;
+}
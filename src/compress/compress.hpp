@@ -0,0 +1,75 @@
+#pragma once
+#ifndef COMPRESS_HPP
+#define COMPRESS_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "../define.hpp"
+
+// Streaming LZ77 codec for session output. Each block is flushed on its own
+// so the receiver can decode it as soon as it arrives, but matches may refer
+// back into the previous COMPRESS_WINDOW bytes of the stream, so repetitive
+// output keeps compressing well across small blocks.
+//
+// Block format (LZ4-style sequences):
+//   token      high nibble literal count, low nibble match length - 4
+//              (15 means more length bytes follow: 255, 255, ..., <255)
+//   literals
+//   offset     uint16 little-endian distance back into the stream
+// The last sequence has literals only and ends the block.
+//
+// Both ends keep the same history. It starts with the first compressed block
+// of a stream; from then on every block of that stream, whether sent
+// compressed or raw, is appended to it.
+
+// Worst-case size of a compressed block for `length` input bytes.
+constexpr size_t compressBound(size_t length) {
+    return length + length / 255 + 16;
+}
+
+class StreamHistory {
+protected:
+    std::vector<char> m_buffer;
+    size_t m_size;
+    uint32_t m_base;
+
+    StreamHistory();
+
+    // Makes room for `length` more bytes, keeping the last window.
+    void reserve(size_t length);
+
+public:
+    bool isStarted() const { return m_size > 0; }
+};
+
+class StreamCompressor : public StreamHistory {
+private:
+    std::vector<uint32_t> m_table;
+    int m_misses;
+    int m_skipped;
+
+public:
+    StreamCompressor();
+
+    // Compresses `length` (at most MAX_FRAME_PAYLOAD) bytes into `out`, which
+    // must hold compressBound(length) bytes. Returns the compressed size, or 0 if the block should be sent
+    // raw: too small to be worth it, or the data did not compress.
+    size_t compress(const char* data, size_t length, char* out);
+
+private:
+    size_t encode(size_t start, size_t end, char* out);
+};
+
+class StreamDecompressor : public StreamHistory {
+public:
+    // Decodes one compressed block. The result stays valid until the next
+    // call; returns false if the block is malformed.
+    bool decompress(const char* data, size_t length, const char*& out, size_t& outLength);
+
+    // Records a block the sender transmitted raw.
+    void append(const char* data, size_t length);
+};
+
+#endif // COMPRESS_HPP
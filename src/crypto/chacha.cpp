@@ -0,0 +1,312 @@
+#include <atomic>
+#include <cstring>
+
+#include <immintrin.h>
+
+#include "crypto.hpp"
+
+// "expand 32-byte k"
+static const uint32_t SIGMA[4] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+
+static inline uint32_t load32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline void store32(uint8_t* p, uint32_t value) {
+    memcpy(p, &value, sizeof(value));
+}
+
+static inline uint32_t rotl32(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+#define QUARTER_ROUND(a, b, c, d)                   \
+    a += b; d ^= a; d = rotl32(d, 16);              \
+    c += d; b ^= c; b = rotl32(b, 12);              \
+    a += b; d ^= a; d = rotl32(d, 8);               \
+    c += d; b ^= c; b = rotl32(b, 7)
+
+static void doubleRounds(uint32_t x[16]) {
+    for (int i = 0; i < 10; ++i) {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+}
+
+static void scalarBlock(const uint32_t state[16], uint8_t out[64]) {
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+    doubleRounds(x);
+    for (int i = 0; i < 16; ++i) {
+        store32(out + 4 * i, x[i] + state[i]);
+    }
+}
+
+static void scalarBlocks(uint32_t state[16], char* out, const char* in, size_t blocks) {
+    uint8_t keystream[64];
+    for (; blocks > 0; --blocks, in += 64, out += 64) {
+        scalarBlock(state, keystream);
+        ++state[12];
+        for (int i = 0; i < 64; ++i) {
+            out[i] = in[i] ^ (char)keystream[i];
+        }
+    }
+}
+
+// Four blocks at once: each vector holds one state word of all four, so the
+// rounds are the scalar ones lane by lane, and a 4x4 transpose per group of
+// four words turns the result back into consecutive blocks.
+__attribute__((target("sse2")))
+static void sse2Blocks(uint32_t state[16], char* out, const char* in, size_t blocks) {
+#define SSE2_ROTL(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define SSE2_QUARTER(a, b, c, d)                                                                         \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a);                                                    \
+    d = _mm_shufflehi_epi16(_mm_shufflelo_epi16(d, 0xB1), 0xB1);                                         \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = SSE2_ROTL(b, 12);                              \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = SSE2_ROTL(d, 8);                               \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = SSE2_ROTL(b, 7)
+
+    for (; blocks >= 4; blocks -= 4, in += 256, out += 256) {
+        __m128i x[16];
+        __m128i initial[16];
+        for (int i = 0; i < 16; ++i) {
+            x[i] = _mm_set1_epi32((int)state[i]);
+        }
+        x[12] = _mm_add_epi32(x[12], _mm_set_epi32(3, 2, 1, 0));
+        memcpy(initial, x, sizeof(x));
+
+        for (int i = 0; i < 10; ++i) {
+            SSE2_QUARTER(x[0], x[4], x[8], x[12]);
+            SSE2_QUARTER(x[1], x[5], x[9], x[13]);
+            SSE2_QUARTER(x[2], x[6], x[10], x[14]);
+            SSE2_QUARTER(x[3], x[7], x[11], x[15]);
+            SSE2_QUARTER(x[0], x[5], x[10], x[15]);
+            SSE2_QUARTER(x[1], x[6], x[11], x[12]);
+            SSE2_QUARTER(x[2], x[7], x[8], x[13]);
+            SSE2_QUARTER(x[3], x[4], x[9], x[14]);
+        }
+
+        for (int group = 0; group < 4; ++group) {
+            __m128i a = _mm_add_epi32(x[4 * group], initial[4 * group]);
+            __m128i b = _mm_add_epi32(x[4 * group + 1], initial[4 * group + 1]);
+            __m128i c = _mm_add_epi32(x[4 * group + 2], initial[4 * group + 2]);
+            __m128i d = _mm_add_epi32(x[4 * group + 3], initial[4 * group + 3]);
+
+            __m128i ab0 = _mm_unpacklo_epi32(a, b);
+            __m128i cd0 = _mm_unpacklo_epi32(c, d);
+            __m128i ab1 = _mm_unpackhi_epi32(a, b);
+            __m128i cd1 = _mm_unpackhi_epi32(c, d);
+            __m128i rows[4] = {
+                _mm_unpacklo_epi64(ab0, cd0),
+                _mm_unpackhi_epi64(ab0, cd0),
+                _mm_unpacklo_epi64(ab1, cd1),
+                _mm_unpackhi_epi64(ab1, cd1)
+            };
+
+            for (int block = 0; block < 4; ++block) {
+                size_t at = 64 * block + 16 * group;
+                __m128i data = _mm_loadu_si128((const __m128i*)(in + at));
+                _mm_storeu_si128((__m128i*)(out + at), _mm_xor_si128(data, rows[block]));
+            }
+        }
+        state[12] += 4;
+    }
+#undef SSE2_QUARTER
+#undef SSE2_ROTL
+}
+
+// Eight blocks at once, laid out as in sse2Blocks. The transpose works
+// within each 128-bit half, which leaves blocks 0-3 in the low halves and
+// 4-7 in the high ones; rotations by 8 and 16 are byte shuffles.
+__attribute__((target("avx2")))
+static void avx2Blocks(uint32_t state[16], char* out, const char* in, size_t blocks) {
+    const __m256i rot16 = _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                                          13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+    const __m256i rot8 = _mm256_set_epi8(14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+                                         14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+#define AVX2_ROTL(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define AVX2_QUARTER(a, b, c, d)                                                                          \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot16);            \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = AVX2_ROTL(b, 12);                         \
+    a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); d = _mm256_shuffle_epi8(d, rot8);             \
+    c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); b = AVX2_ROTL(b, 7)
+
+    for (; blocks >= 8; blocks -= 8, in += 512, out += 512) {
+        __m256i x[16];
+        __m256i initial[16];
+        for (int i = 0; i < 16; ++i) {
+            x[i] = _mm256_set1_epi32((int)state[i]);
+        }
+        x[12] = _mm256_add_epi32(x[12], _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+        memcpy(initial, x, sizeof(x));
+
+        for (int i = 0; i < 10; ++i) {
+            AVX2_QUARTER(x[0], x[4], x[8], x[12]);
+            AVX2_QUARTER(x[1], x[5], x[9], x[13]);
+            AVX2_QUARTER(x[2], x[6], x[10], x[14]);
+            AVX2_QUARTER(x[3], x[7], x[11], x[15]);
+            AVX2_QUARTER(x[0], x[5], x[10], x[15]);
+            AVX2_QUARTER(x[1], x[6], x[11], x[12]);
+            AVX2_QUARTER(x[2], x[7], x[8], x[13]);
+            AVX2_QUARTER(x[3], x[4], x[9], x[14]);
+        }
+
+        // rows[group][j]: words 4*group.. of block j (low half) and j + 4.
+        __m256i rows[4][4];
+        for (int group = 0; group < 4; ++group) {
+            __m256i a = _mm256_add_epi32(x[4 * group], initial[4 * group]);
+            __m256i b = _mm256_add_epi32(x[4 * group + 1], initial[4 * group + 1]);
+            __m256i c = _mm256_add_epi32(x[4 * group + 2], initial[4 * group + 2]);
+            __m256i d = _mm256_add_epi32(x[4 * group + 3], initial[4 * group + 3]);
+
+            __m256i ab0 = _mm256_unpacklo_epi32(a, b);
+            __m256i cd0 = _mm256_unpacklo_epi32(c, d);
+            __m256i ab1 = _mm256_unpackhi_epi32(a, b);
+            __m256i cd1 = _mm256_unpackhi_epi32(c, d);
+            rows[group][0] = _mm256_unpacklo_epi64(ab0, cd0);
+            rows[group][1] = _mm256_unpackhi_epi64(ab0, cd0);
+            rows[group][2] = _mm256_unpacklo_epi64(ab1, cd1);
+            rows[group][3] = _mm256_unpackhi_epi64(ab1, cd1);
+        }
+
+        for (int block = 0; block < 4; ++block) {
+            __m256i keystream[4] = {
+                _mm256_permute2x128_si256(rows[0][block], rows[1][block], 0x20),
+                _mm256_permute2x128_si256(rows[2][block], rows[3][block], 0x20),
+                _mm256_permute2x128_si256(rows[0][block], rows[1][block], 0x31),
+                _mm256_permute2x128_si256(rows[2][block], rows[3][block], 0x31)
+            };
+            const size_t at[4] = { 64u * block, 64u * block + 32, 64u * (block + 4), 64u * (block + 4) + 32 };
+            for (int i = 0; i < 4; ++i) {
+                __m256i data = _mm256_loadu_si256((const __m256i*)(in + at[i]));
+                _mm256_storeu_si256((__m256i*)(out + at[i]), _mm256_xor_si256(data, keystream[i]));
+            }
+        }
+        state[12] += 8;
+    }
+#undef AVX2_QUARTER
+#undef AVX2_ROTL
+}
+
+static CipherKernel bestKernel() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return CipherKernel::Avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return CipherKernel::Sse2;
+    }
+    return CipherKernel::Scalar;
+}
+
+static std::atomic<int> s_kernel(-1);
+
+CipherKernel cipherKernel() {
+    int kernel = s_kernel.load(std::memory_order_relaxed);
+    if (kernel < 0) {
+        kernel = (int)bestKernel();
+        s_kernel = kernel;
+    }
+    return (CipherKernel)kernel;
+}
+
+bool setCipherKernel(CipherKernel kernel) {
+    if ((int)kernel > (int)bestKernel()) {
+        return false;
+    }
+    s_kernel = (int)kernel;
+    return true;
+}
+
+const char* cipherKernelName(CipherKernel kernel) {
+    switch (kernel) {
+    case CipherKernel::Avx2:
+        return "avx2";
+    case CipherKernel::Sse2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+ChaCha20::ChaCha20(const uint8_t key[CRYPTO_KEY_SIZE], const uint8_t nonce[CRYPTO_NONCE_SIZE], uint32_t counter)
+    : m_used(sizeof(m_keystream)) {
+    memcpy(m_state, SIGMA, sizeof(SIGMA));
+    for (int i = 0; i < 8; ++i) {
+        m_state[4 + i] = load32(key + 4 * i);
+    }
+    m_state[12] = counter;
+    for (int i = 0; i < 3; ++i) {
+        m_state[13 + i] = load32(nonce + 4 * i);
+    }
+}
+
+ChaCha20::~ChaCha20() {
+    SecureZeroMemory(m_state, sizeof(m_state));
+    SecureZeroMemory(m_keystream, sizeof(m_keystream));
+}
+
+void ChaCha20::apply(char* out, const char* in, size_t length) {
+    for (; length > 0 && m_used < sizeof(m_keystream); --length) {
+        *out++ = *in++ ^ (char)m_keystream[m_used++];
+    }
+
+    size_t blocks = length / 64;
+    CipherKernel kernel = cipherKernel();
+    if (kernel == CipherKernel::Avx2 && blocks >= 8) {
+        size_t wide = blocks & ~(size_t)7;
+        avx2Blocks(m_state, out, in, wide);
+        blocks -= wide;
+        in += 64 * wide;
+        out += 64 * wide;
+    }
+    if (kernel != CipherKernel::Scalar && blocks >= 4) {
+        size_t wide = blocks & ~(size_t)3;
+        sse2Blocks(m_state, out, in, wide);
+        blocks -= wide;
+        in += 64 * wide;
+        out += 64 * wide;
+    }
+    scalarBlocks(m_state, out, in, blocks);
+    in += 64 * blocks;
+    out += 64 * blocks;
+    length %= 64;
+
+    if (length > 0) {
+        scalarBlock(m_state, m_keystream);
+        ++m_state[12];
+        for (m_used = 0; m_used < length; ++m_used) {
+            out[m_used] = in[m_used] ^ (char)m_keystream[m_used];
+        }
+    }
+}
+
+void ChaCha20::keystream(uint8_t* out, size_t length) {
+    memset(out, 0, length);
+    apply((char*)out, (const char*)out, length);
+}
+
+void hchacha20(uint8_t out[CRYPTO_KEY_SIZE], const uint8_t key[CRYPTO_KEY_SIZE], const uint8_t input[16]) {
+    uint32_t x[16];
+    memcpy(x, SIGMA, sizeof(SIGMA));
+    for (int i = 0; i < 8; ++i) {
+        x[4 + i] = load32(key + 4 * i);
+    }
+    for (int i = 0; i < 4; ++i) {
+        x[12 + i] = load32(input + 4 * i);
+    }
+    doubleRounds(x);
+    for (int i = 0; i < 4; ++i) {
+        store32(out + 4 * i, x[i]);
+        store32(out + 16 + 4 * i, x[12 + i]);
+    }
+    SecureZeroMemory(x, sizeof(x));
+}
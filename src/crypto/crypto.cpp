@@ -0,0 +1,490 @@
+#include <algorithm>
+#include <cstring>
+
+#include "crypto.hpp"
+
+#include <ntsecapi.h>
+
+typedef unsigned __int128 uint128_t;
+
+static inline uint64_t load64(const uint8_t* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline void store64(uint8_t* p, uint64_t value) {
+    memcpy(p, &value, sizeof(value));
+}
+
+bool equalTags(const uint8_t* a, const uint8_t* b, size_t length) {
+    uint8_t difference = 0;
+    for (size_t i = 0; i < length; ++i) {
+        difference |= a[i] ^ b[i];
+    }
+    return difference == 0;
+}
+
+bool randomBytes(void* buffer, size_t length) {
+    return RtlGenRandom(buffer, (ULONG)length) != FALSE;
+}
+
+// Poly1305 with 44-bit limbs, so each block is three 64x64 multiplies.
+
+static const uint64_t MASK44 = 0xfffffffffffULL;
+static const uint64_t MASK42 = 0x3ffffffffffULL;
+
+Poly1305::Poly1305(const uint8_t key[32]) : m_buffered(0) {
+    uint64_t t0 = load64(key);
+    uint64_t t1 = load64(key + 8);
+    m_r[0] = t0 & 0xffc0fffffffULL;
+    m_r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+    m_r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+    m_h[0] = m_h[1] = m_h[2] = 0;
+    m_pad[0] = load64(key + 16);
+    m_pad[1] = load64(key + 24);
+}
+
+Poly1305::~Poly1305() {
+    SecureZeroMemory(m_r, sizeof(m_r));
+    SecureZeroMemory(m_pad, sizeof(m_pad));
+    SecureZeroMemory(m_buffer, sizeof(m_buffer));
+}
+
+void Poly1305::blocks(const uint8_t* data, size_t length, uint64_t hibit) {
+    uint64_t r0 = m_r[0], r1 = m_r[1], r2 = m_r[2];
+    uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+    uint64_t h0 = m_h[0], h1 = m_h[1], h2 = m_h[2];
+
+    for (; length >= 16; length -= 16, data += 16) {
+        uint64_t t0 = load64(data);
+        uint64_t t1 = load64(data + 8);
+        h0 += t0 & MASK44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & MASK44;
+        h2 += ((t1 >> 24) & MASK42) | hibit;
+
+        uint128_t d0 = (uint128_t)h0 * r0 + (uint128_t)h1 * s2 + (uint128_t)h2 * s1;
+        uint128_t d1 = (uint128_t)h0 * r1 + (uint128_t)h1 * r0 + (uint128_t)h2 * s2;
+        uint128_t d2 = (uint128_t)h0 * r2 + (uint128_t)h1 * r1 + (uint128_t)h2 * r0;
+
+        uint64_t carry = (uint64_t)(d0 >> 44);
+        h0 = (uint64_t)d0 & MASK44;
+        d1 += carry;
+        carry = (uint64_t)(d1 >> 44);
+        h1 = (uint64_t)d1 & MASK44;
+        d2 += carry;
+        carry = (uint64_t)(d2 >> 42);
+        h2 = (uint64_t)d2 & MASK42;
+        h0 += carry * 5;
+        carry = h0 >> 44;
+        h0 &= MASK44;
+        h1 += carry;
+    }
+
+    m_h[0] = h0;
+    m_h[1] = h1;
+    m_h[2] = h2;
+}
+
+void Poly1305::update(const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    if (m_buffered > 0) {
+        size_t take = std::min(length, sizeof(m_buffer) - m_buffered);
+        memcpy(m_buffer + m_buffered, bytes, take);
+        m_buffered += take;
+        bytes += take;
+        length -= take;
+        if (m_buffered < sizeof(m_buffer)) {
+            return;
+        }
+        blocks(m_buffer, sizeof(m_buffer), 1ULL << 40);
+        m_buffered = 0;
+    }
+
+    size_t whole = length & ~(size_t)15;
+    blocks(bytes, whole, 1ULL << 40);
+    memcpy(m_buffer, bytes + whole, length - whole);
+    m_buffered = length - whole;
+}
+
+void Poly1305::pad() {
+    if (m_buffered > 0) {
+        memset(m_buffer + m_buffered, 0, sizeof(m_buffer) - m_buffered);
+        blocks(m_buffer, sizeof(m_buffer), 1ULL << 40);
+        m_buffered = 0;
+    }
+}
+
+void Poly1305::finish(uint8_t tag[RECORD_TAG_SIZE]) {
+    if (m_buffered > 0) {
+        m_buffer[m_buffered] = 1;
+        memset(m_buffer + m_buffered + 1, 0, sizeof(m_buffer) - m_buffered - 1);
+        blocks(m_buffer, sizeof(m_buffer), 0);
+        m_buffered = 0;
+    }
+
+    uint64_t h0 = m_h[0], h1 = m_h[1], h2 = m_h[2];
+    uint64_t carry;
+    for (int i = 0; i < 2; ++i) {
+        carry = h1 >> 44; h1 &= MASK44;
+        h2 += carry; carry = h2 >> 42; h2 &= MASK42;
+        h0 += carry * 5; carry = h0 >> 44; h0 &= MASK44;
+        h1 += carry;
+    }
+    carry = h1 >> 44; h1 &= MASK44;
+    h2 += carry;
+
+    // h - p, kept only if it did not go negative.
+    uint64_t g0 = h0 + 5; carry = g0 >> 44; g0 &= MASK44;
+    uint64_t g1 = h1 + carry; carry = g1 >> 44; g1 &= MASK44;
+    uint64_t g2 = h2 + carry - (1ULL << 42);
+    uint64_t mask = (g2 >> 63) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+
+    uint64_t t0 = m_pad[0], t1 = m_pad[1];
+    h0 += t0 & MASK44; carry = h0 >> 44; h0 &= MASK44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & MASK44) + carry; carry = h1 >> 44; h1 &= MASK44;
+    h2 += ((t1 >> 24) & MASK42) + carry; h2 &= MASK42;
+
+    store64(tag, h0 | (h1 << 44));
+    store64(tag + 8, (h1 >> 20) | (h2 << 24));
+    SecureZeroMemory(m_h, sizeof(m_h));
+}
+
+// Field arithmetic mod 2^255 - 19 with five 51-bit limbs. Sums and
+// differences are left uncarried; every product is carried back below 2^52.
+
+typedef uint64_t FieldElement[5];
+
+static const uint64_t MASK51 = 0x7ffffffffffffULL;
+
+static void feFromBytes(FieldElement h, const uint8_t s[32]) {
+    uint64_t t0 = load64(s), t1 = load64(s + 8), t2 = load64(s + 16), t3 = load64(s + 24);
+    h[0] = t0 & MASK51;
+    h[1] = ((t0 >> 51) | (t1 << 13)) & MASK51;
+    h[2] = ((t1 >> 38) | (t2 << 26)) & MASK51;
+    h[3] = ((t2 >> 25) | (t3 << 39)) & MASK51;
+    h[4] = (t3 >> 12) & MASK51;
+}
+
+static void feCarry(uint64_t t[5]) {
+    t[1] += t[0] >> 51; t[0] &= MASK51;
+    t[2] += t[1] >> 51; t[1] &= MASK51;
+    t[3] += t[2] >> 51; t[2] &= MASK51;
+    t[4] += t[3] >> 51; t[3] &= MASK51;
+    t[0] += 19 * (t[4] >> 51); t[4] &= MASK51;
+}
+
+static void feToBytes(uint8_t s[32], const FieldElement h) {
+    uint64_t t[5] = { h[0], h[1], h[2], h[3], h[4] };
+    feCarry(t);
+    feCarry(t);
+    // Now below 2^255; adding 19 carries into bit 255 exactly when t >= p.
+    t[0] += 19;
+    feCarry(t);
+    // Subtract the 19 again, offset by 2^255, and drop the offset.
+    t[0] += 0x8000000000000ULL - 19;
+    t[1] += 0x8000000000000ULL - 1;
+    t[2] += 0x8000000000000ULL - 1;
+    t[3] += 0x8000000000000ULL - 1;
+    t[4] += 0x8000000000000ULL - 1;
+    t[1] += t[0] >> 51; t[0] &= MASK51;
+    t[2] += t[1] >> 51; t[1] &= MASK51;
+    t[3] += t[2] >> 51; t[2] &= MASK51;
+    t[4] += t[3] >> 51; t[3] &= MASK51;
+    t[4] &= MASK51;
+
+    store64(s, t[0] | (t[1] << 51));
+    store64(s + 8, (t[1] >> 13) | (t[2] << 38));
+    store64(s + 16, (t[2] >> 26) | (t[3] << 25));
+    store64(s + 24, (t[3] >> 39) | (t[4] << 12));
+}
+
+static void feAdd(FieldElement h, const FieldElement f, const FieldElement g) {
+    for (int i = 0; i < 5; ++i) {
+        h[i] = f[i] + g[i];
+    }
+}
+
+// f - g + 4p, for g below 2^53.
+static void feSub(FieldElement h, const FieldElement f, const FieldElement g) {
+    h[0] = f[0] + 0x1fffffffffffb4ULL - g[0];
+    for (int i = 1; i < 5; ++i) {
+        h[i] = f[i] + 0x1ffffffffffffcULL - g[i];
+    }
+}
+
+static void feMul(FieldElement h, const FieldElement f, const FieldElement g) {
+    uint64_t f0 = f[0], f1 = f[1], f2 = f[2], f3 = f[3], f4 = f[4];
+    uint64_t g0 = g[0], g1 = g[1], g2 = g[2], g3 = g[3], g4 = g[4];
+    uint64_t g1_19 = 19 * g1, g2_19 = 19 * g2, g3_19 = 19 * g3, g4_19 = 19 * g4;
+
+    uint128_t t0 = (uint128_t)f0 * g0 + (uint128_t)f1 * g4_19 + (uint128_t)f2 * g3_19 +
+                   (uint128_t)f3 * g2_19 + (uint128_t)f4 * g1_19;
+    uint128_t t1 = (uint128_t)f0 * g1 + (uint128_t)f1 * g0 + (uint128_t)f2 * g4_19 +
+                   (uint128_t)f3 * g3_19 + (uint128_t)f4 * g2_19;
+    uint128_t t2 = (uint128_t)f0 * g2 + (uint128_t)f1 * g1 + (uint128_t)f2 * g0 +
+                   (uint128_t)f3 * g4_19 + (uint128_t)f4 * g3_19;
+    uint128_t t3 = (uint128_t)f0 * g3 + (uint128_t)f1 * g2 + (uint128_t)f2 * g1 +
+                   (uint128_t)f3 * g0 + (uint128_t)f4 * g4_19;
+    uint128_t t4 = (uint128_t)f0 * g4 + (uint128_t)f1 * g3 + (uint128_t)f2 * g2 +
+                   (uint128_t)f3 * g1 + (uint128_t)f4 * g0;
+
+    t1 += (uint64_t)(t0 >> 51);
+    uint64_t r0 = (uint64_t)t0 & MASK51;
+    t2 += (uint64_t)(t1 >> 51);
+    uint64_t r1 = (uint64_t)t1 & MASK51;
+    t3 += (uint64_t)(t2 >> 51);
+    uint64_t r2 = (uint64_t)t2 & MASK51;
+    t4 += (uint64_t)(t3 >> 51);
+    uint64_t r3 = (uint64_t)t3 & MASK51;
+    uint64_t carry = (uint64_t)(t4 >> 51);
+    uint64_t r4 = (uint64_t)t4 & MASK51;
+
+    r0 += carry * 19;
+    r1 += r0 >> 51;
+    r0 &= MASK51;
+
+    h[0] = r0;
+    h[1] = r1;
+    h[2] = r2;
+    h[3] = r3;
+    h[4] = r4;
+}
+
+static void feSquare(FieldElement h, const FieldElement f, int times = 1) {
+    feMul(h, f, f);
+    for (int i = 1; i < times; ++i) {
+        feMul(h, h, h);
+    }
+}
+
+// z^(p - 2), by the usual chain of 254 squarings and 11 multiplications.
+static void feInvert(FieldElement out, const FieldElement z) {
+    FieldElement z2, z9, z11, z2_5_0, z2_10_0, z2_20_0, z2_50_0, z2_100_0, t;
+
+    feSquare(z2, z);
+    feSquare(t, z2, 2);
+    feMul(z9, t, z);
+    feMul(z11, z9, z2);
+    feSquare(t, z11);
+    feMul(z2_5_0, t, z9);
+    feSquare(t, z2_5_0, 5);
+    feMul(z2_10_0, t, z2_5_0);
+    feSquare(t, z2_10_0, 10);
+    feMul(z2_20_0, t, z2_10_0);
+    feSquare(t, z2_20_0, 20);
+    feMul(t, t, z2_20_0);
+    feSquare(t, t, 10);
+    feMul(z2_50_0, t, z2_10_0);
+    feSquare(t, z2_50_0, 50);
+    feMul(z2_100_0, t, z2_50_0);
+    feSquare(t, z2_100_0, 100);
+    feMul(t, t, z2_100_0);
+    feSquare(t, t, 50);
+    feMul(t, t, z2_50_0);
+    feSquare(t, t, 5);
+    feMul(out, t, z11);
+}
+
+static void feSwap(FieldElement f, FieldElement g, uint64_t swap) {
+    uint64_t mask = 0 - swap;
+    for (int i = 0; i < 5; ++i) {
+        uint64_t x = mask & (f[i] ^ g[i]);
+        f[i] ^= x;
+        g[i] ^= x;
+    }
+}
+
+// The Montgomery ladder of RFC 7748, in constant time.
+void x25519(uint8_t out[32], const uint8_t scalar[32], const uint8_t point[32]) {
+    uint8_t k[32];
+    memcpy(k, scalar, sizeof(k));
+    k[0] &= 248;
+    k[31] &= 127;
+    k[31] |= 64;
+
+    FieldElement x1, x2 = { 1 }, z2 = { 0 }, x3, z3 = { 1 };
+    FieldElement a, aa, b, bb, e, c, d, da, cb, t;
+    static const FieldElement a24 = { 121665 };
+    feFromBytes(x1, point);
+    memcpy(x3, x1, sizeof(x3));
+
+    uint64_t swap = 0;
+    for (int bit = 254; bit >= 0; --bit) {
+        uint64_t kt = (k[bit / 8] >> (bit & 7)) & 1;
+        swap ^= kt;
+        feSwap(x2, x3, swap);
+        feSwap(z2, z3, swap);
+        swap = kt;
+
+        feAdd(a, x2, z2);
+        feSquare(aa, a);
+        feSub(b, x2, z2);
+        feSquare(bb, b);
+        feSub(e, aa, bb);
+        feAdd(c, x3, z3);
+        feSub(d, x3, z3);
+        feMul(da, d, a);
+        feMul(cb, c, b);
+
+        feAdd(t, da, cb);
+        feSquare(x3, t);
+        feSub(t, da, cb);
+        feSquare(t, t);
+        feMul(z3, x1, t);
+
+        feMul(x2, aa, bb);
+        feMul(t, a24, e);
+        feAdd(t, aa, t);
+        feMul(z2, e, t);
+    }
+    feSwap(x2, x3, swap);
+    feSwap(z2, z3, swap);
+
+    feInvert(z2, z2);
+    feMul(x2, x2, z2);
+    feToBytes(out, x2);
+    SecureZeroMemory(k, sizeof(k));
+}
+
+void x25519Base(uint8_t out[32], const uint8_t scalar[32]) {
+    static const uint8_t basePoint[32] = { 9 };
+    x25519(out, scalar, basePoint);
+}
+
+// Records: the RFC 8439 AEAD, with the sequence number as the nonce.
+
+static const size_t RECORD_STEP = 4096;
+
+RecordCipher::RecordCipher() : m_sequence(0), m_keyed(false) {
+    memset(m_key, 0, sizeof(m_key));
+}
+
+RecordCipher::~RecordCipher() {
+    SecureZeroMemory(m_key, sizeof(m_key));
+}
+
+void RecordCipher::setKey(const uint8_t key[CRYPTO_KEY_SIZE]) {
+    memcpy(m_key, key, sizeof(m_key));
+    m_sequence = 0;
+    m_keyed = true;
+}
+
+void RecordCipher::nonce(uint8_t out[CRYPTO_NONCE_SIZE]) const {
+    memset(out, 0, 4);
+    store64(out + 4, m_sequence);
+}
+
+static void finishTag(Poly1305& mac, size_t aadLength, size_t length, uint8_t tag[RECORD_TAG_SIZE]) {
+    uint8_t lengths[16];
+    mac.pad();
+    store64(lengths, aadLength);
+    store64(lengths + 8, length);
+    mac.update(lengths, sizeof(lengths));
+    mac.finish(tag);
+}
+
+void RecordCipher::seal(const void* aad, size_t aadLength, const WSABUF* buffers, DWORD count, char* out,
+                        uint8_t tag[RECORD_TAG_SIZE]) {
+    uint8_t iv[CRYPTO_NONCE_SIZE];
+    nonce(iv);
+    ++m_sequence;
+
+    ChaCha20 cipher(m_key, iv, 0);
+    uint8_t macKey[32];
+    cipher.keystream(macKey, sizeof(macKey));
+    // The rest of block 0 is not used; the message starts at block 1.
+    uint8_t unused[32];
+    cipher.keystream(unused, sizeof(unused));
+
+    Poly1305 mac(macKey);
+    SecureZeroMemory(macKey, sizeof(macKey));
+    mac.update(aad, aadLength);
+    mac.pad();
+
+    size_t total = 0;
+    for (DWORD i = 0; i < count; ++i) {
+        const char* in = buffers[i].buf;
+        char* to = out ? out + total : buffers[i].buf;
+        for (size_t done = 0; done < buffers[i].len;) {
+            size_t step = std::min<size_t>(RECORD_STEP, buffers[i].len - done);
+            cipher.apply(to + done, in + done, step);
+            mac.update(to + done, step);
+            done += step;
+        }
+        total += buffers[i].len;
+    }
+    finishTag(mac, aadLength, total, tag);
+}
+
+bool RecordCipher::open(const void* aad, size_t aadLength, char* data, size_t length,
+                        const uint8_t tag[RECORD_TAG_SIZE]) {
+    uint8_t iv[CRYPTO_NONCE_SIZE];
+    nonce(iv);
+
+    ChaCha20 cipher(m_key, iv, 0);
+    uint8_t macKey[32];
+    cipher.keystream(macKey, sizeof(macKey));
+    uint8_t unused[32];
+    cipher.keystream(unused, sizeof(unused));
+
+    Poly1305 mac(macKey);
+    SecureZeroMemory(macKey, sizeof(macKey));
+    mac.update(aad, aadLength);
+    mac.pad();
+    mac.update(data, length);
+    uint8_t expected[RECORD_TAG_SIZE];
+    finishTag(mac, aadLength, length, expected);
+    if (!equalTags(expected, tag, RECORD_TAG_SIZE)) {
+        return false;
+    }
+
+    ++m_sequence;
+    for (size_t done = 0; done < length; done += RECORD_STEP) {
+        size_t step = std::min(RECORD_STEP, length - done);
+        cipher.apply(data + done, data + done, step);
+    }
+    return true;
+}
+
+// Labels that tell the two directions' keys apart.
+static const uint8_t CLIENT_TO_SERVER[16] = { 'c', 'l', 'i', 'e', 'n', 't', ' ', 't', 'o', ' ', 's', 'e', 'r', 'v', 'e', 'r' };
+static const uint8_t SERVER_TO_CLIENT[16] = { 's', 'e', 'r', 'v', 'e', 'r', ' ', 't', 'o', ' ', 'c', 'l', 'i', 'e', 'n', 't' };
+
+KeyExchange::KeyExchange() {
+    memset(m_private, 0, sizeof(m_private));
+    memset(m_public, 0, sizeof(m_public));
+}
+
+KeyExchange::~KeyExchange() {
+    SecureZeroMemory(m_private, sizeof(m_private));
+}
+
+bool KeyExchange::generate() {
+    if (!randomBytes(m_private, sizeof(m_private))) {
+        return false;
+    }
+    x25519Base(m_public, m_private);
+    return true;
+}
+
+bool KeyExchange::derive(const uint8_t peer[32], bool client, uint8_t sendKey[CRYPTO_KEY_SIZE],
+                         uint8_t receiveKey[CRYPTO_KEY_SIZE]) {
+    uint8_t shared[32];
+    x25519(shared, m_private, peer);
+    SecureZeroMemory(m_private, sizeof(m_private));
+
+    // A low-order peer key makes the secret all zeros, whatever ours was.
+    static const uint8_t zero[32] = { 0 };
+    if (equalTags(shared, zero, sizeof(shared))) {
+        return false;
+    }
+
+    hchacha20(client ? sendKey : receiveKey, shared, CLIENT_TO_SERVER);
+    hchacha20(client ? receiveKey : sendKey, shared, SERVER_TO_CLIENT);
+    SecureZeroMemory(shared, sizeof(shared));
+    return true;
+}
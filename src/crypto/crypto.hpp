@@ -0,0 +1,132 @@
+#pragma once
+#ifndef CRYPTO_HPP
+#define CRYPTO_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+#include "../utils.hpp"
+
+// Primitives of the encrypted record layer: X25519 for the key exchange and
+// ChaCha20-Poly1305 (RFC 8439) for the records. Everything works on the
+// caller's buffers; nothing here allocates.
+
+#define CRYPTO_KEY_SIZE 32
+#define CRYPTO_NONCE_SIZE 12
+#define RECORD_TAG_SIZE 16
+
+// How ChaCha20 turns out keystream: one block at a time, or 4 (SSE2) or 8
+// (AVX2) blocks side by side. The widest one the CPU supports is picked on
+// first use; a benchmark may force a narrower one to compare.
+enum class CipherKernel {
+    Scalar,
+    Sse2,
+    Avx2
+};
+
+CipherKernel cipherKernel();
+// Returns false, leaving the kernel unchanged, if the CPU lacks it.
+bool setCipherKernel(CipherKernel kernel);
+const char* cipherKernelName(CipherKernel kernel);
+
+// ChaCha20 keystream XORed over a message that may arrive in pieces of any
+// size; `out` may be the same buffer as `in`.
+class ChaCha20 {
+private:
+    uint32_t m_state[16];
+    uint8_t m_keystream[64];
+    size_t m_used;
+
+public:
+    ChaCha20(const uint8_t key[CRYPTO_KEY_SIZE], const uint8_t nonce[CRYPTO_NONCE_SIZE], uint32_t counter);
+    ~ChaCha20();
+
+    void apply(char* out, const char* in, size_t length);
+    // Raw keystream, e.g. a Poly1305 key.
+    void keystream(uint8_t* out, size_t length);
+};
+
+// HChaCha20: a 32-byte key derived from `key` and a 16-byte `input`.
+void hchacha20(uint8_t out[CRYPTO_KEY_SIZE], const uint8_t key[CRYPTO_KEY_SIZE], const uint8_t input[16]);
+
+// One-time authenticator over a message that may arrive in pieces.
+class Poly1305 {
+private:
+    uint64_t m_r[3];
+    uint64_t m_h[3];
+    uint64_t m_pad[2];
+    uint8_t m_buffer[16];
+    size_t m_buffered;
+
+    void blocks(const uint8_t* data, size_t length, uint64_t hibit);
+
+public:
+    explicit Poly1305(const uint8_t key[32]);
+    ~Poly1305();
+
+    void update(const void* data, size_t length);
+    // Zero bytes up to the next 16-byte boundary, as the AEAD construction
+    // pads the associated data and the ciphertext.
+    void pad();
+    void finish(uint8_t tag[RECORD_TAG_SIZE]);
+};
+
+// Constant-time comparison.
+bool equalTags(const uint8_t* a, const uint8_t* b, size_t length);
+
+// Fills `buffer` from the system CSPRNG.
+bool randomBytes(void* buffer, size_t length);
+
+// X25519 (RFC 7748): `out` = `scalar` * `point`, and `scalar` * base point.
+void x25519(uint8_t out[32], const uint8_t scalar[32], const uint8_t point[32]);
+void x25519Base(uint8_t out[32], const uint8_t scalar[32]);
+
+// One direction of an encrypted connection: ChaCha20-Poly1305 records under
+// one key, with the record number as nonce. Nonces therefore never travel,
+// and a record that is dropped, replayed or reordered fails to open.
+class RecordCipher {
+private:
+    uint8_t m_key[CRYPTO_KEY_SIZE];
+    uint64_t m_sequence;
+    bool m_keyed;
+
+    void nonce(uint8_t out[CRYPTO_NONCE_SIZE]) const;
+
+public:
+    RecordCipher();
+    ~RecordCipher();
+
+    void setKey(const uint8_t key[CRYPTO_KEY_SIZE]);
+    bool isKeyed() const { return m_keyed; }
+
+    // Encrypts the `count` buffers as one record, in place or, if `out` is
+    // given, into `out` as one run, and writes the tag over `aad` and the
+    // ciphertext. The two passes go 4 KB at a time, so each piece is still
+    // in cache when it is hashed.
+    void seal(const void* aad, size_t aadLength, const WSABUF* buffers, DWORD count, char* out,
+              uint8_t tag[RECORD_TAG_SIZE]);
+    // Checks the tag and decrypts `data` in place; false if the record is
+    // not the next one under this key.
+    bool open(const void* aad, size_t aadLength, char* data, size_t length, const uint8_t tag[RECORD_TAG_SIZE]);
+};
+
+// Ephemeral X25519 key pair; each side derives the same two record keys.
+class KeyExchange {
+private:
+    uint8_t m_private[32];
+    uint8_t m_public[32];
+
+public:
+    KeyExchange();
+    ~KeyExchange();
+
+    bool generate();
+    const uint8_t* publicKey() const { return m_public; }
+
+    // Keys for what this side sends and receives; `client` tells the
+    // directions apart. False for a peer key that gives no shared secret.
+    bool derive(const uint8_t peer[32], bool client, uint8_t sendKey[CRYPTO_KEY_SIZE],
+                uint8_t receiveKey[CRYPTO_KEY_SIZE]);
+};
+
+#endif // CRYPTO_HPP
@@ -1,2 +1,68 @@
 #define PORT 8894
-#define HOST "127.0.0.1"
\ No newline at end of file
+#define HOST "127.0.0.1"
+#define SHELL_COMMAND "cmd.exe"
+#define SHELL_POOL_SIZE 4
+#define SHELL_POOL_IDLE_MS (10 * 60 * 1000)
+#define SHELL_POOL_CHECK_MS 1000
+
+#define BUFFER_SIZE 4096
+#define PIPE_BUFFER_SIZE 65536
+#define LOOP_THREADS 0
+#define ACCEPT_SHARDS 1
+#define ACCEPT_BACKLOG 32
+#define SHM_RING_BYTES (256 * 1024)
+#define SHM_CONNECT_TIMEOUT_MS 5000
+#define MAX_FRAME_PAYLOAD 65536
+
+#define SESSION_WINDOW (256 * 1024)
+#define MAX_SESSIONS_PER_CONNECTION 256
+#define MAX_CONNECTIONS 2048
+#define MAX_SESSIONS 4096
+#define SPAWN_WORKERS 0
+#define SPAWN_QUEUE 1024
+#define OUTPUT_HIGH_WATER SESSION_WINDOW
+#define OUTPUT_LOW_WATER (SESSION_WINDOW / 2)
+#define CONTROL_QUEUE_HIGH 256
+#define CONTROL_QUEUE_LOW 64
+
+#define SCROLLBACK_BYTES (1024 * 1024)
+#define SCROLLBACK_BUDGET (64 * 1024 * 1024)
+#define DETACHED_TTL_MS (60 * 60 * 1000)
+#define DETACHED_CHECK_MS 1000
+#define RECONNECT_ATTEMPTS 30
+#define RECONNECT_DELAY_MS 1000
+#define EXEC_ERROR_EXIT_CODE 255
+#define INTERRUPT_HELPER_TIMEOUT_MS 5000
+#define INTERRUPT_INPUT_WAIT_MS 500
+#define FANOUT_CONCURRENCY 64
+#define FANOUT_CONNECT_TIMEOUT_MS 5000
+#define FANOUT_TIMEOUT_MS (5 * 60 * 1000)
+
+#define FILE_CHUNK (32 * 1024)
+#define FILE_MAP_WINDOW (4 * 1024 * 1024)
+#define FILE_WINDOW (1024 * 1024)
+#define FILE_PIPELINE (FILE_WINDOW / FILE_CHUNK)
+#define FILE_PARALLEL 16
+#define FILE_RETRIES 3
+#define MAX_TRANSFERS_PER_CONNECTION 64
+
+#define RELAY_BUFFER_MIN 4096
+#define RELAY_BUFFER_MAX 65536
+#define RELAY_RING_CHUNKS 4
+#define BUFFER_POOL_MAX_CACHED (32 * 1024 * 1024)
+#define COALESCE_BYTES 16384
+#define COALESCE_DEADLINE_US 500
+
+#define SCREEN_COLUMNS 80
+#define SCREEN_ROWS 25
+#define SCREEN_MAX_COLUMNS 1024
+#define SCREEN_MAX_ROWS 512
+#define SCREEN_FPS 30
+#define SCREEN_PENDING_BYTES (64 * 1024)
+#define SCREEN_MAX_PARAMS 16
+
+#define COMPRESS_WINDOW 65535
+#define COMPRESS_MIN_BLOCK 64
+
+#define METRICS_PORT 8895
+#define METRICS_SEND_STALL_US 1000
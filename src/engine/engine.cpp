@@ -0,0 +1,97 @@
+#include "engine.hpp"
+#include "../log/log.hpp"
+
+EventLoop::EventLoop() : m_running(false), m_affinity(0) {
+    m_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 0);
+    if (!m_port) {
+        LOG_ERROR(nullptr, "CreateIoCompletionPort failed: " << GetLastError());
+    }
+}
+
+EventLoop::~EventLoop() {
+    stop();
+    if (m_port) {
+        CloseHandle(m_port);
+    }
+}
+
+bool EventLoop::start(size_t threads, DWORD_PTR affinity) {
+    if (!m_port || m_running) {
+        return false;
+    }
+
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+        if (threads == 0) {
+            threads = 2;
+        }
+    }
+
+    m_running = true;
+    m_affinity = affinity;
+    for (size_t i = 0; i < threads; ++i) {
+        m_threads.emplace_back(&EventLoop::loop, this);
+    }
+
+    LOG_INFO(nullptr, "Event loop started with " << threads << " threads");
+    return true;
+}
+
+void EventLoop::stop() {
+    if (!m_running) {
+        return;
+    }
+    m_running = false;
+
+    // A completion without an OVERLAPPED tells one loop thread to exit.
+    for (size_t i = 0; i < m_threads.size(); ++i) {
+        PostQueuedCompletionStatus(m_port, 0, 0, nullptr);
+    }
+
+    for (auto& thread : m_threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    m_threads.clear();
+}
+
+bool EventLoop::attach(HANDLE handle) {
+    if (!m_port || handle == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    if (CreateIoCompletionPort(handle, m_port, 0, 0) != m_port) {
+        LOG_ERROR(nullptr, "Failed to attach handle to completion port: " << GetLastError());
+        return false;
+    }
+    return true;
+}
+
+bool EventLoop::post(IoRequest* request, DWORD bytes) {
+    return PostQueuedCompletionStatus(m_port, bytes, 0, request) != FALSE;
+}
+
+void EventLoop::loop() {
+    if (m_affinity && !SetThreadAffinityMask(GetCurrentThread(), m_affinity)) {
+        LOG_WARN(nullptr, "Failed to pin event loop thread: " << GetLastError());
+    }
+
+    while (true) {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = nullptr;
+
+        BOOL ok = GetQueuedCompletionStatus(m_port, &bytes, &key, &overlapped, INFINITE);
+        if (!overlapped) {
+            if (!ok) {
+                LOG_ERROR(nullptr, "GetQueuedCompletionStatus failed: " << GetLastError());
+            }
+            break;
+        }
+
+        IoRequest* request = static_cast<IoRequest*>(overlapped);
+        DWORD error = ok ? NO_ERROR : GetLastError();
+        request->handler->onCompletion(request, bytes, error);
+    }
+}
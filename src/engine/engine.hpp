@@ -0,0 +1,73 @@
+#pragma once
+#ifndef ENGINE_HPP
+#define ENGINE_HPP
+
+#include "../utils.hpp"
+
+enum class IoOperation {
+    SocketRead,
+    SocketWrite,
+    PipeRead,
+    PipeWrite,
+    FileWrite,
+    ProcessExit,
+    Accept,
+    Notify
+};
+
+class IoHandler;
+
+struct IoRequest : OVERLAPPED {
+    IoOperation operation;
+    IoHandler* handler;
+    void* context;
+
+    IoRequest(IoOperation op = IoOperation::Notify, IoHandler* owner = nullptr, void* ctx = nullptr)
+        : operation(op), handler(owner), context(ctx) {
+        reset();
+    }
+
+    void reset() {
+        ZeroMemory(static_cast<OVERLAPPED*>(this), sizeof(OVERLAPPED));
+    }
+};
+
+class IoHandler {
+public:
+    virtual ~IoHandler() {}
+    virtual void onCompletion(IoRequest* request, DWORD bytes, DWORD error) = 0;
+};
+
+// Completion-port driven loop: a fixed set of threads dequeues finished
+// overlapped operations for every attached socket and pipe and dispatches
+// them to the handler stored in the IoRequest.
+class EventLoop {
+private:
+    HANDLE m_port;
+    std::vector<std::thread> m_threads;
+    std::atomic<bool> m_running;
+    DWORD_PTR m_affinity;
+
+public:
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // With a non-zero `affinity` every loop thread is pinned to those cores.
+    bool start(size_t threads = 0, DWORD_PTR affinity = 0);
+    void stop();
+
+    bool attach(HANDLE handle);
+    bool attach(const Socket& socket) { return attach((HANDLE)socket.getHandle()); }
+    bool post(IoRequest* request, DWORD bytes = 0);
+
+    bool isRunning() const { return m_running; }
+    size_t threadCount() const { return m_threads.size(); }
+
+private:
+    void loop();
+};
+
+#endif // ENGINE_HPP
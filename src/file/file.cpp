@@ -0,0 +1,163 @@
+#include <algorithm>
+
+#include "file.hpp"
+#include "../log/log.hpp"
+
+uint32_t adler32(const char* data, size_t length, uint32_t adler) {
+    // Largest run of bytes before the sums have to be reduced mod 65521.
+    static const size_t NMAX = 5552;
+    static const uint32_t BASE = 65521;
+
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+    while (length > 0) {
+        size_t run = std::min(length, NMAX);
+        length -= run;
+        while (run--) {
+            a += *bytes++;
+            b += a;
+        }
+        a %= BASE;
+        b %= BASE;
+    }
+    return b << 16 | a;
+}
+
+FileStatus fileStatusFromError(DWORD error) {
+    switch (error) {
+    case ERROR_FILE_NOT_FOUND:
+    case ERROR_PATH_NOT_FOUND:
+    case ERROR_INVALID_NAME:
+        return FileStatus::NotFound;
+
+    case ERROR_ACCESS_DENIED:
+    case ERROR_SHARING_VIOLATION:
+    case ERROR_LOCK_VIOLATION:
+    case ERROR_WRITE_PROTECT:
+        return FileStatus::AccessDenied;
+
+    default:
+        return FileStatus::Failed;
+    }
+}
+
+void createParentDirectories(const std::string& path) {
+    for (size_t i = 1; i < path.size(); ++i) {
+        if ((path[i] != '\\' && path[i] != '/') || path[i - 1] == ':' ||
+            path[i - 1] == '\\' || path[i - 1] == '/') {
+            continue;
+        }
+        CreateDirectoryA(path.substr(0, i).c_str(), nullptr);
+    }
+}
+
+bool truncateFile(HANDLE file, uint64_t size) {
+    FILE_END_OF_FILE_INFO info;
+    info.EndOfFile.QuadPart = (LONGLONG)size;
+    return SetFileInformationByHandle(file, FileEndOfFileInfo, &info, sizeof(info)) != FALSE;
+}
+
+MappedFile::MappedFile()
+    : m_file(INVALID_HANDLE_VALUE), m_mapping(nullptr), m_size(0), m_lastBase(0) {}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& path) {
+    close();
+
+    m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                         OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size)) {
+        DWORD error = GetLastError();
+        close();
+        SetLastError(error);
+        return false;
+    }
+    m_size = (uint64_t)size.QuadPart;
+
+    // An empty file cannot be mapped, and has nothing to read anyway.
+    if (m_size > 0) {
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!m_mapping) {
+            DWORD error = GetLastError();
+            close();
+            SetLastError(error);
+            return false;
+        }
+    }
+    return true;
+}
+
+void MappedFile::close() {
+    for (auto& view : m_views) {
+        UnmapViewOfFile(view.data);
+    }
+    m_views.clear();
+
+    if (m_mapping) {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+    m_size = 0;
+}
+
+const char* MappedFile::acquire(uint64_t offset, size_t length) {
+    uint64_t base = offset - offset % FILE_MAP_WINDOW;
+    if (!m_mapping || offset + length > m_size || offset + length > base + FILE_MAP_WINDOW) {
+        return nullptr;
+    }
+
+    auto it = std::find_if(m_views.begin(), m_views.end(), [&](const View& view) { return view.base == base; });
+    if (it == m_views.end()) {
+        unmapIdle();
+
+        SIZE_T viewSize = (SIZE_T)std::min<uint64_t>(FILE_MAP_WINDOW, m_size - base);
+        void* data = MapViewOfFile(m_mapping, FILE_MAP_READ, (DWORD)(base >> 32), (DWORD)base, viewSize);
+        if (!data) {
+            LOG_ERROR(nullptr, "MapViewOfFile failed: " << GetLastError());
+            return nullptr;
+        }
+        m_views.push_back(View{ base, (char*)data, 0 });
+        it = m_views.end() - 1;
+    }
+
+    ++it->refs;
+    m_lastBase = base;
+    return it->data + (offset - base);
+}
+
+void MappedFile::release(uint64_t offset) {
+    uint64_t base = offset - offset % FILE_MAP_WINDOW;
+    auto it = std::find_if(m_views.begin(), m_views.end(), [&](const View& view) { return view.base == base; });
+    if (it == m_views.end()) {
+        return;
+    }
+
+    if (--it->refs == 0 && base != m_lastBase) {
+        UnmapViewOfFile(it->data);
+        m_views.erase(it);
+    }
+}
+
+void MappedFile::unmapIdle() {
+    for (auto it = m_views.begin(); it != m_views.end();) {
+        if (it->refs == 0) {
+            UnmapViewOfFile(it->data);
+            it = m_views.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
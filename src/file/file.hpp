@@ -0,0 +1,76 @@
+#pragma once
+#ifndef FILE_HPP
+#define FILE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../utils.hpp"
+#include "../define.hpp"
+#include "../protocol/protocol.hpp"
+
+// Adler-32, the rolling checksum rsync uses, carried by every File Data
+// frame. `adler` continues an earlier checksum; start with 1.
+uint32_t adler32(const char* data, size_t length, uint32_t adler = 1);
+
+// Length of the Data chunk starting at `offset` of a `size` byte file.
+// Chunks end on FILE_CHUNK boundaries, so a resumed transfer falls back
+// into step after its first chunk and no chunk crosses a mapped window.
+inline uint32_t fileChunkAt(uint64_t offset, uint64_t size) {
+    uint64_t chunk = FILE_CHUNK - offset % FILE_CHUNK;
+    return (uint32_t)(size - offset < chunk ? size - offset : chunk);
+}
+
+// Maps a Win32 error from opening or writing a file to a File Done status.
+FileStatus fileStatusFromError(DWORD error);
+
+// Creates the missing directories above `path`; either separator works.
+// Best effort: the CreateFile that follows reports what went wrong.
+void createParentDirectories(const std::string& path);
+
+// Sets the end of `file` at `size`.
+bool truncateFile(HANDLE file, uint64_t size);
+
+// A file read through FILE_MAP_WINDOW sized views mapped on demand, so data
+// can be checksummed and handed to the socket without copying it into a
+// buffer first. A view stays mapped while any range in it is held; the most
+// recently used one is kept after that for the next chunk. Not thread-safe.
+class MappedFile {
+private:
+    struct View {
+        uint64_t base;
+        char* data;
+        int refs;
+    };
+
+    HANDLE m_file;
+    HANDLE m_mapping;
+    uint64_t m_size;
+    std::vector<View> m_views;
+    uint64_t m_lastBase;
+
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Opens `path` for reading; on failure GetLastError() tells why.
+    bool open(const std::string& path);
+    void close();
+
+    uint64_t size() const { return m_size; }
+
+    // `length` bytes at `offset`, which must not cross a FILE_MAP_WINDOW
+    // boundary; valid until the matching release(offset). nullptr if the
+    // window cannot be mapped.
+    const char* acquire(uint64_t offset, size_t length);
+    void release(uint64_t offset);
+
+private:
+    void unmapIdle();
+};
+
+#endif // FILE_HPP
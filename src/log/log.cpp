@@ -0,0 +1,359 @@
+#include <algorithm>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "log.hpp"
+#include "../utils.hpp"
+
+#define LOG_DRAIN_INTERVAL_MS 20
+#define LOG_WRITE_BUFFER 65536
+
+// Single-producer/single-consumer ring owned by one logging thread. The
+// indices are on separate cache lines so the producer and the writer do not
+// invalidate each other's line on every record.
+struct LogRing {
+    alignas(64) std::atomic<uint32_t> head;
+    alignas(64) std::atomic<uint32_t> tail;
+    alignas(64) std::atomic<bool> orphaned;
+    LogRecord records[LOG_RING_SIZE];
+
+    LogRing() : head(0), tail(0), orphaned(false) {}
+};
+
+struct LoggerState;
+static void stopWriter(LoggerState& logger);
+
+struct LoggerState {
+    std::mutex ringsMutex;
+    std::vector<LogRing*> rings;
+    std::atomic<uint64_t> dropped;
+    uint64_t reportedDropped;
+
+    std::mutex writerMutex;
+    std::thread writer;
+    std::atomic<bool> running;
+    HANDLE wakeEvent;
+
+    std::mutex outputMutex;
+    FILE* file;
+
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER baseTicks;
+    ULONGLONG baseTime;
+
+    LoggerState() : dropped(0), reportedDropped(0), running(false), file(nullptr) {
+        wakeEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&baseTicks);
+
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        baseTime = ((ULONGLONG)now.dwHighDateTime << 32) | now.dwLowDateTime;
+    }
+
+    ~LoggerState() {
+        stopWriter(*this);
+        for (LogRing* ring : rings) {
+            delete ring;
+        }
+        CloseHandle(wakeEvent);
+    }
+};
+
+static LoggerState& state() {
+    static LoggerState instance;
+    return instance;
+}
+
+// Marks the thread's ring for removal once the writer has drained it.
+struct RingHolder {
+    LogRing* ring = nullptr;
+
+    ~RingHolder() {
+        if (ring) {
+            ring->orphaned.store(true, std::memory_order_release);
+        }
+    }
+};
+
+static thread_local RingHolder t_ring;
+
+static const char* levelName(LogLevel level) {
+    switch (level) {
+    case LogLevel::Trace: return "TRACE";
+    case LogLevel::Debug: return "DEBUG";
+    case LogLevel::Info:  return "INFO ";
+    case LogLevel::Warn:  return "WARN ";
+    case LogLevel::Error: return "ERROR";
+    default:              return "?    ";
+    }
+}
+
+static size_t formatRecord(LoggerState& logger, const LogRecord& record, char* out, size_t capacity) {
+    // Ticks are taken by the producer; turning them into wall-clock time is
+    // left to the writer.
+    ULONGLONG elapsed = (ULONGLONG)(record.ticks - logger.baseTicks.QuadPart);
+    ULONGLONG time = logger.baseTime +
+        elapsed / logger.frequency.QuadPart * 10000000 +
+        elapsed % logger.frequency.QuadPart * 10000000 / logger.frequency.QuadPart;
+
+    FILETIME utc, local;
+    utc.dwLowDateTime = (DWORD)time;
+    utc.dwHighDateTime = (DWORD)(time >> 32);
+    SYSTEMTIME parts;
+    FileTimeToLocalFileTime(&utc, &local);
+    FileTimeToSystemTime(&local, &parts);
+
+    int length = snprintf(out, capacity, "%04u-%02u-%02u %02u:%02u:%02u.%06u %s t%-5u %s%s%s%.*s\n",
+                          parts.wYear, parts.wMonth, parts.wDay,
+                          parts.wHour, parts.wMinute, parts.wSecond,
+                          (unsigned)(time % 10000000 / 10), levelName(record.level), record.threadId,
+                          record.tag[0] ? "[" : "", record.tag, record.tag[0] ? "] " : "",
+                          (int)record.length, record.text);
+    return length < 0 ? 0 : std::min<size_t>(length, capacity - 1);
+}
+
+static void writeOut(LoggerState& logger, const char* data, size_t length, bool error) {
+    std::lock_guard<std::mutex> lock(logger.outputMutex);
+    FILE* target = logger.file ? logger.file : (error ? stderr : stdout);
+    fwrite(data, 1, length, target);
+}
+
+static void flushOut(LoggerState& logger) {
+    std::lock_guard<std::mutex> lock(logger.outputMutex);
+    fflush(logger.file ? logger.file : stdout);
+    if (!logger.file) {
+        fflush(stderr);
+    }
+}
+
+// Empties every ring; lines are batched into one buffer per write so the
+// console or file sees a few large writes instead of one per line.
+static void drainRings(LoggerState& logger) {
+    std::vector<LogRing*> rings;
+    {
+        std::lock_guard<std::mutex> lock(logger.ringsMutex);
+        rings = logger.rings;
+    }
+
+    static char buffer[LOG_WRITE_BUFFER];
+    size_t used = 0;
+    bool wrote = false;
+
+    std::vector<LogRing*> finished;
+    for (LogRing* ring : rings) {
+        bool orphaned = ring->orphaned.load(std::memory_order_acquire);
+        uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint32_t head = ring->head.load(std::memory_order_acquire);
+
+        for (; tail != head; ++tail) {
+            const LogRecord& record = ring->records[tail % LOG_RING_SIZE];
+            bool error = record.level >= LogLevel::Warn;
+
+            if (used + LOG_TEXT_SIZE + 128 > sizeof(buffer) || (error && !logger.file)) {
+                writeOut(logger, buffer, used, false);
+                used = 0;
+            }
+
+            if (error && !logger.file) {
+                char line[LOG_TEXT_SIZE + 128];
+                writeOut(logger, line, formatRecord(logger, record, line, sizeof(line)), true);
+            } else {
+                used += formatRecord(logger, record, buffer + used, sizeof(buffer) - used);
+            }
+            wrote = true;
+        }
+        ring->tail.store(tail, std::memory_order_release);
+
+        if (orphaned) {
+            finished.push_back(ring);
+        }
+    }
+
+    uint64_t dropped = logger.dropped.load(std::memory_order_relaxed);
+    if (dropped != logger.reportedDropped) {
+        if (used + 128 > sizeof(buffer)) {
+            writeOut(logger, buffer, used, false);
+            used = 0;
+        }
+        int length = snprintf(buffer + used, sizeof(buffer) - used, "(%llu log lines dropped, ring full)\n",
+                              (unsigned long long)(dropped - logger.reportedDropped));
+        used += length > 0 ? length : 0;
+        logger.reportedDropped = dropped;
+        wrote = true;
+    }
+
+    if (used > 0) {
+        writeOut(logger, buffer, used, false);
+    }
+    if (wrote) {
+        flushOut(logger);
+    }
+
+    if (!finished.empty()) {
+        std::lock_guard<std::mutex> lock(logger.ringsMutex);
+        for (LogRing* ring : finished) {
+            logger.rings.erase(std::find(logger.rings.begin(), logger.rings.end(), ring));
+            delete ring;
+        }
+    }
+}
+
+static void writerLoop(LoggerState* logger) {
+    while (logger->running.load(std::memory_order_relaxed)) {
+        WaitForSingleObject(logger->wakeEvent, LOG_DRAIN_INTERVAL_MS);
+        drainRings(*logger);
+    }
+    drainRings(*logger);
+}
+
+static void startWriter() {
+    LoggerState& logger = state();
+    std::lock_guard<std::mutex> lock(logger.writerMutex);
+    if (!logger.running) {
+        logger.running = true;
+        logger.writer = std::thread(writerLoop, &logger);
+    }
+}
+
+void Logger::configure(LogLevel level, const std::string& path) {
+    LoggerState& logger = state();
+    setLevel(level);
+
+    FILE* file = nullptr;
+    if (!path.empty()) {
+        file = fopen(path.c_str(), "a");
+        if (!file) {
+            fprintf(stderr, "Cannot open log file %s, logging to the console\n", path.c_str());
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(logger.outputMutex);
+    if (logger.file) {
+        fclose(logger.file);
+    }
+    logger.file = file;
+}
+
+static void stopWriter(LoggerState& logger) {
+    {
+        std::lock_guard<std::mutex> lock(logger.writerMutex);
+        if (logger.running.exchange(false)) {
+            SetEvent(logger.wakeEvent);
+            logger.writer.join();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(logger.outputMutex);
+    if (logger.file) {
+        fclose(logger.file);
+        logger.file = nullptr;
+    }
+}
+
+void Logger::shutdown() {
+    stopWriter(state());
+}
+
+uint64_t Logger::droppedCount() {
+    return state().dropped.load(std::memory_order_relaxed);
+}
+
+bool Logger::parseLevel(const std::string& name, LogLevel& level) {
+    static const char* names[] = { "trace", "debug", "info", "warn", "error", "off" };
+    for (int i = 0; i <= (int)LogLevel::Off; ++i) {
+        if (name == names[i]) {
+            level = (LogLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Logger::submit(const LogRecord& record) {
+    LoggerState& logger = state();
+
+    LogRing* ring = t_ring.ring;
+    if (!ring) {
+        ring = new LogRing();
+        {
+            std::lock_guard<std::mutex> lock(logger.ringsMutex);
+            logger.rings.push_back(ring);
+        }
+        t_ring.ring = ring;
+    }
+    if (!logger.running.load(std::memory_order_relaxed)) {
+        startWriter();
+    }
+
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    uint32_t tail = ring->tail.load(std::memory_order_acquire);
+    if (head - tail >= LOG_RING_SIZE) {
+        logger.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    ring->records[head % LOG_RING_SIZE] = record;
+    ring->head.store(head + 1, std::memory_order_release);
+
+    // The writer polls; only wake it early for problems or a filling ring.
+    if (record.level >= LogLevel::Warn || head - tail >= LOG_RING_SIZE / 2) {
+        SetEvent(logger.wakeEvent);
+    }
+}
+
+LogLine::LogLine(LogLevel level, const char* tag) {
+    LARGE_INTEGER ticks;
+    QueryPerformanceCounter(&ticks);
+    m_record.ticks = ticks.QuadPart;
+    m_record.threadId = GetCurrentThreadId();
+    m_record.level = level;
+    m_record.length = 0;
+
+    size_t tagLength = tag ? std::min<size_t>(strlen(tag), LOG_TAG_SIZE - 1) : 0;
+    memcpy(m_record.tag, tag ? tag : "", tagLength);
+    m_record.tag[tagLength] = '\0';
+}
+
+LogLine::~LogLine() {
+    Logger::submit(m_record);
+}
+
+void LogLine::append(const char* text, size_t length) {
+    size_t room = LOG_TEXT_SIZE - m_record.length;
+    if (length > room) {
+        length = room;
+    }
+    memcpy(m_record.text + m_record.length, text, length);
+    m_record.length += (uint16_t)length;
+}
+
+LogLine& LogLine::operator<<(long long value) {
+    char digits[24];
+    int length = snprintf(digits, sizeof(digits), "%lld", value);
+    append(digits, length);
+    return *this;
+}
+
+LogLine& LogLine::operator<<(unsigned long long value) {
+    char digits[24];
+    int length = snprintf(digits, sizeof(digits), "%llu", value);
+    append(digits, length);
+    return *this;
+}
+
+LogLine& LogLine::operator<<(double value) {
+    char digits[32];
+    int length = snprintf(digits, sizeof(digits), "%g", value);
+    append(digits, length);
+    return *this;
+}
+
+LogLine& LogLine::operator<<(const void* pointer) {
+    char digits[24];
+    int length = snprintf(digits, sizeof(digits), "%p", pointer);
+    append(digits, length);
+    return *this;
+}
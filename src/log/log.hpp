@@ -0,0 +1,122 @@
+#pragma once
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "../define.hpp"
+
+enum class LogLevel : int {
+    Trace = 0,
+    Debug = 1,
+    Info = 2,
+    Warn = 3,
+    Error = 4,
+    Off = 5
+};
+
+// Statements below LOG_COMPILE_LEVEL are removed by the preprocessor, so
+// per-chunk trace logging costs nothing in a normal build. Build with
+// -DLOG_COMPILE_LEVEL=0 to keep them and enable them with the runtime level.
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 2
+#endif
+
+#define LOG_TEXT_SIZE 192
+#define LOG_TAG_SIZE 16
+#define LOG_RING_SIZE 1024
+
+// One log line as it sits in a thread's ring: formatted text plus what the
+// writer needs to prefix it.
+struct LogRecord {
+    int64_t ticks;
+    uint32_t threadId;
+    LogLevel level;
+    uint16_t length;
+    char tag[LOG_TAG_SIZE];
+    char text[LOG_TEXT_SIZE];
+};
+
+// Builds a record in place with a fixed-size buffer; text past the end is
+// cut off rather than allocated for. Submitted when it goes out of scope.
+class LogLine {
+private:
+    LogRecord m_record;
+
+    void append(const char* text, size_t length);
+
+public:
+    LogLine(LogLevel level, const char* tag);
+    ~LogLine();
+
+    LogLine& operator<<(const char* text) { append(text, strlen(text)); return *this; }
+    LogLine& operator<<(const std::string& text) { append(text.data(), text.size()); return *this; }
+    LogLine& operator<<(char value) { append(&value, 1); return *this; }
+    LogLine& operator<<(bool value) { return *this << (value ? "true" : "false"); }
+    LogLine& operator<<(int value) { return *this << (long long)value; }
+    LogLine& operator<<(unsigned int value) { return *this << (unsigned long long)value; }
+    LogLine& operator<<(long value) { return *this << (long long)value; }
+    LogLine& operator<<(unsigned long value) { return *this << (unsigned long long)value; }
+    LogLine& operator<<(long long value);
+    LogLine& operator<<(unsigned long long value);
+    LogLine& operator<<(double value);
+    LogLine& operator<<(const void* pointer);
+};
+
+// Process-wide logger. Each thread writes into its own single-producer ring,
+// so logging never takes a lock on the data path; a background thread
+// drains the rings and writes them to the console or a file. A full ring
+// drops the line and counts it instead of blocking.
+class Logger {
+private:
+    static inline std::atomic<int> s_level{(int)LogLevel::Info};
+
+public:
+    // Level and destination; an empty path logs to the console (stdout,
+    // warnings and errors to stderr).
+    static void configure(LogLevel level, const std::string& path = "");
+    static void setLevel(LogLevel level) { s_level.store((int)level, std::memory_order_relaxed); }
+    static LogLevel level() { return (LogLevel)s_level.load(std::memory_order_relaxed); }
+
+    static bool enabled(LogLevel level) {
+        return (int)level >= s_level.load(std::memory_order_relaxed);
+    }
+
+    // Writes everything logged so far and stops the writer thread.
+    static void shutdown();
+
+    static uint64_t droppedCount();
+
+    static bool parseLevel(const std::string& name, LogLevel& level);
+
+    static void submit(const LogRecord& record);
+};
+
+#define LOG_AT(level, tag, message)                      \
+    do {                                                 \
+        if (Logger::enabled(level)) {                    \
+            LogLine logLine_(level, tag);                \
+            logLine_ << message;                         \
+        }                                                \
+    } while (0)
+
+#if LOG_COMPILE_LEVEL <= 0
+#define LOG_TRACE(tag, message) LOG_AT(LogLevel::Trace, tag, message)
+#else
+#define LOG_TRACE(tag, message) do {} while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= 1
+#define LOG_DEBUG(tag, message) LOG_AT(LogLevel::Debug, tag, message)
+#else
+#define LOG_DEBUG(tag, message) do {} while (0)
+#endif
+
+#define LOG_INFO(tag, message) LOG_AT(LogLevel::Info, tag, message)
+#define LOG_WARN(tag, message) LOG_AT(LogLevel::Warn, tag, message)
+#define LOG_ERROR(tag, message) LOG_AT(LogLevel::Error, tag, message)
+
+#endif // LOG_HPP
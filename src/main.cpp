@@ -3,17 +3,25 @@
 #include <thread>
 #include <atomic>
 #include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
 
 #include "server/server.hpp"
 #include "client/client.hpp"
+#include "client/exec.hpp"
+#include "client/fanout.hpp"
 #include "service/service.hpp"
 #include "define.hpp"
+#include "log/log.hpp"
 
 std::atomic<bool> g_running(true);
+HANDLE g_stopEvent = nullptr;
 
 void signalHandler(int signal) {
     std::cout << "\nReceived signal " << signal << ", shutting down..." << std::endl;
     g_running = false;
+    SetEvent(g_stopEvent);
 }
 
 void waitForExit() {
@@ -26,14 +34,66 @@ void waitForExit() {
     
     if (g_running) {
         g_running = false;
+        SetEvent(g_stopEvent);
     }
 }
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         std::cout << "Usage:" << std::endl;
-        std::cout << "  RemoteConsole -s                 Run as server" << std::endl;
-        std::cout << "  RemoteConsole -c                 Run as client" << std::endl;
+        std::cout << "  RemoteConsole -s [options]       Run as server" << std::endl;
+        std::cout << "      --port N                     Listen on port N (default 8894)" << std::endl;
+        std::cout << "      --shell COMMAND              Command line each session runs (default cmd.exe)" << std::endl;
+        std::cout << "      --pool N                     Keep N shells spawned ahead (default 4, 0 = off)" << std::endl;
+        std::cout << "      --pool-idle-s N              Replace a pooled shell unused for N seconds" << std::endl;
+        std::cout << "      --unix PATH                  Also listen on an AF_UNIX socket at PATH" << std::endl;
+        std::cout << "      --shm NAME                   Also accept shared-memory connections named NAME" << std::endl;
+        std::cout << "      --shards N                   Acceptors, each with its own loop and cores (default 1)" << std::endl;
+        std::cout << "      --workers N                  Threads starting sessions (default 0 = one per CPU)" << std::endl;
+        std::cout << "      --max-queued N               Session starts that may wait (default 1024)" << std::endl;
+        std::cout << "      --max-connections N          Refuse clients beyond N (default 2048, 0 = no limit)" << std::endl;
+        std::cout << "      --max-sessions N             Refuse sessions beyond N (default 4096, 0 = no limit)" << std::endl;
+        std::cout << "      --coalesce-bytes N           Batch output up to N bytes (0 = off)" << std::endl;
+        std::cout << "      --coalesce-us N              Max microseconds output is held" << std::endl;
+        std::cout << "      --buffer-min N               Smallest output read buffer (default 4096)" << std::endl;
+        std::cout << "      --buffer-max N               Largest output read buffer (default 65536)" << std::endl;
+        std::cout << "      --relay-depth N              Output chunks read ahead of sends (default 4)" << std::endl;
+        std::cout << "      --window-high N              Uncredited output per session before it pauses" << std::endl;
+        std::cout << "      --window-low N               Uncredited output at which it resumes" << std::endl;
+        std::cout << "      --scrollback-kb N            Output kept per session for resuming (0 = off)" << std::endl;
+        std::cout << "      --scrollback-budget-mb N     Total scrollback of all sessions (default 64)" << std::endl;
+        std::cout << "      --detach-ttl-s N             Stop detached sessions after N seconds (default 3600)" << std::endl;
+        std::cout << "      --screen-fps N               Screen updates a second (default 30, 0 = off)" << std::endl;
+        std::cout << "      --nagle                      Leave Nagle's algorithm enabled" << std::endl;
+        std::cout << "      --no-files                   Refuse ~get and ~put from clients" << std::endl;
+        std::cout << "      --no-encrypt                 Turn down clients asking for encryption" << std::endl;
+        std::cout << "      --require-encrypt            Close connections that do not exchange keys" << std::endl;
+        std::cout << "      --log-level LEVEL            trace, debug, info (default), warn, error, off" << std::endl;
+        std::cout << "      --log-file PATH              Append the log to PATH instead of the console" << std::endl;
+        std::cout << "      --metrics-port N             Serve Prometheus metrics on 127.0.0.1:N (0 = off)" << std::endl;
+        std::cout << "  RemoteConsole -c [options]       Run as client" << std::endl;
+        std::cout << "      --connect TARGET             HOST, unix:PATH or shm:NAME (default 127.0.0.1)" << std::endl;
+        std::cout << "      --no-compress                Do not ask for output compression" << std::endl;
+        std::cout << "      --no-encrypt                 Do not exchange keys; send in the clear" << std::endl;
+        std::cout << "      --raw                        Send keys as typed (Ctrl-] for commands)" << std::endl;
+        std::cout << "      --screen                     Show screen updates instead of all output" << std::endl;
+        std::cout << "      --attach TOKEN               Resume a detached session" << std::endl;
+        std::cout << "  RemoteConsole -e COMMAND         Run COMMAND on the server, exit with its code" << std::endl;
+        std::cout << "      --connect TARGET             As for -c" << std::endl;
+        std::cout << "      --no-compress                Do not ask for output compression" << std::endl;
+        std::cout << "      --no-encrypt                 Do not exchange keys; send in the clear" << std::endl;
+        std::cout << "  RemoteConsole -m COMMAND         Run COMMAND on many servers at once" << std::endl;
+        std::cout << "      --hosts H1,H2:PORT,...       Servers to run on" << std::endl;
+        std::cout << "      --hosts-file PATH            Servers to run on, one HOST[:PORT] per line" << std::endl;
+        std::cout << "      --parallel N                 Servers connected at once (default 64)" << std::endl;
+        std::cout << "      --connect-timeout-s N        Give up on a server not connected in N seconds" << std::endl;
+        std::cout << "      --timeout-s N                Give up on a server not finished in N seconds" << std::endl;
+        std::cout << "      --quiet                      Print only the totals" << std::endl;
+        std::cout << "      --no-compress                Do not ask for output compression" << std::endl;
+        std::cout << "      --no-encrypt                 Do not exchange keys; send in the clear" << std::endl;
+        std::cout << "  RemoteConsole -interrupt --pid N --event E" << std::endl;
+        std::cout << "                                   Raise console event E (0 Ctrl-C, 1 Ctrl-Break) on" << std::endl;
+        std::cout << "                                   process N; run by the server" << std::endl;
         std::cout << "  RemoteConsole -install           Install service" << std::endl;
         std::cout << "  RemoteConsole -uninstall         Uninstall service" << std::endl;
         std::cout << "  RemoteConsole -run               Run as service" << std::endl;
@@ -43,19 +103,153 @@ int main(int argc, char* argv[]) {
     std::string mode = argv[1];
 
     if (mode == "-s") {
-        Server server(PORT);
+        RelayOptions relay;
+        LogLevel logLevel = LogLevel::Info;
+        std::string logFile;
+        unsigned long metricsPort = METRICS_PORT;
+        PoolOptions pool;
+        SchedulerOptions scheduler;
+        unsigned long port = PORT;
+        unsigned long shards = ACCEPT_SHARDS;
+        std::string unixPath;
+        std::string shmName;
+        for (int i = 2; i < argc; ++i) {
+            std::string option = argv[i];
+            if (option == "--port" && i + 1 < argc) {
+                port = std::strtoul(argv[++i], nullptr, 10);
+            } else if (option == "--shell" && i + 1 < argc) {
+                relay.shell = argv[++i];
+            } else if (option == "--pool" && i + 1 < argc) {
+                pool.size = std::strtoul(argv[++i], nullptr, 10);
+            } else if (option == "--pool-idle-s" && i + 1 < argc) {
+                pool.maxIdleMs = std::strtoul(argv[++i], nullptr, 10) * 1000;
+            } else if (option == "--coalesce-bytes" && i + 1 < argc) {
+                relay.coalesceBytes = std::strtoul(argv[++i], nullptr, 10);
+            } else if (option == "--coalesce-us" && i + 1 < argc) {
+                relay.coalesceMicros = std::strtoul(argv[++i], nullptr, 10);
+            } else if (option == "--buffer-min" && i + 1 < argc) {
+                relay.minBuffer = std::strtoul(argv[++i], nullptr, 10);
+            } else if (option == "--buffer-max" && i + 1 < argc) {
+                relay.maxBuffer = std::strtoul(argv[++i], nullptr, 10);
+            } else if (option == "--relay-depth" && i + 1 < argc) {
+                relay.relayDepth = std::strtoul(argv[++i], nullptr, 10);
+            } else if (option == "--screen-fps" && i + 1 < argc) {
+                relay.screenFps = std::strtoul(argv[++i], nullptr, 10);
+            } else if (option == "--window-high" && i + 1 < argc) {
+                relay.outputHighWater = std::strtoul(argv[++i], nullptr, 10);
+            } else if (option == "--window-low" && i + 1 < argc) {
+                relay.outputLowWater = std::strtoul(argv[++i], nullptr, 10);
+            } else if (option == "--scrollback-kb" && i + 1 < argc) {
+                relay.scrollbackBytes = std::strtoul(argv[++i], nullptr, 10) * 1024;
+            } else if (option == "--scrollback-budget-mb" && i + 1 < argc) {
+                relay.scrollbackBudget = (size_t)std::strtoul(argv[++i], nullptr, 10) * 1024 * 1024;
+            } else if (option == "--detach-ttl-s" && i + 1 < argc) {
+                relay.detachedTtlMs = std::strtoul(argv[++i], nullptr, 10) * 1000;
+            } else if (option == "--nagle") {
+                relay.noDelay = false;
+            } else if (option == "--no-files") {
+                relay.fileTransfer = false;
+            } else if (option == "--unix" && i + 1 < argc) {
+                unixPath = argv[++i];
+            } else if (option == "--shm" && i + 1 < argc) {
+                shmName = argv[++i];
+            } else if (option == "--shards" && i + 1 < argc) {
+                shards = std::strtoul(argv[++i], nullptr, 10);
+            } else if (option == "--workers" && i + 1 < argc) {
+                scheduler.workers = std::strtoul(argv[++i], nullptr, 10);
+            } else if (option == "--max-queued" && i + 1 < argc) {
+                scheduler.maxQueued = std::strtoul(argv[++i], nullptr, 10);
+            } else if (option == "--max-connections" && i + 1 < argc) {
+                scheduler.maxConnections = std::strtoul(argv[++i], nullptr, 10);
+            } else if (option == "--max-sessions" && i + 1 < argc) {
+                scheduler.maxSessions = std::strtoul(argv[++i], nullptr, 10);
+            } else if (option == "--no-encrypt") {
+                relay.encryption = false;
+            } else if (option == "--require-encrypt") {
+                relay.requireEncryption = true;
+            } else if (option == "--log-level" && i + 1 < argc) {
+                if (!Logger::parseLevel(argv[++i], logLevel)) {
+                    std::cerr << "Unknown log level: " << argv[i] << std::endl;
+                    return 1;
+                }
+            } else if (option == "--log-file" && i + 1 < argc) {
+                logFile = argv[++i];
+            } else if (option == "--metrics-port" && i + 1 < argc) {
+                metricsPort = std::strtoul(argv[++i], nullptr, 10);
+            } else {
+                std::cerr << "Unknown server option: " << option << std::endl;
+                return 1;
+            }
+        }
+
+        if (relay.minBuffer == 0 || relay.minBuffer > relay.maxBuffer || relay.maxBuffer > MAX_FRAME_PAYLOAD) {
+            std::cerr << "Output buffers must satisfy 0 < min <= max <= " << MAX_FRAME_PAYLOAD << std::endl;
+            return 1;
+        }
+
+        if (relay.relayDepth == 0 || relay.relayDepth > 64) {
+            std::cerr << "Relay depth must be 1..64" << std::endl;
+            return 1;
+        }
+
+        if (relay.screenFps > 1000) {
+            std::cerr << "--screen-fps must be at most 1000" << std::endl;
+            return 1;
+        }
+
+        if (relay.outputHighWater == 0 || relay.outputLowWater >= relay.outputHighWater) {
+            std::cerr << "Output watermarks must satisfy low < high" << std::endl;
+            return 1;
+        }
+
+        if (shards == 0 || shards > 64) {
+            std::cerr << "--shards must be between 1 and 64" << std::endl;
+            return 1;
+        }
+
+        if (scheduler.maxQueued == 0) {
+            std::cerr << "--max-queued must be at least 1" << std::endl;
+            return 1;
+        }
+
+        if (relay.requireEncryption && !relay.encryption) {
+            std::cerr << "--require-encrypt cannot be combined with --no-encrypt" << std::endl;
+            return 1;
+        }
+
+        Logger::configure(logLevel, logFile);
+
+        if (port == 0 || port > 65535) {
+            std::cerr << "Port must be between 1 and 65535" << std::endl;
+            return 1;
+        }
+
+        Server server((unsigned short)port, LOOP_THREADS, relay, scheduler, shards);
         if (!server.initialize()) {
             std::cerr << "Server initialization failed!" << std::endl;
             return 1;
         }
-        
+
+        if (!unixPath.empty() && !server.listenPath(unixPath)) {
+            std::cerr << "Cannot listen on " << unixPath << std::endl;
+            return 1;
+        }
+        if (!shmName.empty() && !server.listenShm(shmName)) {
+            std::cerr << "Cannot accept shared-memory connections as " << shmName << std::endl;
+            return 1;
+        }
+
+        if (metricsPort != 0 && !server.startMetrics((unsigned short)metricsPort)) {
+            std::cerr << "Metrics endpoint disabled, port " << metricsPort << " unavailable" << std::endl;
+        }
+
+        server.startPool(pool);
         server.start();
 
+        g_stopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
         std::thread exitThread(waitForExit);
 
-        while (g_running) {
-            Sleep(100);
-        }
+        WaitForSingleObject(g_stopEvent, INFINITE);
         
         std::cout << "Stopping server..." << std::endl;
         server.stop();
@@ -68,13 +262,120 @@ int main(int argc, char* argv[]) {
         if (exitThread.joinable()) {
             exitThread.join();
         }
+        CloseHandle(g_stopEvent);
         
         std::cout << "Server stopped successfully" << std::endl;
+        Logger::shutdown();
     } 
     else if (mode == "-c") {
-        Client client(HOST, PORT);
+        ClientOptions options;
+        std::string address = HOST;
+        for (int i = 2; i < argc; ++i) {
+            std::string option = argv[i];
+            if (option == "--connect" && i + 1 < argc) {
+                address = argv[++i];
+            } else if (option == "--no-compress") {
+                options.compress = false;
+            } else if (option == "--no-encrypt") {
+                options.encrypt = false;
+            } else if (option == "--raw") {
+                options.raw = true;
+            } else if (option == "--screen") {
+                options.screen = true;
+            } else if (option == "--attach" && i + 1 < argc) {
+                options.attachToken = std::strtoull(argv[++i], nullptr, 16);
+            } else {
+                std::cerr << "Unknown client option: " << option << std::endl;
+                return 1;
+            }
+        }
+
+        Client client(address, PORT, options);
         client.start();
         client.stop();
+        return client.exitCode();
+    }
+    else if (mode == "-e" && argc >= 3) {
+        ClientOptions options;
+        std::string address = HOST;
+        for (int i = 3; i < argc; ++i) {
+            std::string option = argv[i];
+            if (option == "--connect" && i + 1 < argc) {
+                address = argv[++i];
+            } else if (option == "--no-compress") {
+                options.compress = false;
+            } else if (option == "--no-encrypt") {
+                options.encrypt = false;
+            } else {
+                std::cerr << "Unknown exec option: " << option << std::endl;
+                return EXEC_ERROR_EXIT_CODE;
+            }
+        }
+
+        ExecClient client(address, PORT, argv[2], options);
+        return client.run();
+    }
+    else if (mode == "-m" && argc >= 3) {
+        FanoutOptions options;
+        std::string hosts;
+        for (int i = 3; i < argc; ++i) {
+            std::string option = argv[i];
+            if (option == "--hosts" && i + 1 < argc) {
+                hosts += std::string(argv[++i]) + "\n";
+            } else if (option == "--hosts-file" && i + 1 < argc) {
+                std::ifstream file(argv[++i]);
+                if (!file) {
+                    std::cerr << "Cannot read " << argv[i] << std::endl;
+                    return EXEC_ERROR_EXIT_CODE;
+                }
+                hosts.append(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+                hosts += "\n";
+            } else if (option == "--parallel" && i + 1 < argc) {
+                options.concurrency = std::strtoul(argv[++i], nullptr, 10);
+            } else if (option == "--connect-timeout-s" && i + 1 < argc) {
+                options.connectTimeoutMs = std::strtoul(argv[++i], nullptr, 10) * 1000;
+            } else if (option == "--timeout-s" && i + 1 < argc) {
+                options.timeoutMs = std::strtoul(argv[++i], nullptr, 10) * 1000;
+            } else if (option == "--quiet") {
+                options.quiet = true;
+            } else if (option == "--no-compress") {
+                options.compress = false;
+            } else if (option == "--no-encrypt") {
+                options.encrypt = false;
+            } else {
+                std::cerr << "Unknown fan-out option: " << option << std::endl;
+                return EXEC_ERROR_EXIT_CODE;
+            }
+        }
+
+        std::vector<FanoutTarget> targets;
+        if (!parseTargets(hosts, targets)) {
+            return EXEC_ERROR_EXIT_CODE;
+        }
+        if (targets.empty()) {
+            std::cerr << "No hosts given; use --hosts or --hosts-file" << std::endl;
+            return EXEC_ERROR_EXIT_CODE;
+        }
+
+        FanoutClient client(targets, argv[2], options);
+        return client.run();
+    }
+    else if (mode == "-interrupt") {
+        // Run by the server for Interrupt controls, see ProcessSupervisor.
+        DWORD pid = 0;
+        DWORD event = CTRL_C_EVENT;
+        for (int i = 2; i + 1 < argc; i += 2) {
+            std::string option = argv[i];
+            if (option == "--pid") {
+                pid = std::strtoul(argv[i + 1], nullptr, 10);
+            } else if (option == "--event") {
+                event = std::strtoul(argv[i + 1], nullptr, 10);
+            }
+        }
+        if (pid == 0 || (event != CTRL_C_EVENT && event != CTRL_BREAK_EVENT)) {
+            return 1;
+        }
+        return ProcessSupervisor::raiseConsoleEvent(pid, event);
     }
     else if (mode == "-install") {
         Service service("RemoteConsoleService", "Remote Console Service");
@@ -0,0 +1,485 @@
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+
+#include "metrics.hpp"
+#include "../log/log.hpp"
+#include "../crypto/crypto.hpp"
+
+uint64_t monotonicMicros() {
+    static LARGE_INTEGER frequency = [] {
+        LARGE_INTEGER value;
+        QueryPerformanceFrequency(&value);
+        return value;
+    }();
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart * 1000000 +
+                      counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+}
+
+static int highestBit(uint64_t value) {
+    int bit = 0;
+    while (value >>= 1) {
+        ++bit;
+    }
+    return bit;
+}
+
+Histogram::Histogram() : m_count(0), m_sum(0), m_max(0) {
+    for (auto& bucket : m_buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+int Histogram::bucketIndex(uint64_t micros) {
+    if (micros < LINEAR) {
+        return (int)micros;
+    }
+    int exponent = highestBit(micros);
+    if (exponent > MAX_EXPONENT) {
+        return BUCKETS - 1;
+    }
+    // The top five bits select the bucket within this power of two.
+    int offset = (int)(micros >> (exponent - 4)) - SUB_BUCKETS;
+    return LINEAR + (exponent - 5) * SUB_BUCKETS + offset;
+}
+
+uint64_t Histogram::bucketUpperBound(int index) {
+    if (index < LINEAR) {
+        return (uint64_t)index;
+    }
+    int exponent = (index - LINEAR) / SUB_BUCKETS + 5;
+    uint64_t offset = (index - LINEAR) % SUB_BUCKETS;
+    return ((SUB_BUCKETS + offset + 1) << (exponent - 4)) - 1;
+}
+
+void Histogram::record(uint64_t micros) {
+    m_buckets[bucketIndex(micros)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(micros, std::memory_order_relaxed);
+
+    uint64_t current = m_max.load(std::memory_order_relaxed);
+    while (micros > current &&
+           !m_max.compare_exchange_weak(current, micros, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t Histogram::percentile(double p) const {
+    uint64_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t target = std::max<uint64_t>(1, (uint64_t)(p * total + 0.5));
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            return std::min(bucketUpperBound(i), max());
+        }
+    }
+    return max();
+}
+
+uint64_t Histogram::countAtOrBelow(uint64_t micros) const {
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS && bucketUpperBound(i) <= micros; ++i) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+    }
+    return seen;
+}
+
+SessionMetrics::SessionMetrics(const std::string& sessionName)
+    : name(sessionName),
+      startedAt(monotonicMicros()),
+      bytesIn(0),
+      chunksIn(0),
+      bytesOut(0),
+      chunksOut(0),
+      sendStallMicros(0),
+      throttledMicros(0) {}
+
+ServerMetrics::ServerMetrics()
+    : accepts(0),
+      acceptRetries(0),
+      activeConnections(0),
+      activeSessions(0),
+      sessionsOpened(0),
+      spawnFailures(0),
+      poolHits(0),
+      poolMisses(0),
+      poolRecycled(0),
+      pipeReads(0),
+      outputFrames(0),
+      outputBytes(0),
+      relayQueued(0),
+      relayFull(0),
+      interrupts(0),
+      interruptDropped(0),
+      outputThrottles(0),
+      inputPauses(0),
+      inputPausedMicros(0),
+      sessionsDetached(0),
+      sessionsResumed(0),
+      sessionsExpired(0),
+      detachedSessions(0),
+      scrollbackBytes(0),
+      filesSent(0),
+      filesReceived(0),
+      fileBytesSent(0),
+      fileBytesReceived(0),
+      checksumFailures(0),
+      activeTransfers(0),
+      encryptedConnections(0),
+      connectionsRefused(0),
+      sessionsRefused(0),
+      spawnQueued(0),
+      spawnSteals(0),
+      closedBytesIn(0),
+      closedBytesOut(0),
+      closedStallMicros(0),
+      closedThrottledMicros(0) {}
+
+std::shared_ptr<SessionMetrics> MetricsRegistry::addSession(const std::string& name) {
+    auto session = std::make_shared<SessionMetrics>(name);
+    std::lock_guard<std::mutex> lock(m_sessionsMutex);
+    m_sessions.push_back(session);
+    return session;
+}
+
+void MetricsRegistry::removeSession(const std::shared_ptr<SessionMetrics>& session) {
+    m_server.closedBytesIn += session->bytesIn;
+    m_server.closedBytesOut += session->bytesOut;
+    m_server.closedStallMicros += session->sendStallMicros;
+    m_server.closedThrottledMicros += session->throttledMicros;
+
+    std::lock_guard<std::mutex> lock(m_sessionsMutex);
+    auto it = std::find(m_sessions.begin(), m_sessions.end(), session);
+    if (it != m_sessions.end()) {
+        *it = std::move(m_sessions.back());
+        m_sessions.pop_back();
+    }
+}
+
+// Appends printf-style text; metrics dumps are small and infrequent.
+static void appendf(std::string& out, const char* format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length > 0) {
+        out.append(line, std::min<size_t>(length, sizeof(line) - 1));
+    }
+}
+
+std::string MetricsRegistry::renderText() {
+    std::string out;
+    const ServerMetrics& s = m_server;
+
+    appendf(out, "accepts %llu (%llu retried), connections %lld, sessions %lld (opened %llu, spawn failures %llu)\n",
+            (unsigned long long)s.accepts, (unsigned long long)s.acceptRetries, (long long)s.activeConnections,
+            (long long)s.activeSessions, (unsigned long long)s.sessionsOpened, (unsigned long long)s.spawnFailures);
+    appendf(out, "shell pool: %llu hits, %llu misses, %llu recycled\n",
+            (unsigned long long)s.poolHits, (unsigned long long)s.poolMisses,
+            (unsigned long long)s.poolRecycled);
+    appendf(out, "spawn us p50 %llu p99 %llu max %llu; teardown us p50 %llu p99 %llu max %llu\n",
+            (unsigned long long)s.spawnTime.percentile(0.50), (unsigned long long)s.spawnTime.percentile(0.99),
+            (unsigned long long)s.spawnTime.max(),
+            (unsigned long long)s.teardownTime.percentile(0.50), (unsigned long long)s.teardownTime.percentile(0.99),
+            (unsigned long long)s.teardownTime.max());
+    appendf(out, "output: %llu pipe reads, %llu frames, %llu bytes; %lld chunks queued, %llu full rings\n",
+            (unsigned long long)s.pipeReads, (unsigned long long)s.outputFrames,
+            (unsigned long long)s.outputBytes, (long long)s.relayQueued, (unsigned long long)s.relayFull);
+    appendf(out, "interrupts: %llu, %llu output bytes dropped\n", (unsigned long long)s.interrupts,
+            (unsigned long long)s.interruptDropped);
+    appendf(out, "flow control: %llu output throttles, %llu input pauses (%llu us)\n",
+            (unsigned long long)s.outputThrottles, (unsigned long long)s.inputPauses,
+            (unsigned long long)s.inputPausedMicros);
+    appendf(out, "resume: %lld detached (%llu total, %llu resumed, %llu expired), %lld scrollback bytes\n",
+            (long long)s.detachedSessions, (unsigned long long)s.sessionsDetached,
+            (unsigned long long)s.sessionsResumed, (unsigned long long)s.sessionsExpired,
+            (long long)s.scrollbackBytes);
+    appendf(out, "files: %lld transferring, %llu sent (%llu bytes), %llu received (%llu bytes), "
+                 "%llu checksum failures\n",
+            (long long)s.activeTransfers, (unsigned long long)s.filesSent, (unsigned long long)s.fileBytesSent,
+            (unsigned long long)s.filesReceived, (unsigned long long)s.fileBytesReceived,
+            (unsigned long long)s.checksumFailures);
+    appendf(out, "encryption: %llu connections (%s)\n", (unsigned long long)s.encryptedConnections,
+            cipherKernelName(cipherKernel()));
+    appendf(out, "admission: %llu connections and %llu sessions refused, %lld starts queued (%llu stolen)\n",
+            (unsigned long long)s.connectionsRefused, (unsigned long long)s.sessionsRefused,
+            (long long)s.spawnQueued, (unsigned long long)s.spawnSteals);
+
+    std::vector<std::shared_ptr<SessionMetrics>> sessions;
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        sessions = m_sessions;
+    }
+
+    uint64_t now = monotonicMicros();
+    for (const auto& session : sessions) {
+        appendf(out, "%-10s up %llus in %llu B/%llu out %llu B/%llu read p99 %llu us send p50 %llu p99 %llu us "
+                     "stall %llu us throttled %llu us\n",
+                session->name.c_str(), (unsigned long long)((now - session->startedAt) / 1000000),
+                (unsigned long long)session->bytesIn, (unsigned long long)session->chunksIn,
+                (unsigned long long)session->bytesOut, (unsigned long long)session->chunksOut,
+                (unsigned long long)session->pipeRead.percentile(0.99),
+                (unsigned long long)session->socketSend.percentile(0.50),
+                (unsigned long long)session->socketSend.percentile(0.99),
+                (unsigned long long)session->sendStallMicros,
+                (unsigned long long)session->throttledMicros);
+    }
+    return out;
+}
+
+static void appendCounter(std::string& out, const char* name, const char* help, const char* type, double value) {
+    appendf(out, "# HELP %s %s\n# TYPE %s %s\n%s %.17g\n", name, help, name, type, name, value);
+}
+
+static void appendHistogram(std::string& out, const char* name, const char* help, const Histogram& histogram) {
+    static const uint64_t bounds[] = {
+        50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+        100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+    };
+
+    appendf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for (uint64_t bound : bounds) {
+        appendf(out, "%s_bucket{le=\"%g\"} %llu\n", name, bound / 1e6,
+                (unsigned long long)histogram.countAtOrBelow(bound));
+    }
+    appendf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)histogram.count());
+    appendf(out, "%s_sum %.6f\n%s_count %llu\n", name, histogram.sum() / 1e6, name,
+            (unsigned long long)histogram.count());
+}
+
+static void appendSessionSummary(std::string& out, const char* name, const std::string& session,
+                                 const Histogram& histogram) {
+    for (double quantile : { 0.5, 0.99, 0.999 }) {
+        appendf(out, "%s{session=\"%s\",quantile=\"%g\"} %.6f\n", name, session.c_str(), quantile,
+                histogram.percentile(quantile) / 1e6);
+    }
+    appendf(out, "%s_sum{session=\"%s\"} %.6f\n", name, session.c_str(), histogram.sum() / 1e6);
+    appendf(out, "%s_count{session=\"%s\"} %llu\n", name, session.c_str(), (unsigned long long)histogram.count());
+}
+
+std::string MetricsRegistry::renderPrometheus() {
+    std::string out;
+    const ServerMetrics& s = m_server;
+
+    appendCounter(out, "console_accepts_total", "Accepted client connections.", "counter", (double)s.accepts);
+    appendCounter(out, "console_accept_retries_total", "Accepts that failed to post again and were retried later.",
+                  "counter", (double)s.acceptRetries);
+    appendCounter(out, "console_active_connections", "Open client connections.", "gauge", (double)s.activeConnections);
+    appendCounter(out, "console_active_sessions", "Running child sessions.", "gauge", (double)s.activeSessions);
+    appendCounter(out, "console_sessions_opened_total", "Sessions opened.", "counter", (double)s.sessionsOpened);
+    appendCounter(out, "console_spawn_failures_total", "Sessions whose child failed to start.", "counter",
+                  (double)s.spawnFailures);
+    appendCounter(out, "console_pool_hits_total", "Sessions given a pre-spawned shell.", "counter",
+                  (double)s.poolHits);
+    appendCounter(out, "console_pool_misses_total", "Sessions that spawned their shell on demand.", "counter",
+                  (double)s.poolMisses);
+    appendCounter(out, "console_pool_recycled_total", "Pooled shells replaced after dying or idling.", "counter",
+                  (double)s.poolRecycled);
+    appendCounter(out, "console_pipe_reads_total", "Output pipe reads.", "counter", (double)s.pipeReads);
+    appendCounter(out, "console_output_frames_total", "Output frames sent.", "counter", (double)s.outputFrames);
+    appendCounter(out, "console_output_wire_bytes_total", "Output frame bytes sent, headers included.", "counter",
+                  (double)s.outputBytes);
+    appendCounter(out, "console_relay_queued_chunks", "Output chunks read from children and not yet sent.",
+                  "gauge", (double)s.relayQueued);
+    appendCounter(out, "console_relay_full_total", "Times an output reader waited for its ring to drain.",
+                  "counter", (double)s.relayFull);
+    appendCounter(out, "console_interrupts_total", "Interrupts delivered to children.", "counter",
+                  (double)s.interrupts);
+    appendCounter(out, "console_interrupt_dropped_bytes_total", "Output dropped unsent because of an interrupt.",
+                  "counter", (double)s.interruptDropped);
+    appendCounter(out, "console_output_throttles_total", "Times a stream parked at the output high watermark.",
+                  "counter", (double)s.outputThrottles);
+    appendCounter(out, "console_input_pauses_total", "Times a connection stopped reading on a full control queue.",
+                  "counter", (double)s.inputPauses);
+    appendCounter(out, "console_input_paused_seconds_total", "Time connections spent not reading from clients.",
+                  "counter", s.inputPausedMicros / 1e6);
+    appendCounter(out, "console_sessions_detached_total", "Sessions that outlived their connection.", "counter",
+                  (double)s.sessionsDetached);
+    appendCounter(out, "console_sessions_resumed_total", "Detached sessions reattached by a client.", "counter",
+                  (double)s.sessionsResumed);
+    appendCounter(out, "console_sessions_expired_total", "Detached sessions stopped after their lifetime.",
+                  "counter", (double)s.sessionsExpired);
+    appendCounter(out, "console_detached_sessions", "Sessions waiting to be reattached.", "gauge",
+                  (double)s.detachedSessions);
+    appendCounter(out, "console_scrollback_bytes", "Memory reserved for resumable sessions' scrollback.", "gauge",
+                  (double)s.scrollbackBytes);
+    appendCounter(out, "console_files_sent_total", "Files downloaded by clients.", "counter", (double)s.filesSent);
+    appendCounter(out, "console_files_received_total", "Files uploaded by clients.", "counter",
+                  (double)s.filesReceived);
+    appendCounter(out, "console_file_sent_bytes_total", "File data sent to clients.", "counter",
+                  (double)s.fileBytesSent);
+    appendCounter(out, "console_file_received_bytes_total", "File data written from clients.", "counter",
+                  (double)s.fileBytesReceived);
+    appendCounter(out, "console_file_checksum_failures_total", "Uploaded chunks that failed their checksum.",
+                  "counter", (double)s.checksumFailures);
+    appendCounter(out, "console_active_transfers", "File transfers in progress.", "gauge",
+                  (double)s.activeTransfers);
+    appendCounter(out, "console_encrypted_connections_total", "Connections that exchanged keys.", "counter",
+                  (double)s.encryptedConnections);
+    appendCounter(out, "console_connections_refused_total", "Connections closed at the connection limit.",
+                  "counter", (double)s.connectionsRefused);
+    appendCounter(out, "console_sessions_refused_total", "Sessions refused at the session limit.", "counter",
+                  (double)s.sessionsRefused);
+    appendCounter(out, "console_spawn_queued", "Session starts waiting for a worker.", "gauge",
+                  (double)s.spawnQueued);
+    appendCounter(out, "console_spawn_steals_total", "Session starts taken from another worker's queue.",
+                  "counter", (double)s.spawnSteals);
+    appendHistogram(out, "console_spawn_seconds", "Time to create a session's pipes and child.", s.spawnTime);
+    appendHistogram(out, "console_teardown_seconds", "Time from child exit or stop to session cleanup.",
+                    s.teardownTime);
+
+    std::vector<std::shared_ptr<SessionMetrics>> sessions;
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        sessions = m_sessions;
+    }
+
+    uint64_t bytesIn = s.closedBytesIn;
+    uint64_t bytesOut = s.closedBytesOut;
+    uint64_t stall = s.closedStallMicros;
+    uint64_t throttled = s.closedThrottledMicros;
+    for (const auto& session : sessions) {
+        bytesIn += session->bytesIn;
+        bytesOut += session->bytesOut;
+        stall += session->sendStallMicros;
+        throttled += session->throttledMicros;
+    }
+    appendCounter(out, "console_input_bytes_total", "Stdin bytes received from clients.", "counter", (double)bytesIn);
+    appendCounter(out, "console_output_bytes_total", "Output payload bytes sent to clients.", "counter",
+                  (double)bytesOut);
+    appendCounter(out, "console_send_stall_seconds_total", "Time output sends waited on a full socket.", "counter",
+                  stall / 1e6);
+    appendCounter(out, "console_throttled_seconds_total", "Time output waited for client credit.", "counter",
+                  throttled / 1e6);
+
+    static const char* perSession[][3] = {
+        { "console_session_input_bytes_total", "Stdin bytes received, per session.", "counter" },
+        { "console_session_output_bytes_total", "Output payload bytes sent, per session.", "counter" },
+        { "console_session_output_chunks_total", "Output frames sent, per session.", "counter" },
+        { "console_session_send_stall_seconds_total", "Send stall time, per session.", "counter" },
+        { "console_session_throttled_seconds_total", "Credit wait time, per session.", "counter" },
+    };
+    for (int metric = 0; metric < 5; ++metric) {
+        appendf(out, "# HELP %s %s\n# TYPE %s %s\n", perSession[metric][0], perSession[metric][1],
+                perSession[metric][0], perSession[metric][2]);
+        for (const auto& session : sessions) {
+            double value = 0.0;
+            switch (metric) {
+            case 0: value = (double)session->bytesIn; break;
+            case 1: value = (double)session->bytesOut; break;
+            case 2: value = (double)session->chunksOut; break;
+            case 3: value = session->sendStallMicros / 1e6; break;
+            case 4: value = session->throttledMicros / 1e6; break;
+            }
+            appendf(out, "%s{session=\"%s\"} %.17g\n", perSession[metric][0], session->name.c_str(), value);
+        }
+    }
+
+    appendf(out, "# HELP console_session_pipe_read_seconds Time output pipe reads were outstanding.\n"
+                 "# TYPE console_session_pipe_read_seconds summary\n");
+    for (const auto& session : sessions) {
+        appendSessionSummary(out, "console_session_pipe_read_seconds", session->name, session->pipeRead);
+    }
+    appendf(out, "# HELP console_session_send_seconds Time output frame sends took to complete.\n"
+                 "# TYPE console_session_send_seconds summary\n");
+    for (const auto& session : sessions) {
+        appendSessionSummary(out, "console_session_send_seconds", session->name, session->socketSend);
+    }
+    return out;
+}
+
+MetricsEndpoint::MetricsEndpoint(MetricsRegistry& registry) : m_registry(registry) {
+    m_acceptEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    m_stopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+}
+
+MetricsEndpoint::~MetricsEndpoint() {
+    stop();
+    CloseHandle(m_acceptEvent);
+    CloseHandle(m_stopEvent);
+}
+
+bool MetricsEndpoint::listen(unsigned short port) {
+    // Loopback only: the endpoint has no authentication.
+    if (!m_listenSocket.create() || !m_listenSocket.bind(HOST, port) || !m_listenSocket.listen()) {
+        LOG_ERROR(nullptr, "Failed to open metrics endpoint on port " << port);
+        m_listenSocket.close();
+        return false;
+    }
+    if (WSAEventSelect(m_listenSocket.getHandle(), m_acceptEvent, FD_ACCEPT) == SOCKET_ERROR) {
+        LOG_ERROR(nullptr, "WSAEventSelect failed for metrics endpoint: " << WSAGetLastError());
+        m_listenSocket.close();
+        return false;
+    }
+
+    LOG_INFO(nullptr, "Metrics endpoint listening on " << HOST << ":" << port);
+    start();
+    return true;
+}
+
+void MetricsEndpoint::stop() {
+    SetEvent(m_stopEvent);
+    Thread::stop();
+    m_listenSocket.close();
+}
+
+void MetricsEndpoint::run() {
+    HANDLE waitHandles[] = { m_stopEvent, m_acceptEvent };
+
+    while (WaitForMultipleObjects(2, waitHandles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1) {
+        for (;;) {
+            Socket client = m_listenSocket.accept();
+            if (!client.isValid()) {
+                break;
+            }
+            WSAEventSelect(client.getHandle(), nullptr, 0);
+            client.setBlocking(true);
+            serve(client);
+        }
+    }
+}
+
+void MetricsEndpoint::serve(Socket& client) {
+    // The request itself does not matter; read what has arrived and answer.
+    DWORD timeout = 1000;
+    setsockopt(client.getHandle(), SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+    char request[1024];
+    client.recv(request, sizeof(request));
+
+    std::string body = m_registry.renderPrometheus();
+    std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                           std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+
+    size_t sent = 0;
+    while (sent < response.size()) {
+        int result = client.send(response.data() + sent, response.size() - sent);
+        if (result <= 0) {
+            break;
+        }
+        sent += result;
+    }
+    client.shutdown(SD_SEND);
+}
+
+ClientMetrics::ClientMetrics() : bytesIn(0), framesIn(0), bytesOut(0), framesOut(0) {}
+
+std::string ClientMetrics::renderText() const {
+    std::string out;
+    appendf(out, "received %llu bytes in %llu frames, sent %llu bytes in %llu frames\n",
+            (unsigned long long)bytesIn, (unsigned long long)framesIn,
+            (unsigned long long)bytesOut, (unsigned long long)framesOut);
+    appendf(out, "console write us p50 %llu p99 %llu max %llu\n",
+            (unsigned long long)consoleWrite.percentile(0.50), (unsigned long long)consoleWrite.percentile(0.99),
+            (unsigned long long)consoleWrite.max());
+    appendf(out, "input->output us p50 %llu p99 %llu p999 %llu (%llu samples)\n",
+            (unsigned long long)inputToOutput.percentile(0.50), (unsigned long long)inputToOutput.percentile(0.99),
+            (unsigned long long)inputToOutput.percentile(0.999), (unsigned long long)inputToOutput.count());
+    return out;
+}
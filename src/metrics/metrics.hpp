@@ -0,0 +1,217 @@
+#pragma once
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../utils.hpp"
+#include "../define.hpp"
+
+// Monotonic clock in microseconds, for latency measurements.
+uint64_t monotonicMicros();
+
+// Log-linear latency histogram in the style of HdrHistogram: exact below
+// 32 us, then 16 buckets per power of two (about 6% relative error) up to
+// roughly six days. Recording is a few relaxed atomic adds, so it can stay
+// on in production; readers see a consistent-enough snapshot.
+class Histogram {
+public:
+    static const int LINEAR = 32;
+    static const int SUB_BUCKETS = 16;
+    static const int MAX_EXPONENT = 39;
+    static const int BUCKETS = LINEAR + (MAX_EXPONENT - 4) * SUB_BUCKETS;
+
+private:
+    std::atomic<uint64_t> m_buckets[BUCKETS];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_max;
+
+public:
+    Histogram();
+
+    void record(uint64_t micros);
+
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+    uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+
+    // Upper bound of the bucket holding fraction p (0..1) of the values.
+    uint64_t percentile(double p) const;
+
+    // Number of values at or below `micros`, for cumulative buckets.
+    uint64_t countAtOrBelow(uint64_t micros) const;
+
+    static int bucketIndex(uint64_t micros);
+    static uint64_t bucketUpperBound(int index);
+};
+
+// Counters for one child session. Owned by the registry through a
+// shared_ptr so a dump can still read a session that is finishing.
+struct SessionMetrics {
+    std::string name;
+    uint64_t startedAt;
+
+    std::atomic<uint64_t> bytesIn;
+    std::atomic<uint64_t> chunksIn;
+    std::atomic<uint64_t> bytesOut;
+    std::atomic<uint64_t> chunksOut;
+
+    // Time each output pipe read was outstanding, and each frame send.
+    Histogram pipeRead;
+    Histogram socketSend;
+
+    // Time sends spent beyond METRICS_SEND_STALL_US, i.e. with the socket
+    // buffer full, and time output was parked for lack of client credit.
+    std::atomic<uint64_t> sendStallMicros;
+    std::atomic<uint64_t> throttledMicros;
+
+    explicit SessionMetrics(const std::string& sessionName);
+};
+
+struct ServerMetrics {
+    std::atomic<uint64_t> accepts;
+    // Accepts that could not be posted again after completing and waited
+    // for the server's next retry.
+    std::atomic<uint64_t> acceptRetries;
+    std::atomic<int64_t> activeConnections;
+    std::atomic<int64_t> activeSessions;
+    std::atomic<uint64_t> sessionsOpened;
+    std::atomic<uint64_t> spawnFailures;
+
+    // Warm shell pool: sessions served from it or spawned on demand, and
+    // pooled shells replaced because they died or sat idle too long.
+    std::atomic<uint64_t> poolHits;
+    std::atomic<uint64_t> poolMisses;
+    std::atomic<uint64_t> poolRecycled;
+
+    // Output relay: pipe reads, frames sent and their bytes on the wire.
+    std::atomic<uint64_t> pipeReads;
+    std::atomic<uint64_t> outputFrames;
+    std::atomic<uint64_t> outputBytes;
+
+    // Relay stages: chunks read from children and waiting to be sent, and
+    // times a reader found its stream's ring full and waited for a send.
+    std::atomic<int64_t> relayQueued;
+    std::atomic<uint64_t> relayFull;
+
+    // Interrupts delivered to children, and output bytes read before one
+    // and dropped unsent.
+    std::atomic<uint64_t> interrupts;
+    std::atomic<uint64_t> interruptDropped;
+
+    // Flow control: streams parked at the output high watermark, and
+    // connections that stopped reading because control replies backed up.
+    std::atomic<uint64_t> outputThrottles;
+    std::atomic<uint64_t> inputPauses;
+    std::atomic<uint64_t> inputPausedMicros;
+
+    // Resumable sessions: disconnects they outlived, reattaches, those that
+    // stayed detached past their lifetime, and what is detached right now
+    // along with the scrollback memory held for it.
+    std::atomic<uint64_t> sessionsDetached;
+    std::atomic<uint64_t> sessionsResumed;
+    std::atomic<uint64_t> sessionsExpired;
+    std::atomic<int64_t> detachedSessions;
+    std::atomic<int64_t> scrollbackBytes;
+
+    // File transfers: finished ones each way, file bytes moved, chunks that
+    // failed their checksum, and transfers in progress.
+    std::atomic<uint64_t> filesSent;
+    std::atomic<uint64_t> filesReceived;
+    std::atomic<uint64_t> fileBytesSent;
+    std::atomic<uint64_t> fileBytesReceived;
+    std::atomic<uint64_t> checksumFailures;
+    std::atomic<int64_t> activeTransfers;
+
+    // Connections that exchanged keys and sent the rest as records.
+    std::atomic<uint64_t> encryptedConnections;
+
+    // Admission control: connections and sessions turned away at the
+    // server's limits, session starts waiting for a worker, and starts a
+    // worker took from another worker's queue.
+    std::atomic<uint64_t> connectionsRefused;
+    std::atomic<uint64_t> sessionsRefused;
+    std::atomic<int64_t> spawnQueued;
+    std::atomic<uint64_t> spawnSteals;
+
+    // Totals of sessions that have already finished.
+    std::atomic<uint64_t> closedBytesIn;
+    std::atomic<uint64_t> closedBytesOut;
+    std::atomic<uint64_t> closedStallMicros;
+    std::atomic<uint64_t> closedThrottledMicros;
+
+    Histogram spawnTime;
+    Histogram teardownTime;
+
+    ServerMetrics();
+};
+
+class MetricsRegistry {
+private:
+    ServerMetrics m_server;
+
+    std::mutex m_sessionsMutex;
+    std::vector<std::shared_ptr<SessionMetrics>> m_sessions;
+
+public:
+    ServerMetrics& server() { return m_server; }
+    const ServerMetrics& server() const { return m_server; }
+
+    std::shared_ptr<SessionMetrics> addSession(const std::string& name);
+    // Folds the session into the server totals and stops listing it.
+    void removeSession(const std::shared_ptr<SessionMetrics>& session);
+
+    // Human-readable dump, one line per session.
+    std::string renderText();
+    // Prometheus text exposition format (version 0.0.4).
+    std::string renderPrometheus();
+};
+
+// Serves MetricsRegistry::renderPrometheus() over plain HTTP on a loopback
+// port, separate from the console port so scraping never shares the data
+// path. Any request gets the full dump.
+class MetricsEndpoint : public Thread {
+private:
+    MetricsRegistry& m_registry;
+    Socket m_listenSocket;
+    HANDLE m_acceptEvent;
+    HANDLE m_stopEvent;
+
+public:
+    explicit MetricsEndpoint(MetricsRegistry& registry);
+    ~MetricsEndpoint();
+
+    bool listen(unsigned short port);
+    void stop();
+
+protected:
+    void run() override;
+
+private:
+    void serve(Socket& client);
+};
+
+// Client-side counters, shown by the client's ~stats command.
+struct ClientMetrics {
+    std::atomic<uint64_t> bytesIn;
+    std::atomic<uint64_t> framesIn;
+    std::atomic<uint64_t> bytesOut;
+    std::atomic<uint64_t> framesOut;
+
+    // Time spent writing received output to the console.
+    Histogram consoleWrite;
+    // Time from sending a line of input to the next output from that session.
+    Histogram inputToOutput;
+
+    ClientMetrics();
+
+    std::string renderText() const;
+};
+
+#endif // METRICS_HPP
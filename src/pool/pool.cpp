@@ -0,0 +1,201 @@
+#include <vector>
+
+#include "pool.hpp"
+
+SpawnedShell::~SpawnedShell() {
+    if (processInfo.hProcess) {
+        TerminateProcess(processInfo.hProcess, 1);
+        CloseHandle(processInfo.hProcess);
+    }
+    if (processInfo.hThread) {
+        CloseHandle(processInfo.hThread);
+    }
+}
+
+bool SpawnedShell::isAlive() const {
+    return processInfo.hProcess && WaitForSingleObject(processInfo.hProcess, 0) == WAIT_TIMEOUT;
+}
+
+bool spawnShell(const std::string& command, SpawnedShell& shell, const char* logTag) {
+    if (!shell.stdinPipe.create(PipeMode::OverlappedWrite) ||
+        !shell.stdoutPipe.create(PipeMode::OverlappedRead) ||
+        !shell.stderrPipe.create(PipeMode::OverlappedRead)) {
+        LOG_ERROR(logTag, "Failed to create pipes");
+        return false;
+    }
+
+    // Restrict inheritance to this child's ends; otherwise children spawned
+    // concurrently for other sessions would hold these pipes open and the
+    // session would never see EOF when its own child exits.
+    HANDLE inherited[] = {
+        shell.stdinPipe.getReadHandle(),
+        shell.stdoutPipe.getWriteHandle(),
+        shell.stderrPipe.getWriteHandle()
+    };
+
+    SIZE_T attributeSize = 0;
+    InitializeProcThreadAttributeList(nullptr, 1, 0, &attributeSize);
+    std::vector<char> attributeBuffer(attributeSize);
+    LPPROC_THREAD_ATTRIBUTE_LIST attributes =
+        reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(attributeBuffer.data());
+
+    if (!InitializeProcThreadAttributeList(attributes, 1, 0, &attributeSize)) {
+        LOG_ERROR(logTag, "InitializeProcThreadAttributeList failed: " << GetLastError());
+        return false;
+    }
+
+    if (!UpdateProcThreadAttribute(attributes, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST,
+                                   inherited, sizeof(inherited), nullptr, nullptr)) {
+        LOG_ERROR(logTag, "UpdateProcThreadAttribute failed: " << GetLastError());
+        DeleteProcThreadAttributeList(attributes);
+        return false;
+    }
+
+    STARTUPINFOEXA startupInfo;
+    ZeroMemory(&startupInfo, sizeof(startupInfo));
+    startupInfo.StartupInfo.cb = sizeof(startupInfo);
+    startupInfo.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+    startupInfo.StartupInfo.hStdInput = shell.stdinPipe.getReadHandle();
+    startupInfo.StartupInfo.hStdOutput = shell.stdoutPipe.getWriteHandle();
+    startupInfo.StartupInfo.hStdError = shell.stderrPipe.getWriteHandle();
+    startupInfo.lpAttributeList = attributes;
+
+    PROCESS_INFORMATION processInfo;
+    ZeroMemory(&processInfo, sizeof(processInfo));
+
+    // CreateProcessA may modify the command line in place.
+    std::vector<char> cmdLine(command.begin(), command.end());
+    cmdLine.push_back('\0');
+
+    BOOL success = CreateProcessA(
+        nullptr,
+        cmdLine.data(),
+        nullptr,
+        nullptr,
+        TRUE,
+        CREATE_NO_WINDOW | EXTENDED_STARTUPINFO_PRESENT,
+        nullptr,
+        nullptr,
+        &startupInfo.StartupInfo,
+        &processInfo
+    );
+
+    DeleteProcThreadAttributeList(attributes);
+
+    if (!success) {
+        LOG_ERROR(logTag, "CreateProcess failed: " << GetLastError());
+        return false;
+    }
+
+    LOG_INFO(logTag, "Process created successfully with PID: " << processInfo.dwProcessId);
+
+    shell.processInfo = processInfo;
+    shell.spawnedAt = monotonicMicros();
+
+    shell.stdinPipe.closeRead();
+    shell.stdoutPipe.closeWrite();
+    shell.stderrPipe.closeWrite();
+    return true;
+}
+
+ShellPool::ShellPool(const std::string& command, const PoolOptions& options, ServerMetrics& metrics)
+    : m_command(command), m_options(options), m_metrics(metrics) {
+    m_refillEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    m_stopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+}
+
+ShellPool::~ShellPool() {
+    stop();
+    CloseHandle(m_refillEvent);
+    CloseHandle(m_stopEvent);
+}
+
+void ShellPool::stop() {
+    SetEvent(m_stopEvent);
+    Thread::stop();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_ready.clear();
+}
+
+std::unique_ptr<SpawnedShell> ShellPool::take() {
+    std::unique_ptr<SpawnedShell> shell;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // Oldest first, so shells are used before they go stale.
+        while (!m_ready.empty() && !shell) {
+            shell = std::move(m_ready.front());
+            m_ready.pop_front();
+            if (!shell->isAlive()) {
+                LOG_WARN(nullptr, "Discarding pooled shell " << shell->processInfo.dwProcessId << ", it has exited");
+                ++m_metrics.poolRecycled;
+                shell.reset();
+            }
+        }
+    }
+    SetEvent(m_refillEvent);
+    return shell;
+}
+
+size_t ShellPool::readyCount() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_ready.size();
+}
+
+void ShellPool::run() {
+    LOG_INFO(nullptr, "Shell pool keeping " << m_options.size << " shells ready");
+
+    HANDLE waitHandles[] = { m_stopEvent, m_refillEvent };
+    DWORD waitResult = WAIT_TIMEOUT;
+    while (waitResult != WAIT_OBJECT_0) {
+        if (waitResult == WAIT_TIMEOUT) {
+            recycle();
+        }
+        refill();
+        waitResult = WaitForMultipleObjects(2, waitHandles, FALSE, m_options.checkIntervalMs);
+    }
+}
+
+// Drops shells that have exited or idled past maxIdleMs; refill() replaces them.
+void ShellPool::recycle() {
+    uint64_t now = monotonicMicros();
+    uint64_t maxIdle = (uint64_t)m_options.maxIdleMs * 1000;
+
+    std::vector<std::unique_ptr<SpawnedShell>> stale;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_ready.begin(); it != m_ready.end();) {
+            if (!(*it)->isAlive() || now - (*it)->spawnedAt > maxIdle) {
+                stale.push_back(std::move(*it));
+                it = m_ready.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    if (!stale.empty()) {
+        LOG_DEBUG(nullptr, "Recycling " << stale.size() << " pooled shells");
+        m_metrics.poolRecycled += stale.size();
+    }
+    // Killed here, outside the lock, as `stale` goes out of scope.
+}
+
+void ShellPool::refill() {
+    for (;;) {
+        if (WaitForSingleObject(m_stopEvent, 0) == WAIT_OBJECT_0 || readyCount() >= m_options.size) {
+            return;
+        }
+
+        // Spawned outside the lock so take() never waits on CreateProcess.
+        auto shell = std::make_unique<SpawnedShell>();
+        if (!spawnShell(m_command, *shell, "pool")) {
+            // Retried at the next check rather than in a tight loop.
+            LOG_WARN(nullptr, "Shell pool failed to spawn, retrying later");
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_ready.push_back(std::move(shell));
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+#ifndef POOL_HPP
+#define POOL_HPP
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "../utils.hpp"
+#include "../define.hpp"
+#include "../log/log.hpp"
+#include "../metrics/metrics.hpp"
+
+// A child process and the parent's ends of its stdin, stdout and stderr
+// pipes. Whoever holds it owns the child: destroying it kills the child
+// unless the handles have been taken over.
+struct SpawnedShell {
+    PROCESS_INFORMATION processInfo;
+    Pipe stdinPipe;
+    Pipe stdoutPipe;
+    Pipe stderrPipe;
+    uint64_t spawnedAt;
+
+    SpawnedShell() : spawnedAt(0) { ZeroMemory(&processInfo, sizeof(processInfo)); }
+    ~SpawnedShell();
+
+    SpawnedShell(const SpawnedShell&) = delete;
+    SpawnedShell& operator=(const SpawnedShell&) = delete;
+
+    bool isAlive() const;
+};
+
+// Starts `command` on fresh pipes suitable for the event loop: the parent's
+// stdin end is overlapped for writing and its output ends for reading.
+bool spawnShell(const std::string& command, SpawnedShell& shell, const char* logTag);
+
+struct PoolOptions {
+    // Shells kept ready; 0 disables the pool.
+    size_t size;
+    // A pooled shell unused for this long is replaced by a fresh one.
+    uint32_t maxIdleMs;
+    // How often pooled shells are checked for having died or gone stale.
+    uint32_t checkIntervalMs;
+
+    PoolOptions()
+        : size(SHELL_POOL_SIZE),
+          maxIdleMs(SHELL_POOL_IDLE_MS),
+          checkIntervalMs(SHELL_POOL_CHECK_MS) {}
+};
+
+// Keeps a few shells spawned ahead of time so a new session only has to
+// attach their pipes instead of paying for CreateProcess. The pool thread
+// refills it whenever a shell is taken and, every check interval, replaces
+// shells that have exited or idled past maxIdleMs. Output a pooled shell
+// writes while waiting (the cmd.exe banner and prompt) stays in its pipe
+// and reaches the client as soon as the session starts reading.
+class ShellPool : public Thread {
+private:
+    std::string m_command;
+    PoolOptions m_options;
+    ServerMetrics& m_metrics;
+
+    std::mutex m_mutex;
+    std::deque<std::unique_ptr<SpawnedShell>> m_ready;
+
+    HANDLE m_refillEvent;
+    HANDLE m_stopEvent;
+
+public:
+    ShellPool(const std::string& command, const PoolOptions& options, ServerMetrics& metrics);
+    ~ShellPool();
+
+    void stop();
+
+    // Hands out a live pooled shell, or nullptr if none is ready.
+    std::unique_ptr<SpawnedShell> take();
+
+    size_t readyCount();
+
+protected:
+    void run() override;
+
+private:
+    void recycle();
+    void refill();
+};
+
+#endif // POOL_HPP
@@ -0,0 +1,301 @@
+#include <cstring>
+#include <algorithm>
+
+#include "protocol.hpp"
+#include "../log/log.hpp"
+
+static uint32_t toMilliseconds(double seconds) {
+    return seconds > 0.0 ? (uint32_t)(seconds * 1000.0) : 0;
+}
+
+void encodeExitStatus(ExitStatusPayload& payload, DWORD exitCode, double wallSeconds,
+                      double userSeconds, double kernelSeconds, SIZE_T peakWorkingSet) {
+    payload.exitCode = htonl(exitCode);
+    payload.wallMs = htonl(toMilliseconds(wallSeconds));
+    payload.userMs = htonl(toMilliseconds(userSeconds));
+    payload.kernelMs = htonl(toMilliseconds(kernelSeconds));
+    payload.peakWorkingSetKb = htonl((uint32_t)(peakWorkingSet / 1024));
+}
+
+void decodeExitStatus(const Frame& frame, ExitStatusPayload& payload) {
+    ZeroMemory(&payload, sizeof(payload));
+    memcpy(&payload, frame.payload, std::min<size_t>(frame.length, sizeof(payload)));
+
+    payload.exitCode = ntohl(payload.exitCode);
+    payload.wallMs = ntohl(payload.wallMs);
+    payload.userMs = ntohl(payload.userMs);
+    payload.kernelMs = ntohl(payload.kernelMs);
+    payload.peakWorkingSetKb = ntohl(payload.peakWorkingSetKb);
+}
+
+void encodeResume(ResumePayload& payload, uint64_t token, uint64_t offset) {
+    payload.tokenHigh = htonl((uint32_t)(token >> 32));
+    payload.tokenLow = htonl((uint32_t)token);
+    payload.offsetHigh = htonl((uint32_t)(offset >> 32));
+    payload.offsetLow = htonl((uint32_t)offset);
+}
+
+bool decodeResume(const Frame& frame, uint64_t& token, uint64_t& offset) {
+    ResumePayload payload;
+    if (frame.length < sizeof(payload)) {
+        return false;
+    }
+    memcpy(&payload, frame.payload, sizeof(payload));
+    token = (uint64_t)ntohl(payload.tokenHigh) << 32 | ntohl(payload.tokenLow);
+    offset = (uint64_t)ntohl(payload.offsetHigh) << 32 | ntohl(payload.offsetLow);
+    return true;
+}
+
+void encodeFile(FilePayload& payload, FileOp op, uint32_t value, uint64_t offset, uint64_t size) {
+    payload.op = (uint8_t)op;
+    payload.value = htonl(value);
+    payload.offsetHigh = htonl((uint32_t)(offset >> 32));
+    payload.offsetLow = htonl((uint32_t)offset);
+    payload.sizeHigh = htonl((uint32_t)(size >> 32));
+    payload.sizeLow = htonl((uint32_t)size);
+}
+
+bool decodeFile(const Frame& frame, FileMessage& message) {
+    FilePayload payload;
+    if (frame.length < sizeof(payload)) {
+        return false;
+    }
+    memcpy(&payload, frame.payload, sizeof(payload));
+    message.op = (FileOp)payload.op;
+    message.value = ntohl(payload.value);
+    message.offset = (uint64_t)ntohl(payload.offsetHigh) << 32 | ntohl(payload.offsetLow);
+    message.size = (uint64_t)ntohl(payload.sizeHigh) << 32 | ntohl(payload.sizeLow);
+    message.data = frame.payload + sizeof(payload);
+    message.length = frame.length - sizeof(payload);
+    return true;
+}
+
+bool decodeControl(const Frame& frame, ControlPayload& payload) {
+    if (frame.length < sizeof(ControlPayload)) {
+        return false;
+    }
+    memcpy(&payload, frame.payload, sizeof(payload));
+    payload.value = ntohl(payload.value);
+    return true;
+}
+
+bool isRefusal(const Frame& frame) {
+    ControlPayload control;
+    return frame.channel == Channel::Control && frame.session == 0 && decodeControl(frame, control) &&
+           (ControlCode)control.code == ControlCode::SessionOpened && control.value == (uint32_t)OpenStatus::Busy;
+}
+
+const char* describeOpenStatus(uint32_t status) {
+    switch ((OpenStatus)status) {
+    case OpenStatus::Ok:
+        return "ok";
+    case OpenStatus::Duplicate:
+        return "session id in use";
+    case OpenStatus::Limit:
+        return "too many sessions on this connection";
+    case OpenStatus::SpawnFailed:
+        return "could not start the process";
+    case OpenStatus::UnknownToken:
+        return "no such detached session";
+    case OpenStatus::Busy:
+        return "server busy, try again later";
+    default:
+        return "unknown status";
+    }
+}
+
+void advanceBuffers(WSABUF*& buffers, DWORD& count, DWORD bytes) {
+    while (count > 0 && bytes >= buffers->len) {
+        bytes -= buffers->len;
+        ++buffers;
+        --count;
+    }
+    if (count > 0) {
+        buffers->buf += bytes;
+        buffers->len -= bytes;
+    }
+}
+
+void OutgoingFrame::prepare(Channel channel, const void* payload, uint32_t length,
+                            uint8_t flags, uint16_t session) {
+    encodeHeader(header, channel, length, flags, session);
+
+    buffers[0].buf = (char*)&header;
+    buffers[0].len = sizeof(header);
+    buffers[1].buf = (char*)payload;
+    buffers[1].len = length;
+
+    pending = buffers;
+    count = length > 0 ? 2 : 1;
+    sealed = false;
+}
+
+void OutgoingFrame::prepare(Channel channel, const void* prefix, uint32_t prefixLength,
+                            const void* payload, uint32_t length, uint8_t flags, uint16_t session) {
+    prepare(channel, prefix, prefixLength + length, flags, session);
+    buffers[1].len = prefixLength;
+    buffers[2].buf = (char*)payload;
+    buffers[2].len = length;
+    count = length > 0 ? 3 : 2;
+}
+
+bool sendFrame(Transport& transport, OutgoingFrame& frame) {
+    while (frame.count > 0) {
+        int bytesSent = transport.send(frame.pending, frame.count);
+        if (bytesSent <= 0) {
+            return false;
+        }
+        frame.advance((DWORD)bytesSent);
+    }
+    return true;
+}
+
+bool sendFrame(Transport& transport, Channel channel, const void* payload, uint32_t length,
+               uint8_t flags, uint16_t session) {
+    OutgoingFrame frame;
+    frame.prepare(channel, payload, length, flags, session);
+    return sendFrame(transport, frame);
+}
+
+bool sendFrame(Transport& transport, Channel channel, const void* prefix, uint32_t prefixLength,
+               const void* payload, uint32_t length, uint8_t flags, uint16_t session) {
+    OutgoingFrame frame;
+    frame.prepare(channel, prefix, prefixLength, payload, length, flags, session);
+    return sendFrame(transport, frame);
+}
+
+FrameReader::FrameReader(size_t maxPayload)
+    : m_buffer(2 * (sizeof(FrameHeader) + maxPayload)), m_start(0), m_end(0), m_corrupt(false) {}
+
+char* FrameReader::writePointer() {
+    // Compact only when the free tail could no longer hold a full frame.
+    if (m_start > 0 && m_buffer.size() - m_end < m_buffer.size() / 2) {
+        memmove(m_buffer.data(), m_buffer.data() + m_start, m_end - m_start);
+        m_end -= m_start;
+        m_start = 0;
+    }
+    return m_buffer.data() + m_end;
+}
+
+size_t FrameReader::writableSize() {
+    return m_buffer.size() - m_end;
+}
+
+bool FrameReader::next(Frame& frame) {
+    if (m_corrupt || m_end - m_start < sizeof(FrameHeader)) {
+        return false;
+    }
+
+    FrameHeader header;
+    memcpy(&header, m_buffer.data() + m_start, sizeof(header));
+    uint32_t length = ntohl(header.length);
+
+    if (length > m_buffer.size() / 2 - sizeof(FrameHeader)) {
+        LOG_ERROR(nullptr, "Frame of " << length << " bytes exceeds the limit");
+        m_corrupt = true;
+        return false;
+    }
+
+    if (m_end - m_start < sizeof(FrameHeader) + length) {
+        return false;
+    }
+
+    frame.channel = (Channel)header.channel;
+    frame.flags = header.flags;
+    frame.session = ntohs(header.session);
+    frame.payload = m_buffer.data() + m_start + sizeof(FrameHeader);
+    frame.length = length;
+
+    m_start += sizeof(FrameHeader) + length;
+    if (m_start == m_end) {
+        m_start = m_end = 0;
+    }
+    return true;
+}
+
+bool RecordLayer::complete(const Frame& frame, bool client) {
+    uint8_t sendKey[CRYPTO_KEY_SIZE];
+    uint8_t receiveKey[CRYPTO_KEY_SIZE];
+    if (frame.length != CRYPTO_KEY_SIZE ||
+        !m_exchange.derive((const uint8_t*)frame.payload, client, sendKey, receiveKey)) {
+        return false;
+    }
+    m_send.setKey(sendKey);
+    m_receive.setKey(receiveKey);
+    SecureZeroMemory(sendKey, sizeof(sendKey));
+    SecureZeroMemory(receiveKey, sizeof(receiveKey));
+    return true;
+}
+
+void RecordLayer::seal(OutgoingFrame& frame, char* out) {
+    if (frame.sealed) {
+        return;
+    }
+
+    // The header is authenticated as it goes on the wire, tag included.
+    uint32_t length = ntohl(frame.header.length);
+    frame.header.length = htonl(length + RECORD_TAG_SIZE);
+    m_send.seal(&frame.header, sizeof(frame.header), frame.buffers + 1, frame.count - 1, out, frame.tag);
+
+    if (out && length > 0) {
+        frame.buffers[1].buf = out;
+        frame.buffers[1].len = length;
+        frame.count = 2;
+    }
+    frame.buffers[frame.count].buf = (char*)frame.tag;
+    frame.buffers[frame.count].len = RECORD_TAG_SIZE;
+    ++frame.count;
+    frame.pending = frame.buffers;
+    frame.sealed = true;
+}
+
+bool RecordLayer::open(Frame& frame) {
+    if (frame.length < RECORD_TAG_SIZE) {
+        return false;
+    }
+    FrameHeader header;
+    encodeHeader(header, frame.channel, frame.length, frame.flags, frame.session);
+    frame.length -= RECORD_TAG_SIZE;
+    return m_receive.open(&header, sizeof(header), frame.payload, frame.length,
+                          (const uint8_t*)frame.payload + frame.length);
+}
+
+bool clientHandshake(Transport& transport, FrameReader& reader, RecordLayer& layer, uint32_t features,
+                     std::vector<HeldFrame>& early) {
+    if (!layer.begin()) {
+        LOG_ERROR(nullptr, "Cannot generate a key pair: " << GetLastError());
+        return false;
+    }
+
+    ControlPayload hello;
+    encodeControl(hello, ControlCode::Hello, features | FeatureEncryption);
+    if (!sendFrame(transport, Channel::Control, &hello, sizeof(hello)) ||
+        !sendFrame(transport, Channel::Key, layer.publicKey(), CRYPTO_KEY_SIZE)) {
+        return false;
+    }
+
+    for (;;) {
+        Frame frame;
+        while (reader.next(frame)) {
+            if (frame.channel == Channel::Key) {
+                return layer.complete(frame, true);
+            }
+            early.emplace_back(frame);
+
+            ControlPayload control;
+            if (frame.channel == Channel::Control && decodeControl(frame, control) &&
+                (ControlCode)control.code == ControlCode::Hello && !(control.value & FeatureEncryption)) {
+                return true;
+            }
+        }
+        if (reader.isCorrupt()) {
+            return false;
+        }
+
+        int bytesRead = transport.recv(reader.writePointer(), reader.writableSize());
+        if (bytesRead <= 0) {
+            return false;
+        }
+        reader.commit(bytesRead);
+    }
+}
@@ -0,0 +1,378 @@
+#pragma once
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+#include <cstdint>
+
+#include "../utils.hpp"
+#include "../crypto/crypto.hpp"
+
+// Every message on the wire is a FrameHeader followed by `length` payload
+// bytes. Multi-byte fields are in network byte order. `session` selects one
+// of the child sessions multiplexed over the connection; session 0 is opened
+// implicitly when the connection is accepted. On the File channel it is the
+// id of a file transfer instead, chosen by the client. An Exec frame opens
+// the session in its header like OpenSession, but the child is the command
+// line in its payload, started directly instead of the server's shell.
+//
+// With FeatureEncryption, the client follows its Hello with a Key frame and
+// sends nothing else until the server's Key frame arrives; each carries the
+// sender's ephemeral X25519 public key and nothing else. The server's Key is
+// the last frame it sends in the clear, and every frame after either Key is
+// a record: the payload is encrypted, followed by a RECORD_TAG_SIZE tag that
+// also covers the header, and the header's length includes the tag.
+//
+// With FeatureScreen, a session's output is not sent on Stdout/Stderr but
+// run through a terminal model on the server, and the Screen channel carries
+// the VT sequences that bring the client's console up to date with it, at
+// most a few times a second. Screen frames take no output credit.
+enum class Channel : uint8_t {
+    Stdin = 0,
+    Stdout = 1,
+    Stderr = 2,
+    Control = 3,
+    ExitStatus = 4,
+    Resume = 5,
+    File = 6,
+    Exec = 7,
+    Key = 8,
+    Screen = 9
+};
+
+// First payload byte of a Control frame. Codes other than Ping/Pong carry a
+// uint32 value after the code and apply to the session in the header:
+//   OpenSession    client -> server, value unused
+//   CloseSession   client -> server, value unused; answered by ExitStatus
+//   SessionOpened  server -> client, value 0 on success or an error code
+//   WindowUpdate   either way, value is the number of bytes the receiver
+//                  may now send on that session (server: stdout+stderr,
+//                  client: stdin); output credit counts decoded bytes
+//   Hello          client -> server, value is the Feature bits it wants;
+//                  answered with the bits the server accepted
+//   CloseStdin     client -> server, value unused; the child's stdin is
+//                  closed once the input sent before it has been written
+//   WindowSize     client -> server, value is columns << 16 | rows of the
+//                  client's console; the session's screen takes that size
+//                  and is sent in full with the next update
+//   Interrupt      client -> server, value is an InterruptKind; stdin not
+//                  yet written and output not yet sent are dropped and the
+//                  child gets the console control event. The server answers
+//                  with the same code once it has dropped the output, so
+//                  the client can drop what arrives before the answer
+enum class ControlCode : uint8_t {
+    Ping = 1,
+    Pong = 2,
+    OpenSession = 3,
+    CloseSession = 4,
+    SessionOpened = 5,
+    WindowUpdate = 6,
+    Hello = 7,
+    CloseStdin = 8,
+    WindowSize = 9,
+    Interrupt = 10
+};
+
+// Optional features negotiated with Hello for the whole connection.
+enum Feature : uint32_t {
+    FeatureCompression = 0x1,
+    // Sessions outlive the connection and can be reattached by token.
+    FeatureResume = 0x2,
+    // Files can be copied to and from the server on the File channel.
+    FeatureFile = 0x4,
+    // Frames become ChaCha20-Poly1305 records once Key frames are exchanged.
+    FeatureEncryption = 0x8,
+    // Output arrives as screen updates on the Screen channel. A screen
+    // cannot be replayed, so the server never accepts it with FeatureResume.
+    FeatureScreen = 0x10,
+    // Interrupt controls are understood.
+    FeatureInterrupt = 0x20
+};
+
+#define SUPPORTED_FEATURES \
+    (FeatureCompression | FeatureResume | FeatureFile | FeatureEncryption | FeatureScreen | FeatureInterrupt)
+
+// Value of an Interrupt control: the console control event the child gets.
+enum class InterruptKind : uint32_t {
+    CtrlC = 0,
+    CtrlBreak = 1
+};
+
+// FrameHeader flags.
+enum FrameFlag : uint8_t {
+    // Stdout/Stderr payload is a compressed block (see compress.hpp).
+    FrameCompressed = 0x1
+};
+
+// Value of a SessionOpened control. Busy means the server is at its limit
+// of sessions or queued starts; sent for session 0 of a new connection it
+// means the connection limit, and the server closes the connection.
+enum class OpenStatus : uint32_t {
+    Ok = 0,
+    Duplicate = 1,
+    Limit = 2,
+    SpawnFailed = 3,
+    UnknownToken = 4,
+    Busy = 5
+};
+
+const char* describeOpenStatus(uint32_t status);
+
+// Payload of a Resume frame, only used once FeatureResume is negotiated:
+//   server -> client  the session in the header can be resumed with `token`
+//                     (offset 0); or, answering an attach, replay starts at
+//                     `offset` and anything before it is no longer kept
+//   client -> server  attach the detached session `token` as the session in
+//                     the header; the client already has `offset` bytes of
+//                     its output (stdout and stderr, decoded, in order)
+// Failed attaches are answered with SessionOpened(UnknownToken).
+
+// First byte of a File frame, only used once FeatureFile is negotiated.
+// Every File frame starts with a FilePayload; `value`, `offset` and `size`
+// mean, per operation:
+//   Get     client -> server  send the file named by the rest of the payload
+//                             from `offset` on (what the client already has)
+//   Put     client -> server  receive `size` bytes into the file named by the
+//                             rest of the payload; `value` FileResume keeps
+//                             what the server already has of it
+//   Ready   server -> client  transfer accepted, data starts at `offset` and
+//                             the file is `size` bytes long
+//   Data    either way        the rest of the payload is file data at
+//                             `offset`, `value` is its Adler-32 checksum
+//   Ack     either way        the receiver has stored `value` more bytes and
+//                             the file is complete up to `offset`; the sender
+//                             may have FILE_WINDOW bytes of Data unacked
+//   Done    server -> client  the transfer ended with FileStatus `value`; the
+//                             file is complete up to `offset`
+//   Cancel  client -> server  stop the transfer; answered by Done
+// Data is sent in order. A transfer that fails keeps the verified part of
+// the file, so it can be resumed from there.
+enum class FileOp : uint8_t {
+    Get = 1,
+    Put = 2,
+    Ready = 3,
+    Data = 4,
+    Ack = 5,
+    Done = 6,
+    Cancel = 7
+};
+
+enum FileFlag : uint32_t {
+    FileResume = 0x1
+};
+
+// Value of a File Done.
+enum class FileStatus : uint32_t {
+    Ok = 0,
+    NotFound = 1,
+    AccessDenied = 2,
+    Checksum = 3,
+    Failed = 4,
+    Cancelled = 5,
+    Limit = 6
+};
+
+#pragma pack(push, 1)
+struct FrameHeader {
+    uint32_t length;
+    uint8_t channel;
+    uint8_t flags;
+    uint16_t session;
+};
+
+struct ControlPayload {
+    uint8_t code;
+    uint32_t value;
+};
+
+struct ResumePayload {
+    uint32_t tokenHigh;
+    uint32_t tokenLow;
+    uint32_t offsetHigh;
+    uint32_t offsetLow;
+};
+
+struct FilePayload {
+    uint8_t op;
+    uint32_t value;
+    uint32_t offsetHigh;
+    uint32_t offsetLow;
+    uint32_t sizeHigh;
+    uint32_t sizeLow;
+};
+
+struct ExitStatusPayload {
+    uint32_t exitCode;
+    uint32_t wallMs;
+    uint32_t userMs;
+    uint32_t kernelMs;
+    uint32_t peakWorkingSetKb;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(FrameHeader) == 8, "FrameHeader must be 8 bytes on the wire");
+
+struct Frame {
+    Channel channel;
+    uint8_t flags;
+    uint16_t session;
+    char* payload;
+    uint32_t length;
+};
+
+inline void encodeHeader(FrameHeader& header, Channel channel, uint32_t length,
+                         uint8_t flags = 0, uint16_t session = 0) {
+    header.length = htonl(length);
+    header.channel = (uint8_t)channel;
+    header.flags = flags;
+    header.session = htons(session);
+}
+
+inline void encodeControl(ControlPayload& payload, ControlCode code, uint32_t value = 0) {
+    payload.code = (uint8_t)code;
+    payload.value = htonl(value);
+}
+
+// Returns false if the frame is too short to hold a ControlPayload.
+bool decodeControl(const Frame& frame, ControlPayload& payload);
+// True for the SessionOpened(Busy) on session 0 that a server at its
+// connection limit sends before closing.
+bool isRefusal(const Frame& frame);
+
+void encodeResume(ResumePayload& payload, uint64_t token, uint64_t offset);
+// Returns false if the frame is too short to hold a ResumePayload.
+bool decodeResume(const Frame& frame, uint64_t& token, uint64_t& offset);
+
+// A decoded File frame; `data` points into the frame after the FilePayload.
+struct FileMessage {
+    FileOp op;
+    uint32_t value;
+    uint64_t offset;
+    uint64_t size;
+    const char* data;
+    uint32_t length;
+};
+
+void encodeFile(FilePayload& payload, FileOp op, uint32_t value, uint64_t offset, uint64_t size = 0);
+// Returns false if the frame is too short to hold a FilePayload.
+bool decodeFile(const Frame& frame, FileMessage& message);
+
+void encodeExitStatus(ExitStatusPayload& payload, DWORD exitCode, double wallSeconds,
+                      double userSeconds, double kernelSeconds, SIZE_T peakWorkingSet);
+void decodeExitStatus(const Frame& frame, ExitStatusPayload& payload);
+
+// Consumes `bytes` from the front of a WSABUF array after a partial send.
+void advanceBuffers(WSABUF*& buffers, DWORD& count, DWORD bytes);
+
+// A frame prepared for a vectored send: the header and the payload go out as
+// separate WSABUFs, so the payload is never copied behind the header. The
+// payload may itself be in two parts, a fixed prefix and the data. Once
+// sealed by a RecordLayer the tag follows as one more buffer.
+struct OutgoingFrame {
+    FrameHeader header;
+    uint8_t tag[RECORD_TAG_SIZE];
+    WSABUF buffers[4];
+    WSABUF* pending;
+    DWORD count;
+    bool sealed;
+
+    void prepare(Channel channel, const void* payload, uint32_t length,
+                 uint8_t flags = 0, uint16_t session = 0);
+    void prepare(Channel channel, const void* prefix, uint32_t prefixLength,
+                 const void* payload, uint32_t length, uint8_t flags = 0, uint16_t session = 0);
+
+    // Returns true once every byte has been sent.
+    bool advance(DWORD bytes) {
+        advanceBuffers(pending, count, bytes);
+        return count == 0;
+    }
+};
+
+// Sends header and payload with one vectored call, looping over partial
+// sends. Blocking transports only.
+bool sendFrame(Transport& transport, Channel channel, const void* payload, uint32_t length,
+               uint8_t flags = 0, uint16_t session = 0);
+bool sendFrame(Transport& transport, Channel channel, const void* prefix, uint32_t prefixLength,
+               const void* payload, uint32_t length, uint8_t flags = 0, uint16_t session = 0);
+bool sendFrame(Transport& transport, OutgoingFrame& frame);
+
+// Incremental parser over a receive buffer that the socket reads into
+// directly, so frame payloads are handed out in place without copying.
+class FrameReader {
+private:
+    std::vector<char> m_buffer;
+    size_t m_start;
+    size_t m_end;
+    bool m_corrupt;
+
+public:
+    FrameReader(size_t maxPayload = MAX_FRAME_PAYLOAD + RECORD_TAG_SIZE);
+
+    char* writePointer();
+    size_t writableSize();
+    void commit(size_t bytes) { m_end += bytes; }
+
+    // Returns the next complete frame; its payload stays valid until the
+    // next call to writePointer().
+    bool next(Frame& frame);
+    bool isCorrupt() const { return m_corrupt; }
+    size_t buffered() const { return m_end - m_start; }
+};
+
+// One end's encryption state. Frames pass in the clear until the Key frames
+// have been exchanged; from then on each is a record under the key for its
+// direction, with the header authenticated along with the payload.
+class RecordLayer {
+private:
+    KeyExchange m_exchange;
+    RecordCipher m_send;
+    RecordCipher m_receive;
+
+public:
+    // Makes this end's key pair, whose public half goes in its Key frame.
+    bool begin() { return m_exchange.generate(); }
+    const uint8_t* publicKey() const { return m_exchange.publicKey(); }
+    // Takes the peer's Key frame; false if it holds no usable key.
+    bool complete(const Frame& frame, bool client);
+    bool isSecure() const { return m_send.isKeyed(); }
+
+    // Encrypts a prepared frame in place, or into `out` (room for the whole
+    // payload) when the payload must stay as it is, such as a mapped file.
+    // A frame already sealed is left alone, so a partial send can go on.
+    void seal(OutgoingFrame& frame, char* out = nullptr);
+    // Checks and decrypts a received record in place and drops its tag;
+    // false if it was not sealed by the peer as the next record.
+    bool open(Frame& frame);
+};
+
+// A frame copied out of the receive buffer, to be handled later.
+struct HeldFrame {
+    Channel channel;
+    uint8_t flags;
+    uint16_t session;
+    std::string payload;
+
+    explicit HeldFrame(const Frame& frame)
+        : channel(frame.channel), flags(frame.flags), session(frame.session),
+          payload(frame.payload, frame.length) {}
+
+    Frame frame() {
+        Frame result;
+        result.channel = channel;
+        result.flags = flags;
+        result.session = session;
+        result.payload = &payload[0];
+        result.length = (uint32_t)payload.size();
+        return result;
+    }
+};
+
+// The client's side of the key exchange on a blocking transport, before it has
+// sent anything else: a Hello asking for `features` and FeatureEncryption,
+// and a Key frame. Frames are then read until the server's Key arrives, or
+// its Hello turns encryption down, which leaves `layer` in the clear. Frames
+// that come first are copied to `early` for the caller to handle afterwards;
+// those after the Key stay in `reader`. False if the connection failed.
+bool clientHandshake(Transport& transport, FrameReader& reader, RecordLayer& layer, uint32_t features,
+                     std::vector<HeldFrame>& early);
+
+#endif // PROTOCOL_HPP
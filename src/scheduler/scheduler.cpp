@@ -0,0 +1,191 @@
+#include <algorithm>
+
+#include "scheduler.hpp"
+#include "../log/log.hpp"
+
+Scheduler::Scheduler(ServerMetrics& metrics, const SchedulerOptions& options)
+    : m_options(options),
+      m_metrics(metrics),
+      m_next(0),
+      m_queued(0),
+      m_running(false),
+      m_connections(0),
+      m_sessions(0) {
+    if (m_options.workers == 0) {
+        m_options.workers = std::max<size_t>(std::thread::hardware_concurrency(), 2);
+    }
+}
+
+Scheduler::~Scheduler() {
+    stop();
+}
+
+bool Scheduler::start() {
+    std::unique_lock<std::shared_mutex> lock(m_stateMutex);
+    if (m_running) {
+        return false;
+    }
+    m_running = true;
+    for (size_t i = 0; i < m_options.workers; ++i) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        m_workers[i]->thread = std::thread(&Scheduler::work, this, i);
+    }
+
+    LOG_INFO(nullptr, "Scheduler started with " << m_workers.size() << " workers, " << m_options.maxQueued
+             << " queued starts, limits " << m_options.maxConnections << " connections, "
+             << m_options.maxSessions << " sessions");
+    return true;
+}
+
+void Scheduler::stop() {
+    {
+        std::unique_lock<std::shared_mutex> lock(m_stateMutex);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+    }
+    for (auto& worker : m_workers) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->wake.notify_one();
+    }
+
+    for (auto& worker : m_workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+    m_workers.clear();
+}
+
+bool Scheduler::isRunning() {
+    return m_running;
+}
+
+bool Scheduler::submit(IoRequest* request) {
+    size_t queued = m_queued.load();
+    do {
+        if (queued >= m_options.maxQueued) {
+            return false;
+        }
+    } while (!m_queued.compare_exchange_weak(queued, queued + 1));
+
+    std::shared_lock<std::shared_mutex> lock(m_stateMutex);
+    if (!m_running) {
+        lock.unlock();
+        --m_queued;
+        return false;
+    }
+    ++m_metrics.spawnQueued;
+
+    size_t target = m_next++ % m_workers.size();
+    bool taken;
+    {
+        Worker& worker = *m_workers[target];
+        std::lock_guard<std::mutex> queueLock(worker.mutex);
+        worker.queue.push_back(request);
+        taken = worker.idle;
+        if (taken) {
+            worker.woken = true;
+            worker.wake.notify_one();
+        }
+    }
+
+    // Its owner is busy: wake an idle worker to take it from the back.
+    for (size_t i = 1; !taken && i < m_workers.size(); ++i) {
+        Worker& other = *m_workers[(target + i) % m_workers.size()];
+        std::lock_guard<std::mutex> otherLock(other.mutex);
+        if (other.idle && !other.woken) {
+            other.woken = true;
+            other.wake.notify_one();
+            taken = true;
+        }
+    }
+    return true;
+}
+
+bool Scheduler::take(size_t index, IoRequest*& request) {
+    Worker& own = *m_workers[index];
+    for (;;) {
+        // Read first: once it is false nothing more is pushed, so the look
+        // through the queues below sees everything that is left.
+        bool stopping = !m_running;
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            own.woken = false;
+            if (!own.queue.empty()) {
+                own.idle = false;
+                request = own.queue.front();
+                own.queue.pop_front();
+                return true;
+            }
+            // Set before looking at the other queues, so a request pushed to
+            // one of them meanwhile still wakes this worker.
+            own.idle = true;
+        }
+
+        request = steal(index);
+        std::unique_lock<std::mutex> lock(own.mutex);
+        if (request || stopping) {
+            own.idle = false;
+            return request != nullptr;
+        }
+        own.wake.wait(lock, [&] { return !own.queue.empty() || own.woken || !m_running; });
+    }
+}
+
+// Taken from the back, the end its owner reaches last.
+IoRequest* Scheduler::steal(size_t index) {
+    for (size_t i = 1; i < m_workers.size(); ++i) {
+        Worker& victim = *m_workers[(index + i) % m_workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.queue.empty()) {
+            IoRequest* request = victim.queue.back();
+            victim.queue.pop_back();
+            ++m_metrics.spawnSteals;
+            return request;
+        }
+    }
+    return nullptr;
+}
+
+void Scheduler::work(size_t index) {
+    IoRequest* request;
+    while (take(index, request)) {
+        --m_metrics.spawnQueued;
+        request->handler->onCompletion(request, 0, NO_ERROR);
+        --m_queued;
+    }
+}
+
+bool Scheduler::admitConnection() {
+    size_t count = m_connections.load();
+    do {
+        if (m_options.maxConnections && count >= m_options.maxConnections) {
+            ++m_metrics.connectionsRefused;
+            return false;
+        }
+    } while (!m_connections.compare_exchange_weak(count, count + 1));
+    return true;
+}
+
+void Scheduler::releaseConnection() {
+    --m_connections;
+}
+
+bool Scheduler::admitSession() {
+    size_t count = m_sessions.load();
+    do {
+        if (m_options.maxSessions && count >= m_options.maxSessions) {
+            ++m_metrics.sessionsRefused;
+            return false;
+        }
+    } while (!m_sessions.compare_exchange_weak(count, count + 1));
+    return true;
+}
+
+void Scheduler::releaseSession() {
+    --m_sessions;
+}
@@ -0,0 +1,105 @@
+#pragma once
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+#include "../utils.hpp"
+#include "../define.hpp"
+#include "../engine/engine.hpp"
+#include "../metrics/metrics.hpp"
+
+struct SchedulerOptions {
+    // Threads that start sessions, so a slow CreateProcess holds up neither
+    // the accept thread nor the event loop; 0 means one per CPU.
+    size_t workers;
+    // Session starts waiting for a worker; past this a new session is
+    // refused with OpenStatus::Busy instead of queuing without bound.
+    size_t maxQueued;
+    // Connections and sessions (detached ones included) the server takes
+    // on at once; 0 means no limit.
+    size_t maxConnections;
+    size_t maxSessions;
+
+    SchedulerOptions()
+        : workers(SPAWN_WORKERS),
+          maxQueued(SPAWN_QUEUE),
+          maxConnections(MAX_CONNECTIONS),
+          maxSessions(MAX_SESSIONS) {}
+};
+
+// Admission control and the workers that run session starts. Work is an
+// IoRequest dispatched to its handler as if it had completed on the
+// EventLoop. Each worker has its own queue, filled round robin, and its own
+// wakeup; a worker whose queue is empty takes from the back of another's,
+// so one slow spawn does not leave the work queued behind it waiting. A
+// request pushed to a busy worker wakes an idle one to take it. Connections
+// and sessions hold a slot from admit*() until they release it.
+class Scheduler {
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<IoRequest*> queue;
+        std::condition_variable wake;
+        // Under `mutex`: the worker found its queue empty and is looking
+        // through the others or waiting, and a submit has since asked it to
+        // look again.
+        bool idle;
+        bool woken;
+        std::thread thread;
+
+        Worker() : idle(false), woken(false) {}
+    };
+
+    SchedulerOptions m_options;
+    ServerMetrics& m_metrics;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<size_t> m_next;
+    // Submitted and not yet finished, for the queue bound.
+    std::atomic<size_t> m_queued;
+
+    // Held shared by submit() and exclusively by start() and stop(), so
+    // nothing is pushed once stop() has let the workers drain and exit.
+    std::shared_mutex m_stateMutex;
+    std::atomic<bool> m_running;
+
+    std::atomic<size_t> m_connections;
+    std::atomic<size_t> m_sessions;
+
+public:
+    Scheduler(ServerMetrics& metrics, const SchedulerOptions& options = SchedulerOptions());
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    bool start();
+    // Runs what is still queued, then joins the workers.
+    void stop();
+    bool isRunning();
+
+    // False if the queue is full or the scheduler stopped; the request is
+    // then not run.
+    bool submit(IoRequest* request);
+
+    bool admitConnection();
+    void releaseConnection();
+    bool admitSession();
+    void releaseSession();
+
+    const SchedulerOptions& options() const { return m_options; }
+
+private:
+    void work(size_t index);
+    // Waits for the next request for worker `index`, from its own queue or
+    // another's; false once the scheduler has stopped and all are empty.
+    bool take(size_t index, IoRequest*& request);
+    IoRequest* steal(size_t index);
+};
+
+#endif // SCHEDULER_HPP
@@ -0,0 +1,691 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "screen.hpp"
+
+bool ScreenCell::operator==(const ScreenCell& other) const {
+    return size == other.size && flags == other.flags && foreground == other.foreground &&
+           background == other.background && memcmp(bytes, other.bytes, size) == 0;
+}
+
+static ScreenCell defaultCell() {
+    ScreenCell cell;
+    memset(&cell, 0, sizeof(cell));
+    cell.bytes[0] = ' ';
+    cell.size = 1;
+    cell.foreground = ScreenModel::DEFAULT_COLOR;
+    cell.background = ScreenModel::DEFAULT_COLOR;
+    return cell;
+}
+
+static void appendNumber(std::string& out, int value) {
+    char digits[12];
+    int length = snprintf(digits, sizeof(digits), "%d", value);
+    out.append(digits, length);
+}
+
+static void appendCursor(std::string& out, int row, int column) {
+    out += "\x1b[";
+    appendNumber(out, row + 1);
+    out += ';';
+    appendNumber(out, column + 1);
+    out += 'H';
+}
+
+ScreenModel::ScreenModel(int columns, int rows)
+    : m_columns(std::min(std::max(columns, 1), SCREEN_MAX_COLUMNS)),
+      m_rows(std::min(std::max(rows, 1), SCREEN_MAX_ROWS)),
+      m_row(0),
+      m_column(0),
+      m_wrapPending(false),
+      m_pen(defaultCell()),
+      m_top(0),
+      m_bottom(m_rows - 1),
+      m_savedRow(0),
+      m_savedColumn(0),
+      m_savedPen(defaultCell()),
+      m_cursorVisible(true),
+      m_shownCursorVisible(true),
+      m_state(State::Ground),
+      m_paramsFull(false),
+      m_private(0),
+      m_utf8Size(0),
+      m_utf8Expected(0),
+      m_dirty(false),
+      m_repaint(true),
+      m_scrolled(0) {
+    m_cells.assign((size_t)m_columns * m_rows, defaultCell());
+    m_shown = m_cells;
+}
+
+void ScreenModel::resize(int columns, int rows) {
+    columns = std::min(std::max(columns, 1), SCREEN_MAX_COLUMNS);
+    rows = std::min(std::max(rows, 1), SCREEN_MAX_ROWS);
+    if (columns == m_columns && rows == m_rows) {
+        invalidate();
+        return;
+    }
+
+    // Keep the cursor's row on screen by dropping rows from the top.
+    int offset = std::max(0, m_row - (rows - 1));
+    std::vector<ScreenCell> cells((size_t)columns * rows, defaultCell());
+    for (int row = 0; row < rows && row + offset < m_rows; ++row) {
+        std::copy_n(&m_cells[(size_t)(row + offset) * m_columns], std::min(columns, m_columns),
+                    &cells[(size_t)row * columns]);
+    }
+
+    m_cells.swap(cells);
+    m_shown.assign(m_cells.size(), defaultCell());
+    m_columns = columns;
+    m_rows = rows;
+    m_row -= offset;
+    m_column = std::min(m_column, m_columns - 1);
+    m_wrapPending = false;
+    m_top = 0;
+    m_bottom = m_rows - 1;
+    m_savedRow = std::min(m_savedRow, m_rows - 1);
+    m_savedColumn = std::min(m_savedColumn, m_columns - 1);
+    invalidate();
+}
+
+void ScreenModel::invalidate() {
+    m_repaint = true;
+    m_scrolled = 0;
+}
+
+ScreenCell ScreenModel::blank() const {
+    return defaultCell();
+}
+
+void ScreenModel::write(const char* data, size_t length) {
+    if (length > 0) {
+        m_dirty = true;
+    }
+
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char c = (unsigned char)data[i];
+        switch (m_state) {
+        case State::Ground:
+            if (m_utf8Expected > 0) {
+                if ((c & 0xC0) == 0x80) {
+                    m_utf8[m_utf8Size++] = (char)c;
+                    if (m_utf8Size == m_utf8Expected) {
+                        put(m_utf8, m_utf8Size);
+                        m_utf8Expected = 0;
+                    }
+                    break;
+                }
+                // Not UTF-8 after all: each byte is a character of its own.
+                for (int k = 0; k < m_utf8Size; ++k) {
+                    put(&m_utf8[k], 1);
+                }
+                m_utf8Expected = 0;
+            }
+
+            if (c == 0x1b) {
+                m_state = State::Escape;
+            } else if (c < 0x20 || c == 0x7f) {
+                control(c);
+            } else if (c < 0x80) {
+                put(&data[i], 1);
+            } else if ((c & 0xE0) == 0xC0 || (c & 0xF0) == 0xE0 || (c & 0xF8) == 0xF0) {
+                m_utf8[0] = (char)c;
+                m_utf8Size = 1;
+                m_utf8Expected = (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : 4;
+            } else {
+                put(&data[i], 1);
+            }
+            break;
+
+        case State::Escape:
+            escape(c);
+            break;
+
+        case State::EscapeSkip:
+            m_state = State::Ground;
+            break;
+
+        case State::Csi:
+            if (c >= '0' && c <= '9') {
+                if (m_paramsFull) {
+                    break;
+                }
+                if (m_params.empty()) {
+                    m_params.push_back(0);
+                }
+                m_params.back() = std::min(m_params.back() * 10 + (c - '0'), 65535);
+            } else if (c == ';' || c == ':') {
+                if (m_params.empty()) {
+                    m_params.push_back(0);
+                }
+                // A child can send any number of them; the rest are ignored.
+                if (m_params.size() < SCREEN_MAX_PARAMS) {
+                    m_params.push_back(0);
+                } else {
+                    m_paramsFull = true;
+                }
+            } else if (c >= 0x3c && c <= 0x3f) {
+                m_private = (char)c;
+            } else if (c >= 0x40 && c <= 0x7e) {
+                dispatchCsi(c);
+                m_state = State::Ground;
+            } else if (c == 0x1b) {
+                m_state = State::Escape;
+            } else if (c < 0x20) {
+                control(c);
+            }
+            // Intermediate bytes change nothing we model.
+            break;
+
+        case State::Osc:
+            if (c == 0x07) {
+                m_state = State::Ground;
+            } else if (c == 0x1b) {
+                m_state = State::OscEscape;
+            }
+            break;
+
+        case State::OscEscape:
+            m_state = c == '\\' ? State::Ground : State::Osc;
+            break;
+        }
+    }
+}
+
+void ScreenModel::put(const char* bytes, int size) {
+    if (m_wrapPending) {
+        lineFeed();
+        m_wrapPending = false;
+    }
+
+    ScreenCell& target = cell(m_row, m_column);
+    target = m_pen;
+    memcpy(target.bytes, bytes, size);
+    target.size = (uint8_t)size;
+
+    if (m_column == m_columns - 1) {
+        m_wrapPending = true;
+    } else {
+        ++m_column;
+    }
+}
+
+void ScreenModel::control(unsigned char c) {
+    switch (c) {
+    case '\r':
+        m_column = 0;
+        m_wrapPending = false;
+        break;
+    case '\n':
+    case '\v':
+    case '\f':
+        // Returns too, as on a Windows console unless it was told not to.
+        lineFeed();
+        m_wrapPending = false;
+        break;
+    case '\b':
+        if (m_wrapPending) {
+            m_wrapPending = false;
+        } else if (m_column > 0) {
+            --m_column;
+        }
+        break;
+    case '\t':
+        m_column = std::min((m_column / 8 + 1) * 8, m_columns - 1);
+        m_wrapPending = false;
+        break;
+    default:
+        break;
+    }
+}
+
+void ScreenModel::escape(unsigned char c) {
+    m_state = State::Ground;
+    switch (c) {
+    case '[':
+        m_state = State::Csi;
+        m_params.clear();
+        m_paramsFull = false;
+        m_private = 0;
+        break;
+    case ']':
+    case 'P':
+    case 'X':
+    case '^':
+    case '_':
+        // OSC, DCS and the like: skipped up to BEL or ST.
+        m_state = State::Osc;
+        break;
+    case '(':
+    case ')':
+    case '*':
+    case '+':
+        m_state = State::EscapeSkip;
+        break;
+    case '7':
+        m_savedRow = m_row;
+        m_savedColumn = m_column;
+        m_savedPen = m_pen;
+        break;
+    case '8':
+        moveTo(m_savedRow, m_savedColumn);
+        m_pen = m_savedPen;
+        break;
+    case 'D':
+        lineFeed();
+        break;
+    case 'E':
+        lineFeed();
+        m_column = 0;
+        break;
+    case 'M':
+        reverseLineFeed();
+        break;
+    case 'c':
+        m_pen = blank();
+        m_top = 0;
+        m_bottom = m_rows - 1;
+        m_cursorVisible = true;
+        for (int row = 0; row < m_rows; ++row) {
+            clearCells(row, 0, m_columns);
+        }
+        moveTo(0, 0);
+        break;
+    default:
+        break;
+    }
+}
+
+int ScreenModel::param(size_t index, int fallback) const {
+    return index < m_params.size() && m_params[index] != 0 ? m_params[index] : fallback;
+}
+
+void ScreenModel::dispatchCsi(unsigned char final) {
+    if (m_private == '?') {
+        if (final != 'h' && final != 'l') {
+            return;
+        }
+        bool set = final == 'h';
+        for (int mode : m_params) {
+            if (mode == 25) {
+                m_cursorVisible = set;
+            } else if (mode == 47 || mode == 1047 || mode == 1049) {
+                // No second screen is kept: entering or leaving clears.
+                if (mode == 1049 && set) {
+                    m_savedRow = m_row;
+                    m_savedColumn = m_column;
+                    m_savedPen = m_pen;
+                }
+                for (int row = 0; row < m_rows; ++row) {
+                    clearCells(row, 0, m_columns);
+                }
+                if (mode == 1049 && !set) {
+                    moveTo(m_savedRow, m_savedColumn);
+                    m_pen = m_savedPen;
+                }
+            }
+        }
+        return;
+    }
+    if (m_private != 0) {
+        return;
+    }
+
+    int count = param(0, 1);
+    int mode = m_params.empty() ? 0 : m_params[0];
+    switch (final) {
+    case 'A':
+        moveTo(m_row - count, m_column);
+        break;
+    case 'B':
+    case 'e':
+        moveTo(m_row + count, m_column);
+        break;
+    case 'C':
+    case 'a':
+        moveTo(m_row, m_column + count);
+        break;
+    case 'D':
+        moveTo(m_row, m_column - count);
+        break;
+    case 'E':
+        moveTo(m_row + count, 0);
+        break;
+    case 'F':
+        moveTo(m_row - count, 0);
+        break;
+    case 'G':
+    case '`':
+        moveTo(m_row, count - 1);
+        break;
+    case 'H':
+    case 'f':
+        moveTo(param(0, 1) - 1, param(1, 1) - 1);
+        break;
+    case 'd':
+        moveTo(count - 1, m_column);
+        break;
+
+    case 'J':
+        if (mode == 0) {
+            clearCells(m_row, m_column, m_columns);
+            for (int row = m_row + 1; row < m_rows; ++row) {
+                clearCells(row, 0, m_columns);
+            }
+        } else if (mode == 1) {
+            for (int row = 0; row < m_row; ++row) {
+                clearCells(row, 0, m_columns);
+            }
+            clearCells(m_row, 0, m_column + 1);
+        } else {
+            for (int row = 0; row < m_rows; ++row) {
+                clearCells(row, 0, m_columns);
+            }
+        }
+        break;
+    case 'K':
+        if (mode == 0) {
+            clearCells(m_row, m_column, m_columns);
+        } else if (mode == 1) {
+            clearCells(m_row, 0, m_column + 1);
+        } else {
+            clearCells(m_row, 0, m_columns);
+        }
+        break;
+    case 'X':
+        clearCells(m_row, m_column, std::min(m_column + count, m_columns));
+        break;
+
+    case 'L':
+        if (m_row >= m_top && m_row <= m_bottom) {
+            scrollDown(m_row, m_bottom, count);
+        }
+        break;
+    case 'M':
+        if (m_row >= m_top && m_row <= m_bottom) {
+            scrollUp(m_row, m_bottom, count);
+        }
+        break;
+    case 'P': {
+        ScreenCell* line = &cell(m_row, 0);
+        count = std::min(count, m_columns - m_column);
+        std::copy(line + m_column + count, line + m_columns, line + m_column);
+        clearCells(m_row, m_columns - count, m_columns);
+        break;
+    }
+    case '@': {
+        ScreenCell* line = &cell(m_row, 0);
+        count = std::min(count, m_columns - m_column);
+        std::copy_backward(line + m_column, line + m_columns - count, line + m_columns);
+        clearCells(m_row, m_column, m_column + count);
+        break;
+    }
+    case 'S':
+        scrollUp(m_top, m_bottom, count);
+        break;
+    case 'T':
+        scrollDown(m_top, m_bottom, count);
+        break;
+
+    case 'm':
+        selectGraphics();
+        break;
+    case 'r': {
+        int top = param(0, 1) - 1;
+        int bottom = param(1, m_rows) - 1;
+        if (top < bottom && bottom < m_rows) {
+            m_top = top;
+            m_bottom = bottom;
+        } else {
+            m_top = 0;
+            m_bottom = m_rows - 1;
+        }
+        moveTo(0, 0);
+        break;
+    }
+    case 's':
+        m_savedRow = m_row;
+        m_savedColumn = m_column;
+        break;
+    case 'u':
+        moveTo(m_savedRow, m_savedColumn);
+        break;
+    default:
+        break;
+    }
+}
+
+// 24-bit colours are kept as the nearest entry of the 256-colour cube.
+static uint16_t cubeColor(int red, int green, int blue) {
+    auto level = [](int value) { return std::min(std::max(value, 0), 255) * 5 / 255; };
+    return (uint16_t)(16 + 36 * level(red) + 6 * level(green) + level(blue));
+}
+
+void ScreenModel::selectGraphics() {
+    if (m_params.empty()) {
+        m_pen = blank();
+        return;
+    }
+
+    for (size_t i = 0; i < m_params.size(); ++i) {
+        int code = m_params[i];
+        if (code == 0) {
+            m_pen = blank();
+        } else if (code == 1) {
+            m_pen.flags |= Bold;
+        } else if (code == 4) {
+            m_pen.flags |= Underline;
+        } else if (code == 7) {
+            m_pen.flags |= Reverse;
+        } else if (code == 22) {
+            m_pen.flags &= ~Bold;
+        } else if (code == 24) {
+            m_pen.flags &= ~Underline;
+        } else if (code == 27) {
+            m_pen.flags &= ~Reverse;
+        } else if (code >= 30 && code <= 37) {
+            m_pen.foreground = (uint16_t)(code - 30);
+        } else if (code == 39) {
+            m_pen.foreground = DEFAULT_COLOR;
+        } else if (code >= 40 && code <= 47) {
+            m_pen.background = (uint16_t)(code - 40);
+        } else if (code == 49) {
+            m_pen.background = DEFAULT_COLOR;
+        } else if (code >= 90 && code <= 97) {
+            m_pen.foreground = (uint16_t)(code - 90 + 8);
+        } else if (code >= 100 && code <= 107) {
+            m_pen.background = (uint16_t)(code - 100 + 8);
+        } else if ((code == 38 || code == 48) && i + 1 < m_params.size()) {
+            uint16_t* color = code == 38 ? &m_pen.foreground : &m_pen.background;
+            if (m_params[i + 1] == 5 && i + 2 < m_params.size()) {
+                *color = (uint16_t)(m_params[i + 2] & 0xff);
+                i += 2;
+            } else if (m_params[i + 1] == 2 && i + 4 < m_params.size()) {
+                *color = cubeColor(m_params[i + 2], m_params[i + 3], m_params[i + 4]);
+                i += 4;
+            } else {
+                break;
+            }
+        }
+    }
+}
+
+void ScreenModel::lineFeed() {
+    m_column = 0;
+    if (m_row == m_bottom) {
+        scrollUp(m_top, m_bottom, 1);
+    } else if (m_row < m_rows - 1) {
+        ++m_row;
+    }
+}
+
+void ScreenModel::reverseLineFeed() {
+    if (m_row == m_top) {
+        scrollDown(m_top, m_bottom, 1);
+    } else if (m_row > 0) {
+        --m_row;
+    }
+}
+
+void ScreenModel::scrollUp(int top, int bottom, int count) {
+    count = std::min(count, bottom - top + 1);
+    if (count < bottom - top + 1) {
+        ScreenCell* first = &cell(top, 0);
+        std::copy(first + (size_t)count * m_columns, &cell(bottom, 0) + m_columns, first);
+    }
+    for (int row = bottom - count + 1; row <= bottom; ++row) {
+        clearCells(row, 0, m_columns);
+    }
+    if (top == 0 && bottom == m_rows - 1) {
+        m_scrolled = std::min(m_scrolled + count, m_rows);
+    }
+}
+
+void ScreenModel::scrollDown(int top, int bottom, int count) {
+    count = std::min(count, bottom - top + 1);
+    // Scrolling the whole region or more only clears it; there is no row
+    // above it to copy from.
+    if (count < bottom - top + 1) {
+        ScreenCell* first = &cell(top, 0);
+        std::copy_backward(first, &cell(bottom - count, 0) + m_columns, &cell(bottom, 0) + m_columns);
+    }
+    for (int row = top; row < top + count; ++row) {
+        clearCells(row, 0, m_columns);
+    }
+    if (top == 0 && bottom == m_rows - 1) {
+        m_scrolled = std::max(m_scrolled - count, 0);
+    }
+}
+
+void ScreenModel::clearCells(int row, int from, int to) {
+    std::fill(&cell(row, 0) + from, &cell(row, 0) + to, blank());
+}
+
+void ScreenModel::moveTo(int row, int column) {
+    m_row = std::min(std::max(row, 0), m_rows - 1);
+    m_column = std::min(std::max(column, 0), m_columns - 1);
+    m_wrapPending = false;
+}
+
+bool ScreenModel::sameGraphics(const ScreenCell& a, const ScreenCell& b) {
+    return a.flags == b.flags && a.foreground == b.foreground && a.background == b.background;
+}
+
+void ScreenModel::appendGraphics(std::string& out, const ScreenCell& cell) {
+    out += "\x1b[0";
+    if (cell.flags & Bold) {
+        out += ";1";
+    }
+    if (cell.flags & Underline) {
+        out += ";4";
+    }
+    if (cell.flags & Reverse) {
+        out += ";7";
+    }
+    for (int layer = 0; layer < 2; ++layer) {
+        uint16_t color = layer == 0 ? cell.foreground : cell.background;
+        if (color == DEFAULT_COLOR) {
+            continue;
+        }
+        out += ';';
+        if (color < 8) {
+            appendNumber(out, (layer == 0 ? 30 : 40) + color);
+        } else if (color < 16) {
+            appendNumber(out, (layer == 0 ? 90 : 100) + color - 8);
+        } else {
+            out += layer == 0 ? "38;5;" : "48;5;";
+            appendNumber(out, color);
+        }
+    }
+    out += 'm';
+}
+
+void ScreenModel::render(std::string& out) {
+    if (!isDirty()) {
+        return;
+    }
+
+    const ScreenCell empty = blank();
+    if (m_repaint) {
+        out += "\x1b[0m\x1b[H\x1b[2J";
+        std::fill(m_shown.begin(), m_shown.end(), empty);
+        m_repaint = false;
+    } else if (m_scrolled > 0) {
+        // Line feeds on the bottom row scroll the client's screen the same
+        // way, so rows that only moved are not sent again.
+        out += "\x1b[0m";
+        appendCursor(out, m_rows - 1, 0);
+        out.append(m_scrolled, '\n');
+        size_t shift = (size_t)m_scrolled * m_columns;
+        std::copy(m_shown.begin() + shift, m_shown.end(), m_shown.begin());
+        std::fill(m_shown.end() - shift, m_shown.end(), empty);
+    }
+    m_scrolled = 0;
+
+    // The client's pen is unknown until the first cell sets it.
+    const ScreenCell* pen = nullptr;
+    for (int row = 0; row < m_rows; ++row) {
+        const ScreenCell* now = &m_cells[(size_t)row * m_columns];
+        ScreenCell* shown = &m_shown[(size_t)row * m_columns];
+
+        int first = 0;
+        while (first < m_columns && now[first] == shown[first]) {
+            ++first;
+        }
+        if (first == m_columns) {
+            continue;
+        }
+        int last = m_columns - 1;
+        while (now[last] == shown[last]) {
+            --last;
+        }
+        int end = m_columns;
+        while (end > 0 && now[end - 1] == empty) {
+            --end;
+        }
+
+        appendCursor(out, row, first);
+        // Past the row's last visible cell, erasing is shorter than spaces.
+        bool erase = last >= end;
+        int stop = erase ? end : last + 1;
+        for (int column = first; column < stop; ++column) {
+            if (!pen || !sameGraphics(*pen, now[column])) {
+                appendGraphics(out, now[column]);
+                pen = &now[column];
+            }
+            out.append(now[column].bytes, now[column].size);
+        }
+        if (erase) {
+            if (!pen || !sameGraphics(*pen, empty)) {
+                out += "\x1b[0m";
+                pen = &empty;
+            }
+            out += "\x1b[K";
+        }
+        std::copy(now, now + m_columns, shown);
+    }
+
+    if (pen && !sameGraphics(*pen, empty)) {
+        out += "\x1b[0m";
+    }
+    appendCursor(out, m_row, m_column);
+    if (m_cursorVisible != m_shownCursorVisible) {
+        out += m_cursorVisible ? "\x1b[?25h" : "\x1b[?25l";
+        m_shownCursorVisible = m_cursorVisible;
+    }
+    m_dirty = false;
+}
+
+std::string ScreenModel::rowText(int row) const {
+    std::string text;
+    if (row < 0 || row >= m_rows) {
+        return text;
+    }
+    for (int column = 0; column < m_columns; ++column) {
+        const ScreenCell& cell = m_cells[(size_t)row * m_columns + column];
+        text.append(cell.bytes, cell.size);
+    }
+    text.erase(text.find_last_not_of(' ') + 1);
+    return text;
+}
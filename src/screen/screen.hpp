@@ -0,0 +1,134 @@
+#pragma once
+#ifndef SCREEN_HPP
+#define SCREEN_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../define.hpp"
+
+// One character cell. The character is kept as the bytes the child wrote
+// for it, a UTF-8 sequence or a single byte of any other code page, so it is
+// sent back exactly as it came.
+struct ScreenCell {
+    char bytes[4];
+    uint8_t size;
+    uint8_t flags;
+    uint16_t foreground;
+    uint16_t background;
+
+    bool operator==(const ScreenCell& other) const;
+    bool operator!=(const ScreenCell& other) const { return !(*this == other); }
+};
+
+// A terminal screen driven by a child's output, for sessions that send the
+// client screen updates instead of the output itself. write() runs the
+// output through a VT/ANSI parser onto a grid of cells: printable text with
+// autowrap, CR/LF/BS/TAB, cursor movement, erasing, inserting and deleting
+// lines and characters, scroll regions, SGR colours and attributes (16 and
+// 256 colours), cursor save/restore and visibility, and the alternate
+// screen, which is treated as a clear. Anything else is parsed and dropped.
+//
+// render() appends the VT sequences that take the client's screen from the
+// state of the previous render to the current one: rows scrolled off the top
+// since then are scrolled on the client too, then each row that still
+// differs is rewritten from its first to its last changed cell. However much
+// output went into the model, a render is at most one screen.
+class ScreenModel {
+public:
+    static const uint16_t DEFAULT_COLOR = 256;
+    enum CellFlag : uint8_t {
+        Bold = 0x1,
+        Underline = 0x2,
+        Reverse = 0x4
+    };
+
+private:
+    enum class State {
+        Ground,
+        Escape,
+        EscapeSkip,
+        Csi,
+        Osc,
+        OscEscape
+    };
+
+    int m_columns;
+    int m_rows;
+    std::vector<ScreenCell> m_cells;
+    // What the client was last sent.
+    std::vector<ScreenCell> m_shown;
+
+    int m_row;
+    int m_column;
+    // The cursor is past the last column; the next character wraps.
+    bool m_wrapPending;
+    ScreenCell m_pen;
+    int m_top;
+    int m_bottom;
+    int m_savedRow;
+    int m_savedColumn;
+    ScreenCell m_savedPen;
+    bool m_cursorVisible;
+    bool m_shownCursorVisible;
+
+    State m_state;
+    // At most SCREEN_MAX_PARAMS; past that the sequence's parameters are
+    // dropped.
+    std::vector<int> m_params;
+    bool m_paramsFull;
+    char m_private;
+    char m_utf8[4];
+    int m_utf8Size;
+    int m_utf8Expected;
+
+    bool m_dirty;
+    bool m_repaint;
+    // Whole-screen scrolls since the last render.
+    int m_scrolled;
+
+public:
+    ScreenModel(int columns = SCREEN_COLUMNS, int rows = SCREEN_ROWS);
+
+    int columns() const { return m_columns; }
+    int rows() const { return m_rows; }
+
+    // Keeps the left of the rows up to the cursor's; the next render repaints
+    // it all.
+    void resize(int columns, int rows);
+    // The client's screen is unknown, so the next render repaints it all.
+    void invalidate();
+
+    void write(const char* data, size_t length);
+
+    // Something changed since the last render.
+    bool isDirty() const { return m_dirty || m_repaint; }
+    void render(std::string& out);
+
+    // Text of row `row`, trailing blanks trimmed, for diagnostics.
+    std::string rowText(int row) const;
+
+private:
+    ScreenCell blank() const;
+    ScreenCell& cell(int row, int column) { return m_cells[(size_t)row * m_columns + column]; }
+
+    void put(const char* bytes, int size);
+    void control(unsigned char c);
+    void escape(unsigned char c);
+    void dispatchCsi(unsigned char final);
+    void selectGraphics();
+    int param(size_t index, int fallback) const;
+
+    void lineFeed();
+    void reverseLineFeed();
+    void scrollUp(int top, int bottom, int count);
+    void scrollDown(int top, int bottom, int count);
+    void clearCells(int row, int from, int to);
+    void moveTo(int row, int column);
+
+    static void appendGraphics(std::string& out, const ScreenCell& cell);
+    static bool sameGraphics(const ScreenCell& a, const ScreenCell& b);
+};
+
+#endif // SCREEN_HPP
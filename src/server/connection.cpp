@@ -0,0 +1,792 @@
+#include "connection.hpp"
+
+std::atomic<uint32_t> Connection::s_nextId(1);
+
+Connection::Connection(EventLoop& loop, std::unique_ptr<Transport> transport, const RelayOptions& options, MetricsRegistry& metrics,
+                       ShellPool* pool, SessionStore* store, Scheduler& scheduler, FinishedCallback onFinished)
+    : m_loop(loop),
+      m_id(s_nextId++),
+      m_options(options),
+      m_metrics(metrics),
+      m_pool(pool),
+      m_store(store),
+      m_scheduler(scheduler),
+      m_onFinished(std::move(onFinished)),
+      m_transport(std::move(transport)),
+      m_socketRead(IoOperation::SocketRead, this),
+      m_controlWrite(IoOperation::SocketWrite, this),
+      m_reapRequest(IoOperation::Notify, this),
+      m_reapPosted(false),
+      m_controlBusy(false),
+      m_readPaused(false),
+      m_readPausedAt(0),
+      m_features(0),
+      m_negotiated(false),
+      m_keyWrite(IoOperation::SocketWrite, this),
+      m_pending(0),
+      m_closing(false),
+      m_finished(false) {
+    m_finishedEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    snprintf(m_logTag, sizeof(m_logTag), "c%u", m_id);
+    ++m_metrics.server().activeConnections;
+}
+
+Connection::~Connection() {
+    stop();
+    wait();
+    if (m_finishedEvent) {
+        CloseHandle(m_finishedEvent);
+    }
+    --m_metrics.server().activeConnections;
+}
+
+bool Connection::start() {
+    acquire();
+    if (!m_transport->attach(m_loop)) {
+        LOG_ERROR(m_logTag, "Failed to attach connection to event loop");
+        stop();
+        release();
+        return false;
+    }
+
+    if (m_options.noDelay) {
+        m_transport->setNoDelay(true);
+    }
+
+    // With encryption required, session 0 waits for the key exchange so its
+    // first output is sealed like the rest.
+    if (!m_options.requireEncryption) {
+        openSession(0);
+    }
+    readSocket();
+    release();
+    return true;
+}
+
+bool Connection::openSession(uint16_t sessionId, const std::string& command) {
+    std::shared_ptr<ProcessHandler> session;
+    OpenStatus status = OpenStatus::Ok;
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        if (m_closing) {
+            return false;
+        }
+        if (m_sessions.count(sessionId)) {
+            status = OpenStatus::Duplicate;
+        } else if (m_sessions.size() >= MAX_SESSIONS_PER_CONNECTION) {
+            status = OpenStatus::Limit;
+        } else if (!m_scheduler.admitSession()) {
+            status = OpenStatus::Busy;
+        } else {
+            session = std::make_shared<ProcessHandler>(
+                m_loop, *this, sessionId,
+                [this](ProcessHandler* finished) { onSessionFinished(finished); });
+            m_sessions[sessionId] = session;
+        }
+    }
+
+    if (!session) {
+        LOG_WARN(m_logTag, "Rejected session " << sessionId << ", status " << (uint32_t)status);
+        sendControl(sessionId, ControlCode::SessionOpened, (uint32_t)status);
+        return false;
+    }
+
+    ++m_metrics.server().sessionsOpened;
+    ++m_metrics.server().activeSessions;
+
+    // Each live session holds a reference until it has been reaped or
+    // detached, since it keeps sending on this connection's socket.
+    acquire();
+    if (m_features & FeatureResume) {
+        session->enableResume();
+    }
+    if (!command.empty()) {
+        LOG_INFO(m_logTag, "Session " << sessionId << " runs: " << command);
+        session->setCommand(command);
+    }
+    session->start();
+    return true;
+}
+
+void Connection::resumeSession(const Frame& frame) {
+    uint64_t token;
+    uint64_t offset;
+    if (!(m_features & FeatureResume) || !m_store || !decodeResume(frame, token, offset)) {
+        LOG_WARN(m_logTag, "Ignoring unexpected resume request");
+        return;
+    }
+
+    std::shared_ptr<ProcessHandler> session;
+    OpenStatus status = OpenStatus::Ok;
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        if (m_closing) {
+            return;
+        }
+        if (m_sessions.count(frame.session)) {
+            status = OpenStatus::Duplicate;
+        } else if (m_sessions.size() >= MAX_SESSIONS_PER_CONNECTION) {
+            status = OpenStatus::Limit;
+        } else {
+            session = m_store->claim(token);
+            if (session) {
+                m_sessions[frame.session] = session;
+            } else {
+                status = OpenStatus::UnknownToken;
+            }
+        }
+    }
+
+    if (session) {
+        acquire();
+        if (session->attach(*this, frame.session, offset,
+                            [this](ProcessHandler* finished) { onSessionFinished(finished); })) {
+            ++m_metrics.server().sessionsResumed;
+            return;
+        }
+
+        // It stopped while detached; the store releases it once finished.
+        {
+            std::lock_guard<std::mutex> lock(m_sessionsMutex);
+            m_sessions.erase(frame.session);
+        }
+        m_store->retire(session);
+        release();
+        status = OpenStatus::UnknownToken;
+    }
+
+    LOG_WARN(m_logTag, "Rejected resume of session " << frame.session << ", status " << (uint32_t)status);
+    sendControl(frame.session, ControlCode::SessionOpened, (uint32_t)status);
+}
+
+void Connection::closeSession(uint16_t sessionId) {
+    std::shared_ptr<ProcessHandler> session = findSession(sessionId);
+    if (session) {
+        session->terminate();
+    }
+}
+
+std::shared_ptr<ProcessHandler> Connection::findSession(uint16_t sessionId) {
+    std::lock_guard<std::mutex> lock(m_sessionsMutex);
+    auto it = m_sessions.find(sessionId);
+    return it == m_sessions.end() ? nullptr : it->second;
+}
+
+void Connection::onSessionFinished(ProcessHandler* session) {
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        auto it = m_sessions.find(session->sessionId());
+        if (it != m_sessions.end() && it->second.get() == session) {
+            m_finishedSessions.push_back(std::move(it->second));
+            m_sessions.erase(it);
+        }
+    }
+
+    // The session is still inside its own finish(), so release it from a
+    // fresh completion rather than from this call stack.
+    postReap();
+}
+
+void Connection::postReap() {
+    if (!m_reapPosted.exchange(true)) {
+        acquire();
+        if (!m_loop.post(&m_reapRequest)) {
+            m_reapPosted = false;
+            release();
+        }
+    }
+}
+
+void Connection::reapSessions() {
+    m_reapPosted = false;
+
+    std::vector<std::shared_ptr<ProcessHandler>> finished;
+    std::vector<std::shared_ptr<FileTransfer>> transfers;
+    bool empty;
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        finished.swap(m_finishedSessions);
+        transfers.swap(m_finishedTransfers);
+        empty = m_sessions.empty() && m_transfers.empty();
+    }
+
+    for (auto& session : finished) {
+        session->wait();
+        session.reset();
+        --m_metrics.server().activeSessions;
+        release();
+    }
+    for (auto& transfer : transfers) {
+        transfer->wait();
+        transfer.reset();
+        release();
+    }
+
+    if (empty && (!finished.empty() || !transfers.empty())) {
+        LOG_INFO(m_logTag, "Last session or transfer finished, closing connection");
+        stop();
+    }
+}
+
+void Connection::handleFile(const Frame& frame) {
+    FileMessage message;
+    if (!(m_features & FeatureFile) || !decodeFile(frame, message)) {
+        LOG_WARN(m_logTag, "Ignoring unexpected file frame");
+        return;
+    }
+
+    std::shared_ptr<FileTransfer> transfer;
+    switch (message.op) {
+    case FileOp::Get:
+    case FileOp::Put:
+        openTransfer(frame.session, message);
+        break;
+
+    case FileOp::Data:
+        // Data for a transfer that already failed is dropped.
+        if ((transfer = findTransfer(frame.session))) {
+            transfer->receive(message);
+        }
+        break;
+
+    case FileOp::Ack:
+        if ((transfer = findTransfer(frame.session))) {
+            transfer->grant(message.value, message.offset);
+        }
+        break;
+
+    case FileOp::Cancel:
+        if ((transfer = findTransfer(frame.session))) {
+            transfer->cancel();
+        }
+        break;
+
+    default:
+        LOG_WARN(m_logTag, "Ignoring unknown file operation " << (int)message.op);
+        break;
+    }
+}
+
+void Connection::openTransfer(uint16_t id, const FileMessage& message) {
+    std::string path(message.data, message.length);
+    std::shared_ptr<FileTransfer> transfer;
+    FileStatus status = FileStatus::Ok;
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        if (m_closing) {
+            return;
+        }
+        if (m_transfers.count(id)) {
+            status = FileStatus::Failed;
+        } else if (m_transfers.size() >= MAX_TRANSFERS_PER_CONNECTION) {
+            status = FileStatus::Limit;
+        } else if (path.empty()) {
+            status = FileStatus::NotFound;
+        } else {
+            transfer = std::make_shared<FileTransfer>(
+                m_loop, *this, id,
+                [this](FileTransfer* finished) { onTransferFinished(finished); });
+            m_transfers[id] = transfer;
+        }
+    }
+
+    if (!transfer) {
+        LOG_WARN(m_logTag, "Rejected transfer " << id << ", status " << (uint32_t)status);
+        sendFile(id, FileOp::Done, (uint32_t)status, 0);
+        return;
+    }
+
+    // Like a session, a transfer holds a reference until it is reaped.
+    acquire();
+    if (message.op == FileOp::Get) {
+        transfer->startGet(path, message.offset);
+    } else {
+        transfer->startPut(path, message.size, (message.value & FileResume) != 0);
+    }
+}
+
+std::shared_ptr<FileTransfer> Connection::findTransfer(uint16_t id) {
+    std::lock_guard<std::mutex> lock(m_sessionsMutex);
+    auto it = m_transfers.find(id);
+    return it == m_transfers.end() ? nullptr : it->second;
+}
+
+void Connection::onTransferFinished(FileTransfer* transfer) {
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        auto it = m_transfers.find(transfer->id());
+        if (it != m_transfers.end() && it->second.get() == transfer) {
+            m_finishedTransfers.push_back(std::move(it->second));
+            m_transfers.erase(it);
+        }
+    }
+    postReap();
+}
+
+void Connection::onCompletion(IoRequest* request, DWORD bytes, DWORD error) {
+    switch (request->operation) {
+    case IoOperation::SocketRead:
+        onSocketRead(bytes, error);
+        break;
+
+    case IoOperation::SocketWrite:
+        if (request == &m_keyWrite) {
+            onKeySent(bytes, error);
+        } else {
+            onControlSent(bytes, error);
+        }
+        break;
+
+    case IoOperation::Notify:
+        reapSessions();
+        break;
+
+    default:
+        break;
+    }
+
+    release();
+}
+
+void Connection::readSocket() {
+    if (m_closing) {
+        return;
+    }
+    acquire();
+    m_socketRead.reset();
+    if (!m_transport->recvAsync(m_reader.writePointer(), m_reader.writableSize(), &m_socketRead)) {
+        LOG_ERROR(m_logTag, "Socket receive failed: " << WSAGetLastError());
+        stop();
+        release();
+    }
+}
+
+void Connection::onSocketRead(DWORD bytes, DWORD error) {
+    if (error != NO_ERROR) {
+        if (!m_closing) {
+            LOG_ERROR(m_logTag, "Socket receive error: " << error);
+        }
+        stop();
+    } else if (bytes == 0) {
+        LOG_INFO(m_logTag, "Client disconnected (graceful shutdown)");
+        stop();
+    } else {
+        LOG_TRACE(m_logTag, "Received " << bytes << " bytes from client");
+        m_reader.commit(bytes);
+        processInput();
+    }
+}
+
+static bool isHello(const Frame& frame) {
+    ControlPayload control;
+    return frame.channel == Channel::Control && decodeControl(frame, control) &&
+           (ControlCode)control.code == ControlCode::Hello;
+}
+
+void Connection::processInput() {
+    Frame frame;
+    while (!m_closing && m_reader.next(frame)) {
+        // Only this thread completes the exchange, so the layer cannot turn
+        // secure under it.
+        if (m_layer.isSecure()) {
+            if (!m_layer.open(frame)) {
+                LOG_ERROR(m_logTag, "Record from client failed to authenticate, closing connection");
+                stop();
+                return;
+            }
+        } else if (m_options.requireEncryption && frame.channel != Channel::Key && !isHello(frame)) {
+            LOG_WARN(m_logTag, "Client sent data before exchanging keys, closing connection");
+            stop();
+            return;
+        }
+
+        switch (frame.channel) {
+        case Channel::Stdin: {
+            std::shared_ptr<ProcessHandler> session = findSession(frame.session);
+            if (session && !session->queueInput(frame.payload, frame.length)) {
+                session->stop();
+            }
+            break;
+        }
+
+        case Channel::Control:
+            handleControl(frame);
+            break;
+
+        case Channel::Resume:
+            resumeSession(frame);
+            break;
+
+        case Channel::File:
+            handleFile(frame);
+            break;
+
+        case Channel::Key:
+            exchangeKeys(frame);
+            break;
+
+        case Channel::Exec:
+            if (frame.length == 0) {
+                sendControl(frame.session, ControlCode::SessionOpened, (uint32_t)OpenStatus::SpawnFailed);
+            } else {
+                openSession(frame.session, std::string(frame.payload, frame.length));
+            }
+            break;
+
+        default:
+            LOG_WARN(m_logTag, "Ignoring frame on unexpected channel " << (int)frame.channel);
+            break;
+        }
+    }
+
+    if (m_reader.isCorrupt()) {
+        LOG_ERROR(m_logTag, "Malformed frame from client, closing connection");
+        stop();
+        return;
+    }
+
+    // A client that keeps sending but does not read would grow the control
+    // queue without bound; stop reading until onControlSent drains it.
+    {
+        std::lock_guard<std::mutex> lock(m_controlMutex);
+        if (m_controlQueue.size() >= m_options.controlHighWater) {
+            m_readPaused = true;
+            m_readPausedAt = monotonicMicros();
+            ++m_metrics.server().inputPauses;
+            LOG_DEBUG(m_logTag, "Control queue full, pausing reads");
+            return;
+        }
+    }
+
+    readSocket();
+}
+
+void Connection::handleControl(const Frame& frame) {
+    ControlPayload control;
+    if (!decodeControl(frame, control)) {
+        LOG_WARN(m_logTag, "Ignoring short control frame");
+        return;
+    }
+
+    switch ((ControlCode)control.code) {
+    case ControlCode::Ping:
+        sendControl(frame.session, ControlCode::Pong, control.value);
+        break;
+
+    case ControlCode::OpenSession:
+        openSession(frame.session);
+        break;
+
+    case ControlCode::CloseSession:
+        closeSession(frame.session);
+        break;
+
+    case ControlCode::CloseStdin: {
+        std::shared_ptr<ProcessHandler> session = findSession(frame.session);
+        if (session) {
+            session->endInput();
+        }
+        break;
+    }
+
+    case ControlCode::Hello: {
+        uint32_t features = control.value & SUPPORTED_FEATURES;
+        if (!m_store || m_options.scrollbackBytes == 0) {
+            features &= ~FeatureResume;
+        }
+        if (!m_options.fileTransfer) {
+            features &= ~FeatureFile;
+        }
+        if (!m_options.encryption) {
+            features &= ~FeatureEncryption;
+        }
+        if (m_options.screenFps == 0) {
+            features &= ~FeatureScreen;
+        }
+        if (m_options.interruptHelper.empty()) {
+            features &= ~FeatureInterrupt;
+        }
+        // A screen cannot be replayed, so screen sessions do not outlive the
+        // connection.
+        if (features & FeatureScreen) {
+            features &= ~FeatureResume;
+        }
+        m_features = features;
+        m_negotiated = true;
+        LOG_INFO(m_logTag, "Client features: " << features);
+        sendControl(frame.session, ControlCode::Hello, features);
+
+        // Session 0 was opened before the client said what it supports.
+        std::vector<std::shared_ptr<ProcessHandler>> sessions;
+        {
+            std::lock_guard<std::mutex> lock(m_sessionsMutex);
+            for (auto& entry : m_sessions) {
+                sessions.push_back(entry.second);
+            }
+        }
+        for (auto& session : sessions) {
+            if (features & FeatureResume) {
+                session->enableResume();
+            }
+            session->enableScreen((features & FeatureScreen) != 0);
+        }
+        break;
+    }
+
+    case ControlCode::WindowSize: {
+        std::shared_ptr<ProcessHandler> session = findSession(frame.session);
+        if (session) {
+            session->resizeScreen((int)(control.value >> 16), (int)(control.value & 0xffff));
+        }
+        break;
+    }
+
+    case ControlCode::Interrupt: {
+        // Handled as it arrives, ahead of the session's queued stdin.
+        std::shared_ptr<ProcessHandler> session = findSession(frame.session);
+        if (session && (m_features & FeatureInterrupt)) {
+            session->interrupt(control.value == (uint32_t)InterruptKind::CtrlBreak ? InterruptKind::CtrlBreak
+                                                                                   : InterruptKind::CtrlC);
+        }
+        break;
+    }
+
+    case ControlCode::WindowUpdate: {
+        std::shared_ptr<ProcessHandler> session = findSession(frame.session);
+        if (session) {
+            session->grantOutput(control.value);
+        }
+        break;
+    }
+
+    default:
+        LOG_WARN(m_logTag, "Ignoring unknown control code " << (int)control.code);
+        break;
+    }
+}
+
+void Connection::exchangeKeys(const Frame& frame) {
+    bool ok;
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        ok = (m_features & FeatureEncryption) && !m_layer.isSecure() && m_layer.begin();
+        if (ok) {
+            // Ours is posted before the layer turns secure, so it is the
+            // last frame to go out in the clear.
+            m_keyFrame.prepare(Channel::Key, m_layer.publicKey(), CRYPTO_KEY_SIZE);
+            acquire();
+            m_keyWrite.reset();
+            if (!m_transport->sendAsync(m_keyFrame.pending, m_keyFrame.count, &m_keyWrite)) {
+                release();
+                ok = false;
+            }
+        }
+        ok = ok && m_layer.complete(frame, false);
+    }
+
+    if (!ok) {
+        LOG_ERROR(m_logTag, "Key exchange failed, closing connection");
+        stop();
+        return;
+    }
+    ++m_metrics.server().encryptedConnections;
+    LOG_INFO(m_logTag, "Encrypted with " << cipherKernelName(cipherKernel()) << " ChaCha20-Poly1305");
+
+    if (m_options.requireEncryption) {
+        openSession(0);
+    }
+}
+
+void Connection::onKeySent(DWORD bytes, DWORD error) {
+    // Forty bytes; a short send means the connection is going down anyway.
+    if (error != NO_ERROR || !m_keyFrame.advance(bytes)) {
+        stop();
+    }
+}
+
+bool Connection::send(OutgoingFrame& frame, IoRequest& request, char* out) {
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    if (m_layer.isSecure()) {
+        m_layer.seal(frame, out);
+    }
+    return m_transport->sendAsync(frame.pending, frame.count, &request);
+}
+
+void Connection::sendControl(uint16_t session, ControlCode code, uint32_t value) {
+    queueControl([&](PendingControl& control) {
+        encodeControl(control.control, code, value);
+        control.frame.prepare(Channel::Control, &control.control, sizeof(control.control), 0, session);
+    });
+}
+
+void Connection::sendResume(uint16_t session, uint64_t token, uint64_t offset) {
+    queueControl([&](PendingControl& control) {
+        encodeResume(control.resume, token, offset);
+        control.frame.prepare(Channel::Resume, &control.resume, sizeof(control.resume), 0, session);
+    });
+}
+
+void Connection::sendFile(uint16_t transfer, FileOp op, uint32_t value, uint64_t offset, uint64_t size) {
+    queueControl([&](PendingControl& control) {
+        encodeFile(control.file, op, value, offset, size);
+        control.frame.prepare(Channel::File, &control.file, sizeof(control.file), 0, transfer);
+    });
+}
+
+template <typename Fill>
+void Connection::queueControl(Fill fill) {
+    if (m_closing) {
+        return;
+    }
+
+    bool startSend = false;
+    {
+        std::lock_guard<std::mutex> lock(m_controlMutex);
+        m_controlQueue.emplace_back();
+        fill(m_controlQueue.back());
+
+        if (!m_controlBusy) {
+            m_controlBusy = true;
+            startSend = true;
+        }
+    }
+
+    if (startSend) {
+        sendNextControl();
+    }
+}
+
+void Connection::sendNextControl() {
+    // Only the sender touches the front entry while m_controlBusy is set,
+    // and deque::push_back keeps references to existing entries valid.
+    PendingControl* control;
+    {
+        std::lock_guard<std::mutex> lock(m_controlMutex);
+        control = &m_controlQueue.front();
+    }
+
+    acquire();
+    m_controlWrite.reset();
+    if (!send(control->frame, m_controlWrite)) {
+        if (!m_closing) {
+            LOG_ERROR(m_logTag, "Control send failed: " << WSAGetLastError());
+        }
+        stop();
+        release();
+    }
+}
+
+void Connection::onControlSent(DWORD bytes, DWORD error) {
+    if (error != NO_ERROR || bytes == 0) {
+        stop();
+        return;
+    }
+
+    bool more;
+    bool resume = false;
+    {
+        std::lock_guard<std::mutex> lock(m_controlMutex);
+        PendingControl& control = m_controlQueue.front();
+        if (!control.frame.advance(bytes)) {
+            more = true;
+        } else {
+            m_controlQueue.pop_front();
+            more = !m_controlQueue.empty();
+            m_controlBusy = more;
+            if (m_readPaused && m_controlQueue.size() <= m_options.controlLowWater) {
+                m_readPaused = false;
+                resume = true;
+            }
+        }
+    }
+
+    if (more) {
+        sendNextControl();
+    }
+    if (resume) {
+        m_metrics.server().inputPausedMicros += monotonicMicros() - m_readPausedAt;
+        LOG_DEBUG(m_logTag, "Control queue drained, resuming reads");
+        readSocket();
+    }
+}
+
+void Connection::release() {
+    if (--m_pending == 0 && m_closing) {
+        finish();
+    }
+}
+
+void Connection::finish() {
+    if (m_finished.exchange(true)) {
+        return;
+    }
+
+    m_transport->close();
+    LOG_INFO(m_logTag, "Connection closed");
+
+    if (m_onFinished) {
+        m_onFinished(this);
+    }
+
+    // Waiters may destroy the connection as soon as this is signalled, so it
+    // must be the last thing that touches any member.
+    SetEvent(m_finishedEvent);
+}
+
+void Connection::stop() {
+    acquire();
+    if (m_closing.exchange(true)) {
+        release();
+        return;
+    }
+
+    LOG_INFO(m_logTag, "Stopping connection...");
+
+    std::vector<std::shared_ptr<ProcessHandler>> sessions;
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        for (auto& entry : m_sessions) {
+            sessions.push_back(entry.second);
+        }
+    }
+
+    // Resumable sessions are handed to the store before the socket goes
+    // down, so none of their output is lost in between; they no longer
+    // need this connection, so their references are dropped here.
+    for (auto& session : sessions) {
+        if (m_store && m_store->detach(session)) {
+            {
+                std::lock_guard<std::mutex> lock(m_sessionsMutex);
+                auto it = m_sessions.find(session->sessionId());
+                if (it != m_sessions.end() && it->second == session) {
+                    m_sessions.erase(it);
+                }
+            }
+            release();
+        } else {
+            session->stop();
+        }
+    }
+
+    std::vector<std::shared_ptr<FileTransfer>> transfers;
+    {
+        std::lock_guard<std::mutex> lock(m_sessionsMutex);
+        for (auto& entry : m_transfers) {
+            transfers.push_back(entry.second);
+        }
+    }
+    for (auto& transfer : transfers) {
+        transfer->stop();
+    }
+
+    m_transport->shutdown();
+    m_transport->cancelIo();
+
+    release();
+}
+
+void Connection::wait() {
+    if (m_finishedEvent) {
+        WaitForSingleObject(m_finishedEvent, INFINITE);
+    }
+}
@@ -0,0 +1,163 @@
+#pragma once
+#ifndef CONNECTION_HPP
+#define CONNECTION_HPP
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "../utils.hpp"
+#include "../define.hpp"
+#include "../engine/engine.hpp"
+#include "../protocol/protocol.hpp"
+#include "handler.hpp"
+#include "transfer.hpp"
+
+// One accepted client socket carrying any number of child sessions, each
+// identified by the session id in the frame header. The connection reads and
+// routes frames, owns the sessions and serializes its own control replies;
+// sessions send their output frames on the socket directly. Session 0 is
+// opened as soon as the connection starts, and the connection closes once
+// its last session has finished. With FeatureResume, stopping hands the
+// resumable sessions to the SessionStore instead of ending them, and a
+// Resume frame from a client takes one back. With FeatureFile the client can
+// also run FileTransfers, which are owned and reaped like sessions. Exec
+// frames open sessions that run a client's command line instead of a shell.
+// Every frame the connection, its sessions and its transfers send goes
+// through send(), which seals it once the client has exchanged keys.
+class Connection : public IoHandler {
+public:
+    typedef std::function<void(Connection*)> FinishedCallback;
+
+private:
+    struct PendingControl {
+        OutgoingFrame frame;
+        ControlPayload control;
+        ResumePayload resume;
+        FilePayload file;
+    };
+
+    static std::atomic<uint32_t> s_nextId;
+
+    EventLoop& m_loop;
+    uint32_t m_id;
+    char m_logTag[LOG_TAG_SIZE];
+    const RelayOptions& m_options;
+    MetricsRegistry& m_metrics;
+    ShellPool* m_pool;
+    SessionStore* m_store;
+    Scheduler& m_scheduler;
+    FinishedCallback m_onFinished;
+    std::unique_ptr<Transport> m_transport;
+
+    IoRequest m_socketRead;
+    IoRequest m_controlWrite;
+    IoRequest m_reapRequest;
+
+    FrameReader m_reader;
+
+    // Guards both sessions and transfers.
+    std::mutex m_sessionsMutex;
+    std::unordered_map<uint16_t, std::shared_ptr<ProcessHandler>> m_sessions;
+    std::vector<std::shared_ptr<ProcessHandler>> m_finishedSessions;
+    std::unordered_map<uint16_t, std::shared_ptr<FileTransfer>> m_transfers;
+    std::vector<std::shared_ptr<FileTransfer>> m_finishedTransfers;
+    std::atomic<bool> m_reapPosted;
+
+    std::mutex m_controlMutex;
+    std::deque<PendingControl> m_controlQueue;
+    bool m_controlBusy;
+    bool m_readPaused;
+    uint64_t m_readPausedAt;
+
+    std::atomic<uint32_t> m_features;
+    // The client's Hello has arrived and m_features is final.
+    std::atomic<bool> m_negotiated;
+
+    // Records must reach the socket in the order they were sealed, so the
+    // sending side of the layer and posting a send are one step.
+    std::mutex m_sendMutex;
+    RecordLayer m_layer;
+    OutgoingFrame m_keyFrame;
+    IoRequest m_keyWrite;
+
+    std::atomic<int> m_pending;
+    std::atomic<bool> m_closing;
+    std::atomic<bool> m_finished;
+    HANDLE m_finishedEvent;
+
+public:
+    Connection(EventLoop& loop, std::unique_ptr<Transport> transport, const RelayOptions& options, MetricsRegistry& metrics,
+               ShellPool* pool, SessionStore* store, Scheduler& scheduler, FinishedCallback onFinished = nullptr);
+    ~Connection();
+
+    bool start();
+    void stop();
+    void wait();
+    bool isRunning() const { return !m_finished; }
+
+    uint32_t id() const { return m_id; }
+    Transport& transport() { return *m_transport; }
+    const RelayOptions& options() const { return m_options; }
+    MetricsRegistry& metrics() { return m_metrics; }
+    // Pre-spawned shells for new sessions, or nullptr if pooling is off.
+    ShellPool* pool() { return m_pool; }
+    // Where resumable sessions go when the connection drops, or nullptr.
+    SessionStore* store() { return m_store; }
+    // Runs session starts and admits sessions against the server's limit.
+    Scheduler& scheduler() { return m_scheduler; }
+
+    // Feature bits accepted from the client's Hello.
+    uint32_t features() const { return m_features; }
+    bool negotiated() const { return m_negotiated; }
+
+    // Starts an overlapped send of `frame` on the socket, sealing it first
+    // once encryption is on. When the payload must not be changed, `out`
+    // (room for the whole payload) receives the encrypted copy instead.
+    bool send(OutgoingFrame& frame, IoRequest& request, char* out = nullptr);
+
+    // Queues a control frame for `session`; safe from any thread.
+    void sendControl(uint16_t session, ControlCode code, uint32_t value = 0);
+    // Tells the client `session` can be resumed with `token`.
+    void sendResume(uint16_t session, uint64_t token, uint64_t offset);
+    // Queues a File frame without data for `transfer`.
+    void sendFile(uint16_t transfer, FileOp op, uint32_t value, uint64_t offset, uint64_t size = 0);
+
+    void onCompletion(IoRequest* request, DWORD bytes, DWORD error) override;
+
+private:
+    // An empty command runs the configured shell.
+    bool openSession(uint16_t sessionId, const std::string& command = std::string());
+    void closeSession(uint16_t sessionId);
+    void resumeSession(const Frame& frame);
+    std::shared_ptr<ProcessHandler> findSession(uint16_t sessionId);
+    void onSessionFinished(ProcessHandler* session);
+    void reapSessions();
+    void postReap();
+
+    void handleFile(const Frame& frame);
+    void openTransfer(uint16_t id, const FileMessage& message);
+    std::shared_ptr<FileTransfer> findTransfer(uint16_t id);
+    void onTransferFinished(FileTransfer* transfer);
+
+    void readSocket();
+    void onSocketRead(DWORD bytes, DWORD error);
+    void processInput();
+    void handleControl(const Frame& frame);
+    // Answers the client's Key frame with ours; frames after both are records.
+    void exchangeKeys(const Frame& frame);
+    void onKeySent(DWORD bytes, DWORD error);
+
+    template <typename Fill>
+    void queueControl(Fill fill);
+    void sendNextControl();
+    void onControlSent(DWORD bytes, DWORD error);
+
+    void acquire() { ++m_pending; }
+    void release();
+    void finish();
+};
+
+#endif // CONNECTION_HPP
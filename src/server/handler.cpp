@@ -0,0 +1,1541 @@
+#include <algorithm>
+#include <cstring>
+
+#include "handler.hpp"
+#include "connection.hpp"
+
+ProcessHandler::ProcessHandler(EventLoop& loop, Connection& connection, uint16_t sessionId,
+                               FinishedCallback onFinished)
+    : m_loop(loop),
+      m_options(connection.options()),
+      m_registry(connection.metrics()),
+      m_pool(connection.pool()),
+      m_store(connection.store()),
+      m_scheduler(connection.scheduler()),
+      m_connection(&connection),
+      m_sessionId(sessionId),
+      m_onFinished(std::move(onFinished)),
+      m_linkGeneration(0),
+      m_linkBroken(false),
+      m_token(0),
+      m_outputOffset(0),
+      m_replaying(false),
+      m_replayAnnounce(false),
+      m_replayParked(false),
+      m_replayOffset(0),
+      m_replayGeneration(0),
+      m_replayWrite(IoOperation::SocketWrite, this),
+      m_exitGeneration(0),
+      m_exitHeld(false),
+      m_screenOn(false),
+      m_screenPending(0),
+      m_screenBusy(false),
+      m_screenExitHeld(false),
+      m_screenSentAt(0),
+      m_screenOffset(0),
+      m_screenTimer(nullptr),
+      m_screenTick(IoOperation::Notify, this),
+      m_screenWrite(IoOperation::SocketWrite, this),
+      m_answerBusy(false),
+      m_answerGeneration(0),
+      m_answerWrite(IoOperation::SocketWrite, this),
+      m_interruptQueued(false),
+      m_interruptKind(0),
+      m_stdout(Channel::Stdout, this, m_options.relayDepth, m_options.minBuffer),
+      m_stderr(Channel::Stderr, this, m_options.relayDepth, m_options.minBuffer),
+      m_startRequest(IoOperation::Notify, this),
+      m_exitRequest(IoOperation::ProcessExit, this),
+      m_pipeWrite(IoOperation::PipeWrite, this),
+      m_exitWrite(IoOperation::SocketWrite, this),
+      m_inputOffset(0),
+      m_inputBusy(false),
+      m_stdinClosed(false),
+      m_inputEnded(false),
+      m_inputConsumed(0),
+      m_outputCredit((int64_t)m_options.outputHighWater),
+      m_pending(0),
+      m_exited(false),
+      m_exitStages(0),
+      m_terminateRequested(false),
+      m_closing(false),
+      m_finished(false) {
+    ZeroMemory(&m_processInfo, sizeof(m_processInfo));
+    ZeroMemory(&m_exitInfo, sizeof(m_exitInfo));
+    m_finishedEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    snprintf(m_logTag, sizeof(m_logTag), "c%u.s%u", connection.id(), (unsigned)sessionId);
+    m_metrics = m_registry.addSession(m_logTag);
+
+    if (m_options.screenFps > 0 && (!connection.negotiated() || (connection.features() & FeatureScreen))) {
+        m_screen = std::make_unique<ScreenModel>();
+        m_screenOn = connection.negotiated();
+    }
+}
+
+ProcessHandler::~ProcessHandler() {
+    stop();
+    wait();
+    if (m_finishedEvent) {
+        CloseHandle(m_finishedEvent);
+    }
+    m_scheduler.releaseSession();
+}
+
+bool ProcessHandler::createProcess() {
+    LOG_INFO(m_logTag, "Creating process...");
+
+    ServerMetrics& serverMetrics = m_registry.server();
+    // Pooled shells all run the configured command.
+    std::unique_ptr<SpawnedShell> shell = m_pool && m_command.empty() ? m_pool->take() : nullptr;
+    if (shell) {
+        ++serverMetrics.poolHits;
+        LOG_DEBUG(m_logTag, "Using pooled shell with PID: " << shell->processInfo.dwProcessId);
+    } else {
+        if (m_pool && m_command.empty()) {
+            ++serverMetrics.poolMisses;
+        }
+        shell = std::make_unique<SpawnedShell>();
+        if (!spawnShell(m_command.empty() ? m_options.shell : m_command, *shell, m_logTag)) {
+            return false;
+        }
+    }
+
+    // Take over the child; the shell's destructor no longer kills it.
+    m_stdinPipe.swap(shell->stdinPipe);
+    m_stdout.pipe.swap(shell->stdoutPipe);
+    m_stderr.pipe.swap(shell->stderrPipe);
+    m_processInfo = shell->processInfo;
+    ZeroMemory(&shell->processInfo, sizeof(shell->processInfo));
+    return true;
+}
+
+bool ProcessHandler::start() {
+    // Spawning is slow, so it runs on a scheduler worker rather than the
+    // caller's thread or the event loop's.
+    acquire();
+    if (!m_scheduler.submit(&m_startRequest)) {
+        ++m_registry.server().sessionsRefused;
+        LOG_WARN(m_logTag, "Session start queue is full, refusing session");
+        sendControl(ControlCode::SessionOpened, (uint32_t)OpenStatus::Busy);
+        stop();
+        release();
+        return false;
+    }
+    return true;
+}
+
+void ProcessHandler::onStart() {
+    LOG_INFO(m_logTag, "Session started");
+
+    ServerMetrics& serverMetrics = m_registry.server();
+    uint64_t spawnStart = monotonicMicros();
+    if (!createProcess()) {
+        ++serverMetrics.spawnFailures;
+        LOG_ERROR(m_logTag, "Failed to create process");
+        sendControl(ControlCode::SessionOpened, (uint32_t)OpenStatus::SpawnFailed);
+        stop();
+        return;
+    }
+
+    serverMetrics.spawnTime.record(monotonicMicros() - spawnStart);
+
+    if (!m_loop.attach(m_stdinPipe.getWriteHandle()) ||
+        !m_loop.attach(m_stdout.pipe.getReadHandle()) ||
+        !m_loop.attach(m_stderr.pipe.getReadHandle())) {
+        LOG_ERROR(m_logTag, "Failed to attach session to event loop");
+        sendControl(ControlCode::SessionOpened, (uint32_t)OpenStatus::SpawnFailed);
+        stop();
+        return;
+    }
+
+    // The registered wait counts as an outstanding operation until the exit
+    // completion has been handled, so the session cannot finish before it.
+    acquire();
+    if (!m_supervisor.watch(m_processInfo.hProcess, m_loop, &m_exitRequest)) {
+        LOG_ERROR(m_logTag, "Failed to watch child process");
+        sendControl(ControlCode::SessionOpened, (uint32_t)OpenStatus::SpawnFailed);
+        stop();
+        release();
+        return;
+    }
+
+    sendControl(ControlCode::SessionOpened, (uint32_t)OpenStatus::Ok);
+
+    // A CloseSession that arrived while the child was being created.
+    if (m_terminateRequested) {
+        TerminateProcess(m_processInfo.hProcess, 1);
+    }
+
+    readPipe(m_stdout);
+    readPipe(m_stderr);
+
+    // Input may have been queued while the child was being spawned.
+    bool pendingInput = false;
+    {
+        std::lock_guard<std::mutex> lock(m_inputMutex);
+        if (!m_inputQueue.empty() && !m_inputBusy) {
+            m_inputBusy = true;
+            m_inputWriting.swap(m_inputQueue);
+            m_inputOffset = 0;
+            pendingInput = true;
+        }
+        closeEndedInput();
+    }
+    if (pendingInput) {
+        writePipe();
+    }
+}
+
+void ProcessHandler::onCompletion(IoRequest* request, DWORD bytes, DWORD error) {
+    switch (request->operation) {
+    case IoOperation::Notify:
+        if (request == &m_screenTick) {
+            HANDLE timer;
+            {
+                std::lock_guard<std::mutex> lock(m_screenMutex);
+                timer = m_screenTimer;
+                m_screenTimer = nullptr;
+            }
+            DeleteTimerQueueTimer(nullptr, timer, nullptr);
+            sendScreen();
+        } else if (!m_closing) {
+            onStart();
+        }
+        break;
+
+    case IoOperation::ProcessExit:
+        onProcessExit();
+        break;
+
+    case IoOperation::PipeWrite:
+        onPipeWrite(bytes, error);
+        break;
+
+    case IoOperation::PipeRead:
+        onPipeRead(*static_cast<OutputStream*>(request->context), bytes, error);
+        break;
+
+    case IoOperation::SocketWrite:
+        if (request == &m_exitWrite) {
+            onExitStatusSent(bytes, error);
+        } else if (request == &m_replayWrite) {
+            onReplaySent(bytes, error);
+        } else if (request == &m_screenWrite) {
+            onScreenSent(bytes, error);
+        } else if (request == &m_answerWrite) {
+            onAnswerSent(bytes, error);
+        } else {
+            onStreamSent(*static_cast<OutputStream*>(request->context), bytes, error);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    release();
+}
+
+template <typename Operation>
+void ProcessHandler::issue(Operation operation, const char* what) {
+    if (m_closing) {
+        return;
+    }
+    acquire();
+    if (!operation()) {
+        DWORD error = GetLastError();
+        if (!m_closing && error != ERROR_BROKEN_PIPE) {
+            LOG_ERROR(m_logTag, what << " failed: " << error);
+        }
+        stop();
+        release();
+    }
+}
+
+bool ProcessHandler::queueInput(const char* data, uint32_t length) {
+    bool startWrite = false;
+    {
+        std::lock_guard<std::mutex> lock(m_inputMutex);
+        if (m_stdinClosed || m_inputEnded) {
+            return true;
+        }
+        if (m_inputQueue.size() + m_inputWriting.size() - m_inputOffset + length > SESSION_WINDOW) {
+            LOG_WARN(m_logTag, "Client overran the stdin window");
+            return false;
+        }
+
+        m_inputQueue.append(data, length);
+        m_metrics->bytesIn.fetch_add(length, std::memory_order_relaxed);
+        m_metrics->chunksIn.fetch_add(1, std::memory_order_relaxed);
+
+        // Before the child exists there is nowhere to write; onStart flushes.
+        if (!m_inputBusy && m_processInfo.hProcess) {
+            m_inputBusy = true;
+            m_inputWriting.clear();
+            m_inputWriting.swap(m_inputQueue);
+            m_inputOffset = 0;
+            startWrite = true;
+        }
+    }
+
+    if (startWrite) {
+        writePipe();
+    }
+    return true;
+}
+
+void ProcessHandler::writePipe() {
+    if (m_closing) {
+        return;
+    }
+    acquire();
+    m_pipeWrite.reset();
+    if (!m_stdinPipe.writeAsync(m_inputWriting.data() + m_inputOffset,
+                                (DWORD)(m_inputWriting.size() - m_inputOffset), &m_pipeWrite)) {
+        DWORD error = GetLastError();
+        release();
+        onPipeWrite(0, error);
+    }
+}
+
+void ProcessHandler::onPipeWrite(DWORD bytes, DWORD error) {
+    if (error == ERROR_BROKEN_PIPE || error == ERROR_NO_DATA) {
+        // The child stopped reading stdin, usually because it is exiting;
+        // drop the input and let the exit path finish the session.
+        std::lock_guard<std::mutex> lock(m_inputMutex);
+        m_stdinClosed = true;
+        m_inputQueue.clear();
+        m_inputWriting.clear();
+        m_inputOffset = 0;
+        return;
+    }
+    if (error != NO_ERROR || bytes == 0) {
+        if (!m_closing) {
+            LOG_ERROR(m_logTag, "Failed to write to stdin pipe, error: " << error);
+        }
+        stop();
+        return;
+    }
+
+    LOG_TRACE(m_logTag, "Written " << bytes << " bytes to process stdin");
+
+    uint32_t grant = 0;
+    bool more = true;
+    {
+        std::lock_guard<std::mutex> lock(m_inputMutex);
+        m_inputOffset += bytes;
+        m_inputConsumed += bytes;
+
+        if (m_inputOffset >= m_inputWriting.size()) {
+            m_inputWriting.clear();
+            m_inputOffset = 0;
+            if (m_inputQueue.empty()) {
+                m_inputBusy = false;
+                more = false;
+                closeEndedInput();
+            } else {
+                m_inputWriting.swap(m_inputQueue);
+            }
+        }
+
+        // Return credits in batches, or right away once the queue is empty
+        // so an interactive client is never left waiting.
+        if (!more || m_inputConsumed >= SESSION_WINDOW / 4) {
+            grant = m_inputConsumed;
+            m_inputConsumed = 0;
+        }
+    }
+
+    if (grant > 0) {
+        sendControl(ControlCode::WindowUpdate, grant);
+    }
+    if (more) {
+        writePipe();
+    }
+}
+
+void ProcessHandler::endInput() {
+    std::lock_guard<std::mutex> lock(m_inputMutex);
+    m_inputEnded = true;
+    closeEndedInput();
+}
+
+void ProcessHandler::closeEndedInput() {
+    // Before the child exists, onStart calls this again.
+    if (!m_inputEnded || m_stdinClosed || m_inputBusy || !m_inputQueue.empty() || !m_processInfo.hProcess) {
+        return;
+    }
+    LOG_DEBUG(m_logTag, "Closing child stdin");
+    m_stdinClosed = true;
+    m_stdinPipe.closeWrite();
+}
+
+void ProcessHandler::grantOutput(uint32_t bytes) {
+    std::vector<OutputStream*> resumed;
+    bool replay = false;
+    {
+        std::lock_guard<std::mutex> lock(m_creditMutex);
+        m_outputCredit += bytes;
+
+        // Resuming on every small credit would relay in dribbles; wait until
+        // the uncredited output is down to the low watermark.
+        int64_t outstanding = (int64_t)m_options.outputHighWater - m_outputCredit;
+        if (outstanding > (int64_t)m_options.outputLowWater) {
+            return;
+        }
+
+        if (m_replayParked) {
+            m_replayParked = false;
+            replay = true;
+        }
+
+        for (OutputStream* stream : { &m_stdout, &m_stderr }) {
+            if (stream->parked) {
+                stream->parked = false;
+                m_metrics->throttledMicros.fetch_add(monotonicMicros() - stream->parkedAt,
+                                                     std::memory_order_relaxed);
+                resumed.push_back(stream);
+            }
+        }
+    }
+
+    for (OutputStream* stream : resumed) {
+        readPipe(*stream);
+    }
+    if (replay) {
+        sendReplay();
+    }
+}
+
+// Reader stage: reserves credit and reads the pipe into the chunk being
+// filled, taking a free slot first if there is none.
+void ProcessHandler::readPipe(OutputStream& stream) {
+    if (m_closing) {
+        return;
+    }
+
+    if (!stream.filling) {
+        stream.filling = stream.ring.reserve();
+        if (!stream.filling) {
+            // The writer frees a slot and reads on our behalf; unless it
+            // freed one before it could see the flag.
+            stream.readerWaiting = true;
+            if (!stream.ring.reserve() || !stream.readerWaiting.exchange(false)) {
+                m_registry.server().relayFull.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            stream.filling = stream.ring.reserve();
+        }
+        stream.filling->buffer = BufferPool::shared().acquire(stream.bufferSize);
+        stream.filling->tag = stream.interrupts;
+    }
+
+    bool closed = false;
+    {
+        std::lock_guard<std::mutex> lock(m_creditMutex);
+        if (m_exited && isOutputDrained(stream)) {
+            closed = true;
+        } else if (m_outputCredit <= 0) {
+            stream.parked = true;
+            stream.parkedAt = monotonicMicros();
+            m_registry.server().outputThrottles.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            stream.reserved = (DWORD)std::min<int64_t>(stream.filling->buffer.capacity() - stream.buffered,
+                                                       m_outputCredit);
+            m_outputCredit -= stream.reserved;
+        }
+    }
+
+    if (closed) {
+        endStream(stream);
+        return;
+    }
+
+    stream.readIssued = monotonicMicros();
+    issue([&stream] {
+        stream.readRequest.reset();
+        return stream.pipe.readAsync(stream.filling->buffer.data() + stream.buffered, stream.reserved,
+                                     &stream.readRequest);
+    }, "Read from output pipe");
+}
+
+void ProcessHandler::onPipeRead(OutputStream& stream, DWORD bytes, DWORD error) {
+    {
+        // Return the part of the reservation the read did not use.
+        std::lock_guard<std::mutex> lock(m_creditMutex);
+        m_outputCredit += stream.reserved - (error == NO_ERROR ? bytes : 0);
+        stream.reserved = 0;
+    }
+
+    if (error == ERROR_BROKEN_PIPE || (error == ERROR_OPERATION_ABORTED && m_exited)) {
+        endStream(stream);
+    } else if (error != NO_ERROR) {
+        if (!m_closing) {
+            LOG_ERROR(m_logTag, "Failed to read from output pipe, error: " << error);
+        }
+        stop();
+    } else if (bytes > 0) {
+        LOG_TRACE(m_logTag, "Read " << bytes << " bytes from process output");
+        m_metrics->pipeRead.record(monotonicMicros() - stream.readIssued);
+        m_registry.server().pipeReads.fetch_add(1, std::memory_order_relaxed);
+
+        if (stream.buffered == 0) {
+            stream.firstBuffered = monotonicMicros();
+        }
+        stream.buffered += bytes;
+
+        if (!shouldCoalesce(stream)) {
+            publishChunk(stream);
+        }
+        readPipe(stream);
+    } else {
+        readPipe(stream);
+    }
+}
+
+bool ProcessHandler::shouldCoalesce(OutputStream& stream) {
+    size_t threshold = std::min<size_t>(m_options.coalesceBytes, stream.filling->buffer.capacity());
+
+    if (stream.buffered >= threshold ||
+        monotonicMicros() - stream.firstBuffered >= m_options.coalesceMicros) {
+        return false;
+    }
+
+    // Only wait for output that is already in the pipe; an idle child
+    // (an echo, a prompt) is flushed at once rather than on a timer.
+    DWORD available = 0;
+    if (!PeekNamedPipe(stream.pipe.getReadHandle(), nullptr, 0, nullptr, &available, nullptr) ||
+        available == 0) {
+        return false;
+    }
+
+    // Buffered output has already used its credit; never park on top of it.
+    std::lock_guard<std::mutex> lock(m_creditMutex);
+    return m_outputCredit > 0;
+}
+
+// Hands the filled chunk to the writer, starting it if it was idle.
+void ProcessHandler::publishChunk(OutputStream& stream) {
+    if (stream.filling->tag != stream.interrupts) {
+        // Read, at least in part, before an Interrupt: dropped here, and the
+        // next chunk is read into the same buffer.
+        DWORD length = stream.buffered;
+        stream.buffered = 0;
+        stream.filling->tag = stream.interrupts;
+        dropOutput(length);
+        return;
+    }
+    stream.filling->length = stream.buffered;
+    stream.lastFlushed = stream.buffered;
+    stream.buffered = 0;
+    stream.filling = nullptr;
+    resizeBuffer(stream);
+
+    stream.ring.publish();
+    m_registry.server().relayQueued.fetch_add(1, std::memory_order_relaxed);
+    if (stream.writerIdle.exchange(false)) {
+        sendChunks(stream);
+    }
+}
+
+void ProcessHandler::endStream(OutputStream& stream) {
+    if (stream.buffered > 0) {
+        publishChunk(stream);
+    }
+    stream.ended = true;
+    if (stream.writerIdle.exchange(false)) {
+        sendChunks(stream);
+    }
+}
+
+// Called as each chunk is published, on the size of the buffer the next one
+// is read into. A chunk that filled its buffer suggests bulk output, so the
+// next ones get twice the room; eight in a row using under a quarter of it
+// (an interactive shell) give half of it back to the pool.
+void ProcessHandler::resizeBuffer(OutputStream& stream) {
+    size_t capacity = stream.bufferSize;
+    size_t wanted = capacity;
+
+    if (stream.lastFlushed >= capacity) {
+        stream.sparseFlushes = 0;
+        wanted = std::min(capacity * 2, m_options.maxBuffer);
+    } else if (stream.lastFlushed <= capacity / 4) {
+        if (++stream.sparseFlushes >= 8) {
+            stream.sparseFlushes = 0;
+            wanted = std::max(capacity / 2, m_options.minBuffer);
+        }
+    } else {
+        stream.sparseFlushes = 0;
+    }
+
+    if (wanted != capacity) {
+        LOG_TRACE(m_logTag, "Output buffer " << capacity << " -> " << wanted << " bytes");
+        stream.bufferSize = wanted;
+    }
+}
+
+// Writer stage: sends published chunks in order until the ring is empty,
+// then goes idle, or closes the stream once the reader has ended it.
+void ProcessHandler::sendChunks(OutputStream& stream) {
+    for (;;) {
+        RelayChunk* chunk = stream.ring.front();
+        if (!chunk) {
+            if (stream.ended) {
+                onOutputClosed(stream);
+                return;
+            }
+            stream.writerIdle = true;
+            if ((!stream.ring.front() && !stream.ended) || !stream.writerIdle.exchange(false)) {
+                return;
+            }
+            continue;
+        }
+        if (chunk->tag != stream.interrupts) {
+            uint32_t length = chunk->length;
+            releaseChunk(stream);
+            dropOutput(length);
+            continue;
+        }
+        if (sendChunk(stream, *chunk)) {
+            return;
+        }
+        releaseChunk(stream);
+    }
+}
+
+// Records the chunk and sends it; false if there was nobody to send it to,
+// true if the send's completion carries the stage on.
+bool ProcessHandler::sendChunk(OutputStream& stream, RelayChunk& chunk) {
+    uint32_t raw = chunk.length;
+
+    if (feedScreen(chunk.buffer.data(), raw)) {
+        m_metrics->bytesOut.fetch_add(raw, std::memory_order_relaxed);
+        m_metrics->chunksOut.fetch_add(1, std::memory_order_relaxed);
+        // Only screen updates reach the client, and they take no credit.
+        std::lock_guard<std::mutex> creditLock(m_creditMutex);
+        m_outputCredit += raw;
+        return false;
+    }
+
+    std::unique_lock<std::recursive_mutex> lock(m_linkMutex);
+    // An Interrupt came in since sendChunks looked; its answer, posted under
+    // the same lock, is already ahead of this chunk.
+    if (chunk.tag != stream.interrupts) {
+        lock.unlock();
+        dropOutput(raw);
+        return false;
+    }
+    if (!m_answersOwed.empty()) {
+        // An answer is still to be posted and must go out first; the stage
+        // carries on from this chunk once it has.
+        stream.heldForAnswer = true;
+        return true;
+    }
+    m_metrics->bytesOut.fetch_add(raw, std::memory_order_relaxed);
+    m_metrics->chunksOut.fetch_add(1, std::memory_order_relaxed);
+    m_outputOffset += raw;
+    if (m_ring) {
+        m_ring->append(stream.channel, chunk.buffer.data(), raw);
+    }
+
+    if (!m_connection || m_linkBroken || m_replaying) {
+        // Nobody to send to yet: the ring keeps the output for the client
+        // that resumes the session, so return the credit and keep reading.
+        lock.unlock();
+        std::lock_guard<std::mutex> creditLock(m_creditMutex);
+        m_outputCredit += raw;
+        return false;
+    }
+
+    const char* payload = chunk.buffer.data();
+    uint32_t length = raw;
+    uint8_t flags = 0;
+
+    // Each chunk is a complete block, so the client can show it at once.
+    if (m_connection->features() & FeatureCompression) {
+        stream.compressed = BufferPool::shared().acquire(compressBound(length));
+        size_t size = stream.compressor.compress(payload, length, stream.compressed.data());
+        if (size > 0) {
+            payload = stream.compressed.data();
+            length = (uint32_t)size;
+            flags = FrameCompressed;
+        }
+    }
+
+    ServerMetrics& serverMetrics = m_registry.server();
+    serverMetrics.outputFrames.fetch_add(1, std::memory_order_relaxed);
+    serverMetrics.outputBytes.fetch_add(length + sizeof(FrameHeader), std::memory_order_relaxed);
+
+    stream.frame.prepare(stream.channel, payload, length, flags, m_sessionId);
+    stream.generation = m_linkGeneration;
+    stream.sendIssued = monotonicMicros();
+    if (beginSend(stream.sendRequest, stream.frame)) {
+        return true;
+    }
+    lock.unlock();
+    onStreamSent(stream, 0, WSAGetLastError());
+    return true;
+}
+
+void ProcessHandler::sendStream(OutputStream& stream) {
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+        if (stream.generation != m_linkGeneration) {
+            // Fall through to onStreamSent, which drops the stale frame.
+        } else if (!m_linkBroken && beginSend(stream.sendRequest, stream.frame)) {
+            return;
+        }
+    }
+    onStreamSent(stream, 0, WSAGetLastError());
+}
+
+void ProcessHandler::onStreamSent(OutputStream& stream, DWORD bytes, DWORD error) {
+    bool current = stream.generation == m_linkGeneration;
+    if (current && (error != NO_ERROR || bytes == 0)) {
+        onSendFailed(error);
+        if (!m_token) {
+            return;
+        }
+        current = false;
+    }
+
+    if (current) {
+        LOG_TRACE(m_logTag, "Sent " << bytes << " bytes to client");
+        if (!stream.frame.advance(bytes)) {
+            sendStream(stream);
+            return;
+        }
+
+        uint64_t latency = monotonicMicros() - stream.sendIssued;
+        m_metrics->socketSend.record(latency);
+        if (latency > METRICS_SEND_STALL_US) {
+            m_metrics->sendStallMicros.fetch_add(latency - METRICS_SEND_STALL_US, std::memory_order_relaxed);
+        }
+    }
+    // Otherwise the connection this frame was for is gone; the ring still
+    // has the data, so carry on for the next one.
+
+    stream.compressed.reset();
+    releaseChunk(stream);
+    sendChunks(stream);
+}
+
+// Frees the chunk at the front, restarting the reader if it was waiting
+// for the slot.
+void ProcessHandler::releaseChunk(OutputStream& stream) {
+    RelayChunk* chunk = stream.ring.front();
+    chunk->buffer.reset();
+    chunk->length = 0;
+    stream.ring.pop();
+    m_registry.server().relayQueued.fetch_sub(1, std::memory_order_relaxed);
+    if (stream.readerWaiting.exchange(false)) {
+        readPipe(stream);
+    }
+}
+
+void ProcessHandler::onProcessExit() {
+    beginTeardown();
+    m_exitInfo = ProcessSupervisor::collect(m_processInfo.hProcess);
+    LOG_INFO(m_logTag, "Child exited with code: " << m_exitInfo.exitCode
+             << " (wall " << m_exitInfo.wallSeconds << " s, user " << m_exitInfo.userSeconds
+             << " s, kernel " << m_exitInfo.kernelSeconds << " s, peak working set "
+             << m_exitInfo.peakWorkingSet / 1024 << " KB)");
+
+    // Parked streams have no read to complete, so wake them to drain or close.
+    std::vector<OutputStream*> resumed;
+    {
+        std::lock_guard<std::mutex> lock(m_creditMutex);
+        m_exited = true;
+        for (OutputStream* stream : { &m_stdout, &m_stderr }) {
+            if (stream->parked) {
+                stream->parked = false;
+                m_metrics->throttledMicros.fetch_add(monotonicMicros() - stream->parkedAt,
+                                                     std::memory_order_relaxed);
+                resumed.push_back(stream);
+            } else if (isOutputDrained(*stream)) {
+                // Grandchildren may still hold the write end, so do not wait
+                // for EOF: once nothing is buffered, abort the pending read.
+                stream->pipe.cancelIo();
+            }
+        }
+    }
+
+    for (OutputStream* stream : resumed) {
+        readPipe(*stream);
+    }
+
+    if (++m_exitStages == 3) {
+        sendExitStatus();
+    }
+}
+
+void ProcessHandler::onOutputClosed(OutputStream& stream) {
+    LOG_INFO(m_logTag, "Child closed its "
+             << (stream.channel == Channel::Stdout ? "stdout" : "stderr"));
+    stream.closed = true;
+
+    if (++m_exitStages == 3) {
+        sendExitStatus();
+    }
+}
+
+bool ProcessHandler::isOutputDrained(OutputStream& stream) {
+    DWORD available = 0;
+    if (!PeekNamedPipe(stream.pipe.getReadHandle(), nullptr, 0, nullptr, &available, nullptr)) {
+        return true;
+    }
+    return available == 0;
+}
+
+void ProcessHandler::sendExitStatus() {
+    {
+        std::unique_lock<std::mutex> lock(m_screenMutex);
+        if (m_screenOn && (m_screenBusy || m_screen->isDirty())) {
+            // Held until the final screen update has gone out.
+            m_screenExitHeld = true;
+            lock.unlock();
+            scheduleScreen();
+            return;
+        }
+    }
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+        if (!m_connection || m_linkBroken || m_replaying) {
+            // Held until a client has resumed the session and been sent
+            // all of its output.
+            m_exitHeld = true;
+            return;
+        }
+        m_exitHeld = false;
+
+        encodeExitStatus(m_exitPayload, m_exitInfo.exitCode, m_exitInfo.wallSeconds,
+                         m_exitInfo.userSeconds, m_exitInfo.kernelSeconds, m_exitInfo.peakWorkingSet);
+        m_exitFrame.prepare(Channel::ExitStatus, &m_exitPayload, sizeof(m_exitPayload), 0, m_sessionId);
+        m_exitGeneration = m_linkGeneration;
+        if (beginSend(m_exitWrite, m_exitFrame)) {
+            return;
+        }
+    }
+    onExitStatusSent(0, WSAGetLastError());
+}
+
+void ProcessHandler::onExitStatusSent(DWORD bytes, DWORD error) {
+    if (m_exitGeneration != m_linkGeneration) {
+        // Sent on a connection that is gone; start over on the current one.
+        sendExitStatus();
+        return;
+    }
+
+    if (error == NO_ERROR && bytes > 0) {
+        if (m_exitFrame.advance(bytes)) {
+            stop();
+            return;
+        }
+        std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+        if (!m_linkBroken && beginSend(m_exitWrite, m_exitFrame)) {
+            return;
+        }
+        error = WSAGetLastError();
+    }
+
+    onSendFailed(error);
+    if (m_token) {
+        sendExitStatus();
+    }
+}
+
+void ProcessHandler::enableResume() {
+    std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+    if (m_token || !m_store || m_closing || m_options.scrollbackBytes == 0) {
+        return;
+    }
+    if (!m_store->reserve(m_options.scrollbackBytes)) {
+        LOG_WARN(m_logTag, "Scrollback budget used up; session will not survive a disconnect");
+        return;
+    }
+    uint64_t token = m_store->newToken();
+    if (token == 0) {
+        m_store->unreserve(m_options.scrollbackBytes);
+        return;
+    }
+
+    // Output flushed before this point cannot be replayed; the ring starts
+    // at the current offset.
+    m_ring = std::make_unique<ScrollbackRing>(m_options.scrollbackBytes, m_outputOffset);
+    m_token = token;
+    if (m_connection) {
+        m_connection->sendResume(m_sessionId, token, 0);
+    }
+}
+
+bool ProcessHandler::detach(FinishedCallback onFinished) {
+    acquire();
+    bool detached = false;
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+        if (m_token && m_connection && !m_closing) {
+            m_connection = nullptr;
+            ++m_linkGeneration;
+            m_linkBroken = false;
+            m_replaying = false;
+            m_onFinished = std::move(onFinished);
+            detached = true;
+        }
+    }
+
+    if (detached) {
+        LOG_INFO(m_logTag, "Detached, keeping output until the session is resumed");
+        // Nobody is left to return credit; output only goes to the ring now.
+        resetCredit();
+    }
+    release();
+    return detached;
+}
+
+bool ProcessHandler::attach(Connection& connection, uint16_t sessionId, uint64_t offset,
+                            FinishedCallback onFinished) {
+    acquire();
+    bool attached = false;
+    uint64_t replayFrom = 0;
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+        if (m_token && !m_connection && !m_closing) {
+            m_connection = &connection;
+            m_sessionId = sessionId;
+            m_onFinished = std::move(onFinished);
+            ++m_linkGeneration;
+            m_linkBroken = false;
+
+            // The client decodes this session with fresh state.
+            m_stdout.compressor = StreamCompressor();
+            m_stderr.compressor = StreamCompressor();
+
+            replayFrom = std::min(std::max(offset, m_ring->startOffset()), m_ring->endOffset());
+            m_replayOffset = replayFrom;
+            m_replaying = true;
+            m_replayAnnounce = true;
+            attached = true;
+        }
+    }
+
+    if (attached) {
+        LOG_INFO(m_logTag, "Resumed on c" << connection.id() << " as session " << sessionId
+                 << ", replaying from offset " << replayFrom);
+        if (replayFrom > offset) {
+            LOG_WARN(m_logTag, "Client missed " << replayFrom - offset << " bytes no longer in scrollback");
+        }
+
+        resetCredit();
+
+        // The new client starts without stdin credit; give it whatever the
+        // queue has room for.
+        uint32_t window;
+        {
+            std::lock_guard<std::mutex> lock(m_inputMutex);
+            window = (uint32_t)(SESSION_WINDOW - (m_inputQueue.size() + m_inputWriting.size() - m_inputOffset));
+            m_inputConsumed = 0;
+        }
+        sendControl(ControlCode::WindowUpdate, window);
+
+        sendReplay();
+    }
+    release();
+    return attached;
+}
+
+// Sends the Resume answer and then the ring from the client's offset, one
+// frame at a time and within its credit, while new output keeps going to the
+// ring. Once the replay has caught up with the ring, output is sent live.
+void ProcessHandler::sendReplay() {
+    acquire();
+    bool sending = false;
+    bool caughtUp = false;
+    bool exitHeld = false;
+    bool failed = false;
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+        int64_t credit = 0;
+        if (m_replaying && m_connection && !m_linkBroken && !m_replayAnnounce) {
+            std::lock_guard<std::mutex> creditLock(m_creditMutex);
+            credit = m_outputCredit;
+            // grantOutput picks the replay up again.
+            m_replayParked = credit <= 0;
+        }
+
+        if (!m_replaying || !m_connection || m_linkBroken) {
+            // Detached again, or waiting for a broken link to be detached.
+        } else if (m_replayAnnounce) {
+            m_replayAnnounce = false;
+            encodeResume(m_resumePayload, m_token, m_replayOffset);
+            m_replayFrame.prepare(Channel::Resume, &m_resumePayload, sizeof(m_resumePayload), 0, m_sessionId);
+            sending = true;
+        } else if (credit > 0) {
+            if (!m_replayBuffer) {
+                m_replayBuffer = BufferPool::shared().acquire(m_options.maxBuffer);
+            }
+            Channel channel = Channel::Stdout;
+            size_t length = m_ring->read(m_replayOffset, channel, m_replayBuffer.data(),
+                                         std::min({ m_replayBuffer.capacity(), (size_t)MAX_FRAME_PAYLOAD, (size_t)credit }));
+            if (length == 0) {
+                m_replaying = false;
+                m_replayBuffer.reset();
+                exitHeld = m_exitHeld;
+                caughtUp = true;
+            } else {
+                std::lock_guard<std::mutex> creditLock(m_creditMutex);
+                m_outputCredit -= length;
+                m_replayFrame.prepare(channel, m_replayBuffer.data(), (uint32_t)length, 0, m_sessionId);
+                sending = true;
+            }
+        }
+
+        if (sending) {
+            m_replayGeneration = m_linkGeneration;
+            failed = !beginSend(m_replayWrite, m_replayFrame);
+        }
+    }
+
+    if (failed) {
+        onSendFailed(WSAGetLastError());
+    } else if (caughtUp) {
+        LOG_DEBUG(m_logTag, "Replay complete, sending live output");
+        if (exitHeld) {
+            sendExitStatus();
+        }
+    }
+    release();
+}
+
+void ProcessHandler::onReplaySent(DWORD bytes, DWORD error) {
+    if (m_replayGeneration != m_linkGeneration) {
+        return;
+    }
+    if (error != NO_ERROR || bytes == 0) {
+        onSendFailed(error);
+        return;
+    }
+
+    if (!m_replayFrame.advance(bytes)) {
+        {
+            std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+            if (!m_linkBroken && m_connection && beginSend(m_replayWrite, m_replayFrame)) {
+                return;
+            }
+        }
+        onSendFailed(WSAGetLastError());
+        return;
+    }
+    sendReplay();
+}
+
+void ProcessHandler::enableScreen(bool on) {
+    {
+        std::lock_guard<std::mutex> lock(m_screenMutex);
+        if (m_screenOn) {
+            return;
+        }
+        if (!on || m_options.screenFps == 0) {
+            m_screen.reset();
+            return;
+        }
+        if (!m_screen) {
+            // The Hello came too late to have the output so far; the client's
+            // screen starts blank.
+            m_screen = std::make_unique<ScreenModel>();
+        }
+        m_screenOn = true;
+    }
+    LOG_DEBUG(m_logTag, "Sending output as screen updates");
+    scheduleScreen();
+}
+
+void ProcessHandler::resizeScreen(int columns, int rows) {
+    {
+        std::lock_guard<std::mutex> lock(m_screenMutex);
+        if (!m_screen) {
+            return;
+        }
+        m_screen->resize(columns, rows);
+        if (!m_screenOn) {
+            return;
+        }
+    }
+    scheduleScreen();
+}
+
+void ProcessHandler::interrupt(InterruptKind kind) {
+    LOG_DEBUG(m_logTag, "Interrupt (" << (kind == InterruptKind::CtrlBreak ? "Ctrl-Break" : "Ctrl-C") << ")");
+
+    // Input the child has not been given yet was typed ahead of the
+    // interrupt; the write already at the pipe still completes.
+    uint32_t dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_inputMutex);
+        dropped = (uint32_t)m_inputQueue.size();
+        m_inputQueue.clear();
+        closeEndedInput();
+    }
+
+    // Answered before the event is raised, so what the client drops until
+    // the answer is output from before it. Under the link lock, so a chunk
+    // is either posted ahead of the answer or sees the new count, and posted
+    // straight away: behind the control queue, newer chunks could pass it.
+    bool failed = false;
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+        for (OutputStream* stream : { &m_stdout, &m_stderr }) {
+            ++stream->interrupts;
+        }
+        if (m_connection && !m_linkBroken) {
+            m_answersOwed.push_back((uint32_t)kind);
+            failed = !m_answerBusy && !sendAnswer();
+        }
+    }
+    if (failed) {
+        onAnswerSent(0, WSAGetLastError());
+    }
+    if (dropped > 0) {
+        sendControl(ControlCode::WindowUpdate, dropped);
+    }
+
+    m_interruptKind = (uint32_t)kind;
+    if (m_interruptQueued.exchange(true)) {
+        return;
+    }
+    acquire();
+    if (!QueueUserWorkItem(onInterruptWork, this, WT_EXECUTELONGFUNCTION)) {
+        // Raising it here would hold this loop thread for the helper's whole
+        // run; the client has its answer and can interrupt again.
+        LOG_ERROR(m_logTag, "Failed to queue interrupt, not raised: " << GetLastError());
+        m_interruptQueued = false;
+        release();
+    }
+}
+
+bool ProcessHandler::sendAnswer() {
+    if (!m_connection || m_linkBroken) {
+        // The answer would go to a connection that is not there; the client
+        // that resumes did not send the Interrupt.
+        m_answersOwed.clear();
+        return true;
+    }
+    encodeControl(m_answerPayload, ControlCode::Interrupt, m_answersOwed.front());
+    m_answersOwed.pop_front();
+    m_answerFrame.prepare(Channel::Control, &m_answerPayload, sizeof(m_answerPayload), 0, m_sessionId);
+    m_answerBusy = true;
+    m_answerGeneration = m_linkGeneration;
+    return beginSend(m_answerWrite, m_answerFrame);
+}
+
+void ProcessHandler::onAnswerSent(DWORD bytes, DWORD error) {
+    if (error != NO_ERROR || bytes == 0) {
+        // Answers still owed were for the client that is being lost.
+        bool current;
+        {
+            std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+            current = m_answerGeneration == m_linkGeneration;
+            m_answerBusy = false;
+            m_answersOwed.clear();
+        }
+        if (current) {
+            onSendFailed(error);
+        }
+        resumeHeldStreams();
+        return;
+    }
+
+    bool failed = false;
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+        if (m_answerGeneration != m_linkGeneration) {
+            // Went out on a connection that is gone, as would the rest.
+            m_answerBusy = false;
+            m_answersOwed.clear();
+        } else if (!m_answerFrame.advance(bytes)) {
+            failed = !beginSend(m_answerWrite, m_answerFrame);
+        } else {
+            m_answerBusy = false;
+            if (!m_answersOwed.empty()) {
+                failed = !sendAnswer();
+            }
+        }
+    }
+    if (failed) {
+        onAnswerSent(0, WSAGetLastError());
+    } else {
+        resumeHeldStreams();
+    }
+}
+
+// Restarts the writer stages that waited for answers, once none is owed.
+void ProcessHandler::resumeHeldStreams() {
+    std::vector<OutputStream*> held;
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+        if (!m_answersOwed.empty()) {
+            return;
+        }
+        for (OutputStream* stream : { &m_stdout, &m_stderr }) {
+            if (stream->heldForAnswer) {
+                stream->heldForAnswer = false;
+                held.push_back(stream);
+            }
+        }
+    }
+    for (OutputStream* stream : held) {
+        sendChunks(*stream);
+    }
+}
+
+// Runs on the thread pool: starting the helper and waiting for it would hold
+// up a loop thread.
+DWORD WINAPI ProcessHandler::onInterruptWork(void* context) {
+    ProcessHandler* handler = static_cast<ProcessHandler*>(context);
+    handler->raiseInterrupt();
+    handler->release();
+    return 0;
+}
+
+void ProcessHandler::raiseInterrupt() {
+    m_interruptQueued = false;
+    if (m_closing || m_exited) {
+        return;
+    }
+    if (!m_processInfo.hProcess) {
+        LOG_WARN(m_logTag, "Interrupt arrived before the child started, not raised");
+        return;
+    }
+    DWORD event =
+        (InterruptKind)m_interruptKind.load() == InterruptKind::CtrlBreak ? CTRL_BREAK_EVENT : CTRL_C_EVENT;
+    if (ProcessSupervisor::interrupt(m_options.interruptHelper, m_processInfo.dwProcessId, event, m_logTag)) {
+        ++m_registry.server().interrupts;
+    }
+}
+
+void ProcessHandler::dropOutput(uint32_t bytes) {
+    m_registry.server().interruptDropped.fetch_add(bytes, std::memory_order_relaxed);
+    grantOutput(bytes);
+}
+
+bool ProcessHandler::feedScreen(const char* data, uint32_t length) {
+    {
+        std::lock_guard<std::mutex> lock(m_screenMutex);
+        if (!m_screen) {
+            return false;
+        }
+        if (!m_screenOn) {
+            // A client that has not sent its Hello by now is not going to.
+            m_screenPending += length;
+            if (m_screenPending > SCREEN_PENDING_BYTES) {
+                m_screen.reset();
+            } else {
+                m_screen->write(data, length);
+            }
+            return false;
+        }
+        m_screen->write(data, length);
+    }
+    scheduleScreen();
+    return true;
+}
+
+// Starts an update if the model has changed and none is outstanding: at once
+// if the last one was rendered at least a frame ago or the ExitStatus is
+// waiting, otherwise from a timer once it has been.
+void ProcessHandler::scheduleScreen() {
+    bool armed = false;
+    bool timerFailed = false;
+    {
+        std::lock_guard<std::mutex> lock(m_screenMutex);
+        if (!m_screenOn || m_screenBusy || m_closing || !m_screen->isDirty()) {
+            return;
+        }
+        m_screenBusy = true;
+
+        uint64_t interval = 1000000 / m_options.screenFps;
+        uint64_t elapsed = monotonicMicros() - m_screenSentAt;
+        if (elapsed < interval && !m_screenExitHeld) {
+            DWORD delayMs = (DWORD)((interval - elapsed + 999) / 1000);
+            acquire();
+            armed = CreateTimerQueueTimer(&m_screenTimer, nullptr, onScreenTimer, this, delayMs, 0,
+                                          WT_EXECUTEONLYONCE) != FALSE;
+            timerFailed = !armed;
+        }
+    }
+
+    if (armed) {
+        return;
+    }
+    if (timerFailed) {
+        // Sent early rather than not at all.
+        LOG_WARN(m_logTag, "Failed to arm screen timer: " << GetLastError());
+        release();
+    }
+    sendScreen();
+}
+
+void CALLBACK ProcessHandler::onScreenTimer(void* context, BOOLEAN) {
+    ProcessHandler* handler = static_cast<ProcessHandler*>(context);
+    if (handler->m_loop.post(&handler->m_screenTick)) {
+        return;
+    }
+    // Undone as if the update had gone out; the next output schedules
+    // another.
+    LOG_ERROR(handler->m_logTag, "Failed to post screen update: " << GetLastError());
+    HANDLE timer;
+    {
+        std::lock_guard<std::mutex> lock(handler->m_screenMutex);
+        timer = handler->m_screenTimer;
+        handler->m_screenTimer = nullptr;
+        handler->m_screenBusy = false;
+    }
+    DeleteTimerQueueTimer(nullptr, timer, nullptr);
+    handler->release();
+}
+
+// Sends the next piece of the current update, rendering a new one from the
+// model once the last has gone out.
+void ProcessHandler::sendScreen() {
+    bool failed = false;
+    bool idle = false;
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+        if (m_screenOffset == m_screenPayload.size()) {
+            std::lock_guard<std::mutex> screenLock(m_screenMutex);
+            m_screenPayload.clear();
+            m_screenOffset = 0;
+            m_screen->render(m_screenPayload);
+            m_screenSentAt = monotonicMicros();
+        }
+
+        if (m_screenPayload.empty() || !m_connection || m_linkBroken) {
+            // Nothing changed after all, or nobody left to show it to.
+            m_screenOffset = m_screenPayload.size();
+            idle = true;
+        } else {
+            uint32_t length = (uint32_t)std::min(m_screenPayload.size() - m_screenOffset, (size_t)MAX_FRAME_PAYLOAD);
+            m_screenFrame.prepare(Channel::Screen, m_screenPayload.data() + m_screenOffset, length, 0, m_sessionId);
+            m_screenOffset += length;
+
+            ServerMetrics& serverMetrics = m_registry.server();
+            serverMetrics.outputFrames.fetch_add(1, std::memory_order_relaxed);
+            serverMetrics.outputBytes.fetch_add(length + sizeof(FrameHeader), std::memory_order_relaxed);
+            failed = !beginSend(m_screenWrite, m_screenFrame);
+        }
+    }
+
+    if (failed) {
+        onScreenSent(0, WSAGetLastError());
+    } else if (idle && endScreenUpdate()) {
+        sendExitStatus();
+    }
+}
+
+void ProcessHandler::onScreenSent(DWORD bytes, DWORD error) {
+    if (error != NO_ERROR || bytes == 0) {
+        endScreenUpdate();
+        onSendFailed(error);
+        return;
+    }
+
+    if (!m_screenFrame.advance(bytes)) {
+        {
+            std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+            if (!m_linkBroken && m_connection && beginSend(m_screenWrite, m_screenFrame)) {
+                return;
+            }
+        }
+        onScreenSent(0, WSAGetLastError());
+        return;
+    }
+
+    if (m_screenOffset < m_screenPayload.size()) {
+        sendScreen();
+    } else if (endScreenUpdate()) {
+        sendExitStatus();
+    } else {
+        scheduleScreen();
+    }
+}
+
+bool ProcessHandler::endScreenUpdate() {
+    std::lock_guard<std::mutex> lock(m_screenMutex);
+    m_screenBusy = false;
+    if (m_screenExitHeld && !m_screen->isDirty()) {
+        m_screenExitHeld = false;
+        return true;
+    }
+    return false;
+}
+
+void ProcessHandler::sendControl(ControlCode code, uint32_t value) {
+    std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+    if (m_connection) {
+        m_connection->sendControl(m_sessionId, code, value);
+    }
+}
+
+bool ProcessHandler::beginSend(IoRequest& request, OutgoingFrame& frame) {
+    if (m_closing) {
+        return false;
+    }
+    acquire();
+    request.reset();
+    if (!m_connection->send(frame, request)) {
+        release();
+        return false;
+    }
+    return true;
+}
+
+// A send on the current connection failed. A resumable session survives it:
+// cancelling the socket's I/O makes the connection stop and detach us.
+void ProcessHandler::onSendFailed(DWORD error) {
+    if (m_closing) {
+        return;
+    }
+    if (!m_token) {
+        LOG_ERROR(m_logTag, "Failed to send data to client, error: " << error);
+        stop();
+        return;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+    if (m_connection && !m_linkBroken) {
+        LOG_INFO(m_logTag, "Lost the client (error " << error << "), keeping the session");
+        m_linkBroken = true;
+        m_connection->transport().cancelIo();
+    }
+}
+
+// A new link starts with a full window, less what pending reads reserved.
+// Parked streams and a parked replay are woken to use it.
+void ProcessHandler::resetCredit() {
+    std::vector<OutputStream*> resumed;
+    bool replay;
+    {
+        std::lock_guard<std::mutex> lock(m_creditMutex);
+        m_outputCredit = (int64_t)m_options.outputHighWater - m_stdout.reserved - m_stderr.reserved;
+        for (OutputStream* stream : { &m_stdout, &m_stderr }) {
+            if (stream->parked) {
+                stream->parked = false;
+                m_metrics->throttledMicros.fetch_add(monotonicMicros() - stream->parkedAt,
+                                                     std::memory_order_relaxed);
+                resumed.push_back(stream);
+            }
+        }
+        replay = m_replayParked;
+        m_replayParked = false;
+    }
+
+    for (OutputStream* stream : resumed) {
+        readPipe(*stream);
+    }
+    if (replay) {
+        sendReplay();
+    }
+}
+
+void ProcessHandler::release() {
+    if (--m_pending == 0 && m_closing) {
+        finish();
+    }
+}
+
+void ProcessHandler::finish() {
+    if (m_finished.exchange(true)) {
+        return;
+    }
+
+    // No operation is in flight any more, so handles can be closed safely.
+    m_supervisor.unwatch();
+    m_stdinPipe.close();
+    m_stdout.pipe.close();
+    m_stderr.pipe.close();
+
+    if (m_processInfo.hProcess) {
+        CloseHandle(m_processInfo.hProcess);
+        m_processInfo.hProcess = nullptr;
+    }
+    if (m_processInfo.hThread) {
+        CloseHandle(m_processInfo.hThread);
+        m_processInfo.hThread = nullptr;
+    }
+
+    LOG_INFO(m_logTag, "Session stopped");
+
+    uint64_t teardownStarted = m_teardownStarted;
+    if (teardownStarted) {
+        m_registry.server().teardownTime.record(monotonicMicros() - teardownStarted);
+    }
+    m_registry.removeSession(m_metrics);
+    // Chunks a failed send left behind.
+    m_registry.server().relayQueued.fetch_sub(m_stdout.ring.size() + m_stderr.ring.size(),
+                                              std::memory_order_relaxed);
+
+    FinishedCallback onFinished;
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_linkMutex);
+        if (m_ring) {
+            m_store->unreserve(m_options.scrollbackBytes);
+            m_ring.reset();
+        }
+        onFinished = m_onFinished;
+    }
+    if (onFinished) {
+        onFinished(this);
+    }
+
+    // Waiters may destroy the handler as soon as this is signalled, so it
+    // must be the last thing that touches any member.
+    SetEvent(m_finishedEvent);
+}
+
+void ProcessHandler::stop() {
+    acquire();
+    if (m_closing.exchange(true)) {
+        release();
+        return;
+    }
+
+    LOG_INFO(m_logTag, "Stopping session...");
+    beginTeardown();
+
+    // Unblock every outstanding pipe operation; their completions drain the
+    // pending count and the last one closes the handles in finish(). Sends
+    // on the shared socket complete on their own.
+    {
+        // endInput may be closing the write end.
+        std::lock_guard<std::mutex> lock(m_inputMutex);
+        m_stdinPipe.cancelIo();
+    }
+    m_stdout.pipe.cancelIo();
+    m_stderr.pipe.cancelIo();
+
+    if (m_processInfo.hProcess) {
+        TerminateProcess(m_processInfo.hProcess, 0);
+    }
+
+    release();
+}
+
+// Teardown is timed from whichever comes first: the child exiting or a stop.
+void ProcessHandler::beginTeardown() {
+    uint64_t expected = 0;
+    m_teardownStarted.compare_exchange_strong(expected, monotonicMicros());
+}
+
+void ProcessHandler::terminate() {
+    m_terminateRequested = true;
+    if (m_processInfo.hProcess) {
+        LOG_INFO(m_logTag, "Terminating child");
+        TerminateProcess(m_processInfo.hProcess, 1);
+    }
+}
+
+void ProcessHandler::wait() {
+    if (m_finishedEvent) {
+        WaitForSingleObject(m_finishedEvent, INFINITE);
+    }
+}
@@ -0,0 +1,457 @@
+#pragma once
+#ifndef HANDLER_HPP
+#define HANDLER_HPP
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include "../utils.hpp"
+#include "../define.hpp"
+#include "../engine/engine.hpp"
+#include "../supervisor/supervisor.hpp"
+#include "../protocol/protocol.hpp"
+#include "../compress/compress.hpp"
+#include "../log/log.hpp"
+#include "../metrics/metrics.hpp"
+#include "../pool/pool.hpp"
+#include "../buffer/buffer.hpp"
+#include "../scheduler/scheduler.hpp"
+#include "../screen/screen.hpp"
+#include "store.hpp"
+
+class Connection;
+
+// What each session runs, and how its output is batched before it is
+// written to the socket.
+struct RelayOptions {
+    // Command line of the child started for every session.
+    std::string shell;
+    // Keep reading while the pipe has more data, up to this many bytes
+    // (at most the stream's buffer); 0 sends every pipe read on its own.
+    size_t coalesceBytes;
+    // Upper bound on how long the first buffered byte may wait.
+    uint32_t coalesceMicros;
+    // Disable Nagle so a short echo is not held back by the socket.
+    bool noDelay;
+    // Bounds of each output stream's pooled read buffer, which doubles while
+    // reads keep filling it and halves again once output turns sparse.
+    size_t minBuffer;
+    size_t maxBuffer;
+    // Chunks a stream may have read from the child and not yet sent, so
+    // reading goes on while a send is stuck; 1 reads and sends in turn.
+    size_t relayDepth;
+    // Output sent but not yet credited by the client, per session: streams
+    // stop reading the child at the high watermark and resume once it has
+    // fallen to the low one, so a slow client costs at most this much.
+    size_t outputHighWater;
+    size_t outputLowWater;
+    // Control replies queued on a connection: at the high watermark it
+    // stops reading from the client until the queue drains to the low one.
+    size_t controlHighWater;
+    size_t controlLowWater;
+    // Sessions on connections that negotiated FeatureResume keep running
+    // when the connection drops and record this much of their latest output
+    // for the client that resumes them; 0 turns resuming off. All rings
+    // together stay within the budget, and a detached session nobody
+    // resumes is stopped after the lifetime.
+    size_t scrollbackBytes;
+    size_t scrollbackBudget;
+    uint32_t detachedTtlMs;
+    // Let clients that negotiate FeatureFile read and write files with the
+    // rights of the server process.
+    bool fileTransfer;
+    // Accept FeatureEncryption. When it is required, a client must exchange
+    // keys before anything else and session 0 waits for it, so nothing is
+    // ever sent in the clear; otherwise the first output of session 0 may
+    // go out before the client's Key frame arrives.
+    bool encryption;
+    bool requireEncryption;
+    // Accept FeatureScreen, sending its sessions at most this many screen
+    // updates a second; 0 turns screen updates off.
+    uint32_t screenFps;
+    // Command run to raise console control events on a child for Interrupt
+    // controls, see ProcessSupervisor::interrupt; empty turns them off.
+    std::string interruptHelper;
+
+    RelayOptions()
+        : shell(SHELL_COMMAND),
+          coalesceBytes(COALESCE_BYTES),
+          coalesceMicros(COALESCE_DEADLINE_US),
+          noDelay(true),
+          minBuffer(RELAY_BUFFER_MIN),
+          maxBuffer(RELAY_BUFFER_MAX),
+          relayDepth(RELAY_RING_CHUNKS),
+          outputHighWater(OUTPUT_HIGH_WATER),
+          outputLowWater(OUTPUT_LOW_WATER),
+          controlHighWater(CONTROL_QUEUE_HIGH),
+          controlLowWater(CONTROL_QUEUE_LOW),
+          scrollbackBytes(SCROLLBACK_BYTES),
+          scrollbackBudget(SCROLLBACK_BUDGET),
+          detachedTtlMs(DETACHED_TTL_MS),
+          fileTransfer(true),
+          encryption(true),
+          requireEncryption(false),
+          screenFps(SCREEN_FPS),
+          interruptHelper(interruptHelperCommand()) {}
+};
+
+
+// Relays one of the child's output pipes to the client as frames on its
+// channel, in two stages joined by `ring`. The reader stage reads the pipe
+// straight into the chunk it is `filling`, possibly over several reads while
+// output is being coalesced, publishes it and goes on reading into the next
+// free slot. The writer stage sends published chunks in order behind the
+// frame header without copying them, or compressed into `compressed` when
+// the connection negotiated compression, and frees each slot once its send
+// completes. Chunk buffers come from the shared BufferPool and go back to it
+// once sent; `compressed` is only held while its frame is being sent.
+//
+// Each stage runs on whichever loop thread completed its last operation and
+// has at most one operation outstanding. A stage with nothing to do raises
+// its flag (readerWaiting on a full ring, writerIdle on an empty one) and
+// re-checks the ring; the other stage restarts it by clearing the flag, and
+// whichever side clears it first runs the stage.
+struct OutputStream {
+    Channel channel;
+    Pipe pipe;
+    IoRequest readRequest;
+    IoRequest sendRequest;
+    ChunkRing ring;
+
+    // Reader stage.
+    RelayChunk* filling;
+    DWORD buffered;
+    DWORD lastFlushed;
+    size_t bufferSize;
+    int sparseFlushes;
+    uint64_t firstBuffered;
+    uint64_t readIssued;
+    uint64_t parkedAt;
+    DWORD reserved;
+    bool parked;
+
+    // Writer stage.
+    OutgoingFrame frame;
+    StreamCompressor compressor;
+    PooledBuffer compressed;
+    uint64_t sendIssued;
+    uint64_t generation;
+    bool closed;
+    // Under the link lock: the front chunk waits for an Interrupt answer
+    // that could not be posted yet.
+    bool heldForAnswer;
+
+    std::atomic<bool> readerWaiting;
+    std::atomic<bool> writerIdle;
+    // The reader has seen the end of the pipe; the writer closes the stream
+    // once the ring is empty.
+    std::atomic<bool> ended;
+    // Interrupts so far. A chunk tagged with an older count started filling
+    // before the latest one: the reader drops it instead of publishing it,
+    // or the writer instead of sending it.
+    std::atomic<uint32_t> interrupts;
+
+    OutputStream(Channel ch, IoHandler* owner, size_t depth, size_t initialBuffer)
+        : channel(ch),
+          readRequest(IoOperation::PipeRead, owner, this),
+          sendRequest(IoOperation::SocketWrite, owner, this),
+          ring(depth),
+          filling(nullptr),
+          buffered(0),
+          lastFlushed(0),
+          bufferSize(initialBuffer),
+          sparseFlushes(0),
+          firstBuffered(0),
+          readIssued(0),
+          parkedAt(0),
+          reserved(0),
+          parked(false),
+          sendIssued(0),
+          generation(0),
+          closed(false),
+          heldForAnswer(false),
+          readerWaiting(false),
+          writerIdle(true),
+          ended(false),
+          interrupts(0) {}
+};
+
+// One child session multiplexed over a Connection. All pipe I/O is
+// overlapped and completes on the shared EventLoop:
+//   queued Stdin frames -> stdin pipe write -> ...
+//   stdout pipe read -> ring -> Stdout frame send, reads running ahead
+//   stderr pipe read -> ring -> Stderr frame send, of sends by up to
+//                                                   relayDepth chunks
+// Output is bounded by a credit window the client replenishes with
+// WindowUpdate; when it runs out the stream parks and stops reading, so the
+// child blocks on its pipe instead of stalling other sessions. Parked
+// streams resume once the client has caught up to the low watermark. Stdin is
+// queued up to SESSION_WINDOW bytes and credits are returned as the child
+// consumes it, so the connection's reader never waits on a pipe.
+// The child's exit is reported by a ProcessSupervisor. Once the child has
+// exited and both output pipes are drained, an ExitStatus frame is sent and
+// the session finishes.
+//
+// A resumable session also copies every flushed block into its scrollback
+// ring and can outlive its connection: detach() leaves it running with
+// output going only to the ring, and attach() binds it to a new connection,
+// replays the ring from the client's offset and then goes back to sending
+// live. Each link to a connection has a generation; sends completing for an
+// older one are dropped, since the ring still holds their data.
+//
+// On a connection that negotiated FeatureScreen, flushed blocks go into a
+// ScreenModel instead of frames, and their credit is returned at once, so
+// the child never waits for the client. Screen updates are rendered from the
+// model and sent on their own request, one at a time and at most screenFps a
+// second; when one is due too early a timer posts it later, and whatever the
+// model went through in between is never sent. The ExitStatus follows the
+// final update, which does not wait for its turn.
+//
+// An Interrupt control overtakes everything queued for the session: stdin
+// not yet written and output read but not yet sent are dropped, their credit
+// handed back, and the answer goes out before the child is interrupted, so
+// the client can drop what it gets in between. The answer is posted on its
+// own request rather than behind the connection's control queue, and while
+// it waits for an earlier one to go out, output sends wait with it. The console control event is
+// raised on a thread-pool thread, since it takes a helper process, and not
+// on the Scheduler, where it would queue behind session starts.
+class ProcessHandler : public IoHandler {
+public:
+    typedef std::function<void(ProcessHandler*)> FinishedCallback;
+
+private:
+    EventLoop& m_loop;
+    const RelayOptions& m_options;
+    MetricsRegistry& m_registry;
+    ShellPool* m_pool;
+    SessionStore* m_store;
+    // Holds one of its session slots for as long as this session exists.
+    Scheduler& m_scheduler;
+    char m_logTag[LOG_TAG_SIZE];
+    // Command line of an Exec session; empty runs the configured shell.
+    std::string m_command;
+
+    // The connection the session is attached to, if any, and everything that
+    // goes with it. Recursive because a failing control send can stop the
+    // connection, which detaches this session on the same thread.
+    std::recursive_mutex m_linkMutex;
+    Connection* m_connection;
+    uint16_t m_sessionId;
+    FinishedCallback m_onFinished;
+    std::atomic<uint64_t> m_linkGeneration;
+    bool m_linkBroken;
+
+    // Resume state, also under m_linkMutex; m_token is 0 until enabled.
+    std::atomic<uint64_t> m_token;
+    std::unique_ptr<ScrollbackRing> m_ring;
+    uint64_t m_outputOffset;
+    bool m_replaying;
+    bool m_replayAnnounce;
+    bool m_replayParked;
+    uint64_t m_replayOffset;
+    uint64_t m_replayGeneration;
+    IoRequest m_replayWrite;
+    OutgoingFrame m_replayFrame;
+    PooledBuffer m_replayBuffer;
+    ResumePayload m_resumePayload;
+    uint64_t m_exitGeneration;
+    bool m_exitHeld;
+
+    // Screen state. Before the client's Hello the model is also fed the
+    // output being sent, up to SCREEN_PENDING_BYTES, so it is current should
+    // the client ask for screen updates; m_screenOn sends updates instead.
+    std::mutex m_screenMutex;
+    std::unique_ptr<ScreenModel> m_screen;
+    bool m_screenOn;
+    size_t m_screenPending;
+    // An update or its timer is outstanding.
+    bool m_screenBusy;
+    bool m_screenExitHeld;
+    uint64_t m_screenSentAt;
+    std::string m_screenPayload;
+    size_t m_screenOffset;
+    HANDLE m_screenTimer;
+    IoRequest m_screenTick;
+    IoRequest m_screenWrite;
+    OutgoingFrame m_screenFrame;
+
+    // Interrupt answers, under m_linkMutex: one is posted at a time and the
+    // kinds of the rest wait their turn.
+    bool m_answerBusy;
+    uint64_t m_answerGeneration;
+    std::deque<uint32_t> m_answersOwed;
+    ControlPayload m_answerPayload;
+    IoRequest m_answerWrite;
+    OutgoingFrame m_answerFrame;
+
+    // An interrupt is queued on the thread pool; a later one only updates
+    // the kind it raises.
+    std::atomic<bool> m_interruptQueued;
+    std::atomic<uint32_t> m_interruptKind;
+
+    Pipe m_stdinPipe;
+    OutputStream m_stdout;
+    OutputStream m_stderr;
+    PROCESS_INFORMATION m_processInfo;
+    ProcessSupervisor m_supervisor;
+    ProcessExitInfo m_exitInfo;
+
+    std::shared_ptr<SessionMetrics> m_metrics;
+    std::atomic<uint64_t> m_teardownStarted;
+
+    IoRequest m_startRequest;
+    IoRequest m_exitRequest;
+    IoRequest m_pipeWrite;
+    IoRequest m_exitWrite;
+
+    std::mutex m_inputMutex;
+    std::string m_inputQueue;
+    std::string m_inputWriting;
+    DWORD m_inputOffset;
+    bool m_inputBusy;
+    bool m_stdinClosed;
+    bool m_inputEnded;
+    uint32_t m_inputConsumed;
+
+    std::mutex m_creditMutex;
+    int64_t m_outputCredit;
+
+    OutgoingFrame m_exitFrame;
+    ExitStatusPayload m_exitPayload;
+
+    std::atomic<int> m_pending;
+    std::atomic<bool> m_exited;
+    std::atomic<int> m_exitStages;
+    std::atomic<bool> m_terminateRequested;
+    std::atomic<bool> m_closing;
+    std::atomic<bool> m_finished;
+    HANDLE m_finishedEvent;
+
+public:
+    ProcessHandler(EventLoop& loop, Connection& connection, uint16_t sessionId,
+                   FinishedCallback onFinished = nullptr);
+    ~ProcessHandler();
+
+    uint16_t sessionId() const { return m_sessionId; }
+    // Token a client can resume the session with, or 0 if it cannot be.
+    uint64_t token() const { return m_token; }
+
+    // Runs `command` instead of the shell, spawned directly rather than
+    // taken from the pool. Call before start().
+    void setCommand(const std::string& command) { m_command = command; }
+
+    bool createProcess();
+
+    bool start();
+    void stop();
+    void wait();
+
+    // Kills the child but keeps relaying, so the client still receives the
+    // remaining output and an ExitStatus frame.
+    void terminate();
+    bool isRunning() const { return !m_finished; }
+
+    // Called by the Connection for Stdin frames and WindowUpdate controls.
+    // queueInput returns false if the client overran its stdin window.
+    bool queueInput(const char* data, uint32_t length);
+    void grantOutput(uint32_t bytes);
+    // Closes the child's stdin after the input queued so far, for CloseStdin.
+    void endInput();
+
+    // Gives the session a scrollback ring and a token, announced to the
+    // client, if the store's budget allows.
+    void enableResume();
+    // Unbinds a resumable session from its stopping connection; returns
+    // false if it is not resumable or already stopping. `onFinished`
+    // replaces the connection's callback.
+    bool detach(FinishedCallback onFinished);
+    // Binds a detached session to `connection` as `sessionId` and replays
+    // the output after `offset`. Returns false if the session is stopping.
+    bool attach(Connection& connection, uint16_t sessionId, uint64_t offset, FinishedCallback onFinished);
+
+    // Called once the client's Hello has settled whether this session's
+    // output is sent as screen updates.
+    void enableScreen(bool on);
+    // WindowSize from the client: the screen takes its size and the next
+    // update repaints it all.
+    void resizeScreen(int columns, int rows);
+
+    // Interrupt from the client: drops the session's queued input and
+    // output, answers, and has the child sent the console control event.
+    void interrupt(InterruptKind kind);
+
+    void onCompletion(IoRequest* request, DWORD bytes, DWORD error) override;
+
+private:
+    void onStart();
+    void onProcessExit();
+
+    void writePipe();
+    void onPipeWrite(DWORD bytes, DWORD error);
+    // Closes stdin if input has ended and nothing is left to write;
+    // m_inputMutex must be held.
+    void closeEndedInput();
+
+    void readPipe(OutputStream& stream);
+    void onPipeRead(OutputStream& stream, DWORD bytes, DWORD error);
+    bool shouldCoalesce(OutputStream& stream);
+    void publishChunk(OutputStream& stream);
+    void endStream(OutputStream& stream);
+    void resizeBuffer(OutputStream& stream);
+    void sendChunks(OutputStream& stream);
+    bool sendChunk(OutputStream& stream, RelayChunk& chunk);
+    void sendStream(OutputStream& stream);
+    void onStreamSent(OutputStream& stream, DWORD bytes, DWORD error);
+    void releaseChunk(OutputStream& stream);
+    void onOutputClosed(OutputStream& stream);
+    bool isOutputDrained(OutputStream& stream);
+
+    void sendExitStatus();
+    void onExitStatusSent(DWORD bytes, DWORD error);
+
+    void sendReplay();
+    void onReplaySent(DWORD bytes, DWORD error);
+
+    // Runs output through the screen model; true if it is sent as screen
+    // updates rather than as it is.
+    bool feedScreen(const char* data, uint32_t length);
+    void scheduleScreen();
+    static void CALLBACK onScreenTimer(void* context, BOOLEAN fired);
+    void sendScreen();
+    void onScreenSent(DWORD bytes, DWORD error);
+    // Settles an update that is over, returning true if it was what the
+    // ExitStatus was waiting for.
+    bool endScreenUpdate();
+
+    // Posts the next owed answer, with m_linkMutex held; false if the send
+    // failed.
+    bool sendAnswer();
+    void onAnswerSent(DWORD bytes, DWORD error);
+    void resumeHeldStreams();
+    static DWORD WINAPI onInterruptWork(void* context);
+    void raiseInterrupt();
+    // Output read before an Interrupt and never sent: its credit comes back
+    // as if the client had returned it.
+    void dropOutput(uint32_t bytes);
+
+    // Link helpers. beginSend needs m_linkMutex held, an attached
+    // connection and a pending reference held by the caller.
+    void sendControl(ControlCode code, uint32_t value = 0);
+    bool beginSend(IoRequest& request, OutgoingFrame& frame);
+    void onSendFailed(DWORD error);
+    void resetCredit();
+
+    // Issues an overlapped operation, holding a pending reference for it.
+    template <typename Operation>
+    void issue(Operation operation, const char* what);
+
+    void beginTeardown();
+
+    void acquire() { ++m_pending; }
+    void release();
+    void finish();
+};
+
+#endif // HANDLER_HPP
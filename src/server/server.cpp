@@ -2,331 +2,282 @@
 
 #include "server.hpp"
 
-ProcessHandler::ProcessHandler(Socket clientSocket) 
-    : m_clientSocket(std::move(clientSocket)) {
-    ZeroMemory(&m_processInfo, sizeof(m_processInfo));
-    m_clientSocket.setBlocking(true);
+static bool loadAcceptEx(Listener& listener) {
+    GUID acceptExId = WSAID_ACCEPTEX;
+    DWORD returned = 0;
+    if (WSAIoctl(listener.socket.getHandle(), SIO_GET_EXTENSION_FUNCTION_POINTER, &acceptExId, sizeof(acceptExId),
+                 &listener.acceptEx, sizeof(listener.acceptEx), &returned, nullptr, nullptr) == SOCKET_ERROR) {
+        LOG_ERROR(nullptr, "Failed to load AcceptEx: " << WSAGetLastError());
+        return false;
+    }
+    return true;
 }
 
-ProcessHandler::~ProcessHandler() {
-    stop();
-    if (m_processInfo.hProcess) {
-        TerminateProcess(m_processInfo.hProcess, 0);
-        CloseHandle(m_processInfo.hProcess);
-        CloseHandle(m_processInfo.hThread);
+// Shard `index` of `shards` gets an even slice of the first `cores` cores,
+// or a single core, round robin, when there are more shards than cores.
+static DWORD_PTR shardAffinity(size_t index, size_t shards, size_t cores) {
+    if (shards >= cores) {
+        return (DWORD_PTR)1 << (index % cores);
     }
+    DWORD_PTR mask = 0;
+    for (size_t core = index * cores / shards; core < (index + 1) * cores / shards; ++core) {
+        mask |= (DWORD_PTR)1 << core;
+    }
+    return mask;
 }
 
-bool ProcessHandler::createProcess() {
-    std::cout << "Creating process for client..." << std::endl;
-    
-    if (!m_stdinPipe.create() || !m_stdoutPipe.create()) {
-        std::cerr << "Failed to create pipes" << std::endl;
-        return false;
+Server::Server(unsigned short port, size_t loopThreads, const RelayOptions& relayOptions,
+               const SchedulerOptions& schedulerOptions, size_t shards)
+    : m_running(false), m_loopThreads(loopThreads), m_shardCount(std::max<size_t>(shards, 1)),
+      m_relayOptions(relayOptions), m_scheduler(m_metrics.server(), schedulerOptions), m_nextShard(0),
+      m_store(m_metrics, relayOptions.scrollbackBudget, relayOptions.detachedTtlMs) {
+    m_reapEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    m_stopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        LOG_ERROR(nullptr, "WSAStartup failed");
+        return;
     }
     
-    STARTUPINFOA startupInfo;
-    ZeroMemory(&startupInfo, sizeof(startupInfo));
-    startupInfo.cb = sizeof(startupInfo);
-    startupInfo.dwFlags = STARTF_USESTDHANDLES;
-    startupInfo.hStdInput = m_stdinPipe.getReadHandle();
-    startupInfo.hStdOutput = m_stdoutPipe.getWriteHandle();
-    startupInfo.hStdError = m_stdoutPipe.getWriteHandle();
-    
-    PROCESS_INFORMATION processInfo;
-    ZeroMemory(&processInfo, sizeof(processInfo));
+    if (!m_listener.socket.create()) {
+        LOG_ERROR(nullptr, "Failed to create server socket");
+        return;
+    }
 
-    char cmdLine[] = "cmd.exe";
+    int reuse = 1;
+    if (setsockopt(m_listener.socket.getHandle(), SOL_SOCKET, SO_REUSEADDR, 
+                   (char*)&reuse, sizeof(reuse)) < 0) {
+        LOG_ERROR(nullptr, "setsockopt failed");
+    }
     
-    BOOL success = CreateProcessA(
-        nullptr,
-        cmdLine,
-        nullptr,
-        nullptr,
-        TRUE,
-        CREATE_NO_WINDOW,
-        nullptr,
-        nullptr,
-        &startupInfo,
-        &processInfo
-    );
+    if (!m_listener.socket.bind("0.0.0.0", port)) {
+        LOG_ERROR(nullptr, "Failed to bind server socket to port " << port);
+        return;
+    }
     
-    if (!success) {
-        std::cerr << "CreateProcess failed: " << GetLastError() << std::endl;
-        return false;
+    if (!m_listener.socket.listen()) {
+        LOG_ERROR(nullptr, "Failed to listen on server socket");
+        return;
+    }
+
+    if (!loadAcceptEx(m_listener)) {
+        m_listener.socket.close();
+        return;
     }
     
-    std::cout << "Process created successfully with PID: " << processInfo.dwProcessId << std::endl;
+    LOG_INFO(nullptr, "Server initialized successfully on port " << port);
+}
 
-    m_processInfo = processInfo;
+Server::~Server() {
+    LOG_INFO(nullptr, "Server destructor called");
+    stop();
+
+    closeListeners();
+    m_acceptLoop.stop();
+    for (auto& shard : m_shards) {
+        shard->stopLoop();
+    }
+    m_scheduler.stop();
 
-    m_stdinPipe.closeRead();
-    m_stdoutPipe.closeWrite();
+    CloseHandle(m_reapEvent);
+    CloseHandle(m_stopEvent);
     
-    return true;
+    WSACleanup();
+    LOG_INFO(nullptr, "Server cleanup completed");
 }
 
-void ProcessHandler::run() {
-    std::cout << "ProcessHandler started" << std::endl;
-    
-    if (!createProcess()) {
-        std::cerr << "Failed to create process, closing connection" << std::endl;
-        return;
+bool Server::startShards() {
+    std::vector<Listener*> listeners = { &m_listener };
+    if (m_pathListener) {
+        listeners.push_back(m_pathListener.get());
     }
-
-    if (!m_clientSocket.setBlocking(true)) {
-        std::cerr << "Failed to set blocking mode, but continuing..." << std::endl;
+    if (!m_acceptLoop.start(m_shardCount)) {
+        LOG_ERROR(nullptr, "Failed to start accept loop");
+        return false;
     }
-    
-    std::cout << "Starting data transfer threads..." << std::endl;
-
-    std::thread socketToPipeThread(&ProcessHandler::handleSocketToPipe, this);
-    std::thread pipeToSocketThread(&ProcessHandler::handlePipeToSocket, this);
-
-    while (isRunning()) {
-        DWORD exitCode;
-        if (GetExitCodeProcess(m_processInfo.hProcess, &exitCode)) {
-            if (exitCode != STILL_ACTIVE) {
-                std::cout << "Child process exited with code: " << exitCode << std::endl;
-                break;
-            }
-        } else {
-            std::cout << "GetExitCodeProcess failed, assuming process finished" << std::endl;
-            break;
+    for (Listener* listener : listeners) {
+        if (!m_acceptLoop.attach(listener->socket)) {
+            LOG_ERROR(nullptr, "Failed to attach listener to accept loop");
+            return false;
         }
+    }
 
-        if (!m_clientSocket.isValid()) {
-            std::cout << "Client socket is no longer valid" << std::endl;
-            break;
+    size_t cores = std::min<size_t>(std::max<size_t>(std::thread::hardware_concurrency(), 1),
+                                    sizeof(DWORD_PTR) * 8);
+    size_t threads = m_loopThreads ? m_loopThreads : std::thread::hardware_concurrency();
+    size_t perShard = std::max<size_t>(threads / m_shardCount, 1);
+
+    for (size_t i = 0; i < m_shardCount; ++i) {
+        // A single shard keeps the whole machine, as the one loop did.
+        DWORD_PTR affinity = m_shardCount > 1 ? shardAffinity(i, m_shardCount, cores) : 0;
+        auto shard = std::make_unique<AcceptShard>(i, listeners, m_relayOptions, m_metrics,
+                                                   m_pool.get(), &m_store, m_scheduler,
+                                                   [this] { SetEvent(m_reapEvent); });
+        if (!shard->start(perShard, affinity)) {
+            return false;
         }
-        
-        Sleep(100);
+        m_shards.push_back(std::move(shard));
     }
-    
-    std::cout << "Stopping ProcessHandler..." << std::endl;
-    stop();
 
-    if (m_processInfo.hProcess) {
-        TerminateProcess(m_processInfo.hProcess, 0);
-        WaitForSingleObject(m_processInfo.hProcess, 1000);
+    if (m_shmListener) {
+        m_shmListener->start();
     }
 
-    m_stdinPipe.close();
-    m_stdoutPipe.close();
-    m_clientSocket.close();
-    
-    if (socketToPipeThread.joinable()) {
-        socketToPipeThread.join();
-    }
-    if (pipeToSocketThread.joinable()) {
-        pipeToSocketThread.join();
-    }
+    LOG_INFO(nullptr, "Accepting on " << m_shardCount << " shards, " << perShard << " loop threads each");
+    return true;
+}
 
-    if (m_processInfo.hProcess) {
-        CloseHandle(m_processInfo.hProcess);
+void Server::run() {
+    if (!m_scheduler.isRunning() && !m_scheduler.start()) {
+        LOG_ERROR(nullptr, "Failed to start scheduler");
+        return;
     }
-    if (m_processInfo.hThread) {
-        CloseHandle(m_processInfo.hThread);
+    if (m_shards.empty() && !startShards()) {
+        LOG_ERROR(nullptr, "Failed to start acceptor shards");
+        return;
     }
-    
-    std::cout << "ProcessHandler stopped" << std::endl;
-}
 
-void ProcessHandler::handleSocketToPipe() {
-    std::cout << "Socket to pipe thread started" << std::endl;
-    char buffer[4096];
+    m_running = true;
+    LOG_INFO(nullptr, "Server started and waiting for connections...");
+
+    HANDLE waitHandles[] = { m_stopEvent, m_reapEvent };
     
-    while (isRunning() && m_clientSocket.isValid()) {
-        int bytesRead = m_clientSocket.recv(buffer, sizeof(buffer));
-        if (bytesRead > 0) {
-            std::cout << "Received " << bytesRead << " bytes from client" << std::endl;
-
-            DWORD bytesWritten = m_stdinPipe.write(buffer, bytesRead);
-            if (bytesWritten != bytesRead) {
-                std::cerr << "Failed to write all data to stdin pipe. Written: " 
-                         << bytesWritten << ", expected: " << bytesRead << std::endl;
-                break;
-            } else {
-                std::cout << "Written " << bytesWritten << " bytes to process stdin" << std::endl;
-            }
-
-        } else if (bytesRead == 0) {
-            std::cout << "Client disconnected (graceful shutdown)" << std::endl;
+    while (m_running) {
+        DWORD waitResult = WaitForMultipleObjects(2, waitHandles, FALSE, DETACHED_CHECK_MS);
+
+        if (waitResult == WAIT_OBJECT_0 || !m_running) {
             break;
+        } else if (waitResult == WAIT_TIMEOUT) {
+            m_store.expire();
+        } else if (waitResult == WAIT_OBJECT_0 + 1) {
+            reapFinished();
         } else {
-            int error = WSAGetLastError();
-            std::cerr << "Socket receive error in blocking mode: " << error << std::endl;
+            LOG_ERROR(nullptr, "WaitForMultipleObjects failed: " << GetLastError());
             break;
         }
+        for (auto& shard : m_shards) {
+            shard->retryAccepts();
+        }
     }
-    std::cout << "Socket to pipe thread finished" << std::endl;
+    
+    LOG_INFO(nullptr, "Server run loop ended");
 }
 
-void ProcessHandler::handlePipeToSocket() {
-    std::cout << "Pipe to socket thread started" << std::endl;
-    char buffer[4096];
-    
-    while (isRunning() && m_clientSocket.isValid()) {
-        DWORD bytesRead = m_stdoutPipe.read(buffer, sizeof(buffer));
-        if (bytesRead > 0) {
-            std::cout << "Read " << bytesRead << " bytes from process stdout" << std::endl;
-
-            int totalSent = 0;
-            while (totalSent < bytesRead && m_clientSocket.isValid()) {
-                int bytesSent = m_clientSocket.send(buffer + totalSent, bytesRead - totalSent);
-                if (bytesSent > 0) {
-                    totalSent += bytesSent;
-                    std::cout << "Sent " << bytesSent << " bytes to client (total: " << totalSent << "/" << bytesRead << ")" << std::endl;
-                } else if (bytesSent == 0) {
-                    std::cout << "Client disconnected during send" << std::endl;
-                    break;
-                } else {
-                    int error = WSAGetLastError();
-                    std::cerr << "Failed to send data to client, error: " << error << std::endl;
-                    break;
-                }
-            }
-            
-            if (totalSent != bytesRead) {
-                std::cerr << "Failed to send all data to client. Sent: " << totalSent << ", expected: " << bytesRead << std::endl;
-                break;
-            }
-        } else {
-            Sleep(10);
-        }
+void Server::reapFinished() {
+    for (auto& shard : m_shards) {
+        shard->reap();
     }
-    std::cout << "Pipe to socket thread finished" << std::endl;
 }
 
-void ProcessHandler::stop() {
-    std::cout << "Stopping ProcessHandler..." << std::endl;
+void Server::stop() {
+    LOG_INFO(nullptr, "Server stop initiated...");
+    m_running = false;
+    SetEvent(m_stopEvent);
 
-    m_clientSocket.close();
+    // Join the server thread before tearing sessions down.
+    Thread::stop();
 
-    if (m_processInfo.hProcess) {
-        TerminateProcess(m_processInfo.hProcess, 0);
+    if (m_shmListener) {
+        m_shmListener->stop();
     }
-    
-    Thread::stop();
-    std::cout << "ProcessHandler stopped" << std::endl;
-}
 
-Server::Server(unsigned short port) : m_running(false) {
-    WSADATA wsaData;
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        std::cerr << "WSAStartup failed" << std::endl;
-        return;
+    // Closing the listeners fails the outstanding accepts, and stopped
+    // shards do not post them again.
+    for (auto& shard : m_shards) {
+        shard->stopAccepting();
     }
-    
-    if (!m_serverSocket.create()) {
-        std::cerr << "Failed to create server socket" << std::endl;
-        return;
+    closeListeners();
+    for (auto& shard : m_shards) {
+        shard->waitAccepts();
     }
 
-    int reuse = 1;
-    if (setsockopt(m_serverSocket.getHandle(), SOL_SOCKET, SO_REUSEADDR, 
-                   (char*)&reuse, sizeof(reuse)) < 0) {
-        std::cerr << "setsockopt failed" << std::endl;
+    // Closed first so stopping connections end their sessions instead of
+    // detaching them.
+    m_store.close();
+
+    // Connections are only destroyed by reaping, so these pointers stay
+    // valid until the final reap below even if they finish in the meantime.
+    std::vector<Connection*> active;
+    for (auto& shard : m_shards) {
+        std::vector<Connection*> connections = shard->activeConnections();
+        active.insert(active.end(), connections.begin(), connections.end());
     }
-    
-    if (!m_serverSocket.bind("0.0.0.0", port)) {
-        std::cerr << "Failed to bind server socket to port " << port << std::endl;
-        return;
+    for (auto connection : active) {
+        connection->stop();
     }
-    
-    if (!m_serverSocket.listen()) {
-        std::cerr << "Failed to listen on server socket" << std::endl;
-        return;
+    for (auto connection : active) {
+        connection->wait();
     }
-    
-    std::cout << "Server initialized successfully on port " << port << std::endl;
-}
 
-Server::~Server() {
-    std::cout << "Server destructor called" << std::endl;
-    stop();
-
-    m_serverSocket.close();
+    reapFinished();
 
-    for (auto& handler : m_handlers) {
-        handler->stop();
+    if (m_metricsEndpoint) {
+        m_metricsEndpoint->stop();
+    }
+    if (m_pool) {
+        m_pool->stop();
     }
-    m_handlers.clear();
 
-    Sleep(100);
-    
-    WSACleanup();
-    std::cout << "Server cleanup completed" << std::endl;
+    LOG_INFO(nullptr, "Final metrics:\n" << m_metrics.renderText());
+    LOG_INFO(nullptr, "Server stop completed");
 }
 
-void Server::run() {
-    m_running = true;
-    std::cout << "Server started and waiting for connections..." << std::endl;
-
-    m_serverSocket.setBlocking(true);
-    
-    while (m_running) {
-        Socket clientSocket = m_serverSocket.accept();
-        
-        if (!m_running) {
-            if (clientSocket.isValid()) {
-                clientSocket.close();
-            }
-            break;
-        }
-        
-        if (clientSocket.isValid()) {
-            std::cout << "New client connected" << std::endl;
-
-            clientSocket.setBlocking(true);
-            
-            auto handler = std::make_unique<ProcessHandler>(std::move(clientSocket));
-            handler->start();
-            m_handlers.push_back(std::move(handler));
-        } else {
-            int error = WSAGetLastError();
-            if (error != WSAEWOULDBLOCK && m_running) {
-                std::cerr << "Accept failed: " << error << std::endl;
-            }
-            if (!m_running) {
-                break;
-            }
-        }
-
-        m_handlers.erase(
-            std::remove_if(m_handlers.begin(), m_handlers.end(),
-                [](const std::unique_ptr<ProcessHandler>& handler) {
-                    return !handler->isRunning();
-                }),
-            m_handlers.end()
-        );
-        
-        Sleep(100);
+bool Server::startMetrics(unsigned short port) {
+    m_metricsEndpoint = std::make_unique<MetricsEndpoint>(m_metrics);
+    if (!m_metricsEndpoint->listen(port)) {
+        m_metricsEndpoint.reset();
+        return false;
     }
-    
-    std::cout << "Server run loop ended" << std::endl;
+    return true;
 }
 
-void Server::stop() {
-    std::cout << "Server stop initiated..." << std::endl;
-    m_running = false;
+bool Server::listenPath(const std::string& path) {
+    auto listener = std::make_unique<Listener>();
+    if (!listener->socket.create(AF_UNIX, SOCK_STREAM, 0) || !listener->socket.bindPath(path) ||
+        !listener->socket.listen() || !loadAcceptEx(*listener)) {
+        LOG_ERROR(nullptr, "Failed to listen on " << path << ": " << WSAGetLastError());
+        return false;
+    }
+    listener->path = path;
+    m_pathListener = std::move(listener);
+    LOG_INFO(nullptr, "Listening on " << path);
+    return true;
+}
 
-    m_serverSocket.close();
+bool Server::listenShm(const std::string& name) {
+    auto listener = std::make_unique<ShmListener>(name, [this](std::unique_ptr<Transport> transport) {
+        m_shards[m_nextShard++ % m_shards.size()]->adopt(std::move(transport));
+    });
+    if (!listener->listen()) {
+        return false;
+    }
+    m_shmListener = std::move(listener);
+    return true;
+}
 
-    for (auto& handler : m_handlers) {
-        handler->stop();
+void Server::closeListeners() {
+    m_listener.socket.close();
+    if (m_pathListener && m_pathListener->socket.isValid()) {
+        m_pathListener->socket.close();
+        DeleteFileA(m_pathListener->path.c_str());
     }
-    m_handlers.clear();
+}
 
-    std::cout << "Server stop completed" << std::endl;
+void Server::startPool(const PoolOptions& options) {
+    if (options.size == 0) {
+        return;
+    }
+    m_pool = std::make_unique<ShellPool>(m_relayOptions.shell, options, m_metrics.server());
+    m_pool->start();
 }
 
 bool Server::initialize() {
-    if (!m_serverSocket.isValid()) {
-        std::cerr << "Server socket is not valid" << std::endl;
+    if (!m_listener.socket.isValid()) {
+        LOG_ERROR(nullptr, "Server socket is not valid");
         return false;
     }
     
-    std::cout << "Server initialized successfully on port " << PORT << std::endl;
+    LOG_INFO(nullptr, "Server initialized successfully on port " << PORT);
     return true;
 }
@@ -2,52 +2,92 @@
 #ifndef SERVER_HPP
 #define SERVER_HPP
 
-#include <map>
+#include <memory>
 
 #include "../utils.hpp"
 #include "../define.hpp"
+#include "../engine/engine.hpp"
+#include "../scheduler/scheduler.hpp"
+#include "connection.hpp"
+#include "shard.hpp"
+#include "store.hpp"
+#include "../transport/transport.hpp"
 
-class ProcessHandler : public Thread {
-private:
-    Socket m_clientSocket;
-    Pipe m_stdinPipe;
-    Pipe m_stdoutPipe;
-    PROCESS_INFORMATION m_processInfo;
-    
-public:
-    ProcessHandler(Socket clientSocket);
-    ~ProcessHandler();
-    
-    bool createProcess();
-    
-protected:
-    void run() override;
-    
-private:
-    void handlePipeToSocket();
-    void handleSocketToPipe();
-
-public:
-    void stop();
-};
-
+// Connections are accepted by AcceptShards, each with its own event loop and
+// connections; with more than one shard each is pinned to its own share of
+// the cores and gets its share of `loopThreads`. Windows has no
+// SO_REUSEPORT, so the shards share one listening socket and take turns
+// through AcceptEx calls queued on it. A connection past the Scheduler's
+// limit is told OpenStatus::Busy and closed right away, before anything is
+// allocated for it.
+//
+// The server's own thread sleeps in WaitForMultipleObjects and is woken by
+// a connection finishing or by stop(); it also wakes every
+// DETACHED_CHECK_MS to expire detached sessions.
+//
+// Besides TCP the server can listen on an AF_UNIX socket, accepted by the
+// shards like TCP, and for shared-memory connections, which a ShmListener
+// hands to the shards in turn.
 class Server : public Thread {
 private:
-    Socket m_serverSocket;
+    Listener m_listener;
+    std::unique_ptr<Listener> m_pathListener;
     std::atomic<bool> m_running;
-    std::vector<std::unique_ptr<ProcessHandler>> m_handlers;
-    
+    size_t m_loopThreads;
+    size_t m_shardCount;
+    RelayOptions m_relayOptions;
+    MetricsRegistry m_metrics;
+    Scheduler m_scheduler;
+    // Delivers accept completions; connections run on their shard's loop.
+    EventLoop m_acceptLoop;
+    // Declared before the store so detached sessions, which run on a
+    // shard's loop, are gone before the loops are.
+    std::vector<std::unique_ptr<AcceptShard>> m_shards;
+    std::unique_ptr<ShmListener> m_shmListener;
+    std::atomic<size_t> m_nextShard;
+    SessionStore m_store;
+    std::unique_ptr<MetricsEndpoint> m_metricsEndpoint;
+    std::unique_ptr<ShellPool> m_pool;
+
+    HANDLE m_reapEvent;
+    HANDLE m_stopEvent;
+
 public:
-    Server(unsigned short port = PORT);
+    Server(unsigned short port = PORT, size_t loopThreads = LOOP_THREADS,
+           const RelayOptions& relayOptions = RelayOptions(),
+           const SchedulerOptions& schedulerOptions = SchedulerOptions(),
+           size_t shards = ACCEPT_SHARDS);
     ~Server();
-    
+
     bool initialize();
-    
+
+    // Local listeners besides TCP; call before start().
+    bool listenPath(const std::string& path);
+    bool listenShm(const std::string& name);
+
+    MetricsRegistry& metrics() { return m_metrics; }
+
+    // Serves Prometheus-format metrics on a separate loopback port.
+    bool startMetrics(unsigned short port = METRICS_PORT);
+
+    // Keeps shells spawned ahead of connections; call before start().
+    void startPool(const PoolOptions& options = PoolOptions());
+    ShellPool* pool() { return m_pool.get(); }
+
+    SessionStore& store() { return m_store; }
+    Scheduler& scheduler() { return m_scheduler; }
+    size_t shardCount() const { return m_shardCount; }
+
 protected:
     void run() override;
-    
+
+private:
+    bool startShards();
+    void closeListeners();
+    void reapFinished();
+
 public:
     void stop();
 };
 
-#endif // SERVER_HPP
\ No newline at end of file
+#endif // SERVER_HPP
@@ -0,0 +1,231 @@
+#include "shard.hpp"
+
+AcceptShard::AcceptShard(size_t index, const std::vector<Listener*>& listeners, const RelayOptions& options,
+                         MetricsRegistry& metrics, ShellPool* pool, SessionStore* store, Scheduler& scheduler,
+                         FinishedCallback onFinished)
+    : m_index(index),
+      m_listeners(listeners),
+      m_options(options),
+      m_metrics(metrics),
+      m_pool(pool),
+      m_store(store),
+      m_scheduler(scheduler),
+      m_onFinished(std::move(onFinished)),
+      m_accepting(false),
+      m_pendingAccepts(0) {
+    m_acceptsDone = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+}
+
+AcceptShard::~AcceptShard() {
+    stopAccepting();
+    waitAccepts();
+    reap();
+    m_loop.stop();
+    CloseHandle(m_acceptsDone);
+}
+
+bool AcceptShard::start(size_t threads, DWORD_PTR affinity) {
+    if (!m_loop.start(threads, affinity)) {
+        LOG_ERROR(nullptr, "Failed to start event loop for shard " << m_index);
+        return false;
+    }
+
+    m_accepting = true;
+    for (Listener* listener : m_listeners) {
+        for (size_t i = 0; i < ACCEPT_BACKLOG; ++i) {
+            auto slot = std::make_unique<AcceptSlot>();
+            slot->request = IoRequest(IoOperation::Accept, this, slot.get());
+            slot->listener = listener;
+            if (!postAccept(*slot)) {
+                break;
+            }
+            m_slots.push_back(std::move(slot));
+        }
+    }
+    if (m_slots.empty()) {
+        m_accepting = false;
+        return false;
+    }
+
+    LOG_INFO(nullptr, "Shard " << m_index << " started with " << m_loop.threadCount() << " threads, "
+             << m_slots.size() << " accepts posted");
+    return true;
+}
+
+void AcceptShard::stopAccepting() {
+    m_accepting = false;
+}
+
+void AcceptShard::waitAccepts() {
+    if (m_pendingAccepts > 0) {
+        WaitForSingleObject(m_acceptsDone, INFINITE);
+    }
+}
+
+void AcceptShard::retryAccepts() {
+    std::vector<AcceptSlot*> slots;
+    {
+        std::lock_guard<std::mutex> lock(m_idleMutex);
+        slots.swap(m_idleSlots);
+    }
+    for (size_t i = 0; i < slots.size(); ++i) {
+        if (!m_accepting || !postAccept(*slots[i])) {
+            // Kept for the next retry; postAccept has logged why.
+            std::lock_guard<std::mutex> lock(m_idleMutex);
+            m_idleSlots.insert(m_idleSlots.end(), slots.begin() + i, slots.end());
+            return;
+        }
+    }
+}
+
+void AcceptShard::stopLoop() {
+    m_loop.stop();
+}
+
+bool AcceptShard::postAccept(AcceptSlot& slot) {
+    int family = slot.listener->socket.family();
+    if (!slot.socket.create(family, SOCK_STREAM, family == AF_UNIX ? 0 : IPPROTO_TCP)) {
+        LOG_ERROR(nullptr, "Failed to create accept socket: " << WSAGetLastError());
+        return false;
+    }
+    slot.request.reset();
+
+    DWORD addressLength = (DWORD)(family == AF_UNIX ? sizeof(sockaddr_un) : sizeof(sockaddr_in)) + 16;
+    ++m_pendingAccepts;
+    DWORD received = 0;
+    if (!slot.listener->acceptEx(slot.listener->socket.getHandle(), slot.socket.getHandle(), slot.addresses, 0,
+                                 addressLength, addressLength, &received, &slot.request)) {
+        int error = WSAGetLastError();
+        if (error != ERROR_IO_PENDING) {
+            --m_pendingAccepts;
+            slot.socket.close();
+            if (m_accepting) {
+                LOG_ERROR(nullptr, "AcceptEx failed: " << error);
+            }
+            return false;
+        }
+    }
+    // Completes through the listener's port even when it succeeded at once.
+    return true;
+}
+
+void AcceptShard::onCompletion(IoRequest* request, DWORD, DWORD error) {
+    if (request->operation != IoOperation::Accept) {
+        return;
+    }
+    AcceptSlot& slot = *static_cast<AcceptSlot*>(request->context);
+    onAccepted(slot, error);
+
+    // Re-posted before the count drops, so the count reaching zero after
+    // stopAccepting() means nothing is outstanding any more.
+    if (m_accepting && !postAccept(slot)) {
+        ++m_metrics.server().acceptRetries;
+        LOG_WARN(nullptr, "Shard " << m_index << " could not post an accept again, retrying later");
+        std::lock_guard<std::mutex> lock(m_idleMutex);
+        m_idleSlots.push_back(&slot);
+    }
+    if (--m_pendingAccepts == 0 && !m_accepting) {
+        SetEvent(m_acceptsDone);
+    }
+}
+
+void AcceptShard::onAccepted(AcceptSlot& slot, DWORD error) {
+    Socket clientSocket = std::move(slot.socket);
+    if (error != NO_ERROR) {
+        // The listener closing fails every outstanding accept.
+        if (m_accepting) {
+            LOG_ERROR(nullptr, "Accept failed: " << error);
+        }
+        return;
+    }
+    if (!m_accepting) {
+        return;
+    }
+
+    // Until this the socket knows nothing of the listener's options.
+    SOCKET listener = slot.listener->socket.getHandle();
+    if (setsockopt(clientSocket.getHandle(), SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, (char*)&listener,
+                   sizeof(listener)) == SOCKET_ERROR) {
+        LOG_ERROR(nullptr, "SO_UPDATE_ACCEPT_CONTEXT failed: " << WSAGetLastError());
+        return;
+    }
+
+    adopt(std::make_unique<Socket>(std::move(clientSocket)));
+}
+
+void AcceptShard::adopt(std::unique_ptr<Transport> transport) {
+    if (!m_accepting) {
+        return;
+    }
+
+    LOG_INFO(nullptr, "New client connected on shard " << m_index);
+    m_metrics.server().accepts.fetch_add(1, std::memory_order_relaxed);
+
+    if (!m_scheduler.admitConnection()) {
+        refuse(*transport);
+        return;
+    }
+
+    auto connection = std::make_unique<Connection>(
+        m_loop, std::move(transport), m_options, m_metrics, m_pool, m_store, m_scheduler,
+        [this](Connection* finished) { onConnectionFinished(finished); });
+    Connection* key = connection.get();
+
+    {
+        std::lock_guard<std::mutex> lock(m_connectionsMutex);
+        m_connections[key] = std::move(connection);
+    }
+
+    // On failure the connection finishes and is queued for reaping.
+    key->start();
+}
+
+// The refusal goes out in the clear as the only frame, before the client's
+// Hello has been read; a frame this small always fits the send buffer.
+// Whatever the client already sent is drained, without blocking the accept
+// thread, so closing does not reset the connection and lose the refusal.
+void AcceptShard::refuse(Transport& transport) {
+    LOG_WARN(nullptr, "Connection limit reached, refusing client");
+    ControlPayload payload;
+    encodeControl(payload, ControlCode::SessionOpened, (uint32_t)OpenStatus::Busy);
+    sendFrame(transport, Channel::Control, &payload, sizeof(payload));
+    transport.shutdown(SD_SEND);
+
+    transport.setBlocking(false);
+    char drain[256];
+    while (transport.recv(drain, sizeof(drain)) > 0) {
+    }
+    transport.close();
+}
+
+void AcceptShard::onConnectionFinished(Connection* connection) {
+    {
+        std::lock_guard<std::mutex> lock(m_connectionsMutex);
+        auto it = m_connections.find(connection);
+        if (it == m_connections.end()) {
+            return;
+        }
+        m_finishedConnections.push_back(std::move(it->second));
+        m_connections.erase(it);
+    }
+    m_scheduler.releaseConnection();
+    m_onFinished();
+}
+
+std::vector<Connection*> AcceptShard::activeConnections() {
+    std::vector<Connection*> active;
+    std::lock_guard<std::mutex> lock(m_connectionsMutex);
+    for (auto& entry : m_connections) {
+        active.push_back(entry.first);
+    }
+    return active;
+}
+
+void AcceptShard::reap() {
+    std::vector<std::unique_ptr<Connection>> finished;
+    {
+        std::lock_guard<std::mutex> lock(m_connectionsMutex);
+        finished.swap(m_finishedConnections);
+    }
+    // Destroyed outside the lock; each connection has already set its event.
+}
@@ -0,0 +1,114 @@
+#pragma once
+#ifndef SHARD_HPP
+#define SHARD_HPP
+
+#include <functional>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+
+#include <mswsock.h>
+#include <afunix.h>
+
+#include "../utils.hpp"
+#include "../define.hpp"
+#include "../engine/engine.hpp"
+#include "../scheduler/scheduler.hpp"
+#include "connection.hpp"
+#include "store.hpp"
+
+// A listening socket, TCP or AF_UNIX, with the AcceptEx of its provider,
+// which is not the same for the two.
+struct Listener {
+    Socket socket;
+    LPFN_ACCEPTEX acceptEx;
+    // The socket file of an AF_UNIX listener, removed when it closes.
+    std::string path;
+
+    Listener() : acceptEx(nullptr) {}
+};
+
+// One acceptor shard: an EventLoop of its own, optionally pinned to a set of
+// cores, and the connections it accepted. All shards share the listening
+// sockets; each keeps ACCEPT_BACKLOG AcceptEx calls outstanding on every
+// one, and a connection lives on the loop of the shard whose call took it,
+// so accepts and session I/O are spread over the shards instead of
+// funnelling through one thread. Completions of the accepts themselves
+// arrive on the loop the listeners are attached to, which the Server owns.
+// Connections accepted elsewhere, such as over shared memory, are handed
+// in through adopt().
+class AcceptShard : public IoHandler {
+public:
+    typedef std::function<void()> FinishedCallback;
+
+private:
+    struct AcceptSlot {
+        IoRequest request;
+        Listener* listener;
+        Socket socket;
+        // AcceptEx wants room for both addresses plus 16 bytes each.
+        char addresses[2 * (sizeof(sockaddr_un) + 16)];
+    };
+
+    size_t m_index;
+    std::vector<Listener*> m_listeners;
+    EventLoop m_loop;
+    const RelayOptions& m_options;
+    MetricsRegistry& m_metrics;
+    ShellPool* m_pool;
+    SessionStore* m_store;
+    Scheduler& m_scheduler;
+    FinishedCallback m_onFinished;
+
+    std::vector<std::unique_ptr<AcceptSlot>> m_slots;
+    std::atomic<bool> m_accepting;
+    // AcceptEx calls posted and not yet completed; once accepting stops the
+    // event is set when the last one has come back.
+    std::atomic<size_t> m_pendingAccepts;
+    HANDLE m_acceptsDone;
+    // Slots whose accept could not be posted again, for retryAccepts().
+    std::mutex m_idleMutex;
+    std::vector<AcceptSlot*> m_idleSlots;
+
+    std::mutex m_connectionsMutex;
+    std::unordered_map<Connection*, std::unique_ptr<Connection>> m_connections;
+    std::vector<std::unique_ptr<Connection>> m_finishedConnections;
+
+public:
+    AcceptShard(size_t index, const std::vector<Listener*>& listeners, const RelayOptions& options,
+                MetricsRegistry& metrics, ShellPool* pool, SessionStore* store, Scheduler& scheduler,
+                FinishedCallback onFinished);
+    ~AcceptShard();
+
+    AcceptShard(const AcceptShard&) = delete;
+    AcceptShard& operator=(const AcceptShard&) = delete;
+
+    // Starts the shard's loop and posts its accepts.
+    bool start(size_t threads, DWORD_PTR affinity);
+    // Takes on a connection accepted by other means, or refuses it.
+    void adopt(std::unique_ptr<Transport> transport);
+    // Stops re-posting accepts; waitAccepts() returns once the listeners
+    // have been closed and every outstanding accept has completed.
+    void stopAccepting();
+    void waitAccepts();
+    // Posts again the accepts that failed to be re-posted when they
+    // completed, so the shard never runs out of them; the Server calls it
+    // from its run loop.
+    void retryAccepts();
+    void stopLoop();
+
+    // Connections are only destroyed by reap(), so the pointers stay valid
+    // until then even if they finish in the meantime.
+    std::vector<Connection*> activeConnections();
+    void reap();
+
+    void onCompletion(IoRequest* request, DWORD bytes, DWORD error) override;
+
+private:
+    bool postAccept(AcceptSlot& slot);
+    void onAccepted(AcceptSlot& slot, DWORD error);
+    void refuse(Transport& transport);
+    void onConnectionFinished(Connection* connection);
+};
+
+#endif // SHARD_HPP
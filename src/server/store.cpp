@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <cstring>
+
+#include "store.hpp"
+#include "handler.hpp"
+
+#include <ntsecapi.h>
+
+ScrollbackRing::ScrollbackRing(size_t capacity, uint64_t offset)
+    : m_buffer(std::max<size_t>(capacity, RECORD_HEADER + 1)),
+      m_head(0),
+      m_used(0),
+      m_startOffset(offset),
+      m_endOffset(offset) {}
+
+void ScrollbackRing::append(Channel channel, const char* data, size_t length) {
+    if (length == 0) {
+        return;
+    }
+
+    // A block bigger than the whole ring only keeps its tail.
+    size_t keep = std::min(length, m_buffer.size() - RECORD_HEADER);
+    while (m_used + RECORD_HEADER + keep > m_buffer.size()) {
+        evictOldest();
+    }
+    if (keep < length) {
+        m_endOffset += length - keep;
+        m_startOffset = m_endOffset;
+    }
+
+    char header[RECORD_HEADER];
+    uint32_t size = (uint32_t)keep;
+    header[0] = (char)channel;
+    memcpy(header + 1, &size, sizeof(size));
+
+    size_t tail = (m_head + m_used) % m_buffer.size();
+    copyIn(tail, header, RECORD_HEADER);
+    copyIn((tail + RECORD_HEADER) % m_buffer.size(), data + (length - keep), keep);
+    m_used += RECORD_HEADER + keep;
+    m_endOffset += keep;
+}
+
+size_t ScrollbackRing::read(uint64_t& offset, Channel& channel, char* out, size_t capacity) {
+    offset = std::max(offset, m_startOffset);
+
+    size_t position = m_head;
+    size_t remaining = m_used;
+    uint64_t recordStart = m_startOffset;
+    size_t copied = 0;
+
+    while (remaining > 0 && copied < capacity) {
+        char header[RECORD_HEADER];
+        uint32_t size;
+        copyOut(position, header, RECORD_HEADER);
+        memcpy(&size, header + 1, sizeof(size));
+
+        uint64_t recordEnd = recordStart + size;
+        if (offset < recordEnd) {
+            if (copied == 0) {
+                channel = (Channel)header[0];
+            } else if ((Channel)header[0] != channel) {
+                break;
+            }
+
+            size_t skip = (size_t)(offset - recordStart);
+            size_t length = std::min<size_t>(size - skip, capacity - copied);
+            copyOut((position + RECORD_HEADER + skip) % m_buffer.size(), out + copied, length);
+            copied += length;
+            offset += length;
+        }
+
+        position = (position + RECORD_HEADER + size) % m_buffer.size();
+        remaining -= RECORD_HEADER + size;
+        recordStart = recordEnd;
+    }
+    return copied;
+}
+
+void ScrollbackRing::evictOldest() {
+    char header[RECORD_HEADER];
+    uint32_t size;
+    copyOut(m_head, header, RECORD_HEADER);
+    memcpy(&size, header + 1, sizeof(size));
+
+    m_head = (m_head + RECORD_HEADER + size) % m_buffer.size();
+    m_used -= RECORD_HEADER + size;
+    m_startOffset += size;
+}
+
+void ScrollbackRing::copyIn(size_t position, const void* data, size_t length) {
+    size_t first = std::min(length, m_buffer.size() - position);
+    memcpy(&m_buffer[position], data, first);
+    memcpy(&m_buffer[0], (const char*)data + first, length - first);
+}
+
+void ScrollbackRing::copyOut(size_t position, void* data, size_t length) const {
+    size_t first = std::min(length, m_buffer.size() - position);
+    memcpy(data, &m_buffer[position], first);
+    memcpy((char*)data + first, &m_buffer[0], length - first);
+}
+
+SessionStore::SessionStore(MetricsRegistry& metrics, size_t budget, uint32_t ttlMs)
+    : m_metrics(metrics),
+      m_budget(budget),
+      m_ttlMs(ttlMs),
+      m_reserved(0),
+      m_closed(false) {}
+
+SessionStore::~SessionStore() {
+    close();
+}
+
+bool SessionStore::reserve(size_t bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_closed || m_reserved + bytes > m_budget) {
+        return false;
+    }
+    m_reserved += bytes;
+    m_metrics.server().scrollbackBytes += bytes;
+    return true;
+}
+
+void SessionStore::unreserve(size_t bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_reserved -= bytes;
+    m_metrics.server().scrollbackBytes -= bytes;
+}
+
+uint64_t SessionStore::newToken() {
+    // The token is all a client needs to take over a session, so it comes
+    // from the system CSPRNG rather than a counter.
+    uint64_t token = 0;
+    while (token == 0) {
+        if (!RtlGenRandom(&token, sizeof(token))) {
+            LOG_ERROR(nullptr, "RtlGenRandom failed: " << GetLastError());
+            return 0;
+        }
+    }
+    return token;
+}
+
+bool SessionStore::detach(const std::shared_ptr<ProcessHandler>& session) {
+    uint64_t token = session->token();
+    if (token == 0) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_closed) {
+            return false;
+        }
+        m_detached[token] = DetachedSession{ session, monotonicMicros() };
+    }
+
+    // Registered first, so a session finishing right after the switch is
+    // already found by onSessionFinished.
+    if (!session->detach([this](ProcessHandler* finished) { onSessionFinished(finished); })) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_detached.erase(token);
+        return false;
+    }
+
+    ++m_metrics.server().sessionsDetached;
+    ++m_metrics.server().detachedSessions;
+    return true;
+}
+
+std::shared_ptr<ProcessHandler> SessionStore::claim(uint64_t token) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_detached.find(token);
+    if (it == m_detached.end()) {
+        return nullptr;
+    }
+
+    std::shared_ptr<ProcessHandler> session = std::move(it->second.session);
+    m_detached.erase(it);
+    --m_metrics.server().detachedSessions;
+    return session;
+}
+
+void SessionStore::retire(const std::shared_ptr<ProcessHandler>& session) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_finished.push_back(session);
+}
+
+void SessionStore::onSessionFinished(ProcessHandler* session) {
+    // Still inside the session's finish(), so it is only moved aside here
+    // and released by the next expire().
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_detached.find(session->token());
+    if (it != m_detached.end() && it->second.session.get() == session) {
+        m_finished.push_back(std::move(it->second.session));
+        m_detached.erase(it);
+        --m_metrics.server().detachedSessions;
+    }
+}
+
+void SessionStore::expire() {
+    std::vector<std::shared_ptr<ProcessHandler>> expired;
+    uint64_t now = monotonicMicros();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_detached.begin(); it != m_detached.end();) {
+            if (now - it->second.since >= (uint64_t)m_ttlMs * 1000) {
+                expired.push_back(it->second.session);
+                m_finished.push_back(std::move(it->second.session));
+                it = m_detached.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    for (auto& session : expired) {
+        LOG_INFO(nullptr, "Detached session " << session->sessionId() << " expired");
+        --m_metrics.server().detachedSessions;
+        ++m_metrics.server().sessionsExpired;
+        session->stop();
+    }
+
+    reap();
+}
+
+void SessionStore::reap() {
+    std::vector<std::shared_ptr<ProcessHandler>> done;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto running = std::partition(m_finished.begin(), m_finished.end(),
+                                      [](const std::shared_ptr<ProcessHandler>& session) {
+                                          return session->isRunning();
+                                      });
+        done.assign(std::make_move_iterator(running), std::make_move_iterator(m_finished.end()));
+        m_finished.erase(running, m_finished.end());
+    }
+
+    for (auto& session : done) {
+        session->wait();
+        session.reset();
+        --m_metrics.server().activeSessions;
+    }
+}
+
+void SessionStore::close() {
+    std::vector<std::shared_ptr<ProcessHandler>> sessions;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        for (auto& entry : m_detached) {
+            m_finished.push_back(std::move(entry.second.session));
+        }
+        m_metrics.server().detachedSessions -= m_detached.size();
+        m_detached.clear();
+        sessions = m_finished;
+    }
+
+    for (auto& session : sessions) {
+        session->stop();
+    }
+    for (auto& session : sessions) {
+        session->wait();
+    }
+    sessions.clear();
+    reap();
+}
+
+size_t SessionStore::detachedCount() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_detached.size();
+}
@@ -0,0 +1,116 @@
+#pragma once
+#ifndef STORE_HPP
+#define STORE_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "../utils.hpp"
+#include "../define.hpp"
+#include "../protocol/protocol.hpp"
+#include "../metrics/metrics.hpp"
+
+class ProcessHandler;
+
+// The most recent output of a resumable session, kept as (channel, bytes)
+// records in a fixed circular buffer so a reattaching client can be sent
+// what it missed in the original order. Offsets count output bytes since
+// the session started, the same way the client counts what it received;
+// the oldest records are dropped to make room. Not thread-safe: the
+// session serializes access.
+class ScrollbackRing {
+private:
+    static const size_t RECORD_HEADER = 5;
+
+    std::vector<char> m_buffer;
+    size_t m_head;
+    size_t m_used;
+    uint64_t m_startOffset;
+    uint64_t m_endOffset;
+
+public:
+    // `offset` is the session's output count when the ring starts recording.
+    ScrollbackRing(size_t capacity, uint64_t offset);
+
+    void append(Channel channel, const char* data, size_t length);
+
+    // Copies output from `offset` on, as long as it stays on one channel,
+    // into `out` and advances `offset` past it. An offset older than the
+    // ring is first moved up to startOffset(). Returns 0 once caught up.
+    size_t read(uint64_t& offset, Channel& channel, char* out, size_t capacity);
+
+    uint64_t startOffset() const { return m_startOffset; }
+    uint64_t endOffset() const { return m_endOffset; }
+    size_t capacity() const { return m_buffer.size(); }
+
+private:
+    void evictOldest();
+    void copyIn(size_t position, const void* data, size_t length);
+    void copyOut(size_t position, void* data, size_t length) const;
+};
+
+// Server-wide owner of sessions whose connection has gone away. A
+// disconnecting Connection hands its resumable sessions over; they keep
+// running and recording output until a client claims one by token or it
+// has been detached longer than the configured lifetime. The store also
+// accounts the scrollback memory of every resumable session, attached or
+// not, against a global budget.
+class SessionStore {
+private:
+    struct DetachedSession {
+        std::shared_ptr<ProcessHandler> session;
+        uint64_t since;
+    };
+
+    MetricsRegistry& m_metrics;
+    size_t m_budget;
+    uint32_t m_ttlMs;
+
+    std::mutex m_mutex;
+    std::unordered_map<uint64_t, DetachedSession> m_detached;
+    std::vector<std::shared_ptr<ProcessHandler>> m_finished;
+    size_t m_reserved;
+    bool m_closed;
+
+public:
+    SessionStore(MetricsRegistry& metrics, size_t budget = SCROLLBACK_BUDGET, uint32_t ttlMs = DETACHED_TTL_MS);
+    ~SessionStore();
+
+    // Scrollback memory for one session; false once the budget is used up.
+    bool reserve(size_t bytes);
+    void unreserve(size_t bytes);
+
+    // A fresh unguessable session token, never 0.
+    uint64_t newToken();
+
+    // Takes over a session whose connection is stopping. Returns false if
+    // the session cannot be detached (not resumable, already stopping) or
+    // the store is closed; the caller then stops it as usual.
+    bool detach(const std::shared_ptr<ProcessHandler>& session);
+
+    // Removes and returns the detached session with `token`, or nullptr.
+    std::shared_ptr<ProcessHandler> claim(uint64_t token);
+
+    // Takes back a claimed session that could not be attached because it
+    // was already finishing.
+    void retire(const std::shared_ptr<ProcessHandler>& session);
+
+    // Stops sessions detached for longer than the lifetime and releases
+    // finished ones. Called periodically by the server.
+    void expire();
+
+    // Stops every detached session and refuses new ones.
+    void close();
+
+    size_t detachedCount();
+
+private:
+    void onSessionFinished(ProcessHandler* session);
+    void reap();
+};
+
+#endif // STORE_HPP
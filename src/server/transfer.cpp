@@ -0,0 +1,398 @@
+#include <algorithm>
+#include <cstring>
+
+#include "transfer.hpp"
+#include "connection.hpp"
+
+FileTransfer::FileTransfer(EventLoop& loop, Connection& connection, uint16_t id, FinishedCallback onFinished)
+    : m_loop(loop),
+      m_connection(connection),
+      m_metrics(connection.metrics().server()),
+      m_id(id),
+      m_direction(FileOp::Get),
+      m_onFinished(std::move(onFinished)),
+      m_file(INVALID_HANDLE_VALUE),
+      // A window's worth of full chunks, plus a short first and last one.
+      m_chunks(FILE_PIPELINE + 1),
+      m_size(0),
+      m_next(0),
+      m_complete(0),
+      m_credit(FILE_WINDOW),
+      m_done(false),
+      m_pending(0),
+      m_closing(false),
+      m_finished(false) {
+    m_finishedEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    snprintf(m_logTag, sizeof(m_logTag), "c%u.f%u", connection.id(), (unsigned)id);
+    for (auto& chunk : m_chunks) {
+        chunk.request.handler = this;
+        chunk.request.context = &chunk;
+    }
+    ++m_metrics.activeTransfers;
+}
+
+FileTransfer::~FileTransfer() {
+    stop();
+    wait();
+    if (m_finishedEvent) {
+        CloseHandle(m_finishedEvent);
+    }
+}
+
+void FileTransfer::startGet(const std::string& path, uint64_t offset) {
+    acquire();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_direction = FileOp::Get;
+        for (auto& chunk : m_chunks) {
+            chunk.request.operation = IoOperation::SocketWrite;
+        }
+
+        if (!m_source.open(path)) {
+            DWORD error = GetLastError();
+            LOG_WARN(m_logTag, "Cannot open " << path << " for reading: " << error);
+            fail(fileStatusFromError(error));
+        } else {
+            m_size = m_source.size();
+            m_next = m_complete = std::min(offset, m_size);
+            LOG_INFO(m_logTag, "Sending " << path << " from " << m_next << " of " << m_size << " bytes");
+            m_connection.sendFile(m_id, FileOp::Ready, 0, m_next, m_size);
+            sendChunks();
+        }
+    }
+    release();
+}
+
+void FileTransfer::startPut(const std::string& path, uint64_t size, bool resume) {
+    acquire();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_direction = FileOp::Put;
+        m_size = size;
+        for (auto& chunk : m_chunks) {
+            chunk.request.operation = IoOperation::FileWrite;
+        }
+
+        createParentDirectories(path);
+        m_file = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                             resume ? OPEN_ALWAYS : CREATE_ALWAYS,
+                             FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, nullptr);
+        LARGE_INTEGER existing;
+        existing.QuadPart = 0;
+
+        if (m_file == INVALID_HANDLE_VALUE) {
+            DWORD error = GetLastError();
+            LOG_WARN(m_logTag, "Cannot open " << path << " for writing: " << error);
+            fail(fileStatusFromError(error));
+        } else if (!m_loop.attach(m_file)) {
+            fail(FileStatus::Failed);
+        } else if (resume && !GetFileSizeEx(m_file, &existing)) {
+            fail(FileStatus::Failed, GetLastError());
+        } else {
+            // Anything past the requested size is from some other file.
+            uint64_t start = std::min((uint64_t)existing.QuadPart, size);
+            if (!truncateFile(m_file, start)) {
+                fail(FileStatus::Failed, GetLastError());
+            } else {
+                m_next = m_complete = start;
+                LOG_INFO(m_logTag, "Receiving " << path << " from " << start << " of " << size << " bytes");
+                m_connection.sendFile(m_id, FileOp::Ready, 0, start, size);
+                if (start == size) {
+                    complete();
+                }
+            }
+        }
+    }
+    release();
+}
+
+void FileTransfer::sendChunks() {
+    while (!m_closing && !m_done && m_next < m_size) {
+        uint32_t length = fileChunkAt(m_next, m_size);
+        Chunk* chunk = freeChunk();
+        if (!chunk || m_credit < (int64_t)length) {
+            return;
+        }
+
+        const char* data = m_source.acquire(m_next, length);
+        if (!data) {
+            fail(FileStatus::Failed);
+            return;
+        }
+
+        // The mapped view is read-only, so an encrypted record is written to
+        // a buffer of its own as it is encrypted.
+        char* sealed = nullptr;
+        if (m_connection.features() & FeatureEncryption) {
+            chunk->buffer = BufferPool::shared().acquire(sizeof(chunk->payload) + length);
+            sealed = chunk->buffer.data();
+        }
+
+        encodeFile(chunk->payload, FileOp::Data, adler32(data, length), m_next);
+        chunk->frame.prepare(Channel::File, &chunk->payload, sizeof(chunk->payload), data, length, 0, m_id);
+        chunk->offset = m_next;
+        chunk->length = length;
+        chunk->busy = true;
+        chunk->request.reset();
+        m_next += length;
+        m_credit -= length;
+
+        acquire();
+        if (!m_connection.send(chunk->frame, chunk->request, sealed)) {
+            if (!m_closing) {
+                LOG_ERROR(m_logTag, "File data send failed: " << WSAGetLastError());
+            }
+            chunk->busy = false;
+            chunk->buffer.reset();
+            m_source.release(chunk->offset);
+            fail(FileStatus::Failed);
+            release();
+            return;
+        }
+    }
+
+    // Done goes out once every chunk has left, so it arrives after them.
+    if (!m_closing && m_next == m_size &&
+        std::none_of(m_chunks.begin(), m_chunks.end(), [](const Chunk& chunk) { return chunk.busy; })) {
+        complete();
+    }
+}
+
+void FileTransfer::onChunkSent(Chunk& chunk, DWORD bytes, DWORD error) {
+    if (error == NO_ERROR && bytes > 0 && !chunk.frame.advance(bytes) && !m_closing) {
+        // Partial send: the rest of the frame goes out before anything else
+        // of this transfer.
+        acquire();
+        chunk.request.reset();
+        if (m_connection.send(chunk.frame, chunk.request)) {
+            return;
+        }
+        error = WSAGetLastError();
+        release();
+    }
+
+    chunk.busy = false;
+    chunk.buffer.reset();
+    m_source.release(chunk.offset);
+
+    if (error != NO_ERROR || bytes == 0) {
+        if (!m_closing) {
+            LOG_ERROR(m_logTag, "File data send error: " << error);
+        }
+        fail(FileStatus::Failed);
+        return;
+    }
+
+    m_metrics.fileBytesSent += chunk.length;
+    sendChunks();
+}
+
+void FileTransfer::receive(const FileMessage& message) {
+    acquire();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_direction != FileOp::Put || m_closing || m_done) {
+            // Data still in flight for a transfer that already ended.
+        } else if (message.offset != m_next || message.length == 0 || message.length > m_size - m_next) {
+            LOG_WARN(m_logTag, "Unexpected data at " << message.offset << ", expected " << m_next);
+            fail(FileStatus::Failed);
+        } else if (adler32(message.data, message.length) != message.value) {
+            ++m_metrics.checksumFailures;
+            LOG_WARN(m_logTag, "Checksum mismatch at " << message.offset);
+            fail(FileStatus::Checksum);
+        } else {
+            Chunk* chunk = freeChunk();
+            if (!chunk) {
+                LOG_WARN(m_logTag, "Client overran its file window");
+                fail(FileStatus::Limit);
+            } else {
+                // The frame is only valid until the next socket read.
+                chunk->buffer = BufferPool::shared().acquire(message.length);
+                memcpy(chunk->buffer.data(), message.data, message.length);
+                chunk->offset = m_next;
+                chunk->length = message.length;
+                chunk->busy = true;
+                chunk->request.reset();
+                chunk->request.Offset = (DWORD)m_next;
+                chunk->request.OffsetHigh = (DWORD)(m_next >> 32);
+                m_next += message.length;
+
+                acquire();
+                if (!WriteFile(m_file, chunk->buffer.data(), chunk->length, nullptr, &chunk->request) &&
+                    GetLastError() != ERROR_IO_PENDING) {
+                    DWORD error = GetLastError();
+                    LOG_ERROR(m_logTag, "File write failed: " << error);
+                    chunk->busy = false;
+                    chunk->buffer.reset();
+                    fail(fileStatusFromError(error), error);
+                    release();
+                }
+            }
+        }
+    }
+    release();
+}
+
+void FileTransfer::onChunkWritten(Chunk& chunk, DWORD bytes, DWORD error) {
+    chunk.busy = false;
+    chunk.buffer.reset();
+
+    if (m_done) {
+        return;
+    }
+    if (error != NO_ERROR || bytes != chunk.length) {
+        if (!m_closing) {
+            LOG_ERROR(m_logTag, "File write error: " << error);
+        }
+        fail(error == NO_ERROR ? FileStatus::Failed : fileStatusFromError(error), error);
+        return;
+    }
+
+    // Writes finish in any order; the file has no gap up to the oldest one
+    // still in flight.
+    m_metrics.fileBytesReceived += bytes;
+    m_complete = m_next;
+    for (const auto& other : m_chunks) {
+        if (other.busy) {
+            m_complete = std::min(m_complete, other.offset);
+        }
+    }
+
+    m_connection.sendFile(m_id, FileOp::Ack, bytes, m_complete);
+    if (m_complete == m_size) {
+        complete();
+    }
+}
+
+void FileTransfer::grant(uint32_t bytes, uint64_t complete) {
+    acquire();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_direction == FileOp::Get) {
+            m_credit += bytes;
+            m_complete = std::max(m_complete, std::min(complete, m_next));
+            sendChunks();
+        }
+    }
+    release();
+}
+
+void FileTransfer::cancel() {
+    acquire();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        fail(FileStatus::Cancelled);
+    }
+    release();
+}
+
+FileTransfer::Chunk* FileTransfer::freeChunk() {
+    for (auto& chunk : m_chunks) {
+        if (!chunk.busy) {
+            return &chunk;
+        }
+    }
+    return nullptr;
+}
+
+void FileTransfer::complete() {
+    if (m_done) {
+        return;
+    }
+    m_done = true;
+
+    if (m_direction == FileOp::Get) {
+        ++m_metrics.filesSent;
+    } else {
+        ++m_metrics.filesReceived;
+    }
+    LOG_INFO(m_logTag, "Transfer complete, " << m_size << " bytes");
+    m_connection.sendFile(m_id, FileOp::Done, (uint32_t)FileStatus::Ok, m_size, m_size);
+    stop();
+}
+
+void FileTransfer::fail(FileStatus status, DWORD error) {
+    if (m_done) {
+        return;
+    }
+    m_done = true;
+
+    if (!m_closing) {
+        LOG_WARN(m_logTag, "Transfer failed with status " << (uint32_t)status << " (error " << error
+                           << "), complete up to " << m_complete);
+    }
+    m_connection.sendFile(m_id, FileOp::Done, (uint32_t)status, m_complete, m_size);
+    stop();
+}
+
+void FileTransfer::onCompletion(IoRequest* request, DWORD bytes, DWORD error) {
+    Chunk& chunk = *static_cast<Chunk*>(request->context);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (request->operation == IoOperation::SocketWrite) {
+            onChunkSent(chunk, bytes, error);
+        } else {
+            onChunkWritten(chunk, bytes, error);
+        }
+    }
+    release();
+}
+
+void FileTransfer::release() {
+    if (--m_pending == 0 && m_closing) {
+        finish();
+    }
+}
+
+void FileTransfer::finish() {
+    if (m_finished.exchange(true)) {
+        return;
+    }
+
+    // No operation is in flight any more. An upload that did not complete
+    // keeps only its gapless part, which is where a resume continues.
+    m_source.close();
+    if (m_file != INVALID_HANDLE_VALUE) {
+        if (m_complete < m_size) {
+            truncateFile(m_file, m_complete);
+        }
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+    for (auto& chunk : m_chunks) {
+        chunk.buffer.reset();
+    }
+
+    LOG_INFO(m_logTag, "Transfer stopped");
+    --m_metrics.activeTransfers;
+
+    if (m_onFinished) {
+        m_onFinished(this);
+    }
+
+    // Waiters may destroy the transfer as soon as this is signalled, so it
+    // must be the last thing that touches any member.
+    SetEvent(m_finishedEvent);
+}
+
+void FileTransfer::stop() {
+    acquire();
+    if (m_closing.exchange(true)) {
+        release();
+        return;
+    }
+
+    // Pending writes are cancelled; sends on the shared socket complete on
+    // their own.
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CancelIoEx(m_file, nullptr);
+    }
+
+    release();
+}
+
+void FileTransfer::wait() {
+    if (m_finishedEvent) {
+        WaitForSingleObject(m_finishedEvent, INFINITE);
+    }
+}
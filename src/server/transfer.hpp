@@ -0,0 +1,119 @@
+#pragma once
+#ifndef TRANSFER_HPP
+#define TRANSFER_HPP
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../utils.hpp"
+#include "../define.hpp"
+#include "../engine/engine.hpp"
+#include "../protocol/protocol.hpp"
+#include "../log/log.hpp"
+#include "../metrics/metrics.hpp"
+#include "../buffer/buffer.hpp"
+#include "../file/file.hpp"
+
+class Connection;
+
+// One file copied over a Connection's File channel, as transfer `id`.
+//
+// Get: the file is read through a MappedFile and each chunk is checksummed
+// and sent straight from the mapped view behind its frame header. Up to
+// FILE_PIPELINE Data frames are on the socket at once, within FILE_WINDOW
+// bytes of credit the client returns with Ack as it stores them. Done
+// follows the last chunk.
+//
+// Put: each Data frame is checked against its checksum, copied into a
+// pooled buffer and written with an overlapped WriteFile at its offset, so
+// several chunks are written at once; each finished write is acknowledged.
+// A transfer that fails or is cut off keeps only the part of the file that
+// was written without a gap, so a resumed Put continues from there.
+//
+// Lifetime follows ProcessHandler: every overlapped operation holds a
+// pending reference and the last one to complete after stop() finishes the
+// transfer.
+class FileTransfer : public IoHandler {
+public:
+    typedef std::function<void(FileTransfer*)> FinishedCallback;
+
+private:
+    // A Data frame on its way to the socket (Get) or to the file (Put).
+    struct Chunk {
+        IoRequest request;
+        OutgoingFrame frame;
+        FilePayload payload;
+        PooledBuffer buffer;
+        uint64_t offset;
+        uint32_t length;
+        bool busy;
+
+        Chunk() : offset(0), length(0), busy(false) {}
+    };
+
+    EventLoop& m_loop;
+    Connection& m_connection;
+    ServerMetrics& m_metrics;
+    uint16_t m_id;
+    FileOp m_direction;
+    char m_logTag[LOG_TAG_SIZE];
+    FinishedCallback m_onFinished;
+
+    std::mutex m_mutex;
+    MappedFile m_source;
+    HANDLE m_file;
+    std::vector<Chunk> m_chunks;
+    uint64_t m_size;
+    // Next offset to send or to expect, and the end of the gapless part the
+    // client has acknowledged (Get) or that has been written (Put).
+    uint64_t m_next;
+    uint64_t m_complete;
+    int64_t m_credit;
+    bool m_done;
+
+    std::atomic<int> m_pending;
+    std::atomic<bool> m_closing;
+    std::atomic<bool> m_finished;
+    HANDLE m_finishedEvent;
+
+public:
+    FileTransfer(EventLoop& loop, Connection& connection, uint16_t id, FinishedCallback onFinished = nullptr);
+    ~FileTransfer();
+
+    uint16_t id() const { return m_id; }
+
+    // Sends `path` from `offset` on.
+    void startGet(const std::string& path, uint64_t offset);
+    // Receives `size` bytes into `path`; with `resume` the data already in
+    // the file is kept and the client is told to continue after it.
+    void startPut(const std::string& path, uint64_t size, bool resume);
+
+    // Called by the Connection for the client's Data, Ack and Cancel.
+    void receive(const FileMessage& message);
+    void grant(uint32_t bytes, uint64_t complete);
+    void cancel();
+
+    void stop();
+    void wait();
+    bool isRunning() const { return !m_finished; }
+
+    void onCompletion(IoRequest* request, DWORD bytes, DWORD error) override;
+
+private:
+    void sendChunks();
+    void onChunkSent(Chunk& chunk, DWORD bytes, DWORD error);
+    void onChunkWritten(Chunk& chunk, DWORD bytes, DWORD error);
+    Chunk* freeChunk();
+
+    // Send Done once and stop; m_mutex must be held.
+    void complete();
+    void fail(FileStatus status, DWORD error = 0);
+
+    void acquire() { ++m_pending; }
+    void release();
+    void finish();
+};
+
+#endif // TRANSFER_HPP
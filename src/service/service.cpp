@@ -173,19 +173,7 @@ void Service::serviceWorker() {
     m_server = new Server(PORT);
     m_server->start();
 
-    HANDLE waitHandles[2];
-    waitHandles[0] = m_stopEvent;
-    
-    while (true) {
-        DWORD waitResult = WaitForMultipleObjects(1, waitHandles, FALSE, 1000);
-        
-        if (waitResult == WAIT_OBJECT_0) {
-            break;
-        }
-        else if (waitResult == WAIT_TIMEOUT) {
-            continue;
-        }
-    }
+    WaitForSingleObject(m_stopEvent, INFINITE);
     
     m_server->stop();
 }
@@ -0,0 +1,126 @@
+#include <psapi.h>
+
+#include <vector>
+
+#include "supervisor.hpp"
+#include "../log/log.hpp"
+
+static double fileTimeSeconds(const FILETIME& time) {
+    ULONGLONG ticks = ((ULONGLONG)time.dwHighDateTime << 32) | time.dwLowDateTime;
+    return ticks / 1e7;
+}
+
+bool ProcessSupervisor::watch(HANDLE process, EventLoop& loop, IoRequest* request) {
+    unwatch();
+
+    m_process = process;
+    m_loop = &loop;
+    m_request = request;
+
+    if (!RegisterWaitForSingleObject(&m_waitHandle, process, onProcessSignaled, this,
+                                     INFINITE, WT_EXECUTEONLYONCE | WT_EXECUTEINWAITTHREAD)) {
+        LOG_ERROR(nullptr, "RegisterWaitForSingleObject failed: " << GetLastError());
+        m_waitHandle = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void ProcessSupervisor::unwatch() {
+    if (m_waitHandle) {
+        // Blocks until a callback that is already running has returned.
+        UnregisterWaitEx(m_waitHandle, INVALID_HANDLE_VALUE);
+        m_waitHandle = nullptr;
+    }
+}
+
+void CALLBACK ProcessSupervisor::onProcessSignaled(void* context, BOOLEAN) {
+    ProcessSupervisor* supervisor = static_cast<ProcessSupervisor*>(context);
+    if (!supervisor->m_loop->post(supervisor->m_request)) {
+        LOG_ERROR(nullptr, "Failed to post process exit: " << GetLastError());
+    }
+}
+
+ProcessExitInfo ProcessSupervisor::collect(HANDLE process) {
+    ProcessExitInfo info;
+    ZeroMemory(&info, sizeof(info));
+
+    if (!GetExitCodeProcess(process, &info.exitCode)) {
+        info.exitCode = (DWORD)-1;
+    }
+
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (GetProcessTimes(process, &creationTime, &exitTime, &kernelTime, &userTime)) {
+        info.wallSeconds = fileTimeSeconds(exitTime) - fileTimeSeconds(creationTime);
+        info.userSeconds = fileTimeSeconds(userTime);
+        info.kernelSeconds = fileTimeSeconds(kernelTime);
+    }
+
+    PROCESS_MEMORY_COUNTERS memory;
+    ZeroMemory(&memory, sizeof(memory));
+    memory.cb = sizeof(memory);
+    if (GetProcessMemoryInfo(process, &memory, sizeof(memory))) {
+        info.peakWorkingSet = memory.PeakWorkingSetSize;
+    }
+
+    IO_COUNTERS io;
+    if (GetProcessIoCounters(process, &io)) {
+        info.readBytes = io.ReadTransferCount;
+        info.writeBytes = io.WriteTransferCount;
+    }
+
+    return info;
+}
+
+bool ProcessSupervisor::interrupt(const std::string& helper, DWORD processId, DWORD event, const char* logTag) {
+    std::string command = helper + " --pid " + std::to_string(processId) + " --event " + std::to_string(event);
+    // CreateProcessA may modify the command line in place.
+    std::vector<char> cmdLine(command.begin(), command.end());
+    cmdLine.push_back('\0');
+
+    STARTUPINFOA startupInfo;
+    ZeroMemory(&startupInfo, sizeof(startupInfo));
+    startupInfo.cb = sizeof(startupInfo);
+    PROCESS_INFORMATION processInfo;
+    ZeroMemory(&processInfo, sizeof(processInfo));
+
+    if (!CreateProcessA(nullptr, cmdLine.data(), nullptr, nullptr, FALSE, CREATE_NO_WINDOW, nullptr, nullptr,
+                        &startupInfo, &processInfo)) {
+        LOG_ERROR(logTag, "Failed to start interrupt helper: " << GetLastError());
+        return false;
+    }
+
+    DWORD exitCode = 1;
+    if (WaitForSingleObject(processInfo.hProcess, INTERRUPT_HELPER_TIMEOUT_MS) != WAIT_OBJECT_0) {
+        LOG_ERROR(logTag, "Interrupt helper did not finish, killing it");
+        TerminateProcess(processInfo.hProcess, 1);
+    } else {
+        GetExitCodeProcess(processInfo.hProcess, &exitCode);
+    }
+    CloseHandle(processInfo.hProcess);
+    CloseHandle(processInfo.hThread);
+
+    if (exitCode != 0) {
+        LOG_WARN(logTag, "Interrupt helper failed with code " << exitCode);
+        return false;
+    }
+    return true;
+}
+
+int ProcessSupervisor::raiseConsoleEvent(DWORD processId, DWORD event) {
+    FreeConsole();
+    if (!AttachConsole(processId)) {
+        return 2;
+    }
+    // The event reaches this process too.
+    SetConsoleCtrlHandler(nullptr, TRUE);
+    BOOL raised = GenerateConsoleCtrlEvent(event, 0);
+    FreeConsole();
+    return raised ? 0 : 3;
+}
+
+std::string interruptHelperCommand() {
+    char path[MAX_PATH];
+    DWORD length = GetModuleFileNameA(nullptr, path, MAX_PATH);
+    return "\"" + std::string(path, length) + "\" -interrupt";
+}
@@ -0,0 +1,59 @@
+#pragma once
+#ifndef SUPERVISOR_HPP
+#define SUPERVISOR_HPP
+
+#include "../utils.hpp"
+#include "../engine/engine.hpp"
+
+struct ProcessExitInfo {
+    DWORD exitCode;
+    double wallSeconds;
+    double userSeconds;
+    double kernelSeconds;
+    SIZE_T peakWorkingSet;
+    ULONGLONG readBytes;
+    ULONGLONG writeBytes;
+};
+
+// Watches a child process without a polling thread: the wait is registered
+// with the system thread pool and, when the process handle is signalled,
+// the given request is posted to the event loop so the owner handles the
+// exit on one of its loop threads.
+class ProcessSupervisor {
+private:
+    HANDLE m_process;
+    HANDLE m_waitHandle;
+    EventLoop* m_loop;
+    IoRequest* m_request;
+
+public:
+    ProcessSupervisor() : m_process(nullptr), m_waitHandle(nullptr), m_loop(nullptr), m_request(nullptr) {}
+    ~ProcessSupervisor() { unwatch(); }
+
+    ProcessSupervisor(const ProcessSupervisor&) = delete;
+    ProcessSupervisor& operator=(const ProcessSupervisor&) = delete;
+
+    bool watch(HANDLE process, EventLoop& loop, IoRequest* request);
+    void unwatch();
+    bool isWatching() const { return m_waitHandle != nullptr; }
+
+    static ProcessExitInfo collect(HANDLE process);
+
+    // Raises CTRL_C_EVENT or CTRL_BREAK_EVENT on the console of `processId`,
+    // which every process attached to it receives. A process can only raise
+    // events on its own console and children have consoles of their own, so
+    // this runs `helper` with "--pid N --event E" appended and waits for it.
+    static bool interrupt(const std::string& helper, DWORD processId, DWORD event, const char* logTag);
+    // The helper's side: joins the console of `processId` and raises `event`
+    // there; returns the helper's exit code.
+    static int raiseConsoleEvent(DWORD processId, DWORD event);
+
+private:
+    static void CALLBACK onProcessSignaled(void* context, BOOLEAN timedOut);
+};
+
+// Helper command for ProcessSupervisor::interrupt: this executable in its
+// -interrupt mode.
+std::string interruptHelperCommand();
+
+#endif // SUPERVISOR_HPP
@@ -0,0 +1,583 @@
+#include <algorithm>
+#include <new>
+
+#include "transport.hpp"
+#include "../engine/engine.hpp"
+#include "../log/log.hpp"
+
+static const uint32_t SHM_MAGIC = 0x314d4853;
+
+struct ShmRendezvous {
+    DWORD clientPid;
+    uint32_t id;
+    // Last request number handed out, under the mutex.
+    uint32_t sequence;
+    // Number of the request waiting for an answer, 0 once it is settled:
+    // the listener takes it back to 0 to answer, a client that gives up to
+    // withdraw, and whichever does so first decides.
+    std::atomic<uint32_t> pending;
+    // Number of the request `id` answers.
+    uint32_t answered;
+};
+
+static std::string objectName(const std::string& name) {
+    return name.find('\\') == std::string::npos ? "Local\\RemoteConsole." + name : name;
+}
+
+static size_t ringUsed(ShmRing& ring) {
+    return (size_t)(ring.head.load() - ring.tail.load());
+}
+
+// Producer side only. Publishes what fitted with a sequentially consistent
+// store, which a reader that set readerWaiting is sure to see or be woken
+// for.
+static size_t ringWrite(ShmRing& ring, const char* data, size_t length) {
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    uint64_t tail = ring.tail.load(std::memory_order_acquire);
+    size_t count = std::min<size_t>(length, SHM_RING_BYTES - (size_t)(head - tail));
+    if (count == 0) {
+        return 0;
+    }
+
+    size_t at = (size_t)(head % SHM_RING_BYTES);
+    size_t first = std::min(count, SHM_RING_BYTES - at);
+    memcpy(ring.data + at, data, first);
+    memcpy(ring.data, data + first, count - first);
+    ring.head.store(head + count);
+    return count;
+}
+
+// Consumer side only.
+static size_t ringRead(ShmRing& ring, char* data, size_t length) {
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    uint64_t head = ring.head.load();
+    size_t count = std::min<size_t>(length, (size_t)(head - tail));
+    if (count == 0) {
+        return 0;
+    }
+
+    size_t at = (size_t)(tail % SHM_RING_BYTES);
+    size_t first = std::min(count, SHM_RING_BYTES - at);
+    memcpy(data, ring.data + at, first);
+    memcpy(data + first, ring.data, count - first);
+    ring.tail.store(tail + count);
+    return count;
+}
+
+// Signals `event` if the other side said it is about to sleep on it.
+static void wake(std::atomic<uint32_t>& waiting, HANDLE event) {
+    if (waiting.load() && waiting.exchange(0)) {
+        SetEvent(event);
+    }
+}
+
+ShmTransport::ShmTransport()
+    : m_mapping(nullptr),
+      m_region(nullptr),
+      m_in(nullptr),
+      m_out(nullptr),
+      m_inData(nullptr),
+      m_outSpace(nullptr),
+      m_outData(nullptr),
+      m_inSpace(nullptr),
+      m_peer(nullptr),
+      m_blocking(true),
+      m_peerGone(false),
+      m_loop(nullptr),
+      m_dataWait(nullptr),
+      m_spaceWait(nullptr),
+      m_peerWait(nullptr),
+      m_readRequest(nullptr),
+      m_readBuffer(nullptr),
+      m_readLength(0),
+      m_cancelled(false) {}
+
+ShmTransport::~ShmTransport() {
+    close();
+}
+
+bool ShmTransport::create(const std::string& base, uint32_t id, DWORD clientPid) {
+    return open(base, id, true, clientPid);
+}
+
+bool ShmTransport::connect(const std::string& name, DWORD timeoutMs) {
+    std::string base = objectName(name);
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, (base + ".listen").c_str());
+    HANDLE mutex = OpenMutexA(SYNCHRONIZE | MUTEX_MODIFY_STATE, FALSE, (base + ".lock").c_str());
+    HANDLE request = OpenEventA(EVENT_MODIFY_STATE, FALSE, (base + ".request").c_str());
+    HANDLE reply = OpenEventA(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, (base + ".reply").c_str());
+    ShmRendezvous* rendezvous =
+        mapping ? (ShmRendezvous*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(ShmRendezvous)) : nullptr;
+
+    uint32_t id = 0;
+    if (rendezvous && mutex && request && reply) {
+        // One client at a time; the mutex of a client that died holding it
+        // comes back abandoned, which is as good.
+        DWORD waited = WaitForSingleObject(mutex, timeoutMs);
+        if (waited == WAIT_OBJECT_0 || waited == WAIT_ABANDONED) {
+            uint32_t sequence = ++rendezvous->sequence;
+            if (sequence == 0) {
+                sequence = ++rendezvous->sequence;
+            }
+            rendezvous->clientPid = GetCurrentProcessId();
+            rendezvous->id = 0;
+            ResetEvent(reply);
+            rendezvous->pending.store(sequence);
+            SetEvent(request);
+
+            bool answered = WaitForSingleObject(reply, timeoutMs) == WAIT_OBJECT_0;
+            uint32_t expected = sequence;
+            if (!answered && !rendezvous->pending.compare_exchange_strong(expected, 0)) {
+                // The listener took the request just as we gave up; its
+                // reply is on the way.
+                answered = WaitForSingleObject(reply, timeoutMs) == WAIT_OBJECT_0;
+            }
+            if (answered && rendezvous->answered == sequence) {
+                id = rendezvous->id;
+            }
+            ReleaseMutex(mutex);
+        }
+    }
+
+    if (rendezvous) {
+        UnmapViewOfFile(rendezvous);
+    }
+    for (HANDLE handle : { mapping, mutex, request, reply }) {
+        if (handle) {
+            CloseHandle(handle);
+        }
+    }
+
+    if (id == 0) {
+        LOG_ERROR(nullptr, "No shared-memory listener answered on " << base);
+        return false;
+    }
+    return open(base, id, false, 0);
+}
+
+bool ShmTransport::open(const std::string& base, uint32_t id, bool server, DWORD peerPid) {
+    std::string name = base + "." + std::to_string(id);
+    if (server) {
+        m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(ShmRegion),
+                                       name.c_str());
+    } else {
+        m_mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+    }
+    if (!m_mapping) {
+        LOG_ERROR(nullptr, "Cannot open shared memory " << name << ": " << GetLastError());
+        return false;
+    }
+    m_region = (ShmRegion*)MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(ShmRegion));
+    if (!m_region) {
+        LOG_ERROR(nullptr, "Cannot map shared memory " << name << ": " << GetLastError());
+        close();
+        return false;
+    }
+
+    if (server) {
+        new (m_region) ShmRegion();
+        m_region->magic = SHM_MAGIC;
+        m_region->serverPid = GetCurrentProcessId();
+    } else {
+        if (m_region->magic != SHM_MAGIC) {
+            LOG_ERROR(nullptr, "Shared memory " << name << " is not a connection");
+            close();
+            return false;
+        }
+        peerPid = m_region->serverPid;
+    }
+
+    auto event = [&](const char* suffix) {
+        std::string eventName = name + suffix;
+        return server ? CreateEventA(nullptr, FALSE, FALSE, eventName.c_str())
+                      : OpenEventA(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, eventName.c_str());
+    };
+    HANDLE toServerData = event(".ts.data");
+    HANDLE toServerSpace = event(".ts.space");
+    HANDLE toClientData = event(".tc.data");
+    HANDLE toClientSpace = event(".tc.space");
+    m_in = server ? &m_region->toServer : &m_region->toClient;
+    m_out = server ? &m_region->toClient : &m_region->toServer;
+    m_inData = server ? toServerData : toClientData;
+    m_inSpace = server ? toServerSpace : toClientSpace;
+    m_outData = server ? toClientData : toServerData;
+    m_outSpace = server ? toClientSpace : toServerSpace;
+    m_peer = OpenProcess(SYNCHRONIZE, FALSE, peerPid);
+
+    if (!m_inData || !m_inSpace || !m_outData || !m_outSpace || !m_peer) {
+        LOG_ERROR(nullptr, "Cannot open the events of shared memory " << name << ": " << GetLastError());
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ShmTransport::close() {
+    for (HANDLE* wait : { &m_dataWait, &m_spaceWait, &m_peerWait }) {
+        if (*wait) {
+            // Waits for a callback that is running to return.
+            UnregisterWaitEx(*wait, INVALID_HANDLE_VALUE);
+            *wait = nullptr;
+        }
+    }
+
+    if (m_region) {
+        if (m_in) {
+            shutdown(SD_BOTH);
+        }
+        UnmapViewOfFile(m_region);
+        m_region = nullptr;
+        m_in = nullptr;
+        m_out = nullptr;
+    }
+    for (HANDLE* handle : { &m_inData, &m_inSpace, &m_outData, &m_outSpace, &m_peer, &m_mapping }) {
+        if (*handle) {
+            CloseHandle(*handle);
+            *handle = nullptr;
+        }
+    }
+}
+
+void ShmTransport::shutdown(int how) {
+    if (!m_region) {
+        return;
+    }
+    if (how == SD_SEND || how == SD_BOTH) {
+        m_out->writerClosed = 1;
+        SetEvent(m_outData);
+    }
+    if (how == SD_RECEIVE || how == SD_BOTH) {
+        m_in->readerClosed = 1;
+        SetEvent(m_inSpace);
+    }
+}
+
+int ShmTransport::send(WSABUF* buffers, DWORD count) {
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    int total = 0;
+    for (DWORD i = 0; i < count; ++i) {
+        const char* data = buffers[i].buf;
+        size_t left = buffers[i].len;
+        while (left > 0) {
+            if (!m_region || m_out->readerClosed || m_peerGone) {
+                WSASetLastError(WSAECONNRESET);
+                return SOCKET_ERROR;
+            }
+
+            size_t written = ringWrite(*m_out, data, left);
+            if (written > 0) {
+                wake(m_out->readerWaiting, m_outData);
+                data += written;
+                left -= written;
+                total += (int)written;
+                continue;
+            }
+
+            if (!m_blocking) {
+                if (total > 0) {
+                    return total;
+                }
+                WSASetLastError(WSAEWOULDBLOCK);
+                return SOCKET_ERROR;
+            }
+            m_out->writerWaiting = 1;
+            if (ringUsed(*m_out) < SHM_RING_BYTES || m_out->readerClosed) {
+                continue;
+            }
+            HANDLE handles[] = { m_outSpace, m_peer };
+            if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0) {
+                m_peerGone = true;
+            }
+        }
+    }
+    return total;
+}
+
+int ShmTransport::recv(void* buffer, size_t length, int /*flags*/) {
+    if (!m_region) {
+        WSASetLastError(WSAENOTSOCK);
+        return SOCKET_ERROR;
+    }
+    while (true) {
+        // The flag is read first: the writer sets it after its last write.
+        bool closed = m_in->writerClosed != 0;
+        size_t bytesRead = ringRead(*m_in, (char*)buffer, length);
+        if (bytesRead > 0) {
+            wake(m_in->writerWaiting, m_inSpace);
+            return (int)bytesRead;
+        }
+        if (closed) {
+            return 0;
+        }
+        if (m_peerGone) {
+            WSASetLastError(WSAECONNRESET);
+            return SOCKET_ERROR;
+        }
+
+        if (!m_blocking) {
+            WSASetLastError(WSAEWOULDBLOCK);
+            return SOCKET_ERROR;
+        }
+        m_in->readerWaiting = 1;
+        if (ringUsed(*m_in) > 0 || m_in->writerClosed) {
+            continue;
+        }
+        HANDLE handles[] = { m_inData, m_peer };
+        if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0) {
+            m_peerGone = true;
+        }
+    }
+}
+
+void CALLBACK ShmTransport::onSignal(void* context, BOOLEAN) {
+    static_cast<ShmTransport*>(context)->progress();
+}
+
+void CALLBACK ShmTransport::onPeerExit(void* context, BOOLEAN) {
+    ShmTransport* transport = static_cast<ShmTransport*>(context);
+    transport->m_peerGone = true;
+    transport->progress();
+}
+
+bool ShmTransport::attach(EventLoop& loop) {
+    if (!m_region) {
+        return false;
+    }
+    m_loop = &loop;
+    if (!RegisterWaitForSingleObject(&m_dataWait, m_inData, onSignal, this, INFINITE, WT_EXECUTEINWAITTHREAD) ||
+        !RegisterWaitForSingleObject(&m_spaceWait, m_outSpace, onSignal, this, INFINITE, WT_EXECUTEINWAITTHREAD) ||
+        !RegisterWaitForSingleObject(&m_peerWait, m_peer, onPeerExit, this, INFINITE,
+                                     WT_EXECUTEINWAITTHREAD | WT_EXECUTEONLYONCE)) {
+        LOG_ERROR(nullptr, "Cannot wait on shared-memory events: " << GetLastError());
+        return false;
+    }
+    return true;
+}
+
+bool ShmTransport::sendAsync(WSABUF* buffers, DWORD count, OVERLAPPED* overlapped) {
+    if (!m_loop || count > 4) {
+        WSASetLastError(WSAEINVAL);
+        return false;
+    }
+
+    PendingSend send;
+    send.count = count;
+    send.index = 0;
+    send.offset = 0;
+    send.total = 0;
+    send.overlapped = overlapped;
+    for (DWORD i = 0; i < count; ++i) {
+        send.buffers[i] = buffers[i];
+        send.total += buffers[i].len;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_ioMutex);
+        m_sends.push_back(send);
+    }
+    progress();
+    return true;
+}
+
+bool ShmTransport::recvAsync(void* buffer, size_t length, OVERLAPPED* overlapped) {
+    {
+        std::lock_guard<std::mutex> lock(m_ioMutex);
+        if (!m_loop || m_readRequest) {
+            WSASetLastError(WSAEINVAL);
+            return false;
+        }
+        m_readRequest = overlapped;
+        m_readBuffer = (char*)buffer;
+        m_readLength = length;
+    }
+    progress();
+    return true;
+}
+
+// Anything pending completes with 0 bytes, which the caller takes as the
+// connection ending; so does anything issued afterwards.
+void ShmTransport::cancelIo() {
+    {
+        std::lock_guard<std::mutex> lock(m_ioMutex);
+        m_cancelled = true;
+    }
+    progress();
+}
+
+bool ShmTransport::setBlocking(bool blocking) {
+    m_blocking = blocking;
+    return true;
+}
+
+void ShmTransport::complete(OVERLAPPED* overlapped, DWORD bytes) {
+    // Every overlapped operation in the server is an IoRequest.
+    m_loop->post(static_cast<IoRequest*>(overlapped), bytes);
+}
+
+// Moves the pending read and sends along as far as the rings allow. Runs
+// on the caller's thread when an operation is issued and on a thread-pool
+// wait thread when the peer signals.
+void ShmTransport::progress() {
+    std::lock_guard<std::mutex> lock(m_ioMutex);
+    if (!m_loop || !m_region) {
+        return;
+    }
+
+    while (m_readRequest) {
+        bool closed = m_in->writerClosed != 0;
+        size_t bytesRead = ringRead(*m_in, m_readBuffer, m_readLength);
+        if (bytesRead > 0) {
+            wake(m_in->writerWaiting, m_inSpace);
+            complete(m_readRequest, (DWORD)bytesRead);
+            m_readRequest = nullptr;
+        } else if (closed || m_peerGone || m_cancelled) {
+            complete(m_readRequest, 0);
+            m_readRequest = nullptr;
+        } else {
+            m_in->readerWaiting = 1;
+            if (ringUsed(*m_in) == 0 && !m_in->writerClosed) {
+                break;
+            }
+        }
+    }
+
+    while (!m_sends.empty()) {
+        PendingSend& send = m_sends.front();
+        if (m_out->readerClosed || m_peerGone || m_cancelled) {
+            complete(send.overlapped, 0);
+            m_sends.pop_front();
+            continue;
+        }
+
+        bool blocked = false;
+        while (send.index < send.count) {
+            WSABUF& buffer = send.buffers[send.index];
+            size_t written = ringWrite(*m_out, buffer.buf + send.offset, buffer.len - send.offset);
+            send.offset += (DWORD)written;
+            if (send.offset == buffer.len) {
+                ++send.index;
+                send.offset = 0;
+            } else if (written == 0) {
+                m_out->writerWaiting = 1;
+                if (ringUsed(*m_out) == SHM_RING_BYTES) {
+                    blocked = true;
+                    break;
+                }
+            }
+        }
+        wake(m_out->readerWaiting, m_outData);
+
+        if (blocked) {
+            if (!m_out->readerClosed) {
+                break;
+            }
+            // Failed at the top of the loop.
+            continue;
+        }
+        complete(send.overlapped, send.total);
+        m_sends.pop_front();
+    }
+}
+
+ShmListener::ShmListener(const std::string& name, AcceptedCallback onAccepted)
+    : m_base(objectName(name)),
+      m_onAccepted(std::move(onAccepted)),
+      m_mapping(nullptr),
+      m_rendezvous(nullptr),
+      m_mutex(nullptr),
+      m_request(nullptr),
+      m_reply(nullptr),
+      m_nextId(1) {
+    m_stopEvent = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+}
+
+ShmListener::~ShmListener() {
+    stop();
+    if (m_rendezvous) {
+        UnmapViewOfFile(m_rendezvous);
+    }
+    for (HANDLE handle : { m_mapping, m_mutex, m_request, m_reply, m_stopEvent }) {
+        if (handle) {
+            CloseHandle(handle);
+        }
+    }
+}
+
+bool ShmListener::listen() {
+    m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, sizeof(ShmRendezvous),
+                                   (m_base + ".listen").c_str());
+    if (m_mapping && GetLastError() == ERROR_ALREADY_EXISTS) {
+        LOG_ERROR(nullptr, "Another server is listening on " << m_base);
+        return false;
+    }
+    if (m_mapping) {
+        m_rendezvous = (ShmRendezvous*)MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(ShmRendezvous));
+    }
+    m_mutex = CreateMutexA(nullptr, FALSE, (m_base + ".lock").c_str());
+    m_request = CreateEventA(nullptr, FALSE, FALSE, (m_base + ".request").c_str());
+    m_reply = CreateEventA(nullptr, FALSE, FALSE, (m_base + ".reply").c_str());
+    if (!m_rendezvous || !m_mutex || !m_request || !m_reply) {
+        LOG_ERROR(nullptr, "Cannot listen for shared-memory connections on " << m_base << ": " << GetLastError());
+        return false;
+    }
+
+    LOG_INFO(nullptr, "Listening for shared-memory connections on " << m_base);
+    return true;
+}
+
+void ShmListener::stop() {
+    SetEvent(m_stopEvent);
+    Thread::stop();
+}
+
+void ShmListener::run() {
+    HANDLE waitHandles[] = { m_stopEvent, m_request };
+    while (WaitForMultipleObjects(2, waitHandles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1) {
+        uint32_t sequence = m_rendezvous->pending.load();
+        if (sequence == 0) {
+            // Withdrawn before we got to it.
+            continue;
+        }
+        auto transport = std::make_unique<ShmTransport>();
+        uint32_t id = m_nextId++;
+        if (!transport->create(m_base, id, m_rendezvous->clientPid)) {
+            id = 0;
+        }
+        uint32_t expected = sequence;
+        if (!m_rendezvous->pending.compare_exchange_strong(expected, 0)) {
+            // Its client gave up waiting and nobody will open this one; a
+            // client that asked since has signalled the request again.
+            LOG_WARN(nullptr, "Shared-memory client gave up before connection " << id << " was ready");
+            continue;
+        }
+        m_rendezvous->id = id;
+        m_rendezvous->answered = sequence;
+        SetEvent(m_reply);
+
+        if (id != 0) {
+            m_onAccepted(std::move(transport));
+        }
+    }
+}
+
+std::unique_ptr<Transport> connectTransport(const std::string& address, unsigned short port) {
+    if (address.compare(0, 5, "unix:") == 0) {
+        auto socket = std::make_unique<Socket>();
+        if (!socket->create(AF_UNIX, SOCK_STREAM, 0) || !socket->connectPath(address.substr(5))) {
+            return nullptr;
+        }
+        return socket;
+    }
+    if (address.compare(0, 4, "shm:") == 0) {
+        auto transport = std::make_unique<ShmTransport>();
+        if (!transport->connect(address.substr(4))) {
+            return nullptr;
+        }
+        return transport;
+    }
+
+    auto socket = std::make_unique<Socket>();
+    if (!socket->create() || !socket->connect(address, port)) {
+        return nullptr;
+    }
+    return socket;
+}
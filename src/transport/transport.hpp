@@ -0,0 +1,158 @@
+#pragma once
+#ifndef TRANSPORT_HPP
+#define TRANSPORT_HPP
+
+#include <deque>
+#include <functional>
+#include <mutex>
+
+#include "../utils.hpp"
+#include "../define.hpp"
+
+// One direction of a shared-memory connection: a single-producer,
+// single-consumer byte ring. head and tail count every byte written and
+// read, so the ring holds head - tail bytes and neither counter wraps in
+// practice. Each side sets its *Waiting flag before sleeping on its event;
+// the other side only signals the event when the flag is set, so a busy
+// connection makes no system calls.
+struct ShmRing {
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) std::atomic<uint32_t> readerWaiting;
+    std::atomic<uint32_t> writerWaiting;
+    // The writer will write nothing more; the reader gets EOF once empty.
+    std::atomic<uint32_t> writerClosed;
+    // The reader will read nothing more; writes fail.
+    std::atomic<uint32_t> readerClosed;
+    alignas(64) char data[SHM_RING_BYTES];
+};
+
+struct ShmRegion {
+    uint32_t magic;
+    DWORD serverPid;
+    ShmRing toServer;
+    ShmRing toClient;
+};
+
+// Both sides of a connection over a shared-memory region the server
+// creates for it, named after the listener. Each direction has a data event
+// for its reader and a space event for its writer, and each side watches
+// the other's process so a crash reads as a reset rather than a hang.
+//
+// Blocking and non-blocking calls serve the client. Once attached to an
+// EventLoop, the overlapped calls are driven by thread-pool waits on the
+// events and complete by posting to the loop; sends complete in order and
+// only once all of a send is in the ring, as on a socket.
+class ShmTransport : public Transport {
+private:
+    struct PendingSend {
+        WSABUF buffers[4];
+        DWORD count;
+        DWORD index;
+        DWORD offset;
+        DWORD total;
+        OVERLAPPED* overlapped;
+    };
+
+    HANDLE m_mapping;
+    ShmRegion* m_region;
+    ShmRing* m_in;
+    ShmRing* m_out;
+    // Ours to wait on: data in m_in, space in m_out.
+    HANDLE m_inData;
+    HANDLE m_outSpace;
+    // Ours to signal: data in m_out, space in m_in.
+    HANDLE m_outData;
+    HANDLE m_inSpace;
+    HANDLE m_peer;
+    bool m_blocking;
+    std::atomic<bool> m_peerGone;
+    std::mutex m_sendMutex;
+
+    EventLoop* m_loop;
+    HANDLE m_dataWait;
+    HANDLE m_spaceWait;
+    HANDLE m_peerWait;
+    std::mutex m_ioMutex;
+    OVERLAPPED* m_readRequest;
+    char* m_readBuffer;
+    size_t m_readLength;
+    std::deque<PendingSend> m_sends;
+    bool m_cancelled;
+
+public:
+    ShmTransport();
+    ~ShmTransport();
+
+    ShmTransport(const ShmTransport&) = delete;
+    ShmTransport& operator=(const ShmTransport&) = delete;
+
+    // Server side: creates connection `id` of listener `base` for the
+    // client process `clientPid`.
+    bool create(const std::string& base, uint32_t id, DWORD clientPid);
+    // Client side: asks the listener `name` for a connection and opens it.
+    bool connect(const std::string& name, DWORD timeoutMs = SHM_CONNECT_TIMEOUT_MS);
+
+    void close() override;
+    void shutdown(int how = SD_BOTH) override;
+    int send(WSABUF* buffers, DWORD count) override;
+    int recv(void* buffer, size_t length, int flags = 0) override;
+
+    bool attach(EventLoop& loop) override;
+    bool sendAsync(WSABUF* buffers, DWORD count, OVERLAPPED* overlapped) override;
+    bool recvAsync(void* buffer, size_t length, OVERLAPPED* overlapped) override;
+    void cancelIo() override;
+
+    bool setBlocking(bool blocking) override;
+    bool setNoDelay(bool) override { return true; }
+    bool isValid() const override { return m_region != nullptr; }
+
+private:
+    bool open(const std::string& base, uint32_t id, bool server, DWORD peerPid);
+    void progress();
+    void complete(OVERLAPPED* overlapped, DWORD bytes);
+    static void CALLBACK onSignal(void* context, BOOLEAN timedOut);
+    static void CALLBACK onPeerExit(void* context, BOOLEAN timedOut);
+};
+
+struct ShmRendezvous;
+
+// Accepts shared-memory connections under a name: a client takes the
+// listener's mutex, leaves its process id in the listener's small region
+// and signals the request event; this thread creates the connection, puts
+// its id in the region, signals the reply and hands the server side on.
+// Each request is numbered and the reply carries the number it answers; a
+// connection made for a client that gave up waiting is closed, not handed on.
+// Names without a namespace are made session-local ("Local\").
+class ShmListener : public Thread {
+public:
+    typedef std::function<void(std::unique_ptr<Transport>)> AcceptedCallback;
+
+private:
+    std::string m_base;
+    AcceptedCallback m_onAccepted;
+    HANDLE m_mapping;
+    ShmRendezvous* m_rendezvous;
+    HANDLE m_mutex;
+    HANDLE m_request;
+    HANDLE m_reply;
+    HANDLE m_stopEvent;
+    uint32_t m_nextId;
+
+public:
+    ShmListener(const std::string& name, AcceptedCallback onAccepted);
+    ~ShmListener();
+
+    bool listen();
+    void stop();
+
+protected:
+    void run() override;
+};
+
+// Connects to `address`: "unix:PATH" for an AF_UNIX socket, "shm:NAME" for a
+// shared-memory connection, or else a TCP host on `port`. The transport is
+// blocking; null if it could not connect.
+std::unique_ptr<Transport> connectTransport(const std::string& address, unsigned short port);
+
+#endif // TRANSPORT_HPP
@@ -1,8 +1,12 @@
 #include "utils.hpp"
+#include <afunix.h>
+#include "log/log.hpp"
+#include "engine/engine.hpp"
 
 bool Socket::create(int af, int type, int protocol) {
     close();
     m_socket = socket(af, type, protocol);
+    m_family = af;
     return m_socket != INVALID_SOCKET;
 }
 
@@ -13,7 +17,7 @@ bool Socket::bind(const std::string& address, unsigned short port) {
 
     int reuse = 1;
     if (setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, (char*)&reuse, sizeof(reuse)) < 0) {
-        std::cerr << "setsockopt SO_REUSEADDR failed: " << WSAGetLastError() << std::endl;
+        LOG_ERROR(nullptr, "setsockopt SO_REUSEADDR failed: " << WSAGetLastError());
     }
     
     sockaddr_in addr;
@@ -29,7 +33,7 @@ bool Socket::bind(const std::string& address, unsigned short port) {
     }
     
     if (::bind(m_socket, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
-        std::cerr << "Bind failed for port " << port << ", error: " << WSAGetLastError() << std::endl;
+        LOG_ERROR(nullptr, "Bind failed for port " << port << ", error: " << WSAGetLastError());
         return false;
     }
     
@@ -62,6 +66,39 @@ bool Socket::connect(const std::string& address, unsigned short port) {
     return ::connect(m_socket, (sockaddr*)&addr, sizeof(addr)) != SOCKET_ERROR;
 }
 
+static bool pathAddress(const std::string& path, sockaddr_un& addr) {
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        LOG_ERROR(nullptr, "AF_UNIX path must be 1 to " << sizeof(addr.sun_path) - 1 << " characters: " << path);
+        return false;
+    }
+    ZeroMemory(&addr, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+bool Socket::bindPath(const std::string& path) {
+    sockaddr_un addr;
+    if (m_socket == INVALID_SOCKET || !pathAddress(path, addr)) {
+        return false;
+    }
+
+    DeleteFileA(path.c_str());
+    if (::bind(m_socket, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        LOG_ERROR(nullptr, "Bind failed for " << path << ", error: " << WSAGetLastError());
+        return false;
+    }
+    return true;
+}
+
+bool Socket::connectPath(const std::string& path) {
+    sockaddr_un addr;
+    if (!pathAddress(path, addr)) {
+        return false;
+    }
+    return ::connect(m_socket, (sockaddr*)&addr, sizeof(addr)) != SOCKET_ERROR;
+}
+
 void Socket::close() {
     if (m_socket != INVALID_SOCKET) {
         closesocket(m_socket);
@@ -69,28 +106,90 @@ void Socket::close() {
     }
 }
 
+void Socket::shutdown(int how) {
+    if (m_socket != INVALID_SOCKET) {
+        ::shutdown(m_socket, how);
+    }
+}
+
 int Socket::send(const void* buffer, size_t length, int flags) {
     return ::send(m_socket, (const char*)buffer, length, flags);
 }
 
+int Socket::send(WSABUF* buffers, DWORD count) {
+    DWORD bytesSent = 0;
+    if (WSASend(m_socket, buffers, count, &bytesSent, 0, nullptr, nullptr) == SOCKET_ERROR) {
+        return SOCKET_ERROR;
+    }
+    return (int)bytesSent;
+}
+
 int Socket::recv(void* buffer, size_t length, int flags) {
     return ::recv(m_socket, (char*)buffer, length, flags);
 }
 
+bool Socket::attach(EventLoop& loop) {
+    return loop.attach(*this);
+}
+
+bool Socket::sendAsync(const void* buffer, size_t length, OVERLAPPED* overlapped) {
+    WSABUF wsaBuffer;
+    wsaBuffer.buf = (char*)buffer;
+    wsaBuffer.len = (ULONG)length;
+    return sendAsync(&wsaBuffer, 1, overlapped);
+}
+
+bool Socket::sendAsync(WSABUF* buffers, DWORD count, OVERLAPPED* overlapped) {
+    if (WSASend(m_socket, buffers, count, nullptr, 0, overlapped, nullptr) == SOCKET_ERROR) {
+        return WSAGetLastError() == WSA_IO_PENDING;
+    }
+    return true;
+}
+
+bool Socket::recvAsync(void* buffer, size_t length, OVERLAPPED* overlapped) {
+    WSABUF wsaBuffer;
+    wsaBuffer.buf = (char*)buffer;
+    wsaBuffer.len = (ULONG)length;
+
+    DWORD flags = 0;
+    if (WSARecv(m_socket, &wsaBuffer, 1, nullptr, &flags, overlapped, nullptr) == SOCKET_ERROR) {
+        return WSAGetLastError() == WSA_IO_PENDING;
+    }
+    return true;
+}
+
+void Socket::cancelIo() {
+    if (m_socket != INVALID_SOCKET) {
+        CancelIoEx((HANDLE)m_socket, nullptr);
+    }
+}
+
 bool Socket::setBlocking(bool blocking) {
     if (m_socket == INVALID_SOCKET) {
-        std::cerr << "Cannot set blocking mode: socket is invalid" << std::endl;
+        LOG_ERROR(nullptr, "Cannot set blocking mode: socket is invalid");
         return false;
     }
     
     u_long mode = blocking ? 0 : 1;
     if (ioctlsocket(m_socket, FIONBIO, &mode) != 0) {
         int error = WSAGetLastError();
-        std::cerr << "ioctlsocket failed with error: " << error << std::endl;
+        LOG_ERROR(nullptr, "ioctlsocket failed with error: " << error);
         return false;
     }
     m_blocking = blocking;
-    std::cout << "Socket set to " << (blocking ? "blocking" : "non-blocking") << " mode" << std::endl;
+    LOG_DEBUG(nullptr, "Socket set to " << (blocking ? "blocking" : "non-blocking") << " mode");
+    return true;
+}
+
+bool Socket::setNoDelay(bool noDelay) {
+    if (m_family == AF_UNIX) {
+        return true;
+    }
+    BOOL value = noDelay ? TRUE : FALSE;
+    if (setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&value, sizeof(value)) != 0) {
+        LOG_ERROR(nullptr, "setsockopt(TCP_NODELAY) failed with error: " << WSAGetLastError());
+        return false;
+    }
     return true;
 }
 
@@ -110,16 +209,58 @@ void Thread::stop() {
     }
 }
 
-bool Pipe::create() {
+bool Pipe::create(PipeMode mode) {
+    close();
+
     SECURITY_ATTRIBUTES sa;
     sa.nLength = sizeof(SECURITY_ATTRIBUTES);
     sa.bInheritHandle = TRUE;
     sa.lpSecurityDescriptor = nullptr;
     
-    if (!CreatePipe(&m_readHandle, &m_writeHandle, &sa, 0)) {
+    if (mode == PipeMode::Blocking) {
+        return CreatePipe(&m_readHandle, &m_writeHandle, &sa, 0) != FALSE;
+    }
+
+    // Anonymous pipes cannot do overlapped I/O, so use a uniquely named pipe.
+    static std::atomic<unsigned long> s_counter(0);
+    char name[MAX_PATH];
+    snprintf(name, sizeof(name), "\\\\.\\pipe\\RemoteConsole.%lu.%lu",
+             GetCurrentProcessId(), s_counter.fetch_add(1));
+
+    bool serverReads = mode == PipeMode::OverlappedRead;
+    HANDLE serverEnd = CreateNamedPipeA(
+        name,
+        (serverReads ? PIPE_ACCESS_INBOUND : PIPE_ACCESS_OUTBOUND) |
+            FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+        1,
+        PIPE_BUFFER_SIZE,
+        PIPE_BUFFER_SIZE,
+        0,
+        nullptr
+    );
+    if (serverEnd == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(nullptr, "CreateNamedPipe failed: " << GetLastError());
+        return false;
+    }
+
+    HANDLE childEnd = CreateFileA(
+        name,
+        serverReads ? GENERIC_WRITE : GENERIC_READ,
+        0,
+        &sa,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr
+    );
+    if (childEnd == INVALID_HANDLE_VALUE) {
+        LOG_ERROR(nullptr, "Failed to open client end of pipe: " << GetLastError());
+        CloseHandle(serverEnd);
         return false;
     }
 
+    m_readHandle = serverReads ? serverEnd : childEnd;
+    m_writeHandle = serverReads ? childEnd : serverEnd;
     return true;
 }
 
@@ -142,4 +283,27 @@ DWORD Pipe::write(const void* buffer, DWORD size) {
         return 0;
     }
     return bytesWritten;
+}
+
+bool Pipe::readAsync(void* buffer, DWORD size, OVERLAPPED* overlapped) {
+    if (!ReadFile(m_readHandle, buffer, size, nullptr, overlapped)) {
+        return GetLastError() == ERROR_IO_PENDING;
+    }
+    return true;
+}
+
+bool Pipe::writeAsync(const void* buffer, DWORD size, OVERLAPPED* overlapped) {
+    if (!WriteFile(m_writeHandle, buffer, size, nullptr, overlapped)) {
+        return GetLastError() == ERROR_IO_PENDING;
+    }
+    return true;
+}
+
+void Pipe::cancelIo() {
+    if (m_readHandle != INVALID_HANDLE_VALUE) {
+        CancelIoEx(m_readHandle, nullptr);
+    }
+    if (m_writeHandle != INVALID_HANDLE_VALUE) {
+        CancelIoEx(m_writeHandle, nullptr);
+    }
 }
\ No newline at end of file
@@ -11,22 +11,55 @@
 #include <atomic>
 #include <memory>
 #include <vector>
+#include <cstdio>
+
+#include "define.hpp"
 
 #pragma comment(lib, "ws2_32.lib")
 
-class Socket {
+class EventLoop;
+
+// The byte stream between a client and the server: a TCP or AF_UNIX Socket,
+// or a ShmTransport (src/transport). Clients use the blocking calls; the
+// server attaches the transport to an EventLoop and uses the overlapped
+// ones, which complete through it. An overlapped send completes once all of
+// it has gone, so sends issued one after another never interleave.
+class Transport {
+public:
+    virtual ~Transport() {}
+
+    virtual void close() = 0;
+    virtual void shutdown(int how = SD_BOTH) = 0;
+    virtual int send(WSABUF* buffers, DWORD count) = 0;
+    // A non-blocking transport returns SOCKET_ERROR with WSAEWOULDBLOCK
+    // when nothing is there yet.
+    virtual int recv(void* buffer, size_t length, int flags = 0) = 0;
+
+    virtual bool attach(EventLoop& loop) = 0;
+    // Return false only on immediate failure.
+    virtual bool sendAsync(WSABUF* buffers, DWORD count, OVERLAPPED* overlapped) = 0;
+    virtual bool recvAsync(void* buffer, size_t length, OVERLAPPED* overlapped) = 0;
+    virtual void cancelIo() = 0;
+
+    virtual bool setBlocking(bool blocking) = 0;
+    virtual bool setNoDelay(bool noDelay) = 0;
+    virtual bool isValid() const = 0;
+};
+
+class Socket : public Transport {
 private:
     SOCKET m_socket;
+    int m_family;
     bool m_blocking;
 
 public:
-    Socket() : m_socket(INVALID_SOCKET), m_blocking(true) {}
-    Socket(SOCKET s) : m_socket(s), m_blocking(true) {}
+    Socket() : m_socket(INVALID_SOCKET), m_family(AF_INET), m_blocking(true) {}
+    Socket(SOCKET s, int family = AF_INET) : m_socket(s), m_family(family), m_blocking(true) {}
 
     Socket(const Socket&) = delete;
     Socket& operator=(const Socket&) = delete;
 
-    Socket(Socket&& other) noexcept : m_socket(other.m_socket), m_blocking(other.m_blocking) {
+    Socket(Socket&& other) noexcept : m_socket(other.m_socket), m_family(other.m_family), m_blocking(other.m_blocking) {
         other.m_socket = INVALID_SOCKET;
     }
     
@@ -34,6 +67,7 @@ public:
         if (this != &other) {
             close();
             m_socket = other.m_socket;
+            m_family = other.m_family;
             m_blocking = other.m_blocking;
             other.m_socket = INVALID_SOCKET;
         }
@@ -47,14 +81,31 @@ public:
     bool listen(int backlog = SOMAXCONN);
     Socket accept();
     bool connect(const std::string& address, unsigned short port);
-    void close();
+    // AF_UNIX sockets, named by a file system path; bindPath replaces a
+    // stale socket file left by an earlier run.
+    bool bindPath(const std::string& path);
+    bool connectPath(const std::string& path);
+    void close() override;
+    void shutdown(int how = SD_BOTH) override;
     
     int send(const void* buffer, size_t length, int flags = 0);
-    int recv(void* buffer, size_t length, int flags = 0);
+    int send(WSABUF* buffers, DWORD count) override;
+    int recv(void* buffer, size_t length, int flags = 0) override;
+
+    // Overlapped variants; completion is reported through the port the
+    // socket is attached to. Return false only on immediate failure.
+    bool attach(EventLoop& loop) override;
+    bool sendAsync(const void* buffer, size_t length, OVERLAPPED* overlapped);
+    bool sendAsync(WSABUF* buffers, DWORD count, OVERLAPPED* overlapped) override;
+    bool recvAsync(void* buffer, size_t length, OVERLAPPED* overlapped) override;
+    void cancelIo() override;
     
-    bool setBlocking(bool blocking);
-    bool isValid() const { return m_socket != INVALID_SOCKET; }
+    bool setBlocking(bool blocking) override;
+    // A no-op on AF_UNIX sockets, which have no Nagle delay.
+    bool setNoDelay(bool noDelay) override;
+    bool isValid() const override { return m_socket != INVALID_SOCKET; }
     SOCKET getHandle() const { return m_socket; }
+    int family() const { return m_family; }
 };
 
 class Thread {
@@ -74,6 +125,15 @@ protected:
     virtual void run() = 0;
 };
 
+// OverlappedRead/OverlappedWrite create a named pipe whose server-side end
+// (the read or write end respectively) supports overlapped I/O and is not
+// inheritable, while the other end is a plain inheritable handle for the child.
+enum class PipeMode {
+    Blocking,
+    OverlappedRead,
+    OverlappedWrite
+};
+
 class Pipe {
 private:
     HANDLE m_readHandle;
@@ -82,8 +142,11 @@ private:
 public:
     Pipe() : m_readHandle(INVALID_HANDLE_VALUE), m_writeHandle(INVALID_HANDLE_VALUE) {}
     ~Pipe() { close(); }
+
+    Pipe(const Pipe&) = delete;
+    Pipe& operator=(const Pipe&) = delete;
     
-    bool create();
+    bool create(PipeMode mode = PipeMode::Blocking);
     void close();
 
     void closeRead() {
@@ -102,9 +165,18 @@ public:
     
     HANDLE getReadHandle() const { return m_readHandle; }
     HANDLE getWriteHandle() const { return m_writeHandle; }
+
+    void swap(Pipe& other) {
+        std::swap(m_readHandle, other.m_readHandle);
+        std::swap(m_writeHandle, other.m_writeHandle);
+    }
     
     DWORD read(void* buffer, DWORD size);
     DWORD write(const void* buffer, DWORD size);
+
+    bool readAsync(void* buffer, DWORD size, OVERLAPPED* overlapped);
+    bool writeAsync(const void* buffer, DWORD size, OVERLAPPED* overlapped);
+    void cancelIo();
     
     bool isValid() const { 
         return m_readHandle != INVALID_HANDLE_VALUE && 